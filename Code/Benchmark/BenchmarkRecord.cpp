@@ -0,0 +1,116 @@
+// Name:
+// BenchmarkRecord.cpp
+// Description:
+// Implementation file for BenchmarkRecord class
+// Notes:
+// OS-Unaware
+
+#include "BenchmarkRecord.h"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+using namespace std;
+
+//Included after the standard headers, libstdc++ can't be compiled with it's new macro defined
+#include "CustomMemory.h"
+
+//Quotes and escapes a string for JSON
+static string quote(const string &value)
+{
+	stringstream result;
+	result << '"';
+	for (string::const_iterator it = value.begin(); it != value.end(); it++)
+	{
+		if (*it == '"' || *it == '\\')
+			result << '\\' << *it;
+		else if (static_cast<unsigned char>(*it) < 0x20)
+			result << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(*it) << dec;
+		else
+			result << *it;
+	}
+	result << '"';
+	return result.str();
+}
+
+//Formats a number for JSON, which has no way to write infinity or NaN
+static string number(double value)
+{
+	if (value != value || value == HUGE_VAL || value == -HUGE_VAL)
+		return "null";
+	stringstream result;
+	result << setprecision(10) << value;
+	return result.str();
+}
+
+BenchmarkRecord::BenchmarkRecord(const string &suite, const string &operation) : suite(suite), operation(operation), bytes(0), seconds(-1) {}
+
+void BenchmarkRecord::setParameter(const string &name, const string &value)
+{
+	parameters.push_back(pair<string, string>(name, quote(value)));
+}
+
+void BenchmarkRecord::setParameter(const string &name, double value)
+{
+	parameters.push_back(pair<string, string>(name, number(value)));
+}
+
+void BenchmarkRecord::addSample(chrono::steady_clock::duration duration)
+{
+	samples.push_back(chrono::duration<double, micro>(duration).count());
+}
+
+void BenchmarkRecord::addBytes(unsigned long long bytes)
+{
+	this->bytes += bytes;
+}
+
+void BenchmarkRecord::setElapsed(chrono::steady_clock::duration duration)
+{
+	seconds = chrono::duration<double>(duration).count();
+}
+
+double BenchmarkRecord::getPercentile(double percentile) const
+{
+	if (samples.size() == 0)
+		return 0;
+	//Nearest rank
+	vector<double> sorted(samples);
+	size_t rank = static_cast<size_t>(ceil(percentile / 100 * sorted.size()));
+	rank = min(max(rank, static_cast<size_t>(1)), sorted.size()) - 1;
+	nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+	return sorted[rank];
+}
+
+string BenchmarkRecord::toJson() const
+{
+	double totalMicroseconds = 0;
+	for (vector<double>::const_iterator it = samples.begin(); it != samples.end(); it++)
+		totalMicroseconds += *it;
+	double elapsed = seconds >= 0 ? seconds : totalMicroseconds / 1000000;
+
+	stringstream json;
+	json << "{\"suite\":" << quote(suite) << ",\"operation\":" << quote(operation);
+	for (vector<pair<string, string> >::const_iterator it = parameters.begin(); it != parameters.end(); it++)
+		json << "," << quote(it->first) << ":" << it->second;
+	json << ",\"samples\":" << samples.size() << ",\"seconds\":" << number(elapsed);
+	if (bytes > 0)
+	{
+		json << ",\"bytes\":" << bytes;
+		json << ",\"mb_per_second\":" << (elapsed > 0 ? number(bytes / elapsed / (1024 * 1024)) : "null");
+	}
+	if (samples.size() > 0)
+	{
+		json << ",\"mean_us\":" << number(totalMicroseconds / samples.size());
+		json << ",\"p50_us\":" << number(getPercentile(50));
+		json << ",\"p90_us\":" << number(getPercentile(90));
+		json << ",\"p99_us\":" << number(getPercentile(99));
+		json << ",\"max_us\":" << number(getPercentile(100));
+	}
+	json << "}";
+	return json.str();
+}
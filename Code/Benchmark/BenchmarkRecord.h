@@ -0,0 +1,49 @@
+// Name:
+// BenchmarkRecord.h
+// Description:
+// Header file for BenchmarkRecord class
+// A BenchmarkRecord collects the timings of one measurement and writes them out as a single line of JSON, so results can be collected and compared by scripts.
+// Each record names the suite and operation measured, any parameters that describe the run, and the latency percentiles and throughput of the samples.
+// Notes:
+// OS-Unaware
+
+#ifndef BENCHMARK_RECORD_H
+#define BENCHMARK_RECORD_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <chrono>
+using namespace std;
+
+class BenchmarkRecord
+{
+private:
+	string suite;
+	string operation;
+	//Parameters in the order they were set, values are already formatted as JSON
+	vector<pair<string, string> > parameters;
+	//Time taken by each sample, in microseconds
+	vector<double> samples;
+	unsigned long long bytes;
+	//Wall clock time of the whole measurement, used for throughput. Defaults to the total of the samples.
+	double seconds;
+public:
+	BenchmarkRecord(const string &suite, const string &operation);
+
+	void setParameter(const string &name, const string &value);
+	void setParameter(const string &name, double value);
+	//Records the time taken by one sample
+	void addSample(chrono::steady_clock::duration duration);
+	//Records bytes processed, for throughput
+	void addBytes(unsigned long long bytes);
+	//Records the wall clock time of the whole measurement
+	void setElapsed(chrono::steady_clock::duration duration);
+
+	//Returns the percentile (0 to 100) of the samples, in microseconds
+	double getPercentile(double percentile) const;
+	//Returns the record as a line of JSON
+	string toJson() const;
+};
+
+#endif
@@ -0,0 +1,776 @@
+// Name:
+// MemoryBenchmark.cpp
+// Description:
+// Entry point for the memory benchmarks
+// The tracking suite measures allocation throughput through the tracked new and delete operators on 1 to 16 threads.
+// It compares them with the design they replaced, one global lock around a single AllocMap, and with plain malloc and free, which track nothing.
+// The table suite measures AllocMap itself against the map it replaced, which probed one slot at a time on std::hash and left markers in erased slots, filling, draining, churning and searching real allocation addresses.
+// The allocator suite measures the SpanAllocator behind the tracked operators against plain malloc and free on 1 to 16 threads, with a mix of sizes like the engine's messages, shared_ptr control blocks, list nodes, log strings and the occasional resource buffer.
+// It also reports the memory the SpanAllocator still has mapped from the OS once every block is freed, before and after trimming it, and measures the new and delete operators as this build has them.
+// Built with NO_ALLOC_TRACKING (see CustomMemory.h), operator_new should cost the same as malloc. The run's config record says which tracking the build has.
+// The table_stress suite checks AllocMap against std::unordered_map through random maps and erases of closely packed pointers, growing and draining the map so it resizes both ways. The benchmark exits with 1 if they disagree.
+// The tracker_order suite checks a block freed on one thread and allocated again on another, before the first thread's log is merged, is charged to it's newest allocation. The benchmark exits with 1 if it isn't.
+// Every measurement is written as one line of JSON (see BenchmarkRecord.h), to standard output or appended to the file given with --output.
+// Run with --help for the options.
+// Notes:
+// OS-Unaware
+
+#include <string>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <exception>
+#include <cstdlib>
+using namespace std;
+
+//Included after the standard headers, libstdc++ can't be compiled with it's new macro defined
+#include "CustomMemory.h"
+#include "AllocMap.h"
+#include "AllocTracker.h"
+#include "SpanAllocator.h"
+#include "EngineMsg.h"
+#include "BenchmarkRecord.h"
+
+struct BenchmarkOptions
+{
+	//File the results are appended to, standard output if empty
+	string outputFile;
+	//Number of times each measurement is repeated
+	unsigned int iterations;
+	//Allocations each thread makes per measurement
+	unsigned int allocations;
+	//Most threads to allocate on at once, thread counts double from 1 up to this
+	unsigned int maxThreads;
+	//Allocations each thread keeps alive, the oldest is freed as each new one is made
+	unsigned int liveAllocations;
+	//Pointers the table suite keeps in the map
+	unsigned int tableSize;
+	unsigned int seed;
+	//Suites to run
+	set<string> suites;
+
+	BenchmarkOptions() : iterations(3), allocations(200000), maxThreads(16), liveAllocations(64), tableSize(10000), seed(1)
+	{
+		const char *allSuites[] = { "tracking", "table", "table_stress", "tracker_order", "allocator" };
+		suites.insert(begin(allSuites), end(allSuites));
+	}
+};
+
+typedef chrono::steady_clock Clock;
+
+static ostream *output = &cout;
+
+static void writeRecord(const BenchmarkRecord &record)
+{
+	*output << record.toJson() << endl;
+}
+
+//Ways of allocating and freeing a block, the sizes are given to both
+struct AllocationMethod
+{
+	string name;
+	function<void*(size_t)> allocate;
+	function<void(void*, size_t)> release;
+};
+
+//Makes options.allocations allocations on each of threadCount threads at once, keeping options.liveAllocations of them alive at a time.
+//Returns the wall clock time from the threads starting to the last one finishing.
+static Clock::duration runThreads(const AllocationMethod &method, unsigned int threadCount, const vector<size_t> &sizes, const BenchmarkOptions &options)
+{
+	atomic<unsigned int> ready(0);
+	atomic<bool> go(false);
+	vector<thread> threads;
+	for (unsigned int I = 0; I < threadCount; I++)
+	{
+		threads.push_back(thread([&, I]()
+		{
+			vector<void*> live(options.liveAllocations, nullptr);
+			vector<size_t> liveSizes(options.liveAllocations, 0);
+			ready++;
+			while (!go)
+				this_thread::yield();
+
+			//Each thread starts at a different point in the sizes, so they aren't all allocating the same size at once
+			size_t next = I * 7919;
+			for (unsigned int J = 0; J < options.allocations; J++)
+			{
+				unsigned int slot = J % options.liveAllocations;
+				if (live[slot] != nullptr)
+					method.release(live[slot], liveSizes[slot]);
+				liveSizes[slot] = sizes[next++ % sizes.size()];
+				live[slot] = method.allocate(liveSizes[slot]);
+			}
+			for (unsigned int J = 0; J < options.liveAllocations; J++)
+			{
+				if (live[J] != nullptr)
+					method.release(live[J], liveSizes[J]);
+			}
+		}));
+	}
+
+	while (ready < threadCount)
+		this_thread::yield();
+	Clock::time_point start = Clock::now();
+	go = true;
+	for (vector<thread>::iterator it = threads.begin(); it != threads.end(); it++)
+		it->join();
+	return Clock::now() - start;
+}
+
+//The tracked operators before each thread kept it's own log, every allocation and free took one lock shared by every thread
+static recursive_mutex globalLockMutex;
+static AllocMap globalLockMap;
+
+static void benchmarkTracking(const BenchmarkOptions &options)
+{
+	//Small blocks, like the strings, messages and list nodes most of the engine's allocations are
+	const size_t sizeChoices[] = { 16, 24, 32, 48, 64, 96, 128, 256 };
+	mt19937 random(options.seed);
+	uniform_int_distribution<size_t> choice(0, sizeof(sizeChoices) / sizeof(sizeChoices[0]) - 1);
+	vector<size_t> sizes(4096);
+	for (vector<size_t>::iterator it = sizes.begin(); it != sizes.end(); it++)
+		*it = sizeChoices[choice(random)];
+
+	vector<AllocationMethod> methods;
+	methods.push_back(AllocationMethod{ "malloc",
+		[](size_t size) { return malloc(size); },
+		[](void *ptr, size_t) { free(ptr); } });
+	methods.push_back(AllocationMethod{ "global_lock",
+		[](size_t size)
+		{
+			void *ptr = malloc(size);
+			lock_guard<recursive_mutex> memoryLock(globalLockMutex);
+			globalLockMap.map(AllocData{ ptr, __FILE__, __FUNCTION__, __LINE__, size });
+			return ptr;
+		},
+		[](void *ptr, size_t)
+		{
+			{
+				lock_guard<recursive_mutex> memoryLock(globalLockMutex);
+				globalLockMap.erase(ptr);
+			}
+			free(ptr);
+		} });
+	methods.push_back(AllocationMethod{ "thread_logs",
+		[](size_t size) { return static_cast<void*>(new char[size]); },
+		[](void *ptr, size_t) { delete[] static_cast<char*>(ptr); } });
+
+	for (unsigned int threadCount = 1; threadCount <= options.maxThreads; threadCount *= 2)
+	{
+		for (vector<AllocationMethod>::const_iterator it = methods.begin(); it != methods.end(); it++)
+		{
+			BenchmarkRecord record("tracking", "allocate_free");
+			record.setParameter("method", it->name);
+			record.setParameter("threads", threadCount);
+			record.setParameter("allocations_per_thread", options.allocations);
+			Clock::duration elapsed = Clock::duration::zero();
+			for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+			{
+				Clock::duration sample = runThreads(*it, threadCount, sizes, options);
+				record.addSample(sample);
+				elapsed += sample;
+			}
+			record.setElapsed(elapsed);
+			double seconds = chrono::duration<double>(elapsed).count();
+			double allocations = static_cast<double>(options.allocations) * threadCount * options.iterations;
+			record.setParameter("allocations_per_second", seconds > 0 ? allocations / seconds : 0);
+			writeRecord(record);
+		}
+	}
+}
+
+static void benchmarkAllocator(const BenchmarkOptions &options)
+{
+	//Shaped like what the engine allocates: make_shared messages, nodes of lists of shared_ptrs, log strings, and now and then a resource buffer too large for a size class
+	mt19937 random(options.seed);
+	uniform_int_distribution<unsigned int> kind(0, 31);
+	uniform_int_distribution<size_t> stringSize(32, 512);
+	uniform_int_distribution<size_t> bufferSize(2048, 8192);
+	vector<size_t> sizes(4096);
+	for (vector<size_t>::iterator it = sizes.begin(); it != sizes.end(); it++)
+	{
+		unsigned int choice = kind(random);
+		if (choice < 10)
+			*it = sizeof(EngineMsgShutdown) + 4 * sizeof(void*);
+		else if (choice < 20)
+			*it = sizeof(shared_ptr<EngineMsg>) + 2 * sizeof(void*);
+		else if (choice < 31)
+			*it = stringSize(random);
+		else
+			*it = bufferSize(random);
+	}
+
+	vector<AllocationMethod> methods;
+	methods.push_back(AllocationMethod{ "malloc",
+		[](size_t size) { return malloc(size); },
+		[](void *ptr, size_t) { free(ptr); } });
+	methods.push_back(AllocationMethod{ "span_allocator",
+		[](size_t size) { return getSpanAllocator().allocate(size, MemoryTag::Untagged); },
+		[](void *ptr, size_t) { getSpanAllocator().release(ptr); } });
+	//Whatever the replaced operators do in this build, tracked and tagged, sampled, or with NO_ALLOC_TRACKING straight to malloc
+	methods.push_back(AllocationMethod{ "operator_new",
+		[](size_t size) { return static_cast<void*>(new char[size]); },
+		[](void *ptr, size_t) { delete[] static_cast<char*>(ptr); } });
+
+	for (unsigned int threadCount = 1; threadCount <= options.maxThreads; threadCount *= 2)
+	{
+		for (vector<AllocationMethod>::const_iterator it = methods.begin(); it != methods.end(); it++)
+		{
+			BenchmarkRecord record("allocator", "engine_mix");
+			record.setParameter("method", it->name);
+			record.setParameter("threads", threadCount);
+			record.setParameter("allocations_per_thread", options.allocations);
+			Clock::duration elapsed = Clock::duration::zero();
+			for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+			{
+				Clock::duration sample = runThreads(*it, threadCount, sizes, options);
+				record.addSample(sample);
+				elapsed += sample;
+			}
+			record.setElapsed(elapsed);
+			double seconds = chrono::duration<double>(elapsed).count();
+			double allocations = static_cast<double>(options.allocations) * threadCount * options.iterations;
+			record.setParameter("allocations_per_second", seconds > 0 ? allocations / seconds : 0);
+			//Spans kept as spares once everything's freed, the rest have gone back to the OS. Trimming gives back the spares and what this thread has cached.
+			if (it->name == "span_allocator")
+			{
+				record.setParameter("mapped_bytes_after", static_cast<double>(getSpanAllocator().getMappedBytes()));
+				getSpanAllocator().trim();
+				record.setParameter("mapped_bytes_after_trim", static_cast<double>(getSpanAllocator().getMappedBytes()));
+			}
+			writeRecord(record);
+		}
+	}
+}
+
+//The AllocMap before it compared control bytes in groups. Pointers go in the slot picked by the top bits of std::hash, which is the address itself on common libraries, and the slots after it.
+//Erased slots are left as markers searches carry on past, and the map only ever grows.
+class MarkerAllocMap
+{
+private:
+	struct AllocSlot
+	{
+		AllocData data;
+		int count;
+	};
+
+	recursive_mutex objectMutex;
+	hash<void*> hasher;
+	AllocSlot *allocDataMap;
+	unsigned long allocatedSlots;
+	unsigned long usedSlots;
+	unsigned long liveSlots;
+	unsigned long reallocationPoint;
+	short shift;
+
+	static void *erasedSlot()
+	{
+		return reinterpret_cast<void*>(1);
+	}
+
+	void rehash()
+	{
+		unsigned long oldSlotCount = allocatedSlots;
+		if (allocDataMap == nullptr || liveSlots >= reallocationPoint / 2)
+		{
+			allocatedSlots *= 2;
+			shift--;
+		}
+		reallocationPoint = allocatedSlots / 4 * 3;
+		AllocSlot *oldMap = allocDataMap;
+		allocDataMap = reinterpret_cast<AllocSlot*>(malloc(sizeof(AllocSlot) * allocatedSlots));
+		for (unsigned long I = 0; I < allocatedSlots; I++)
+			allocDataMap[I].data.ptr = nullptr;
+		usedSlots = liveSlots;
+		if (oldMap != nullptr)
+		{
+			for (unsigned long I = 0; I < oldSlotCount; I++)
+			{
+				if (oldMap[I].data.ptr != nullptr && oldMap[I].data.ptr != erasedSlot())
+					allocDataMap[findSlot(oldMap[I].data.ptr)] = oldMap[I];
+			}
+			free(oldMap);
+		}
+	}
+
+	unsigned long findSlot(void* ptr)
+	{
+		//The engine is 32 bit, so only the low 32 bits of the hash were shifted
+		unsigned long slot = static_cast<unsigned int>(hasher(ptr)) >> shift;
+		unsigned long erased = allocatedSlots;
+		while (allocDataMap[slot].data.ptr != nullptr)
+		{
+			if (allocDataMap[slot].data.ptr == ptr)
+				return slot;
+			if (allocDataMap[slot].data.ptr == erasedSlot() && erased == allocatedSlots)
+				erased = slot;
+			slot++;
+			if (slot == allocatedSlots)
+				slot = 0;
+		}
+		return erased != allocatedSlots ? erased : slot;
+	}
+
+	int adjust(const AllocData& allocData, int count)
+	{
+		lock_guard<recursive_mutex> objectLock(objectMutex);
+		AllocSlot &allocSlot = allocDataMap[findSlot(allocData.ptr)];
+		if (allocSlot.data.ptr == allocData.ptr)
+		{
+			int oldCount = allocSlot.count;
+			allocSlot.count += count;
+			if (allocSlot.count == 0)
+			{
+				allocSlot.data.ptr = erasedSlot();
+				liveSlots--;
+			}
+			else if (count > 0)
+				allocSlot.data = allocData;
+			return oldCount;
+		}
+		if (allocSlot.data.ptr == nullptr)
+			usedSlots++;
+		liveSlots++;
+		allocSlot.data = allocData;
+		allocSlot.count = count;
+		if (usedSlots >= reallocationPoint)
+			rehash();
+		return 0;
+	}
+
+	MarkerAllocMap(const MarkerAllocMap& markerAllocMap) = delete;
+	MarkerAllocMap& operator =(const MarkerAllocMap& markerAllocMap) = delete;
+
+public:
+	MarkerAllocMap() : allocDataMap(nullptr), allocatedSlots(256), usedSlots(0), liveSlots(0), shift(24)
+	{
+		rehash();
+	}
+
+	~MarkerAllocMap()
+	{
+		free(allocDataMap);
+	}
+
+	int map(const AllocData& allocData)
+	{
+		return adjust(allocData, 1);
+	}
+
+	AllocData retrieve(void* ptr)
+	{
+		lock_guard<recursive_mutex> objectLock(objectMutex);
+		unsigned long slot = findSlot(ptr);
+		if (allocDataMap[slot].data.ptr != ptr || allocDataMap[slot].count <= 0)
+			throw exception();
+		return allocDataMap[slot].data;
+	}
+
+	int erase(void* ptr)
+	{
+		return adjust(AllocData{ ptr, nullptr, nullptr, 0, 0 }, -1);
+	}
+};
+
+//Keeps the table searches from being optimized away
+static volatile size_t searchChecksum;
+
+//Runs one table workload on a new map, returning the time taken and adding the operations made to operations.
+//keys holds twice options.tableSize pointers, the first half of them are put in the map before the clock starts for churn and search.
+template <class Map>
+static Clock::duration runTableWorkload(const string &workload, const vector<void*> &keys, const vector<unsigned int> &order, const BenchmarkOptions &options, unsigned long long &operations)
+{
+	Map map;
+	unsigned int tableSize = options.tableSize;
+	if (workload != "fill_drain")
+	{
+		for (unsigned int I = 0; I < tableSize; I++)
+			map.map(AllocData{ keys[I], __FILE__, __FUNCTION__, __LINE__, 0 });
+	}
+
+	size_t checksum = 0;
+	Clock::time_point start = Clock::now();
+	if (workload == "fill_drain")
+	{
+		for (unsigned int I = 0; I < tableSize; I++)
+			map.map(AllocData{ keys[I], __FILE__, __FUNCTION__, __LINE__, 0 });
+		for (unsigned int I = 0; I < tableSize; I++)
+			map.erase(keys[order[I]]);
+		operations += tableSize * 2ULL;
+	}
+	else if (workload == "churn")
+	{
+		//Free a random live pointer and allocate the one in the other half of the keys in it's place, replacing every pointer four times
+		vector<unsigned int> live(order.begin(), order.end());
+		for (unsigned int I = 0; I < tableSize * 4; I++)
+		{
+			unsigned int &key = live[I % tableSize];
+			map.erase(keys[key]);
+			key = key < tableSize ? key + tableSize : key - tableSize;
+			map.map(AllocData{ keys[key], __FILE__, __FUNCTION__, __LINE__, 0 });
+		}
+		operations += tableSize * 8ULL;
+	}
+	else
+	{
+		for (unsigned int I = 0; I < tableSize; I++)
+			checksum += map.retrieve(keys[order[I]]).lineNum;
+		operations += tableSize;
+	}
+	Clock::duration elapsed = Clock::now() - start;
+
+	searchChecksum = checksum;
+	return elapsed;
+}
+
+static void benchmarkTable(const BenchmarkOptions &options)
+{
+	//The keys are real allocations, so they're aligned and packed like the pointers the tracker sees
+	const size_t sizeChoices[] = { 16, 24, 32, 48, 64, 96, 128, 256 };
+	mt19937 random(options.seed);
+	uniform_int_distribution<size_t> choice(0, sizeof(sizeChoices) / sizeof(sizeChoices[0]) - 1);
+	vector<void*> keys(options.tableSize * 2);
+	for (vector<void*>::iterator it = keys.begin(); it != keys.end(); it++)
+		*it = malloc(sizeChoices[choice(random)]);
+	//The keys in the map in a random order
+	vector<unsigned int> order(options.tableSize);
+	for (unsigned int I = 0; I < options.tableSize; I++)
+		order[I] = I;
+	shuffle(order.begin(), order.end(), random);
+
+	const char *workloads[] = { "fill_drain", "churn", "search" };
+	const char *maps[] = { "marker_probing", "alloc_map" };
+	for (unsigned int I = 0; I < sizeof(workloads) / sizeof(workloads[0]); I++)
+	{
+		for (unsigned int J = 0; J < sizeof(maps) / sizeof(maps[0]); J++)
+		{
+			BenchmarkRecord record("table", workloads[I]);
+			record.setParameter("map", maps[J]);
+			record.setParameter("table_size", options.tableSize);
+			unsigned long long operations = 0;
+			Clock::duration elapsed = Clock::duration::zero();
+			for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+			{
+				Clock::duration sample;
+				if (J == 0)
+					sample = runTableWorkload<MarkerAllocMap>(workloads[I], keys, order, options, operations);
+				else
+					sample = runTableWorkload<AllocMap>(workloads[I], keys, order, options, operations);
+				record.addSample(sample);
+				elapsed += sample;
+			}
+			record.setElapsed(elapsed);
+			double seconds = chrono::duration<double>(elapsed).count();
+			record.setParameter("operations_per_second", seconds > 0 ? operations / seconds : 0);
+			writeRecord(record);
+		}
+	}
+
+	for (vector<void*>::iterator it = keys.begin(); it != keys.end(); it++)
+		free(*it);
+}
+
+//Returns true if the map holds what the reference says it does for ptr. lineNum is used to check the newest allocation mapped is the one kept.
+static bool checkPointer(AllocMap &map, void *ptr, const unordered_map<void*, pair<int, unsigned int> > &reference)
+{
+	unordered_map<void*, pair<int, unsigned int> >::const_iterator expected = reference.find(ptr);
+	int count = expected != reference.end() ? expected->second.first : 0;
+	try
+	{
+		AllocData allocData = map.retrieve(ptr);
+		return count > 0 && allocData.ptr == ptr && allocData.lineNum == expected->second.second;
+	}
+	catch (exception &)
+	{
+		return count <= 0;
+	}
+}
+
+//Checks AllocMap against an unordered_map through random maps and erases. Returns the number of times they disagreed.
+static unsigned long long stressTable(const BenchmarkOptions &options)
+{
+	//Pointers 16 bytes apart, the closest allocations can be, so many share their low bits
+	const unsigned int keyCount = 1 << 16;
+	vector<void*> keys(keyCount);
+	for (unsigned int I = 0; I < keyCount; I++)
+		keys[I] = reinterpret_cast<void*>(static_cast<size_t>(0x10000) + I * 16);
+
+	mt19937 random(options.seed);
+	uniform_int_distribution<unsigned int> pickKey(0, keyCount - 1);
+	uniform_int_distribution<unsigned int> pickOperation(0, 9);
+
+	AllocMap map;
+	//Count and the lineNum of the newest allocation of each pointer
+	unordered_map<void*, pair<int, unsigned int> > reference;
+	unsigned long long mismatches = 0;
+	unsigned long long operations = 0;
+	unsigned int sequence = 0;
+
+	Clock::time_point start = Clock::now();
+	for (unsigned int round = 0; round < options.iterations * 4; round++)
+	{
+		//Grow the map with random maps and erases, more maps than erases and some erases made before their map
+		for (unsigned int I = 0; I < options.allocations; I++)
+		{
+			void *ptr = keys[pickKey(random)];
+			pair<int, unsigned int> &expected = reference[ptr];
+			unsigned int operation = pickOperation(random);
+			if (operation < 6)
+			{
+				sequence++;
+				if (map.map(AllocData{ ptr, __FILE__, __FUNCTION__, sequence, 0 }) != expected.first)
+					mismatches++;
+				expected.first++;
+				if (expected.first > 0)
+					expected.second = sequence;
+			}
+			else if (operation < 9)
+			{
+				if (map.erase(ptr) != expected.first)
+					mismatches++;
+				expected.first--;
+			}
+			else if (!checkPointer(map, ptr, reference))
+				mismatches++;
+			operations++;
+		}
+
+		//Check every pointer, then drain the map so it shrinks back down
+		for (unsigned int I = 0; I < keyCount; I++)
+		{
+			if (!checkPointer(map, keys[I], reference))
+				mismatches++;
+		}
+		for (unordered_map<void*, pair<int, unsigned int> >::iterator it = reference.begin(); it != reference.end(); it++)
+		{
+			for (; it->second.first > 0; it->second.first--, operations++)
+				map.erase(it->first);
+			for (; it->second.first < 0; it->second.first++, operations++)
+				map.map(AllocData{ it->first, __FILE__, __FUNCTION__, 0, 0 });
+		}
+		reference.clear();
+		for (unsigned int I = 0; I < keyCount; I++)
+		{
+			if (!checkPointer(map, keys[I], reference))
+				mismatches++;
+		}
+	}
+
+	BenchmarkRecord record("table_stress", "random_operations");
+	record.setParameter("operations", static_cast<double>(operations));
+	record.setParameter("mismatches", static_cast<double>(mismatches));
+	record.setElapsed(Clock::now() - start);
+	writeRecord(record);
+	return mismatches;
+}
+
+//Returns the allocations of a site that haven't been freed
+static unsigned long long liveAllocations(const vector<AllocSiteStats> &stats, const char *sourceFile, const char *funcName, unsigned int lineNum)
+{
+	for (vector<AllocSiteStats>::const_iterator it = stats.begin(); it != stats.end(); it++)
+	{
+		if (it->sourceFile == sourceFile && it->funcName == funcName && it->lineNum == lineNum)
+			return it->liveAllocations;
+	}
+	return 0;
+}
+
+//Records an allocation and free of a block on one thread, then an allocation of the same block on a second thread, keeping both threads and their logs alive until the tracker's statistics are read.
+//Returns the number of rounds the block was charged to the wrong allocation.
+static unsigned long long checkTrackerOrder(const BenchmarkOptions &options)
+{
+	AllocTracker &tracker = getAllocTracker();
+	const char *sourceFile = __FILE__;
+	const char *funcName = __FUNCTION__;
+	const unsigned int firstLine = __LINE__;
+	const unsigned int secondLine = __LINE__;
+	unsigned long long mismatches = 0;
+
+	Clock::time_point start = Clock::now();
+	for (unsigned int round = 0; round < options.iterations * 4; round++)
+	{
+		//An address below anything the allocators hand out, so only this round's events are on it
+		void *ptr = reinterpret_cast<void*>(static_cast<size_t>(0x1000) + round * 16);
+		atomic<unsigned int> step(0);
+		thread first([&]()
+		{
+			tracker.recordAlloc(AllocData{ ptr, sourceFile, funcName, firstLine, 16 });
+			tracker.recordFree(ptr);
+			step = 1;
+			while (step < 3)
+				this_thread::yield();
+		});
+		thread second([&]()
+		{
+			while (step < 1)
+				this_thread::yield();
+			tracker.recordAlloc(AllocData{ ptr, sourceFile, funcName, secondLine, 16 });
+			step = 2;
+			while (step < 3)
+				this_thread::yield();
+		});
+
+		while (step < 2)
+			this_thread::yield();
+		vector<AllocSiteStats> stats = tracker.getSiteStats();
+		if (liveAllocations(stats, sourceFile, funcName, firstLine) != 0 || liveAllocations(stats, sourceFile, funcName, secondLine) != 1)
+			mismatches++;
+		step = 3;
+		first.join();
+		second.join();
+		tracker.recordFree(ptr);
+	}
+
+	BenchmarkRecord record("tracker_order", "free_then_reuse");
+	record.setParameter("rounds", options.iterations * 4);
+	record.setParameter("mismatches", static_cast<double>(mismatches));
+	record.setElapsed(Clock::now() - start);
+	writeRecord(record);
+	return mismatches;
+}
+
+static void printUsage()
+{
+	cerr << "Usage: MemoryBenchmark [options]" << endl;
+	cerr << "  --iterations N            Repeats of each measurement (3)" << endl;
+	cerr << "  --allocations N           Allocations each thread makes per measurement (200000)" << endl;
+	cerr << "  --max-threads N           Most threads to allocate on at once, doubling from 1 (16)" << endl;
+	cerr << "  --live-allocations N      Allocations each thread keeps alive at once (64)" << endl;
+	cerr << "  --table-size N            Pointers the table suite keeps in the map (10000)" << endl;
+	cerr << "  --seed N                  Seed for the allocation sizes and table operations (1)" << endl;
+	cerr << "  --suites a,b,...          tracking, table, table_stress, tracker_order, allocator (all)" << endl;
+	cerr << "  --output FILE             Append results to FILE instead of printing them" << endl;
+}
+
+//Splits a comma separated list
+static vector<string> splitList(const string &list)
+{
+	vector<string> result;
+	stringstream stream(list);
+	string item;
+	while (getline(stream, item, ','))
+	{
+		if (item.length() > 0)
+			result.push_back(item);
+	}
+	return result;
+}
+
+//Reads the command line in to options. Returns false if it's invalid.
+static bool parseOptions(int argc, char *argv[], BenchmarkOptions &options)
+{
+	for (int I = 1; I < argc; I++)
+	{
+		string option = argv[I];
+		if (option == "--help" || I + 1 >= argc)
+			return false;
+		string value = argv[++I];
+		unsigned int number = static_cast<unsigned int>(strtoul(value.c_str(), nullptr, 10));
+
+		if (option == "--iterations")
+			options.iterations = max(number, 1u);
+		else if (option == "--allocations")
+			options.allocations = max(number, 1u);
+		else if (option == "--max-threads")
+			options.maxThreads = max(number, 1u);
+		else if (option == "--live-allocations")
+			options.liveAllocations = max(number, 1u);
+		else if (option == "--table-size")
+			options.tableSize = max(number, 1u);
+		else if (option == "--seed")
+			options.seed = number;
+		else if (option == "--suites")
+		{
+			vector<string> suites = splitList(value);
+			options.suites = set<string>(suites.begin(), suites.end());
+		}
+		else if (option == "--output")
+			options.outputFile = value;
+		else
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchmarkOptions options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 1;
+	}
+
+	ofstream outputFile;
+	if (options.outputFile.length() > 0)
+	{
+		outputFile.open(options.outputFile, ios_base::out | ios_base::app);
+		if (!outputFile)
+		{
+			cerr << "Failed to open " << options.outputFile << endl;
+			return 1;
+		}
+		output = &outputFile;
+	}
+
+	//Describe the run, so results from different runs and machines can be told apart
+	{
+		BenchmarkRecord record("run", "config");
+		record.setParameter("timestamp", static_cast<double>(time(nullptr)));
+#ifdef _WIN32
+		record.setParameter("os", "windows");
+#else
+		record.setParameter("os", "posix");
+#endif
+#ifdef _DEBUG
+		record.setParameter("build", "debug");
+#else
+		record.setParameter("build", "release");
+#endif
+#if defined(NO_ALLOC_TRACKING)
+		record.setParameter("alloc_tracking", "off");
+#elif defined(ALLOC_SAMPLING)
+		record.setParameter("alloc_tracking", "sampling");
+#else
+		record.setParameter("alloc_tracking", "full");
+#endif
+		record.setParameter("iterations", options.iterations);
+		record.setParameter("allocations", options.allocations);
+		record.setParameter("live_allocations", options.liveAllocations);
+		record.setParameter("table_size", options.tableSize);
+		record.setParameter("seed", options.seed);
+		record.setParameter("hardware_threads", thread::hardware_concurrency());
+		writeRecord(record);
+	}
+
+	if (options.suites.count("tracking"))
+		benchmarkTracking(options);
+	if (options.suites.count("table"))
+		benchmarkTable(options);
+	if (options.suites.count("allocator"))
+		benchmarkAllocator(options);
+	if (options.suites.count("table_stress") && stressTable(options) > 0)
+	{
+		cerr << "AllocMap disagreed with std::unordered_map" << endl;
+		return 1;
+	}
+	if (options.suites.count("tracker_order") && checkTrackerOrder(options) > 0)
+	{
+		cerr << "AllocTracker charged a reused block to an allocation that was freed" << endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,952 @@
+// Name:
+// ResourceBenchmark.cpp
+// Description:
+// Entry point for the resource benchmarks
+// Generates synthetic zip files and directory trees, then measures opening, looking up and reading resources through each of the resource sources.
+// The zip suite also measures the zip's read ahead on sequential reads and on short runs it should back off from.
+// The inflate suite compares the deflate decoder with zlib on the synthetic zip, and on any real asset zips given with --asset-zips.
+// The prefetch suite reads through a ShapedResourceSource to measure how much of a slow device's latency ResourceCache::preLoad hides.
+// Every measurement is written as one line of JSON (see BenchmarkRecord.h), to standard output or appended to the file given with --output.
+// Run with --help for the options. Run from the Game directory, the Logger reads LogInit.xml from the working directory.
+// Notes:
+// OS-Aware
+// The batch and scan suites measure POSIX only code, and are skipped on Windows.
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <zlib/unzip.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <ctime>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+#include "Logger.h"
+#include "IResourceSource.h"
+#include "ZipResourceSource.h"
+#include "DirectoryResourceSource.h"
+#include "MasterDirectoryResourceSource.h"
+#include "ShapedResourceSource.h"
+#include "ResourceCache.h"
+#include "ResourceHandle.h"
+#include "ResourceNameTable.h"
+#include "DeflateDecoder.h"
+#include "Crc32.h"
+#ifndef _WIN32
+#include "BatchReader.h"
+#include "DirectoryScanner.h"
+#endif
+#include "SyntheticResources.h"
+#include "BenchmarkRecord.h"
+
+//Included after the standard headers, libstdc++ can't be compiled with it's new macro defined
+#include "CustomMemory.h"
+
+Logger* appLogger;
+
+struct BenchmarkOptions
+{
+	SyntheticConfig synthetic;
+	//Where the synthetic resources are written
+	string workDirectory;
+	//File the results are appended to, standard output if empty
+	string outputFile;
+	//Number of times each measurement is repeated
+	unsigned int iterations;
+	//Number of zips and directories the master suite spreads the files over
+	unsigned int masterZips;
+	unsigned int masterDirectories;
+	//Resources read per getRawResources call
+	unsigned int batchSize;
+	//Device the prefetch suite simulates, and the number of resources it loads
+	ShapingConfig shaping;
+	unsigned int prefetchFiles;
+	//Real zips the inflate suite measures as well as the synthetic one
+	vector<string> assetZips;
+	//Suites to run
+	set<string> suites;
+	//Page cache states to measure, "warm" and/or "cold"
+	vector<string> cacheModes;
+	//Keep the synthetic resources once the benchmarks are done
+	bool keepData;
+
+	BenchmarkOptions() : workDirectory("BenchmarkData"), iterations(3), masterZips(4), masterDirectories(2), batchSize(64), prefetchFiles(256), keepData(false)
+	{
+		const char *allSuites[] = { "generate", "zip", "directory", "master", "nametable", "inflate", "prefetch", "batch", "scan" };
+		//A slow network file system
+		shaping.latencyMicroseconds = 2000;
+		shaping.jitterMicroseconds = 500;
+		shaping.bytesPerSecond = 100 * 1024 * 1024;
+		suites.insert(begin(allSuites), end(allSuites));
+		cacheModes.push_back("warm");
+		cacheModes.push_back("cold");
+	}
+};
+
+typedef chrono::steady_clock Clock;
+
+static ostream *output = &cout;
+
+static void writeRecord(const BenchmarkRecord &record)
+{
+	*output << record.toJson() << endl;
+}
+
+//Adds the parameters every record from a run shares
+static void describeRun(BenchmarkRecord &record, const BenchmarkOptions &options, const string &cache)
+{
+	if (cache.length() > 0)
+		record.setParameter("cache", cache);
+	record.setParameter("files", options.synthetic.fileCount);
+}
+
+//Drops every file below path from the page cache. Returns false if any couldn't be dropped.
+static bool dropTree(const string &path)
+{
+	vector<string> files;
+	listTree(path, files);
+	//path is a single file, such as a zip
+	if (files.size() == 0)
+		files.push_back(path);
+	bool result = true;
+	for (vector<string>::const_iterator it = files.begin(); it != files.end(); it++)
+		result = dropFromPageCache(*it) && result;
+	return result;
+}
+
+//Gets the page cache in to the state a measurement needs
+static void prepareCache(const string &path, const string &cache)
+{
+	if (cache == "cold" && !dropTree(path))
+		appLogger->eWriteLog("Failed to drop " + path + " from the page cache, cold measurements will be warm", LogLevel::Warning, { "Benchmark" });
+}
+
+//Measures a resource source. Each measurement is repeated for every iteration, and each iteration opens a new source.
+static void benchmarkSource(const string &suite, const string &path, const function<IResourceSource*()> &createSource, const vector<SyntheticFile> &files, const BenchmarkOptions &options)
+{
+	mt19937 random(options.synthetic.seed);
+	vector<string> names;
+	for (vector<SyntheticFile>::const_iterator it = files.begin(); it != files.end(); it++)
+		names.push_back(it->name);
+	vector<char> buffer;
+
+	for (vector<string>::const_iterator cache = options.cacheModes.begin(); cache != options.cacheModes.end(); cache++)
+	{
+		BenchmarkRecord openRecord(suite, "open");
+		BenchmarkRecord sizeRecord(suite, "getRawResourceSize");
+		BenchmarkRecord readRecord(suite, "getRawResource");
+		BenchmarkRecord batchRecord(suite, "getRawResources");
+		describeRun(openRecord, options, *cache);
+		describeRun(sizeRecord, options, *cache);
+		describeRun(readRecord, options, *cache);
+		describeRun(batchRecord, options, *cache);
+		batchRecord.setParameter("batch_size", options.batchSize);
+		Clock::duration readElapsed = Clock::duration::zero();
+		Clock::duration batchElapsed = Clock::duration::zero();
+
+		//Warm runs read everything once first, so nothing comes from the disk
+		if (*cache == "warm")
+		{
+			unique_ptr<IResourceSource> source(createSource());
+			source->open();
+			for (vector<string>::const_iterator it = names.begin(); it != names.end(); it++)
+			{
+				buffer.resize(static_cast<size_t>(max(source->getRawResourceSize(*it), 1ULL)));
+				source->getRawResource(*it, &buffer[0]);
+			}
+		}
+
+		for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+		{
+			//Open
+			prepareCache(path, *cache);
+			Clock::time_point start = Clock::now();
+			unique_ptr<IResourceSource> source(createSource());
+			bool opened = source->open();
+			openRecord.addSample(Clock::now() - start);
+			if (!opened)
+			{
+				appLogger->eWriteLog("Failed to open " + path, LogLevel::Warning, { "Benchmark" });
+				return;
+			}
+
+			//Look up every resource in a random order
+			shuffle(names.begin(), names.end(), random);
+			vector<unsigned long long> sizes(names.size());
+			for (unsigned int I = 0; I < names.size(); I++)
+			{
+				start = Clock::now();
+				sizes[I] = source->getRawResourceSize(names[I]);
+				sizeRecord.addSample(Clock::now() - start);
+			}
+
+			//Read every resource in a random order, one at a time
+			prepareCache(path, *cache);
+			Clock::time_point readStart = Clock::now();
+			for (unsigned int I = 0; I < names.size(); I++)
+			{
+				buffer.resize(static_cast<size_t>(max(sizes[I], 1ULL)));
+				start = Clock::now();
+				unsigned long long result = source->getRawResource(names[I], &buffer[0]);
+				readRecord.addSample(Clock::now() - start);
+				readRecord.addBytes(result);
+			}
+			readElapsed += Clock::now() - readStart;
+
+			//Read every resource again in batches
+			prepareCache(path, *cache);
+			Clock::time_point batchStart = Clock::now();
+			for (unsigned int batch = 0; batch < names.size(); batch += options.batchSize)
+			{
+				unsigned int batchEnd = min<unsigned int>(batch + options.batchSize, names.size());
+				vector<vector<char> > buffers(batchEnd - batch);
+				vector<RawResourceRequest> requests;
+				for (unsigned int I = batch; I < batchEnd; I++)
+				{
+					buffers[I - batch].resize(static_cast<size_t>(max(sizes[I], 1ULL)));
+					RawResourceRequest request = { names[I], &buffers[I - batch][0], 0 };
+					requests.push_back(request);
+				}
+				start = Clock::now();
+				source->getRawResources(requests, [&](RawResourceRequest &request)
+				{
+					batchRecord.addBytes(request.result);
+				});
+				batchRecord.addSample(Clock::now() - start);
+			}
+			batchElapsed += Clock::now() - batchStart;
+		}
+
+		readRecord.setElapsed(readElapsed);
+		batchRecord.setElapsed(batchElapsed);
+		writeRecord(openRecord);
+		writeRecord(sizeRecord);
+		writeRecord(readRecord);
+		writeRecord(batchRecord);
+	}
+}
+
+//Measures the zip's read ahead. Single reads walk through the zip in the order it was written, then in short runs from random places, with reading ahead on and off.
+static void benchmarkZipReadAhead(const string &path, const vector<SyntheticFile> &files, const BenchmarkOptions &options)
+{
+	//Files are written to the zip in order, so the whole list is one long run. Runs of 4 are enough to start reading ahead, but too short for most of it to be used.
+	const unsigned int runLength = 4;
+	mt19937 random(options.synthetic.seed);
+	vector<string> sequential;
+	vector<string> runs;
+	for (vector<SyntheticFile>::const_iterator it = files.begin(); it != files.end(); it++)
+		sequential.push_back(it->name);
+	while (runs.size() < files.size() && files.size() >= runLength)
+	{
+		unsigned int start = random() % (files.size() - runLength + 1);
+		for (unsigned int I = start; I < start + runLength; I++)
+			runs.push_back(files[I].name);
+	}
+	const vector<string> *patterns[] = { &sequential, &runs };
+	const char *patternNames[] = { "sequential", "runs" };
+	vector<char> buffer;
+
+	for (vector<string>::const_iterator cache = options.cacheModes.begin(); cache != options.cacheModes.end(); cache++)
+	{
+		for (unsigned int pattern = 0; pattern < 2; pattern++)
+		{
+			for (unsigned int readAhead = 0; readAhead < 2; readAhead++)
+			{
+				BenchmarkRecord record("zip", string("read_ahead_") + patternNames[pattern] + (readAhead ? "" : "_off"));
+				describeRun(record, options, *cache);
+				ZipReadAheadStats stats;
+				for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+				{
+					prepareCache(path, *cache);
+					ZipResourceSource source(path);
+					if (!source.open())
+					{
+						appLogger->eWriteLog("Failed to open " + path, LogLevel::Warning, { "Benchmark" });
+						return;
+					}
+					if (!readAhead)
+						source.setReadAhead(0, 0);
+					for (vector<string>::const_iterator it = patterns[pattern]->begin(); it != patterns[pattern]->end(); it++)
+					{
+						buffer.resize(static_cast<size_t>(max(source.getRawResourceSize(*it), 1ULL)));
+						Clock::time_point start = Clock::now();
+						unsigned long long result = source.getRawResource(*it, &buffer[0]);
+						record.addSample(Clock::now() - start);
+						record.addBytes(result);
+					}
+					ZipReadAheadStats iterationStats = source.getReadAheadStats();
+					stats.prefetched += iterationStats.prefetched;
+					stats.hits += iterationStats.hits;
+					stats.wasted += iterationStats.wasted;
+				}
+				record.setParameter("prefetched", static_cast<double>(stats.prefetched));
+				record.setParameter("hits", static_cast<double>(stats.hits));
+				record.setParameter("wasted", static_cast<double>(stats.wasted));
+				writeRecord(record);
+			}
+		}
+	}
+}
+
+//Baseline for the directory suite, reading each file with an ifstream as DirectoryResourceSource used to everywhere
+static void benchmarkStreamReads(const string &path, const vector<SyntheticFile> &files, const BenchmarkOptions &options)
+{
+	mt19937 random(options.synthetic.seed);
+	vector<SyntheticFile> order(files);
+	vector<char> buffer;
+	for (vector<string>::const_iterator cache = options.cacheModes.begin(); cache != options.cacheModes.end(); cache++)
+	{
+		BenchmarkRecord record("directory", "ifstreamRead");
+		describeRun(record, options, *cache);
+		Clock::duration elapsed = Clock::duration::zero();
+		for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+		{
+			shuffle(order.begin(), order.end(), random);
+			prepareCache(path, *cache);
+			Clock::time_point readStart = Clock::now();
+			for (vector<SyntheticFile>::const_iterator it = order.begin(); it != order.end(); it++)
+			{
+				buffer.resize(max(it->size, 1u));
+				Clock::time_point start = Clock::now();
+				ifstream file(path + "/" + it->name, ios_base::in | ios_base::binary);
+				file.read(&buffer[0], it->size);
+				record.addSample(Clock::now() - start);
+				record.addBytes(file.gcount());
+			}
+			elapsed += Clock::now() - readStart;
+		}
+		record.setElapsed(elapsed);
+		writeRecord(record);
+	}
+}
+
+//Compares ResourceNameTable::find against the containers sources used before it
+static void benchmarkNameTable(const vector<SyntheticFile> &files, const BenchmarkOptions &options)
+{
+	//Lookups are timed in groups, single lookups are too quick for the clock
+	const unsigned int lookupsPerSample = 256;
+
+	vector<string> names;
+	for (vector<SyntheticFile>::const_iterator it = files.begin(); it != files.end(); it++)
+		names.push_back(it->name);
+	mt19937 random(options.synthetic.seed);
+	shuffle(names.begin(), names.end(), random);
+
+	ResourceNameTable nameTable(names);
+	map<string, unsigned int> orderedMap;
+	unordered_map<string, unsigned int> hashMap;
+	for (unsigned int I = 0; I < names.size(); I++)
+	{
+		orderedMap[names[I]] = I;
+		hashMap[names[I]] = I;
+	}
+
+	//Runs lookup over every name, recording the average time per lookup
+	unsigned int found = 0;
+	auto measure = [&](const string &structure, const function<bool(const string&)> &lookup)
+	{
+		BenchmarkRecord record("nametable", "find");
+		describeRun(record, options, "");
+		record.setParameter("structure", structure);
+		for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+		{
+			for (unsigned int group = 0; group < names.size(); group += lookupsPerSample)
+			{
+				unsigned int groupEnd = min<unsigned int>(group + lookupsPerSample, names.size());
+				Clock::time_point start = Clock::now();
+				for (unsigned int I = group; I < groupEnd; I++)
+					found += lookup(names[I]);
+				record.addSample((Clock::now() - start) / (groupEnd - group));
+			}
+		}
+		writeRecord(record);
+	};
+
+	measure("ResourceNameTable", [&](const string &name) { return nameTable.find(name) != ResourceNameTable::npos; });
+	measure("map", [&](const string &name) { return orderedMap.find(name) != orderedMap.end(); });
+	measure("unordered_map", [&](const string &name) { return hashMap.find(name) != hashMap.end(); });
+
+	//Building the table happens while the source is opened
+	BenchmarkRecord buildRecord("nametable", "build");
+	describeRun(buildRecord, options, "");
+	for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+	{
+		Clock::time_point start = Clock::now();
+		ResourceNameTable table(names);
+		buildRecord.addSample(Clock::now() - start);
+		found += table.size();
+	}
+	writeRecord(buildRecord);
+
+	//Keep the lookups from being optimized away
+	if (found == 0)
+		appLogger->eWriteLog("Name table benchmark found nothing", LogLevel::Warning, { "Benchmark" });
+}
+
+//A deflated file read raw from a zip
+struct DeflatedEntry
+{
+	vector<char> data;
+	unsigned long uncompressedSize;
+	unsigned long crc;
+};
+
+//Reads the raw data of every deflated file in a zip. Returns false if the zip can't be read.
+static bool readDeflatedEntries(const string &path, vector<DeflatedEntry> &entries)
+{
+	unzFile zip = unzOpen(path.c_str());
+	if (zip == nullptr)
+		return false;
+	int result = unzGoToFirstFile(zip);
+	while (result == UNZ_OK)
+	{
+		unz_file_info fileInfo;
+		int method, level;
+		if (unzGetCurrentFileInfo(zip, &fileInfo, nullptr, 0, nullptr, 0, nullptr, 0) == UNZ_OK && fileInfo.compression_method == Z_DEFLATED &&
+			(fileInfo.flag & 1) == 0 && unzOpenCurrentFile2(zip, &method, &level, 1) == UNZ_OK)
+		{
+			DeflatedEntry entry;
+			entry.data.resize(max(fileInfo.compressed_size, 1ul));
+			entry.uncompressedSize = fileInfo.uncompressed_size;
+			entry.crc = fileInfo.crc;
+			if (unzReadCurrentFile(zip, &entry.data[0], fileInfo.compressed_size) == static_cast<int>(fileInfo.compressed_size))
+			{
+				entry.data.resize(fileInfo.compressed_size);
+				entries.push_back(entry);
+			}
+			unzCloseCurrentFile(zip);
+		}
+		result = unzGoToNextFile(zip);
+	}
+	unzClose(zip);
+	return true;
+}
+
+//Inflates with zlib the way ZipResourceSource did before it had the deflate decoder
+static size_t zlibInflate(const vector<char> &source, char *destination, size_t destinationSize)
+{
+	z_stream stream = z_stream();
+	if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+		return 0;
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(source.data()));
+	stream.avail_in = static_cast<uInt>(source.size());
+	stream.next_out = reinterpret_cast<Bytef*>(destination);
+	stream.avail_out = static_cast<uInt>(destinationSize);
+	int result = inflate(&stream, Z_FINISH);
+	size_t produced = stream.total_out;
+	inflateEnd(&stream);
+	return result == Z_STREAM_END ? produced : 0;
+}
+
+//Compares the deflate decoder with zlib, decoding every deflated file in a zip from memory. Each sample is one pass over the whole zip.
+static void benchmarkInflate(const string &path, const BenchmarkOptions &options)
+{
+	vector<DeflatedEntry> entries;
+	if (!readDeflatedEntries(path, entries))
+	{
+		appLogger->eWriteLog("Failed to read " + path, LogLevel::Warning, { "Benchmark" });
+		return;
+	}
+	unsigned long long compressedSize = 0;
+	unsigned long largest = 1;
+	for (vector<DeflatedEntry>::const_iterator it = entries.begin(); it != entries.end(); it++)
+	{
+		compressedSize += it->data.size();
+		largest = max(largest, it->uncompressedSize);
+	}
+	vector<char> buffer(largest);
+
+	const char *engines[] = { "decoder", "zlib" };
+	for (unsigned int engine = 0; engine < 2; engine++)
+	{
+		BenchmarkRecord record("inflate", "inflate");
+		record.setParameter("zip", path);
+		record.setParameter("engine", engines[engine]);
+		record.setParameter("entries", static_cast<double>(entries.size()));
+		record.setParameter("compressed_bytes", static_cast<double>(compressedSize));
+		//Output that didn't match the zip's CRCs, which should never happen
+		unsigned int mismatches = 0;
+		for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+		{
+			unsigned long long produced = 0;
+			Clock::time_point start = Clock::now();
+			for (vector<DeflatedEntry>::const_iterator it = entries.begin(); it != entries.end(); it++)
+			{
+				if (engine == 0)
+					produced += decodeDeflate(it->data.data(), it->data.size(), &buffer[0], it->uncompressedSize, nullptr);
+				else
+					produced += zlibInflate(it->data, &buffer[0], it->uncompressedSize);
+			}
+			record.addSample(Clock::now() - start);
+			record.addBytes(produced);
+
+			//Check the output outside the timing, on the first iteration only
+			if (iteration == 0)
+			{
+				for (vector<DeflatedEntry>::const_iterator it = entries.begin(); it != entries.end(); it++)
+				{
+					size_t size = engine == 0 ? decodeDeflate(it->data.data(), it->data.size(), &buffer[0], it->uncompressedSize, nullptr) :
+						zlibInflate(it->data, &buffer[0], it->uncompressedSize);
+					if (size != it->uncompressedSize || updateCrc32(0, &buffer[0], size) != it->crc)
+						mismatches++;
+				}
+			}
+		}
+		record.setParameter("mismatches", mismatches);
+		if (mismatches > 0)
+			appLogger->eWriteLog(string(engines[engine]) + " output didn't match the CRCs in " + path, LogLevel::Warning, { "Benchmark" });
+		writeRecord(record);
+	}
+}
+
+//Adds the parameters of the simulated device to a prefetch record
+static void describeShaping(BenchmarkRecord &record, const BenchmarkOptions &options)
+{
+	record.setParameter("latency_us", options.shaping.latencyMicroseconds);
+	record.setParameter("jitter_us", options.shaping.jitterMicroseconds);
+	record.setParameter("bandwidth_mb", static_cast<double>(options.shaping.bytesPerSecond) / (1024 * 1024));
+	record.setParameter("failure_rate", options.shaping.failureRate);
+	record.setParameter("queue_depth", options.shaping.queueDepth);
+	record.setParameter("resources", options.prefetchFiles);
+}
+
+//Measures how much of a slow device's latency preloading hides. The directory source is wrapped in a ShapedResourceSource, then the same resources are loaded
+//with gethandle alone, and with preLoad a batch ahead of the gethandle calls. The page cache is left warm, the shaping stands in for the device.
+static void benchmarkPrefetch(const string &path, const vector<SyntheticFile> &files, const BenchmarkOptions &options)
+{
+	//The same random selection of resources for both modes
+	mt19937 random(options.synthetic.seed);
+	vector<SyntheticFile> selected(files);
+	shuffle(selected.begin(), selected.end(), random);
+	selected.resize(min<size_t>(selected.size(), options.prefetchFiles));
+	vector<string> names;
+	//Big enough that nothing is evicted
+	unsigned long long cacheSize = 1;
+	for (vector<SyntheticFile>::const_iterator it = selected.begin(); it != selected.end(); it++)
+	{
+		names.push_back(it->name);
+		cacheSize += it->size;
+	}
+
+	const char *modes[] = { "on_demand", "prefetch" };
+	double onDemandSeconds = 0;
+	for (unsigned int mode = 0; mode < 2; mode++)
+	{
+		//Total time to load everything, and time each gethandle call waited
+		BenchmarkRecord loadRecord("prefetch", string(modes[mode]) + "_load");
+		BenchmarkRecord stallRecord("prefetch", string(modes[mode]) + "_gethandle");
+		describeRun(loadRecord, options, "");
+		describeRun(stallRecord, options, "");
+		describeShaping(loadRecord, options);
+		describeShaping(stallRecord, options);
+		loadRecord.setParameter("batch_size", options.batchSize);
+		stallRecord.setParameter("batch_size", options.batchSize);
+		double totalSeconds = 0;
+		ShapingStats shapingStats;
+
+		for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+		{
+			ShapedResourceSource source(new DirectoryResourceSource(path), options.shaping);
+			if (!source.open())
+			{
+				appLogger->eWriteLog("Failed to open " + path, LogLevel::Warning, { "Benchmark" });
+				return;
+			}
+			ResourceCache cache(cacheSize, &source);
+
+			Clock::time_point start = Clock::now();
+			for (unsigned int I = 0; I < names.size(); I++)
+			{
+				//Preload the next batch when the last one runs out, as a loading screen or streaming system would
+				if (mode == 1 && I % options.batchSize == 0)
+				{
+					vector<string> batch(names.begin() + I, names.begin() + min<size_t>(I + options.batchSize, names.size()));
+					cache.preLoad(batch);
+				}
+				Clock::time_point getStart = Clock::now();
+				shared_ptr<ResourceHandle> handle = cache.gethandle(names[I]);
+				stallRecord.addSample(Clock::now() - getStart);
+			}
+			Clock::duration elapsed = Clock::now() - start;
+			loadRecord.addSample(elapsed);
+			totalSeconds += chrono::duration<double>(elapsed).count();
+
+			ShapingStats iterationStats = source.getStats();
+			loadRecord.addBytes(iterationStats.bytes);
+			shapingStats.reads += iterationStats.reads;
+			shapingStats.failures += iterationStats.failures;
+		}
+
+		loadRecord.setParameter("reads", static_cast<double>(shapingStats.reads));
+		loadRecord.setParameter("failures", static_cast<double>(shapingStats.failures));
+		if (mode == 0)
+			onDemandSeconds = totalSeconds;
+		//Fraction of the on demand load time that preloading saved
+		else if (onDemandSeconds > 0)
+			loadRecord.setParameter("latency_hidden", 1 - totalSeconds / onDemandSeconds);
+		writeRecord(loadRecord);
+		writeRecord(stallRecord);
+	}
+}
+
+#ifndef _WIN32
+//Measures BatchReader at different queue depths, reading every file in the directory tree as one batch
+static void benchmarkBatchReader(const string &path, const vector<SyntheticFile> &files, const BenchmarkOptions &options)
+{
+	const unsigned int queueDepths[] = { 1, 4, 16, 64, 256 };
+
+	int directoryFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (directoryFd < 0)
+		return;
+	vector<int> fds;
+	unsigned long long totalSize = 0;
+	for (vector<SyntheticFile>::const_iterator it = files.begin(); it != files.end(); it++)
+	{
+		fds.push_back(openat(directoryFd, it->name.c_str(), O_RDONLY | O_CLOEXEC));
+		totalSize += it->size;
+	}
+	vector<char> buffer(max(totalSize, 1ULL));
+
+	for (vector<string>::const_iterator cache = options.cacheModes.begin(); cache != options.cacheModes.end(); cache++)
+	{
+		//Depth 0 is the plain pread backend
+		for (int depthIndex = -1; depthIndex < static_cast<int>(sizeof(queueDepths) / sizeof(queueDepths[0])); depthIndex++)
+		{
+			unique_ptr<BatchReader> batchReader(depthIndex < 0 ? BatchReader::createPread() : BatchReader::create(queueDepths[depthIndex]));
+			BenchmarkRecord record("batch", "read");
+			describeRun(record, options, *cache);
+			record.setParameter("backend", batchReader->getName());
+			record.setParameter("queue_depth", depthIndex < 0 ? 0 : queueDepths[depthIndex]);
+			for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+			{
+				vector<BatchRead> reads;
+				unsigned long long offset = 0;
+				for (unsigned int I = 0; I < files.size(); I++)
+				{
+					if (fds[I] < 0)
+						continue;
+					BatchRead read = { fds[I], 0, files[I].size, &buffer[offset], I, 0 };
+					reads.push_back(read);
+					offset += files[I].size;
+				}
+				if (reads.size() == 0)
+					break;
+				prepareCache(path, *cache);
+				Clock::time_point start = Clock::now();
+				batchReader->read(&reads[0], reads.size(), [&](BatchRead &read)
+				{
+					record.addBytes(max(read.result, 0LL));
+				});
+				record.addSample(Clock::now() - start);
+			}
+			writeRecord(record);
+		}
+	}
+
+	for (vector<int>::const_iterator it = fds.begin(); it != fds.end(); it++)
+	{
+		if (*it >= 0)
+			close(*it);
+	}
+	close(directoryFd);
+}
+
+//Measures DirectoryScanner with different numbers of threads. The OS's directory cache isn't dropped, so scans are always warm.
+static void benchmarkScan(const string &path, const BenchmarkOptions &options)
+{
+	int directoryFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (directoryFd < 0)
+		return;
+
+	vector<unsigned int> threadCounts;
+	threadCounts.push_back(1);
+	for (unsigned int threads = 2; threads < thread::hardware_concurrency(); threads *= 2)
+		threadCounts.push_back(threads);
+	if (thread::hardware_concurrency() > 1)
+		threadCounts.push_back(thread::hardware_concurrency());
+
+	for (vector<unsigned int>::const_iterator threads = threadCounts.begin(); threads != threadCounts.end(); threads++)
+	{
+		BenchmarkRecord record("scan", "scan");
+		describeRun(record, options, "warm");
+		record.setParameter("max_threads", *threads);
+		unsigned int threadsUsed = 0;
+		for (unsigned int iteration = 0; iteration < options.iterations; iteration++)
+		{
+			vector<pair<string, unsigned long long> > found;
+			DirectoryScanner scanner(directoryFd, *threads);
+			Clock::time_point start = Clock::now();
+			scanner.scan(found);
+			record.addSample(Clock::now() - start);
+			threadsUsed = max(threadsUsed, scanner.getThreadCount());
+		}
+		//Helper threads are shared with other scans, so fewer may have been available than were asked for
+		record.setParameter("threads_used", threadsUsed);
+		writeRecord(record);
+	}
+	close(directoryFd);
+}
+#endif
+
+static void printUsage()
+{
+	cerr << "Usage: ResourceBenchmark [options]" << endl;
+	cerr << "  --files N                 Number of files to generate (1000)" << endl;
+	cerr << "  --distribution D          fixed, uniform or lognormal file sizes (lognormal)" << endl;
+	cerr << "  --min-size N              Smallest file in bytes (64)" << endl;
+	cerr << "  --mean-size N             Fixed size, or median of lognormal sizes, in bytes (16384)" << endl;
+	cerr << "  --max-size N              Largest file in bytes (4194304)" << endl;
+	cerr << "  --compressibility F       Fraction of content that's repetitive, 0 to 1 (0.5)" << endl;
+	cerr << "  --level N                 zlib level for zip files, 0 stores them (6)" << endl;
+	cerr << "  --fanout N                Files or subdirectories per directory (16)" << endl;
+	cerr << "  --depth N                 Depth of the directory tree (2)" << endl;
+	cerr << "  --seed N                  Seed for the synthetic files (1)" << endl;
+	cerr << "  --iterations N            Repeats of each measurement (3)" << endl;
+	cerr << "  --batch-size N            Resources per getRawResources call (64)" << endl;
+	cerr << "  --master-zips N           Zips in the master directory (4)" << endl;
+	cerr << "  --master-directories N    Directories in the master directory (2)" << endl;
+	cerr << "  --suites a,b,...          generate, zip, directory, master, nametable, inflate, prefetch, batch, scan (all)" << endl;
+	cerr << "  --asset-zips a,b,...      Real zips for the inflate suite to measure too" << endl;
+	cerr << "  --latency-us N            Latency of each read in the prefetch suite (2000)" << endl;
+	cerr << "  --jitter-us N             Random latency added to each read in the prefetch suite (500)" << endl;
+	cerr << "  --bandwidth-mb N          Bandwidth of the prefetch suite's device in MB/s, 0 for no limit (100)" << endl;
+	cerr << "  --failure-rate F          Chance of a read failing in the prefetch suite, 0 to 1 (0)" << endl;
+	cerr << "  --queue-depth N           Reads the prefetch suite's device runs at once (32)" << endl;
+	cerr << "  --prefetch-files N        Resources the prefetch suite loads (256)" << endl;
+	cerr << "  --cache a,b               warm and/or cold page cache (warm,cold)" << endl;
+	cerr << "  --work-dir PATH           Where to write the synthetic files (BenchmarkData)" << endl;
+	cerr << "  --output FILE             Append results to FILE instead of printing them" << endl;
+	cerr << "  --keep                    Keep the synthetic files afterwards" << endl;
+}
+
+//Splits a comma separated list
+static vector<string> splitList(const string &list)
+{
+	vector<string> result;
+	stringstream stream(list);
+	string item;
+	while (getline(stream, item, ','))
+	{
+		if (item.length() > 0)
+			result.push_back(item);
+	}
+	return result;
+}
+
+//Reads the command line in to options. Returns false if it's invalid.
+static bool parseOptions(int argc, char *argv[], BenchmarkOptions &options)
+{
+	for (int I = 1; I < argc; I++)
+	{
+		string option = argv[I];
+		if (option == "--keep")
+		{
+			options.keepData = true;
+			continue;
+		}
+		if (option == "--help" || I + 1 >= argc)
+			return false;
+		string value = argv[++I];
+		unsigned int number = static_cast<unsigned int>(strtoul(value.c_str(), nullptr, 10));
+
+		if (option == "--files")
+			options.synthetic.fileCount = number;
+		else if (option == "--distribution")
+		{
+			if (value == "fixed")
+				options.synthetic.sizeDistribution = SizeDistribution::Fixed;
+			else if (value == "uniform")
+				options.synthetic.sizeDistribution = SizeDistribution::Uniform;
+			else if (value == "lognormal")
+				options.synthetic.sizeDistribution = SizeDistribution::LogNormal;
+			else
+				return false;
+		}
+		else if (option == "--min-size")
+			options.synthetic.minSize = number;
+		else if (option == "--mean-size")
+			options.synthetic.meanSize = number;
+		else if (option == "--max-size")
+			options.synthetic.maxSize = number;
+		else if (option == "--compressibility")
+			options.synthetic.compressibility = atof(value.c_str());
+		else if (option == "--level")
+			options.synthetic.compressionLevel = min(number, 9u);
+		else if (option == "--fanout")
+			options.synthetic.directoryFanout = max(number, 1u);
+		else if (option == "--depth")
+			options.synthetic.directoryDepth = number;
+		else if (option == "--seed")
+			options.synthetic.seed = number;
+		else if (option == "--iterations")
+			options.iterations = max(number, 1u);
+		else if (option == "--batch-size")
+			options.batchSize = max(number, 1u);
+		else if (option == "--master-zips")
+			options.masterZips = number;
+		else if (option == "--master-directories")
+			options.masterDirectories = number;
+		else if (option == "--suites")
+		{
+			vector<string> suites = splitList(value);
+			options.suites = set<string>(suites.begin(), suites.end());
+		}
+		else if (option == "--latency-us")
+			options.shaping.latencyMicroseconds = number;
+		else if (option == "--jitter-us")
+			options.shaping.jitterMicroseconds = number;
+		else if (option == "--bandwidth-mb")
+			options.shaping.bytesPerSecond = static_cast<unsigned long long>(number) * 1024 * 1024;
+		else if (option == "--failure-rate")
+			options.shaping.failureRate = atof(value.c_str());
+		else if (option == "--queue-depth")
+			options.shaping.queueDepth = max(number, 1u);
+		else if (option == "--prefetch-files")
+			options.prefetchFiles = max(number, 1u);
+		else if (option == "--asset-zips")
+			options.assetZips = splitList(value);
+		else if (option == "--cache")
+			options.cacheModes = splitList(value);
+		else if (option == "--work-dir")
+			options.workDirectory = value;
+		else if (option == "--output")
+			options.outputFile = value;
+		else
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchmarkOptions options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return 1;
+	}
+
+	appLogger = new Logger("LogInit.xml", "BenchmarkGeneral.log");
+
+	ofstream outputFile;
+	if (options.outputFile.length() > 0)
+	{
+		outputFile.open(options.outputFile, ios_base::out | ios_base::app);
+		if (!outputFile)
+		{
+			cerr << "Failed to open " << options.outputFile << endl;
+			return 1;
+		}
+		output = &outputFile;
+	}
+
+	//Describe the run, so results from different runs and machines can be told apart
+	{
+		BenchmarkRecord record("run", "config");
+		record.setParameter("timestamp", static_cast<double>(time(nullptr)));
+#ifdef _WIN32
+		record.setParameter("os", "windows");
+#else
+		record.setParameter("os", "posix");
+#endif
+#ifdef _DEBUG
+		record.setParameter("build", "debug");
+#else
+		record.setParameter("build", "release");
+#endif
+		const char *distributions[] = { "fixed", "uniform", "lognormal" };
+		record.setParameter("files", options.synthetic.fileCount);
+		record.setParameter("distribution", distributions[static_cast<int>(options.synthetic.sizeDistribution)]);
+		record.setParameter("min_size", options.synthetic.minSize);
+		record.setParameter("mean_size", options.synthetic.meanSize);
+		record.setParameter("max_size", options.synthetic.maxSize);
+		record.setParameter("compressibility", options.synthetic.compressibility);
+		record.setParameter("level", options.synthetic.compressionLevel);
+		record.setParameter("fanout", options.synthetic.directoryFanout);
+		record.setParameter("depth", options.synthetic.directoryDepth);
+		record.setParameter("seed", options.synthetic.seed);
+		record.setParameter("iterations", options.iterations);
+		record.setParameter("hardware_threads", thread::hardware_concurrency());
+		writeRecord(record);
+	}
+
+	//Generate the synthetic resources
+	vector<SyntheticFile> files = planSyntheticFiles(options.synthetic);
+	string zipPath = options.workDirectory + "/synthetic.zip";
+	string directoryPath = options.workDirectory + "/synthetic";
+	string masterPath = options.workDirectory + "/master";
+	removeTree(options.workDirectory);
+	{
+		BenchmarkRecord record("generate", "write");
+		describeRun(record, options, "");
+		unsigned long long totalSize = 0;
+		for (vector<SyntheticFile>::const_iterator it = files.begin(); it != files.end(); it++)
+			totalSize += it->size;
+		Clock::time_point start = Clock::now();
+		bool result = makeDirectory(options.workDirectory) &&
+			writeSyntheticZip(zipPath, files, options.synthetic) &&
+			writeSyntheticDirectory(directoryPath, files, options.synthetic) &&
+			writeSyntheticMaster(masterPath, files, options.synthetic, options.masterZips, options.masterDirectories);
+		record.setElapsed(Clock::now() - start);
+		record.addBytes(totalSize);
+		if (!result)
+		{
+			cerr << "Failed to write synthetic resources to " << options.workDirectory << endl;
+			return 1;
+		}
+		if (options.suites.count("generate"))
+			writeRecord(record);
+	}
+
+	if (options.suites.count("zip"))
+	{
+		benchmarkSource("zip", zipPath, [&]() { return new ZipResourceSource(zipPath); }, files, options);
+		benchmarkZipReadAhead(zipPath, files, options);
+	}
+	if (options.suites.count("directory"))
+	{
+		benchmarkSource("directory", directoryPath, [&]() { return new DirectoryResourceSource(directoryPath); }, files, options);
+		benchmarkStreamReads(directoryPath, files, options);
+	}
+	if (options.suites.count("master"))
+		benchmarkSource("master", masterPath, [&]() { return new MasterDirectoryResourceSource(masterPath); }, files, options);
+	if (options.suites.count("nametable"))
+		benchmarkNameTable(files, options);
+	if (options.suites.count("inflate"))
+	{
+		benchmarkInflate(zipPath, options);
+		for (vector<string>::const_iterator it = options.assetZips.begin(); it != options.assetZips.end(); it++)
+			benchmarkInflate(*it, options);
+	}
+	if (options.suites.count("prefetch"))
+		benchmarkPrefetch(directoryPath, files, options);
+#ifndef _WIN32
+	if (options.suites.count("batch"))
+		benchmarkBatchReader(directoryPath, files, options);
+	if (options.suites.count("scan"))
+		benchmarkScan(directoryPath, options);
+#endif
+
+	if (!options.keepData)
+		removeTree(options.workDirectory);
+
+	delete appLogger;
+	return 0;
+}
@@ -0,0 +1,306 @@
+// Name:
+// SyntheticResources.cpp
+// Description:
+// Implementation file for the synthetic resource generators
+// Notes:
+// OS-Aware
+// Uses OS-Specific functions to create, list and delete directories, and to drop files from the page cache.
+
+#include "SyntheticResources.h"
+
+#include <zlib/zip.h>
+#ifdef _WIN32
+#include <Windows.h>
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+using namespace std;
+
+//Included after the standard headers, libstdc++ can't be compiled with it's new macro defined
+#include "CustomMemory.h"
+
+//Content is generated in blocks, each either random or repetitive
+const unsigned int contentBlockSize = 256;
+//Text repeated through the repetitive blocks
+const char repeatedText[] = "NaturalFury synthetic resource data. ";
+
+SyntheticConfig::SyntheticConfig() : fileCount(1000), directoryFanout(16), directoryDepth(2), sizeDistribution(SizeDistribution::LogNormal),
+	minSize(64), meanSize(16 * 1024), maxSize(4 * 1024 * 1024), compressibility(0.5), compressionLevel(6), seed(1) {}
+
+vector<SyntheticFile> planSyntheticFiles(const SyntheticConfig &config)
+{
+	vector<SyntheticFile> files(config.fileCount);
+	mt19937 random(config.seed);
+	uniform_int_distribution<unsigned int> uniformSize(config.minSize, max(config.minSize, config.maxSize));
+	//Sizes with a median of meanSize, where one in twenty files is about ten times bigger
+	lognormal_distribution<double> logNormalSize(log(static_cast<double>(max(config.meanSize, 1u))), 1.4);
+	unsigned int fanout = max(config.directoryFanout, 1u);
+
+	for (unsigned int I = 0; I < files.size(); I++)
+	{
+		//Files are spread over the tree fanout at a time, the top level takes whatever doesn't fit
+		stringstream name;
+		unsigned int directory = I / fanout;
+		vector<unsigned int> components;
+		for (unsigned int J = 0; J < config.directoryDepth; J++)
+		{
+			components.push_back(J + 1 < config.directoryDepth ? directory % fanout : directory);
+			directory /= fanout;
+		}
+		for (vector<unsigned int>::reverse_iterator it = components.rbegin(); it != components.rend(); it++)
+			name << "dir" << setw(3) << setfill('0') << *it << "/";
+		name << "file" << setw(6) << setfill('0') << I << ".bin";
+		files[I].name = name.str();
+
+		if (config.sizeDistribution == SizeDistribution::Fixed)
+			files[I].size = config.meanSize;
+		else if (config.sizeDistribution == SizeDistribution::Uniform)
+			files[I].size = uniformSize(random);
+		else
+			files[I].size = static_cast<unsigned int>(min(max(logNormalSize(random), static_cast<double>(config.minSize)), static_cast<double>(config.maxSize)));
+		files[I].seed = random();
+	}
+	return files;
+}
+
+void fillSyntheticContent(const SyntheticFile &file, double compressibility, char *buffer)
+{
+	mt19937 random(file.seed);
+	uniform_real_distribution<double> chance(0.0, 1.0);
+	unsigned int textLength = sizeof(repeatedText) - 1;
+	for (unsigned int blockStart = 0; blockStart < file.size; blockStart += contentBlockSize)
+	{
+		unsigned int blockEnd = min(blockStart + contentBlockSize, file.size);
+		if (chance(random) < compressibility)
+		{
+			for (unsigned int I = blockStart; I < blockEnd; I++)
+				buffer[I] = repeatedText[I % textLength];
+		}
+		else
+		{
+			for (unsigned int I = blockStart; I < blockEnd; I++)
+				buffer[I] = static_cast<char>(random());
+		}
+	}
+}
+
+bool makeDirectory(const string &path)
+{
+#ifdef _WIN32
+	return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+	return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+//Creates every directory leading up to a file
+static bool makeParentDirectories(const string &root, const string &name)
+{
+	for (size_t separator = name.find('/'); separator != string::npos; separator = name.find('/', separator + 1))
+	{
+		if (!makeDirectory(root + "/" + name.substr(0, separator)))
+			return false;
+	}
+	return true;
+}
+
+//Calls visitor for everything below path, children before their parents
+static void visitTree(const string &path, const function<void(const string&, bool)> &visitor)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATA findData;
+	HANDLE searchHandle = FindFirstFile((path + "\\*").c_str(), &findData);
+	if (searchHandle == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		if (strcmp(findData.cFileName, ".") == 0 || strcmp(findData.cFileName, "..") == 0)
+			continue;
+		string childPath = path + "\\" + findData.cFileName;
+		bool isDirectory = (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+		if (isDirectory)
+			visitTree(childPath, visitor);
+		visitor(childPath, isDirectory);
+	} while (FindNextFile(searchHandle, &findData));
+	FindClose(searchHandle);
+#else
+	DIR *dir = opendir(path.c_str());
+	if (dir == nullptr)
+		return;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		string childPath = path + "/" + entry->d_name;
+		struct stat fileStat;
+		bool isDirectory = lstat(childPath.c_str(), &fileStat) == 0 && S_ISDIR(fileStat.st_mode);
+		if (isDirectory)
+			visitTree(childPath, visitor);
+		visitor(childPath, isDirectory);
+	}
+	closedir(dir);
+#endif
+}
+
+void removeTree(const string &path)
+{
+	visitTree(path, [](const string &childPath, bool isDirectory)
+	{
+#ifdef _WIN32
+		if (isDirectory)
+			RemoveDirectory(childPath.c_str());
+		else
+			DeleteFile(childPath.c_str());
+#else
+		if (isDirectory)
+			rmdir(childPath.c_str());
+		else
+			unlink(childPath.c_str());
+#endif
+	});
+#ifdef _WIN32
+	RemoveDirectory(path.c_str());
+#else
+	rmdir(path.c_str());
+#endif
+}
+
+void listTree(const string &path, vector<string> &files)
+{
+	visitTree(path, [&](const string &childPath, bool isDirectory)
+	{
+		if (!isDirectory)
+			files.push_back(childPath);
+	});
+}
+
+bool dropFromPageCache(const string &path)
+{
+#ifdef _WIN32
+	//Opening a file without buffering makes Windows throw away it's cached pages for the file
+	HANDLE file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	CloseHandle(file);
+	return true;
+#else
+	//Dirty pages can't be dropped, so write them out first
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	fdatasync(fd);
+	bool result = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+	close(fd);
+	return result;
+#endif
+}
+
+//Writes the manifest every source needs. The synthetic files don't need a blacklist.
+static string getManifest()
+{
+	return "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<Manifest>\n</Manifest>\n";
+}
+
+bool writeSyntheticDirectory(const string &path, const vector<SyntheticFile> &files, const SyntheticConfig &config)
+{
+	if (!makeDirectory(path))
+		return false;
+
+	ofstream manifest(path + "/manifest.xml", ios_base::out | ios_base::binary);
+	manifest << getManifest();
+	if (!manifest)
+		return false;
+
+	vector<char> buffer;
+	for (vector<SyntheticFile>::const_iterator it = files.begin(); it != files.end(); it++)
+	{
+		if (!makeParentDirectories(path, it->name))
+			return false;
+		buffer.resize(max(it->size, 1u));
+		fillSyntheticContent(*it, config.compressibility, &buffer[0]);
+		ofstream file(path + "/" + it->name, ios_base::out | ios_base::binary);
+		file.write(&buffer[0], it->size);
+		if (!file)
+			return false;
+	}
+	return true;
+}
+
+bool writeSyntheticZip(const string &path, const vector<SyntheticFile> &files, const SyntheticConfig &config)
+{
+	zipFile zip = zipOpen64(path.c_str(), APPEND_STATUS_CREATE);
+	if (zip == nullptr)
+		return false;
+
+	int method = config.compressionLevel > 0 ? Z_DEFLATED : 0;
+	zip_fileinfo fileInfo = zip_fileinfo();
+	bool result = true;
+
+	string manifest = getManifest();
+	result = zipOpenNewFileInZip(zip, "manifest.xml", &fileInfo, nullptr, 0, nullptr, 0, nullptr, method, config.compressionLevel) == ZIP_OK &&
+		zipWriteInFileInZip(zip, manifest.c_str(), manifest.length()) == ZIP_OK &&
+		zipCloseFileInZip(zip) == ZIP_OK;
+
+	vector<char> buffer;
+	//Bytes written so far, at most the sizes of the files plus their headers
+	unsigned long long written = manifest.length();
+	for (vector<SyntheticFile>::const_iterator it = files.begin(); it != files.end() && result; it++)
+	{
+		buffer.resize(max(it->size, 1u));
+		fillSyntheticContent(*it, config.compressibility, &buffer[0]);
+		//Files that might end past 4GB need Zip64 headers, big synthetic sets test ZipResourceSource's Zip64 support
+		int zip64 = written + it->size + 1024 * 1024 >= 0xFFFFFFFFULL ? 1 : 0;
+		written += it->size + it->name.length() + 1024;
+		result = zipOpenNewFileInZip64(zip, it->name.c_str(), &fileInfo, nullptr, 0, nullptr, 0, nullptr, method, config.compressionLevel, zip64) == ZIP_OK &&
+			zipWriteInFileInZip(zip, &buffer[0], it->size) == ZIP_OK &&
+			zipCloseFileInZip(zip) == ZIP_OK;
+	}
+
+	return zipClose(zip, nullptr) == ZIP_OK && result;
+}
+
+bool writeSyntheticMaster(const string &path, const vector<SyntheticFile> &files, const SyntheticConfig &config, unsigned int zipCount, unsigned int directoryCount)
+{
+	if (!makeDirectory(path))
+		return false;
+
+	//Deal the files out to the sources in turn
+	unsigned int sourceCount = max(zipCount + directoryCount, 1u);
+	vector<vector<SyntheticFile> > sourceFiles(sourceCount);
+	for (unsigned int I = 0; I < files.size(); I++)
+		sourceFiles[I % sourceCount].push_back(files[I]);
+
+	for (unsigned int I = 0; I < sourceCount; I++)
+	{
+		stringstream sourcePath;
+		sourcePath << path << "/" << (I < zipCount ? "pack" : "loose") << setw(2) << setfill('0') << I;
+		if (I < zipCount)
+		{
+			sourcePath << ".zip";
+			if (!writeSyntheticZip(sourcePath.str(), sourceFiles[I], config))
+				return false;
+		}
+		else if (!writeSyntheticDirectory(sourcePath.str(), sourceFiles[I], config))
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,84 @@
+// Name:
+// SyntheticResources.h
+// Description:
+// Header file for the synthetic resource generators used by the resource benchmarks
+// Generates reproducible sets of files, then writes them out as a directory tree, a zip file, or a master directory holding several of each.
+// File sizes follow a configurable distribution, and the content is a mix of random and repetitive data so it compresses by a configurable amount.
+// Notes:
+// OS-Aware
+// File does not pollute with OS-Headers.
+
+#ifndef SYNTHETIC_RESOURCES_H
+#define SYNTHETIC_RESOURCES_H
+
+#include <string>
+#include <vector>
+#include <random>
+using namespace std;
+
+enum class SizeDistribution
+{
+	//Every file is meanSize
+	Fixed,
+	//Sizes are spread evenly between minSize and maxSize
+	Uniform,
+	//Lots of small files and a few large ones, with a median of meanSize, clamped to minSize and maxSize. Closest to real game data.
+	LogNormal
+};
+
+struct SyntheticConfig
+{
+	//Number of files to generate
+	unsigned int fileCount;
+	//Most files or subdirectories in a directory, and how deep the tree goes
+	unsigned int directoryFanout;
+	unsigned int directoryDepth;
+
+	SizeDistribution sizeDistribution;
+	unsigned int minSize;
+	unsigned int meanSize;
+	unsigned int maxSize;
+
+	//Fraction of the content that's repetitive, 0 is incompressible and 1 compresses almost entirely away
+	double compressibility;
+	//zlib compression level for zip files, 0 stores the files uncompressed
+	int compressionLevel;
+
+	//Seed for the sizes and content, the same seed always generates the same files
+	unsigned int seed;
+
+	SyntheticConfig();
+};
+
+//A file to be generated
+struct SyntheticFile
+{
+	//Name relative to the root of the source, using '/' as a separator
+	string name;
+	unsigned int size;
+	//Seed for the file's content
+	unsigned int seed;
+};
+
+//Picks the names and sizes of the files described by config
+vector<SyntheticFile> planSyntheticFiles(const SyntheticConfig &config);
+//Fills buffer with file's content
+void fillSyntheticContent(const SyntheticFile &file, double compressibility, char *buffer);
+
+//Writes files in to a new directory at path, along with the manifest.xml DirectoryResourceSource needs
+bool writeSyntheticDirectory(const string &path, const vector<SyntheticFile> &files, const SyntheticConfig &config);
+//Writes files in to a new zip file at path, along with the manifest.xml ZipResourceSource needs
+bool writeSyntheticZip(const string &path, const vector<SyntheticFile> &files, const SyntheticConfig &config);
+//Writes a directory for MasterDirectoryResourceSource at path, with the files spread over zipCount zips and directoryCount directories
+bool writeSyntheticMaster(const string &path, const vector<SyntheticFile> &files, const SyntheticConfig &config, unsigned int zipCount, unsigned int directoryCount);
+
+//Creates a directory. Returns true if it was created or already exists.
+bool makeDirectory(const string &path);
+//Deletes a directory and everything in it
+void removeTree(const string &path);
+//Lists every file below path, used to drop them from the page cache
+void listTree(const string &path, vector<string> &files);
+//Asks the OS to drop a file from it's page cache, so the next read comes from the disk. Returns false if the OS wouldn't.
+bool dropFromPageCache(const string &path);
+
+#endif
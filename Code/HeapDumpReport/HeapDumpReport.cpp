@@ -0,0 +1,140 @@
+// Name:
+// HeapDumpReport.cpp
+// Description:
+// Entry point for the heap dump report tool
+// Reads a heap dump written by dumpAllocs (see HeapDump.h and CustomMemory.h) and reports the call sites holding the most memory, largest first.
+// Usage: HeapDumpReport DUMP [--top N] [--by bytes|allocations] [--group site|function|file]
+// Sites are grouped by the text of their names, so the same site compiled in to several files is reported once.
+// A dump that was cut short is still reported as far as it goes, and the tool exits with 1.
+// Notes:
+// OS-Unaware
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+using namespace std;
+
+#include "HeapDump.h"
+
+//Allocations from one site, function or file
+struct SiteTotals
+{
+	string sourceFile;
+	string funcName;
+	unsigned int lineNum;
+	unsigned long long liveBytes;
+	unsigned long long liveAllocations;
+	unsigned long long largest;
+};
+
+static void printUsage()
+{
+	cerr << "Usage: HeapDumpReport DUMP [options]" << endl;
+	cerr << "  --top N                      Sites to report, 0 for all (20)" << endl;
+	cerr << "  --by bytes|allocations       What sites are ranked by (bytes)" << endl;
+	cerr << "  --group site|function|file   What allocations are grouped by (site)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		printUsage();
+		return 1;
+	}
+
+	string dumpFile = argv[1];
+	unsigned int top = 20;
+	bool byBytes = true;
+	string group = "site";
+	for (int I = 2; I < argc; I++)
+	{
+		string option = argv[I];
+		if (I + 1 >= argc)
+		{
+			printUsage();
+			return 1;
+		}
+		string value = argv[++I];
+		if (option == "--top")
+			top = static_cast<unsigned int>(strtoul(value.c_str(), nullptr, 10));
+		else if (option == "--by" && (value == "bytes" || value == "allocations"))
+			byBytes = value == "bytes";
+		else if (option == "--group" && (value == "site" || value == "function" || value == "file"))
+			group = value;
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	HeapDumpReader reader;
+	if (!reader.open(dumpFile))
+	{
+		cerr << "Failed to read " << dumpFile << " as a heap dump" << endl;
+		return 1;
+	}
+
+	//Totals keyed by the names and line of the group, as far as the grouping goes
+	map<string, SiteTotals> totals;
+	unsigned long long allocations = 0;
+	unsigned long long bytes = 0;
+	HeapDumpAllocation allocation;
+	while (reader.next(allocation))
+	{
+		const string &sourceFile = reader.getString(allocation.sourceFileId);
+		string funcName = group == "file" ? string() : reader.getString(allocation.funcNameId);
+		unsigned int lineNum = group == "site" ? allocation.lineNum : 0;
+		string key = sourceFile + '\n' + funcName + '\n' + to_string(lineNum);
+
+		map<string, SiteTotals>::iterator it = totals.find(key);
+		if (it == totals.end())
+			it = totals.insert(map<string, SiteTotals>::value_type(key, SiteTotals{ sourceFile, funcName, lineNum, 0, 0, 0 })).first;
+		it->second.liveBytes += allocation.size;
+		it->second.liveAllocations++;
+		it->second.largest = max(it->second.largest, allocation.size);
+		allocations++;
+		bytes += allocation.size;
+	}
+
+	vector<SiteTotals> sites;
+	for (map<string, SiteTotals>::iterator it = totals.begin(); it != totals.end(); it++)
+		sites.push_back(it->second);
+	sort(sites.begin(), sites.end(), [byBytes](const SiteTotals &a, const SiteTotals &b)
+	{
+		if (byBytes)
+			return a.liveBytes != b.liveBytes ? a.liveBytes > b.liveBytes : a.liveAllocations > b.liveAllocations;
+		return a.liveAllocations != b.liveAllocations ? a.liveAllocations > b.liveAllocations : a.liveBytes > b.liveBytes;
+	});
+	if (top > 0 && sites.size() > top)
+		sites.resize(top);
+
+	cout << allocations << " allocations holding " << bytes << " bytes from " << totals.size() << " " << group << (totals.size() == 1 ? "" : "s") << endl;
+	for (vector<SiteTotals>::iterator it = sites.begin(); it != sites.end(); it++)
+	{
+		double share = bytes > 0 ? 100.0 * it->liveBytes / bytes : 0;
+		cout << "{sourceFile: " << it->sourceFile;
+		if (group != "file")
+			cout << ", funcName: " << it->funcName;
+		if (group == "site")
+			cout << ", lineNum: " << it->lineNum;
+		cout << ", liveBytes: " << it->liveBytes << ", liveAllocations: " << it->liveAllocations << ", largest: " << it->largest << ", share: " << fixed << setprecision(1) << share << "%}" << endl;
+	}
+
+	if (!reader.isComplete())
+	{
+		cerr << dumpFile << " was cut short, only the allocations before the damage are reported" << endl;
+		return 1;
+	}
+	if (reader.getEndAllocations() != allocations || reader.getEndBytes() != bytes)
+	{
+		cerr << dumpFile << " lists " << reader.getEndAllocations() << " allocations holding " << reader.getEndBytes() << " bytes, but " << allocations << " were read" << endl;
+		return 1;
+	}
+	return 0;
+}
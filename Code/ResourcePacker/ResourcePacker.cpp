@@ -0,0 +1,212 @@
+// Name:
+// ResourcePacker.cpp
+// Description:
+// Entry point for the resource packer
+// Packs every file in a directory in to a C++ source file defining an EmbeddedResourcePack (see EmbeddedResourceSource.h), so the files can be compiled in to the executable.
+// Usage: ResourcePacker DIRECTORY OUTPUT NAME, where NAME is the name of the EmbeddedResourcePack the output defines.
+// The build runs it before compiling the engine. A missing directory packs nothing, and the output is only written when it changes so it isn't recompiled every build.
+// Notes:
+// OS-Aware
+// Uses OS-Specific functions to iterate over directory contents
+
+#include "CustomMemory.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+#include "Crc32.h"
+
+//Resources start on 16 byte boundaries in the pack's data, so they can be read with aligned loads
+const unsigned int resourceAlignment = 16;
+
+//A file found in the directory
+struct PackedFile
+{
+	//Name relative to the directory, with '/' separators
+	string name;
+	vector<char> data;
+};
+
+//Adds every file below path to names, ignoring hidden files as the other sources do
+static void listFiles(const string &path, const string &prefix, vector<string> &names)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATA findData;
+	HANDLE searchHandle = FindFirstFile((path + "\\*").c_str(), &findData);
+	if (searchHandle == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		if (findData.cFileName[0] == '.')
+			continue;
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			listFiles(path + "\\" + findData.cFileName, prefix + findData.cFileName + "/", names);
+		else
+			names.push_back(prefix + findData.cFileName);
+	} while (FindNextFile(searchHandle, &findData));
+	FindClose(searchHandle);
+#else
+	DIR *dir = opendir(path.c_str());
+	if (dir == nullptr)
+		return;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		string childPath = path + "/" + entry->d_name;
+		struct stat fileStat;
+		if (stat(childPath.c_str(), &fileStat) != 0)
+			continue;
+		if (S_ISDIR(fileStat.st_mode))
+			listFiles(childPath, prefix + entry->d_name + "/", names);
+		else
+			names.push_back(prefix + entry->d_name);
+	}
+	closedir(dir);
+#endif
+}
+
+//Quotes and escapes a name for a C++ string literal
+static string quote(const string &value)
+{
+	stringstream result;
+	result << '"';
+	for (string::const_iterator it = value.begin(); it != value.end(); it++)
+	{
+		unsigned char character = static_cast<unsigned char>(*it);
+		if (character == '"' || character == '\\')
+			result << '\\' << *it;
+		//Octal escapes are always three digits, so they can't run in to the next character
+		else if (character < 0x20 || character >= 0x7F || character == '?')
+			result << '\\' << oct << setw(3) << setfill('0') << static_cast<int>(character) << dec;
+		else
+			result << *it;
+	}
+	result << '"';
+	return result.str();
+}
+
+//Writes the source file for a pack
+static string writePack(const vector<PackedFile> &files, const string &directory, const string &packName)
+{
+	stringstream source;
+	source << "// Generated by ResourcePacker from " << directory << ", don't edit" << endl;
+	source << endl;
+	source << "#include \"EmbeddedResourceSource.h\"" << endl;
+	source << endl;
+
+	//All of the data goes in one array. Arrays can't be empty, so an empty pack still gets a byte.
+	vector<unsigned int> offsets;
+	unsigned int dataSize = 0;
+	for (vector<PackedFile>::const_iterator it = files.begin(); it != files.end(); it++)
+	{
+		dataSize = (dataSize + resourceAlignment - 1) / resourceAlignment * resourceAlignment;
+		offsets.push_back(dataSize);
+		dataSize += it->data.size();
+	}
+	vector<unsigned char> data(max(dataSize, 1u));
+	for (unsigned int I = 0; I < files.size(); I++)
+	{
+		if (files[I].data.size() > 0)
+			memcpy(&data[offsets[I]], &files[I].data[0], files[I].data.size());
+	}
+
+	source << "alignas(" << resourceAlignment << ") static const unsigned char packData[" << data.size() << "] =" << endl << "{" << endl;
+	for (unsigned int I = 0; I < data.size(); I += 16)
+	{
+		source << "\t";
+		for (unsigned int J = I; J < min(I + 16, static_cast<unsigned int>(data.size())); J++)
+			source << "0x" << hex << setw(2) << setfill('0') << static_cast<int>(data[J]) << dec << ",";
+		source << endl;
+	}
+	source << "};" << endl;
+	source << endl;
+
+	//The index is sorted by name and constexpr, so it can be searched at compile time
+	source << "static constexpr EmbeddedResource packIndex[" << max(files.size(), static_cast<size_t>(1)) << "] =" << endl << "{" << endl;
+	for (unsigned int I = 0; I < files.size(); I++)
+	{
+		unsigned int crc = files[I].data.size() > 0 ? updateCrc32(0, &files[I].data[0], files[I].data.size()) : 0;
+		source << "\t{ " << quote(files[I].name) << ", packData + " << offsets[I] << ", " << files[I].data.size() << ", 0x" << hex << setw(8) << setfill('0') << crc << dec << "u },"<< endl;
+	}
+	if (files.size() == 0)
+		source << "\t{ \"\", packData, 0, 0 }," << endl;
+	source << "};" << endl;
+	source << endl;
+	source << "static_assert(isEmbeddedIndexSorted(packIndex, 0, " << files.size() << "), \"ResourcePacker wrote an unsorted index\");" << endl;
+	source << endl;
+	source << "extern const EmbeddedResourcePack " << packName << " = { packIndex, " << files.size() << " };" << endl;
+	return source.str();
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 4)
+	{
+		cerr << "Usage: ResourcePacker DIRECTORY OUTPUT NAME" << endl;
+		cerr << "  Packs the files in DIRECTORY in to the C++ source file OUTPUT, which defines the EmbeddedResourcePack NAME." << endl;
+		return 1;
+	}
+	string directory = argv[1];
+	string outputPath = argv[2];
+	string packName = argv[3];
+
+	//Sort the names the same way the name table does
+	vector<string> names;
+	listFiles(directory, "", names);
+	sort(names.begin(), names.end());
+	if (names.size() == 0)
+		cout << "ResourcePacker: nothing to pack in " << directory << endl;
+
+	vector<PackedFile> files(names.size());
+	unsigned long long totalSize = 0;
+	for (unsigned int I = 0; I < names.size(); I++)
+	{
+		files[I].name = names[I];
+		ifstream file(directory + "/" + names[I], ios_base::in | ios_base::binary);
+		if (!file)
+		{
+			cerr << "ResourcePacker: failed to read " << directory << "/" << names[I] << endl;
+			return 1;
+		}
+		files[I].data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+		totalSize += files[I].data.size();
+	}
+
+	string source = writePack(files, directory, packName);
+
+	//Leave the output alone if it hasn't changed, so the build doesn't recompile it
+	ifstream existing(outputPath, ios_base::in | ios_base::binary);
+	if (existing && string(istreambuf_iterator<char>(existing), istreambuf_iterator<char>()) == source)
+	{
+		cout << "ResourcePacker: " << outputPath << " is up to date" << endl;
+		return 0;
+	}
+	existing.close();
+
+	ofstream output(outputPath, ios_base::out | ios_base::binary | ios_base::trunc);
+	output << source;
+	if (!output)
+	{
+		cerr << "ResourcePacker: failed to write " << outputPath << endl;
+		return 1;
+	}
+	cout << "ResourcePacker: packed " << files.size() << " files, " << totalSize << " bytes, in to " << outputPath << endl;
+	return 0;
+}
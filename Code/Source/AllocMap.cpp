@@ -7,148 +7,275 @@
 
 #include "AllocMap.h"
 
-#include <functional>
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
+#include <stdexcept>
 using namespace std;
 
+//Compare control bytes with SSE2 where the compiler targets it, otherwise one at a time
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define ALLOC_MAP_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//Control bytes compared at once by a search
+const unsigned int groupWidth = 16;
+//Control byte of an empty slot, slots holding a pointer have the high bit clear
+const unsigned char emptyControl = 0x80;
+//The map never shrinks below this many slots
+const unsigned long minSlots = 512;
+
+//Mixes every bit of a pointer in to every bit of the hash, since allocations are aligned and close together.
+//The low bits pick the pointer's home slot and the high 7 bits are it's control byte.
+static inline unsigned long long hashPointer(void* ptr)
+{
+	unsigned long long bits = reinterpret_cast<size_t>(ptr);
+	bits ^= bits >> 33;
+	bits *= 0xff51afd7ed558ccdULL;
+	bits ^= bits >> 33;
+	bits *= 0xc4ceb9fe1a85ec53ULL;
+	bits ^= bits >> 33;
+	return bits;
+}
+
+static inline unsigned char hashControl(unsigned long long hash)
+{
+	return static_cast<unsigned char>(hash >> 57);
+}
+
+//Returns a bit for each of the group's control bytes that equals control
+static inline unsigned int matchControls(const unsigned char *group, unsigned char control)
+{
+#ifdef ALLOC_MAP_SSE2
+	__m128i groupControls = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+	return static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(groupControls, _mm_set1_epi8(static_cast<char>(control)))));
+#else
+	unsigned int result = 0;
+	for (unsigned int I = 0; I < groupWidth; I++)
+	{
+		if (group[I] == control)
+			result |= 1u << I;
+	}
+	return result;
+#endif
+}
+
+//Returns the index of the lowest set bit, bits must not be 0
+static inline unsigned int lowestBit(unsigned int bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return index;
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+
 AllocMap::AllocMap()
 {
-	//Make sure that unsigned int is 4 byte so bit shifting works properly
-	static_assert(sizeof(unsigned int) == 4, "unsigned int size mismatch.");
-	//Set allocation map to 'half' of what I want the defaults
-	allocDataMap = nullptr;
-	allocatedSlots = 256;
-	shift = 24;
-	usedSlots = 0;
-	//Call doubleSlots which will allocate memory for the map and 512 slots.
-	doubleSlots();
+	controls = nullptr;
+	slots = nullptr;
+	slotCount = 0;
+	liveSlots = 0;
+	//Allocate memory for the map and 512 slots.
+	resize(minSlots);
 }
 
 AllocMap::~AllocMap()
 {
-	//If the map was allocated, deallocate it.
-	if (allocDataMap != nullptr)
-		free(allocDataMap);
+	free(controls);
+	free(slots);
 }
 
-void AllocMap::doubleSlots()
+void AllocMap::resize(unsigned long newSlotCount)
 {
-	//Store old slot count, update slot count and shift.
-	unsigned int oldSlotCount = allocatedSlots;
-	allocatedSlots *= 2;
-	shift--;
-	//TODO: Check to see if /4*3 is faster or slower than *0.75 cast to int
-	reallocationPoint = allocatedSlots/4*3;
+	unsigned char *oldControls = controls;
+	AllocSlot *oldSlots = slots;
+	unsigned long oldSlotCount = slotCount;
 
-	AllocData *oldMap = allocDataMap;
+	slotCount = newSlotCount;
+	//TODO: Check to see if /4*3 is faster or slower than *0.75 cast to int
+	growPoint = slotCount / 4 * 3;
+	shrinkPoint = slotCount > minSlots ? slotCount / 8 : 0;
 
-	//Allocate room for hash map
-	allocDataMap = reinterpret_cast<AllocData*>(malloc(sizeof(AllocData)* allocatedSlots));
+	//Allocate room for hash map, with the control bytes repeated for the last group
+	controls = reinterpret_cast<unsigned char*>(malloc(slotCount + groupWidth - 1));
+	slots = reinterpret_cast<AllocSlot*>(malloc(sizeof(AllocSlot) * slotCount));
+	memset(controls, emptyControl, slotCount + groupWidth - 1);
 
-	//Set all of the pointer values to null
-	for (unsigned int I = 0; I < allocatedSlots; I++)
+	//If we have an old map, copy over it's pointers
+	if (oldControls != nullptr)
 	{
-		allocDataMap[I].ptr = nullptr;
+		for (unsigned long I = 0; I < oldSlotCount; I++)
+		{
+			if (oldControls[I] != emptyControl)
+			{
+				bool found;
+				unsigned long long hash = hashPointer(oldSlots[I].data.ptr);
+				unsigned long slot = findSlot(oldSlots[I].data.ptr, hash, found);
+				slots[slot] = oldSlots[I];
+				setControl(slot, hashControl(hash));
+			}
+		}
+
+		//Free the old map's memory
+		free(oldControls);
+		free(oldSlots);
 	}
+}
 
-	//If we have an old map
-	if (oldMap != nullptr)
+void AllocMap::setControl(unsigned long slot, unsigned char control)
+{
+	controls[slot] = control;
+	if (slot < groupWidth - 1)
+		controls[slotCount + slot] = control;
+}
+
+unsigned long AllocMap::findSlot(void* ptr, unsigned long long hash, bool &found)
+{
+	unsigned long mask = slotCount - 1;
+	unsigned char control = hashControl(hash);
+	//Get base slot that this pointer will go to
+	unsigned long slot = static_cast<unsigned long>(hash) & mask;
+
+	//Search a group at a time until the pointer or an empty slot is found, the map is never full so there's always an empty slot.
+	//Pointers are never past an empty slot from their home slot, so a matching pointer after the group's first empty slot is still the one searched for.
+	while (true)
 	{
-		//Iterate through the old map's values and copy over any used slots
-		for (unsigned int I = 0; I < oldSlotCount; I++)
+		const unsigned char *group = controls + slot;
+		for (unsigned int matches = matchControls(group, control); matches != 0; matches &= matches - 1)
 		{
-			if (oldMap[I].ptr != nullptr)
+			unsigned long candidate = (slot + lowestBit(matches)) & mask;
+			if (slots[candidate].data.ptr == ptr)
 			{
-				map(oldMap[I]);
+				found = true;
+				return candidate;
 			}
 		}
 
-		//Free the old map's memory
-		free(oldMap);
+		unsigned int empties = matchControls(group, emptyControl);
+		if (empties != 0)
+		{
+			found = false;
+			return (slot + lowestBit(empties)) & mask;
+		}
+		slot = (slot + groupWidth) & mask;
 	}
 }
 
+void AllocMap::eraseSlot(unsigned long slot)
+{
+	unsigned long mask = slotCount - 1;
+	unsigned long hole = slot;
+	//Move back every pointer after the hole whose home slot is at or before it, up to the next empty slot
+	for (unsigned long next = (hole + 1) & mask; controls[next] != emptyControl; next = (next + 1) & mask)
+	{
+		unsigned long home = static_cast<unsigned long>(hashPointer(slots[next].data.ptr)) & mask;
+		if (((next - home) & mask) >= ((next - hole) & mask))
+		{
+			slots[hole] = slots[next];
+			setControl(hole, controls[next]);
+			hole = next;
+		}
+	}
+	setControl(hole, emptyControl);
+	liveSlots--;
+}
+
 string AllocMap::getAllocData()
 {
 	lock_guard<recursive_mutex> objectLock(objectMutex);
 	//stream to hold results
 	stringstream result;
-	//Iterate over the map and write out any pointers that aren't null
-	for (unsigned int I = 0; I < allocatedSlots; I++)
+	//Iterate over the map and write out any pointers that are allocated
+	for (unsigned long I = 0; I < slotCount; I++)
 	{
-		if (allocDataMap[I].ptr != nullptr)
-			result << allocDataMap[I].ptr << "{sourceFile: " << allocDataMap[I].sourceFile << ", funcName: " << allocDataMap[I].funcName << ", lineNum: " << allocDataMap[I].lineNum << "}" << endl;
+		if (controls[I] != emptyControl && slots[I].count > 0)
+			result << slots[I].data.ptr << "{sourceFile: " << slots[I].data.sourceFile << ", funcName: " << slots[I].data.funcName << ", lineNum: " << slots[I].data.lineNum << ", size: " << slots[I].data.size << "}" << endl;
 	}
-	//Copy up to 5000 characters from result stream to temp.
 	return result.str();
 }
 
-void AllocMap::map(const AllocData& allocData)
+bool AllocMap::copyAllocations(AllocData *&allocations, unsigned long &count)
 {
 	lock_guard<recursive_mutex> objectLock(objectMutex);
-	//Increment used slots, this function shouldn't ever be called unsuccessfully
-	usedSlots++;
+	//Every used slot might be allocated, one more keeps an empty map from asking malloc for nothing
+	allocations = reinterpret_cast<AllocData*>(malloc(sizeof(AllocData) * (liveSlots + 1)));
+	if (allocations == nullptr)
+		return false;
+	count = 0;
+	for (unsigned long I = 0; I < slotCount; I++)
+	{
+		if (controls[I] != emptyControl && slots[I].count > 0)
+			allocations[count++] = slots[I].data;
+	}
+	return true;
+}
 
-	//If the number of used slots has grown to far, get more slots
-	if (usedSlots >= reallocationPoint)
-		doubleSlots();
+int AllocMap::adjust(const AllocData& allocData, int count, AllocData *previous)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
 
-	//Get base slot that this pointer will go to
-	unsigned long slot = hasher(allocData.ptr) >> shift;
+	bool found;
+	unsigned long long hash = hashPointer(allocData.ptr);
+	unsigned long slot = findSlot(allocData.ptr, hash, found);
 
-	//Get first empty slot following base slot
-	while (allocDataMap[slot].ptr != nullptr)
+	if (found)
 	{
-		if (allocDataMap[slot].ptr != allocData.ptr)
-			slot++;
-		else
-			throw exception("Attempt to map already mapped pointer!");
-		if (slot == allocatedSlots)
-			slot = 0;
+		AllocSlot &allocSlot = slots[slot];
+		int oldCount = allocSlot.count;
+		if (previous != nullptr)
+			*previous = allocSlot.data;
+		allocSlot.count += count;
+		//Once the allocations and frees balance out the pointer is gone
+		if (allocSlot.count == 0)
+		{
+			eraseSlot(slot);
+			if (liveSlots < shrinkPoint)
+				resize(slotCount / 2);
+		}
+		//The most recently merged allocation is the one reported
+		else if (count > 0)
+			allocSlot.data = allocData;
+		return oldCount;
 	}
 
-	//Put allocation data in empty slot.
-	allocDataMap[slot] = allocData;
+	//Put the pointer in the slot, freed pointers are kept with a negative count until their allocation is merged
+	slots[slot].data = allocData;
+	slots[slot].count = count;
+	setControl(slot, hashControl(hash));
+	liveSlots++;
+
+	//If the map has filled to far, get more slots
+	if (liveSlots > growPoint)
+		resize(slotCount * 2);
+	return 0;
+}
+
+int AllocMap::map(const AllocData& allocData, AllocData *previous)
+{
+	return adjust(allocData, 1, previous);
 }
 
 AllocData AllocMap::retrieve(void* ptr)
 {
 	lock_guard<recursive_mutex> objectLock(objectMutex);
-	//Get starting slot for search
-	unsigned long slot = hasher(ptr) >> shift;
-	//Store starting slot to make sure we don't infinitely loop around
-	unsigned long startSlot = slot;
-
 	//Search for the pointer
-	while (allocDataMap[slot].ptr != ptr)
-	{
-		slot++;
-		if (slot == allocatedSlots)
-			slot = 0;
-		if (slot == startSlot)
-			throw exception("Retrieve requested for untracked pointer!");
-	}
+	bool found;
+	unsigned long slot = findSlot(ptr, hashPointer(ptr), found);
+	if (!found || slots[slot].count <= 0)
+		throw runtime_error("Retrieve requested for untracked pointer!");
 
 	//Return pointer
-	return allocDataMap[slot];
+	return slots[slot].data;
 }
 
-void AllocMap::erase(void* ptr)
+int AllocMap::erase(void* ptr, AllocData *previous)
 {
-	lock_guard<recursive_mutex> objectLock(objectMutex);
-	//Get starting slot
-	unsigned long slot = hasher(ptr) >> shift;
-	//Store starting slot to make sure we don't infinitely loop
-	unsigned long startSlot = slot;
-	//Find the pointer
-	while (allocDataMap[slot].ptr != ptr)
-	{
-		slot++;
-		if (slot == allocatedSlots)
-			slot = 0;
-		if (slot == startSlot)
-			throw exception("Erase data requested for untracked pointer!");
-	}
-	//Null the pointer once it's found, no need to change the rest of the data it'll get overwritten when the slot is reused.
-	allocDataMap[slot].ptr = nullptr;
+	return adjust(AllocData{ ptr, nullptr, nullptr, 0, 0 }, -1, previous);
 }
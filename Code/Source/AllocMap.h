@@ -3,6 +3,10 @@
 // Description:
 // Header file for AllocMap class
 // AllocMap is a hashmap designed to track the memory allocations of the new and delete functions and thus does not use the c++ new/delete functions itself.
+// The tracker merges allocations and frees in the order they were made (see AllocTracker.h), but ones made while tracking was paused are never merged, so a free can come without the allocation it frees.
+// Each pointer keeps a count of the allocations merged less the frees, and is only reported while the count is above zero.
+// The map is open addressed with linear probing. Each slot has a control byte holding 7 bits of it's pointer's hash, or marking it empty, and searches compare a group of 16 control bytes at once.
+// Erasing shifts the pointers after the slot back in to it rather than leaving a marker, so searches never scan past erased slots, and the map shrinks again once it's mostly empty.
 // Notes:
 // OS-Unaware
 
@@ -20,30 +24,56 @@ struct AllocData
 	const char *sourceFile;
 	const char *funcName;
 	unsigned int lineNum;
+	size_t size;
 };
 
 class AllocMap
 {
 private:
+	//Slot of the map. count is normally 1, but can be anything once events made with tracking paused are missing.
+	struct AllocSlot
+	{
+		AllocData data;
+		int count;
+	};
+
 	recursive_mutex objectMutex;
-	hash<void*> hasher;
-	AllocData  *allocDataMap;
-	unsigned long allocatedSlots;
-	unsigned long usedSlots;
-	unsigned long reallocationPoint;
-	short shift;
-
-	void doubleSlots();
+	//Control byte of each slot. The first bytes are repeated after the last slot, so a group can be read from any slot without wrapping around.
+	unsigned char *controls;
+	AllocSlot *slots;
+	//Always a power of two
+	unsigned long slotCount;
+	unsigned long liveSlots;
+	//The map grows once more slots than this are used, and shrinks once fewer are
+	unsigned long growPoint;
+	unsigned long shrinkPoint;
+
+	//Rebuilds the map with newSlotCount slots
+	void resize(unsigned long newSlotCount);
+	void setControl(unsigned long slot, unsigned char control);
+	//Returns the slot holding ptr, or the empty slot to put it in if it isn't in the map
+	unsigned long findSlot(void* ptr, unsigned long long hash, bool &found);
+	//Empties a slot, moving the pointers after it back to keep every pointer reachable from it's home slot
+	void eraseSlot(unsigned long slot);
+	//Adds count to the pointer's count, putting data in the slot if the pointer ends up allocated. Returns the count before, and the data before in previous if the pointer was in the map.
+	int adjust(const AllocData& allocData, int count, AllocData *previous);
 	string getAllocData();
+	//Copies every allocated pointer in to an array from malloc, which the caller frees. Returns false if there's no memory for the array.
+	bool copyAllocations(AllocData *&allocations, unsigned long &count);
+
+	AllocMap(const AllocMap& allocMap) = delete;
+	AllocMap& operator =(const AllocMap& allocMap) = delete;
 
 public:
 	AllocMap();
 	~AllocMap();
-	void map(const AllocData& allocData);
+	//Maps and erases return the pointer's count before the call, 1 or more when the pointer was allocated and less than 0 when it's free was merged first.
+	//previous is set to the allocation the pointer had, if it had one.
+	int map(const AllocData& allocData, AllocData *previous = nullptr);
 	AllocData retrieve(void* ptr);
-	void erase(void* ptr);
+	int erase(void* ptr, AllocData *previous = nullptr);
 
-	friend string getAllocs();
+	friend class AllocTracker;
 };
 
 #endif
@@ -0,0 +1,352 @@
+// Name:
+// AllocSampler.cpp
+// Description:
+// Implementation file for AllocSampler class
+// Notes:
+// OS-Aware
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <execinfo.h>
+#endif
+
+#include "AllocSampler.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <type_traits>
+#include <algorithm>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+//Average bytes between samples unless setSampleInterval is called
+const unsigned long long defaultSampleInterval = 512 * 1024;
+//Frames of the sampler and operator new skipped at the top of each call stack
+const unsigned int skippedStackFrames = 2;
+//Counters in the table frees check, must be a power of 2
+const unsigned int sampledFilterSize = 16384;
+//Marks an empty slot of the site table
+const unsigned int emptySite = ~0u;
+
+//Bytes the calling thread can allocate before it's next sample
+static thread_local long long bytesUntilSample = 0;
+//State of the calling thread's random numbers, 0 until the thread's first allocation
+static thread_local unsigned long long randomState = 0;
+
+//Number of sampled pointers that haven't been freed in each bucket. Frees of pointers in an empty bucket weren't sampled.
+static atomic<unsigned int> sampledFilter[sampledFilterSize];
+
+//Mixes the bits of a pointer, allocations are aligned so the low bits alone are poor hashes
+static inline size_t hashPointer(void *ptr)
+{
+	unsigned long long bits = reinterpret_cast<size_t>(ptr);
+	bits = (bits ^ (bits >> 33)) * 0xFF51AFD7ED558CCDULL;
+	bits = (bits ^ (bits >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+	return static_cast<size_t>(bits ^ (bits >> 33));
+}
+
+//Returns a random number from 0 (exclusive) to 1 (inclusive) from the calling thread's state, see xorshift64*
+static double nextUnit()
+{
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	unsigned long long bits = randomState * 2685821657736338717ULL;
+	return ((bits >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+//Returns the bytes until the next sample, drawn from an exponential distribution so every byte is equally likely to be sampled
+static long long nextInterval(unsigned long long interval)
+{
+	return static_cast<long long>(-log(nextUnit()) * interval) + 1;
+}
+
+//Fills stack with the calling function's callers, returning the number of frames
+static unsigned int captureStack(void **stack, unsigned int depth)
+{
+#ifdef _WIN32
+	return CaptureStackBackTrace(skippedStackFrames + 1, depth, stack, nullptr);
+#else
+	void *frames[allocStackDepth + skippedStackFrames + 1];
+	int captured = backtrace(frames, depth + skippedStackFrames + 1);
+	int skipped = captured < static_cast<int>(skippedStackFrames + 1) ? captured : skippedStackFrames + 1;
+	memcpy(stack, frames + skipped, (captured - skipped) * sizeof(void*));
+	return captured - skipped;
+#endif
+}
+
+AllocSampler::AllocSampler() : sampleInterval(defaultSampleInterval), sites(nullptr), siteCount(0), siteCapacity(0), siteTable(nullptr), siteTableSize(0), sampled(nullptr), sampledCount(0), sampledTableSize(0)
+{
+	growSiteTable();
+	growSampledTable();
+}
+
+bool AllocSampler::countDown(size_t size)
+{
+	bytesUntilSample -= static_cast<long long>(size);
+	return bytesUntilSample <= 0;
+}
+
+bool AllocSampler::mightBeSampled(void *ptr)
+{
+	return sampledFilter[hashPointer(ptr) & (sampledFilterSize - 1)].load(memory_order_relaxed) != 0;
+}
+
+bool AllocSampler::growSiteTable()
+{
+	//Sites are kept in the order they were found, the table only holds indexes so it can be rebuilt from them
+	unsigned int newSize = siteTableSize == 0 ? 256 : siteTableSize * 2;
+	unsigned int *newTable = reinterpret_cast<unsigned int*>(malloc(sizeof(unsigned int) * newSize));
+	if (newTable == nullptr)
+		return false;
+	free(siteTable);
+	siteTable = newTable;
+	siteTableSize = newSize;
+	for (unsigned int I = 0; I < siteTableSize; I++)
+		siteTable[I] = emptySite;
+	for (unsigned int I = 0; I < siteCount; I++)
+	{
+		size_t slot = sites[I].hash & (siteTableSize - 1);
+		while (siteTable[slot] != emptySite)
+			slot = (slot + 1) & (siteTableSize - 1);
+		siteTable[slot] = I;
+	}
+	return true;
+}
+
+bool AllocSampler::growSampledTable()
+{
+	unsigned int oldSize = sampledTableSize;
+	SampledAlloc *oldTable = sampled;
+
+	unsigned int newSize = sampledTableSize == 0 ? 1024 : sampledTableSize * 2;
+	SampledAlloc *newTable = reinterpret_cast<SampledAlloc*>(malloc(sizeof(SampledAlloc) * newSize));
+	if (newTable == nullptr)
+		return false;
+	sampled = newTable;
+	sampledTableSize = newSize;
+	for (unsigned int I = 0; I < sampledTableSize; I++)
+		sampled[I].ptr = nullptr;
+	for (unsigned int I = 0; I < oldSize; I++)
+	{
+		if (oldTable[I].ptr == nullptr)
+			continue;
+		size_t slot = hashPointer(oldTable[I].ptr) & (sampledTableSize - 1);
+		while (sampled[slot].ptr != nullptr)
+			slot = (slot + 1) & (sampledTableSize - 1);
+		sampled[slot] = oldTable[I];
+	}
+	free(oldTable);
+	return true;
+}
+
+unsigned int AllocSampler::findSite(const char *sourceFile, const char *funcName, unsigned int lineNum, void **stack, unsigned int stackDepth)
+{
+	//FNV-1a of the location and stack
+	size_t hash = 2166136261u;
+	size_t parts[3 + allocStackDepth] = { reinterpret_cast<size_t>(sourceFile), reinterpret_cast<size_t>(funcName), lineNum };
+	for (unsigned int I = 0; I < stackDepth; I++)
+		parts[3 + I] = reinterpret_cast<size_t>(stack[I]);
+	for (unsigned int I = 0; I < 3 + stackDepth; I++)
+		hash = (hash ^ parts[I]) * 16777619u;
+	hash = hashPointer(reinterpret_cast<void*>(hash));
+
+	if (siteTableSize == 0 && !growSiteTable())
+		return emptySite;
+	size_t slot = hash & (siteTableSize - 1);
+	while (siteTable[slot] != emptySite)
+	{
+		AllocSite &site = sites[siteTable[slot]];
+		if (site.hash == hash && site.sourceFile == sourceFile && site.funcName == funcName && site.lineNum == lineNum &&
+			site.stackDepth == stackDepth && memcmp(site.stack, stack, stackDepth * sizeof(void*)) == 0)
+			return siteTable[slot];
+		slot = (slot + 1) & (siteTableSize - 1);
+	}
+
+	//A new site, the table is kept at most half full so it always has an empty slot to stop searches
+	if ((siteCount + 1) * 2 > siteTableSize)
+	{
+		if (!growSiteTable())
+			return emptySite;
+		slot = hash & (siteTableSize - 1);
+		while (siteTable[slot] != emptySite)
+			slot = (slot + 1) & (siteTableSize - 1);
+	}
+	if (siteCount == siteCapacity)
+	{
+		unsigned int newCapacity = siteCapacity == 0 ? 256 : siteCapacity * 2;
+		AllocSite *newSites = reinterpret_cast<AllocSite*>(realloc(sites, sizeof(AllocSite) * newCapacity));
+		if (newSites == nullptr)
+			return emptySite;
+		sites = newSites;
+		siteCapacity = newCapacity;
+	}
+	AllocSite &site = sites[siteCount];
+	site.sourceFile = sourceFile;
+	site.funcName = funcName;
+	site.lineNum = lineNum;
+	memcpy(site.stack, stack, stackDepth * sizeof(void*));
+	site.stackDepth = stackDepth;
+	site.hash = hash;
+	site.liveBytes = 0;
+	site.liveAllocations = 0;
+	site.samples = 0;
+	site.liveSamples = 0;
+	siteTable[slot] = siteCount;
+	siteCount++;
+	return siteCount - 1;
+}
+
+void AllocSampler::sample(void *ptr, size_t size, const char *sourceFile, const char *funcName, unsigned int lineNum)
+{
+	unsigned long long interval = sampleInterval.load(memory_order_relaxed);
+
+	//A thread's first allocation starts it's count down
+	if (randomState == 0)
+	{
+		chrono::steady_clock::rep now = chrono::steady_clock::now().time_since_epoch().count();
+		randomState = hashPointer(reinterpret_cast<void*>(&bytesUntilSample)) ^ static_cast<unsigned long long>(now) ^ 0x9E3779B97F4A7C15ULL;
+		if (randomState == 0)
+			randomState = 1;
+		bytesUntilSample = nextInterval(interval) - static_cast<long long>(size);
+		if (bytesUntilSample > 0)
+			return;
+	}
+	bytesUntilSample = nextInterval(interval);
+	if (ptr == nullptr)
+		return;
+
+	//Capture the stack before locking, it's the slowest part of a sample
+	void *stack[allocStackDepth];
+	unsigned int stackDepth = captureStack(stack, allocStackDepth);
+
+	//The chance this allocation was sampled, each sample stands in for the allocations that weren't
+	double chance = -expm1(-static_cast<double>(size) / interval);
+
+	lock_guard<mutex> objectLock(objectMutex);
+	//Without the memory for the sample's site or pointer it's dropped, the estimates just lose it's weight
+	if ((sampledCount + 1) * 2 > sampledTableSize && !growSampledTable())
+		return;
+	unsigned int siteIndex = findSite(sourceFile, funcName, lineNum, stack, stackDepth);
+	if (siteIndex == emptySite)
+		return;
+	AllocSite &site = sites[siteIndex];
+	site.liveBytes += size / chance;
+	site.liveAllocations += 1 / chance;
+	site.samples++;
+	site.liveSamples++;
+
+	size_t slot = hashPointer(ptr) & (sampledTableSize - 1);
+	while (sampled[slot].ptr != nullptr)
+		slot = (slot + 1) & (sampledTableSize - 1);
+	sampled[slot] = SampledAlloc{ ptr, siteIndex, size / chance, 1 / chance };
+	sampledCount++;
+
+	//Frees of the pointer check the filter, so it's marked before the pointer is returned
+	sampledFilter[hashPointer(ptr) & (sampledFilterSize - 1)].fetch_add(1, memory_order_relaxed);
+}
+
+void AllocSampler::recordFree(void *ptr)
+{
+	lock_guard<mutex> objectLock(objectMutex);
+
+	size_t mask = sampledTableSize - 1;
+	size_t slot = hashPointer(ptr) & mask;
+	while (sampled[slot].ptr != ptr)
+	{
+		//Another sampled pointer shares the filter's bucket, this one wasn't sampled
+		if (sampled[slot].ptr == nullptr)
+			return;
+		slot = (slot + 1) & mask;
+	}
+
+	AllocSite &site = sites[sampled[slot].site];
+	site.liveBytes -= sampled[slot].bytes;
+	site.liveAllocations -= sampled[slot].allocations;
+	site.liveSamples--;
+	sampledCount--;
+	sampledFilter[hashPointer(ptr) & (sampledFilterSize - 1)].fetch_sub(1, memory_order_relaxed);
+
+	//Shift the pointers after the slot back, so none of them is left after an empty slot it has to be searched past
+	size_t hole = slot;
+	for (size_t next = (hole + 1) & mask; sampled[next].ptr != nullptr; next = (next + 1) & mask)
+	{
+		size_t home = hashPointer(sampled[next].ptr) & mask;
+		//Move the pointer if the hole is between it's home slot and where it is now
+		if (((next - home) & mask) >= ((next - hole) & mask))
+		{
+			sampled[hole] = sampled[next];
+			hole = next;
+		}
+	}
+	sampled[hole].ptr = nullptr;
+}
+
+void AllocSampler::setSampleInterval(unsigned long long bytes)
+{
+	sampleInterval.store(bytes > 0 ? bytes : 1, memory_order_relaxed);
+}
+
+unsigned long long AllocSampler::getSampleInterval() const
+{
+	return sampleInterval.load(memory_order_relaxed);
+}
+
+vector<AllocSiteEstimate> AllocSampler::getSiteEstimates()
+{
+	//Copy the sites with malloc, building the vector allocates memory and can't be done with the object locked
+	AllocSiteEstimate *estimates;
+	unsigned int count;
+	{
+		lock_guard<mutex> objectLock(objectMutex);
+		count = siteCount;
+		estimates = reinterpret_cast<AllocSiteEstimate*>(malloc(sizeof(AllocSiteEstimate) * (count > 0 ? count : 1)));
+		for (unsigned int I = 0; I < count; I++)
+		{
+			estimates[I].sourceFile = sites[I].sourceFile;
+			estimates[I].funcName = sites[I].funcName;
+			estimates[I].lineNum = sites[I].lineNum;
+			memcpy(estimates[I].stack, sites[I].stack, sizeof(sites[I].stack));
+			estimates[I].stackDepth = sites[I].stackDepth;
+			//Rounding leaves slivers behind when every sample is freed
+			estimates[I].liveBytes = sites[I].liveSamples > 0 ? static_cast<unsigned long long>(sites[I].liveBytes + 0.5) : 0;
+			estimates[I].liveAllocations = sites[I].liveSamples > 0 ? static_cast<unsigned long long>(sites[I].liveAllocations + 0.5) : 0;
+			estimates[I].samples = sites[I].samples;
+			estimates[I].liveSamples = sites[I].liveSamples;
+		}
+	}
+
+	vector<AllocSiteEstimate> result(estimates, estimates + count);
+	free(estimates);
+	sort(result.begin(), result.end(), [](const AllocSiteEstimate &first, const AllocSiteEstimate &second) { return first.liveBytes > second.liveBytes; });
+	return result;
+}
+
+string AllocSampler::getAllocData()
+{
+	vector<AllocSiteEstimate> estimates = getSiteEstimates();
+	stringstream result;
+	for (vector<AllocSiteEstimate>::const_iterator it = estimates.begin(); it != estimates.end() && it->liveSamples > 0; it++)
+	{
+		result << "~" << it->liveBytes << " bytes in ~" << it->liveAllocations << " allocations{sourceFile: " << it->sourceFile << ", funcName: " << it->funcName << ", lineNum: " << it->lineNum << ", samples: " << it->liveSamples << ", stack:";
+		for (unsigned int I = 0; I < it->stackDepth; I++)
+			result << " " << it->stack[I];
+		result << "}" << endl;
+	}
+	return result.str();
+}
+
+AllocSampler &getAllocSampler()
+{
+	static aligned_storage<sizeof(AllocSampler), alignof(AllocSampler)>::type samplerStorage;
+	static AllocSampler *sampler = new (&samplerStorage) AllocSampler();
+	return *sampler;
+}
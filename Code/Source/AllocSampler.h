@@ -0,0 +1,119 @@
+// Name:
+// AllocSampler.h
+// Description:
+// Header file for AllocSampler class
+// AllocSampler is the tracking used when the engine is built with ALLOC_SAMPLING (see CustomMemory.h). It records roughly one allocation per sample interval bytes instead of every allocation, so it's cheap enough to leave on.
+// Each thread counts down a random number of bytes, drawn from an exponential distribution averaging the sample interval, and the allocation that takes the count past zero is sampled.
+// An allocation of size bytes is sampled with probability 1 - e^(-size / interval), so each sample is weighted by the inverse of that to keep the estimates unbiased.
+// Samples record the allocation's location and a short call stack, and are grouped by both in to sites that hold the estimated live bytes and allocations.
+// Frees check a small table of counters to see whether the pointer might have been sampled, so only frees of sampled pointers (and the odd collision) take the lock.
+// Like AllocMap, the sampler doesn't use the c++ new/delete functions itself.
+// Notes:
+// OS-Aware
+// Call stacks are captured with CaptureStackBackTrace on Windows and backtrace elsewhere.
+
+#ifndef ALLOC_SAMPLER_H
+#define ALLOC_SAMPLER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+using namespace std;
+
+//Frames of call stack recorded with each sample
+const unsigned int allocStackDepth = 8;
+
+//Estimated memory held by allocations made from one location and call stack
+struct AllocSiteEstimate
+{
+	const char *sourceFile;
+	const char *funcName;
+	unsigned int lineNum;
+	void *stack[allocStackDepth];
+	unsigned int stackDepth;
+	//Estimated bytes and allocations still allocated
+	unsigned long long liveBytes;
+	unsigned long long liveAllocations;
+	//Samples taken at the site, and the ones that haven't been freed
+	unsigned long long samples;
+	unsigned long long liveSamples;
+};
+
+class AllocSampler
+{
+private:
+	//A location and call stack that has been sampled
+	struct AllocSite
+	{
+		const char *sourceFile;
+		const char *funcName;
+		unsigned int lineNum;
+		void *stack[allocStackDepth];
+		unsigned int stackDepth;
+		size_t hash;
+		double liveBytes;
+		double liveAllocations;
+		unsigned long long samples;
+		unsigned long long liveSamples;
+	};
+
+	//A sampled pointer that hasn't been freed, and the weight it added to it's site
+	struct SampledAlloc
+	{
+		void *ptr;
+		unsigned int site;
+		double bytes;
+		double allocations;
+	};
+
+	mutex objectMutex;
+	atomic<unsigned long long> sampleInterval;
+
+	//Sites, and a hash table of indexes in to them. Empty slots of the table are ~0.
+	AllocSite *sites;
+	unsigned int siteCount;
+	unsigned int siteCapacity;
+	unsigned int *siteTable;
+	unsigned int siteTableSize;
+
+	//Hash table of sampled pointers, kept with backward shift deletion. Empty slots have a null ptr.
+	SampledAlloc *sampled;
+	unsigned int sampledCount;
+	unsigned int sampledTableSize;
+
+	//Returns the index of the site for a location and call stack, adding it if it's new. Returns ~0u if a new site can't be added. Call with the object locked.
+	unsigned int findSite(const char *sourceFile, const char *funcName, unsigned int lineNum, void **stack, unsigned int stackDepth);
+	//Double the size of a table, returning false and leaving it as it was if there's no memory for it
+	bool growSiteTable();
+	bool growSampledTable();
+
+	AllocSampler(const AllocSampler& allocSampler) = delete;
+	AllocSampler& operator =(const AllocSampler& allocSampler) = delete;
+
+public:
+	AllocSampler();
+
+	//Counts an allocation of size bytes down from the calling thread's next sample. Returns true if the allocation should be sampled.
+	static bool countDown(size_t size);
+	//Returns false if ptr definitely wasn't sampled
+	static bool mightBeSampled(void *ptr);
+
+	//Records a sampled allocation
+	void sample(void *ptr, size_t size, const char *sourceFile, const char *funcName, unsigned int lineNum);
+	//Records a free of a pointer that might have been sampled
+	void recordFree(void *ptr);
+
+	//Sets the average bytes between samples. Threads pick the new interval up after their next sample.
+	void setSampleInterval(unsigned long long bytes);
+	unsigned long long getSampleInterval() const;
+	//Returns the estimates for every site, largest live bytes first
+	vector<AllocSiteEstimate> getSiteEstimates();
+	//Returns a line for every site still holding memory
+	string getAllocData();
+};
+
+//Returns the sampler, which is created on first use and never destroyed
+AllocSampler &getAllocSampler();
+
+#endif
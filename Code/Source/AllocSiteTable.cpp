@@ -0,0 +1,117 @@
+// Name:
+// AllocSiteTable.cpp
+// Description:
+// Implementation file for AllocSiteTable class
+// Notes:
+// OS-Unaware
+
+#include "AllocSiteTable.h"
+
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+#include "AllocMap.h"
+
+//Marks an empty slot of the table
+const unsigned int emptySite = ~0u;
+
+AllocSiteTable::AllocSiteTable() : sites(nullptr), siteCount(0), siteCapacity(0), siteTable(nullptr), siteTableSize(0)
+{
+	growTable();
+}
+
+AllocSiteTable::~AllocSiteTable()
+{
+	free(sites);
+	free(siteTable);
+}
+
+//Hashes a location, the name pointers are aligned so their low bits are mixed in with the rest
+static size_t hashSite(const char *sourceFile, const char *funcName, unsigned int lineNum)
+{
+	unsigned long long bits = reinterpret_cast<size_t>(sourceFile) * 0x9E3779B97F4A7C15ULL;
+	bits ^= reinterpret_cast<size_t>(funcName) + (bits >> 29);
+	bits = (bits ^ lineNum) * 0xBF58476D1CE4E5B9ULL;
+	return static_cast<size_t>(bits ^ (bits >> 31));
+}
+
+void AllocSiteTable::growTable()
+{
+	siteTableSize = siteTableSize == 0 ? 256 : siteTableSize * 2;
+	free(siteTable);
+	siteTable = reinterpret_cast<unsigned int*>(malloc(sizeof(unsigned int) * siteTableSize));
+	for (unsigned int I = 0; I < siteTableSize; I++)
+		siteTable[I] = emptySite;
+	for (unsigned int I = 0; I < siteCount; I++)
+	{
+		size_t slot = hashSite(sites[I].sourceFile, sites[I].funcName, sites[I].lineNum) & (siteTableSize - 1);
+		while (siteTable[slot] != emptySite)
+			slot = (slot + 1) & (siteTableSize - 1);
+		siteTable[slot] = I;
+	}
+}
+
+AllocSiteStats &AllocSiteTable::findSite(const AllocData& allocData)
+{
+	size_t slot = hashSite(allocData.sourceFile, allocData.funcName, allocData.lineNum) & (siteTableSize - 1);
+	while (siteTable[slot] != emptySite)
+	{
+		AllocSiteStats &site = sites[siteTable[slot]];
+		if (site.sourceFile == allocData.sourceFile && site.funcName == allocData.funcName && site.lineNum == allocData.lineNum)
+			return site;
+		slot = (slot + 1) & (siteTableSize - 1);
+	}
+
+	//A new site
+	if (siteCount == siteCapacity)
+	{
+		siteCapacity = siteCapacity == 0 ? 256 : siteCapacity * 2;
+		sites = reinterpret_cast<AllocSiteStats*>(realloc(sites, sizeof(AllocSiteStats) * siteCapacity));
+	}
+	unsigned int index = siteCount++;
+	memset(&sites[index], 0, sizeof(AllocSiteStats));
+	sites[index].sourceFile = allocData.sourceFile;
+	sites[index].funcName = allocData.funcName;
+	sites[index].lineNum = allocData.lineNum;
+	siteTable[slot] = index;
+
+	//Keep the table at most half full
+	if (siteCount * 2 > siteTableSize)
+		growTable();
+	return sites[index];
+}
+
+void AllocSiteTable::recordAlloc(const AllocData& allocData, bool live)
+{
+	AllocSiteStats &site = findSite(allocData);
+	site.totalAllocations++;
+	site.totalBytes += allocData.size;
+	if (live)
+	{
+		site.liveAllocations++;
+		site.liveBytes += allocData.size;
+		if (site.liveBytes > site.peakBytes)
+			site.peakBytes = site.liveBytes;
+	}
+}
+
+void AllocSiteTable::recordFree(const AllocData& allocData)
+{
+	AllocSiteStats &site = findSite(allocData);
+	site.liveAllocations--;
+	site.liveBytes -= allocData.size;
+}
+
+unsigned int AllocSiteTable::size() const
+{
+	return siteCount;
+}
+
+unsigned int AllocSiteTable::copy(AllocSiteStats *stats, unsigned int count) const
+{
+	if (count > siteCount)
+		count = siteCount;
+	memcpy(stats, sites, sizeof(AllocSiteStats) * count);
+	return count;
+}
@@ -0,0 +1,77 @@
+// Name:
+// AllocSiteTable.h
+// Description:
+// Header file for AllocSiteTable class
+// AllocSiteTable keeps statistics for each location tracked allocations are made from: the bytes and allocations it holds, the most bytes it has held at once, and everything it has ever allocated.
+// Locations are told apart by the pointers of their file and function names, which the compiler pools, and their line.
+// Like AllocMap, the table doesn't use the c++ new/delete functions itself.
+// Notes:
+// OS-Unaware
+
+#ifndef ALLOC_SITE_TABLE_H
+#define ALLOC_SITE_TABLE_H
+
+#include <cstddef>
+using namespace std;
+
+struct AllocData;
+
+//Statistics for one location allocations are made from
+struct AllocSiteStats
+{
+	const char *sourceFile;
+	const char *funcName;
+	unsigned int lineNum;
+	//Bytes and allocations that haven't been freed
+	unsigned long long liveBytes;
+	unsigned long long liveAllocations;
+	//Most bytes the site has held at once
+	unsigned long long peakBytes;
+	//Every allocation the site has made
+	unsigned long long totalAllocations;
+	unsigned long long totalBytes;
+};
+
+//Change in a site's statistics between two snapshots
+struct AllocSiteDelta
+{
+	const char *sourceFile;
+	const char *funcName;
+	unsigned int lineNum;
+	long long liveBytes;
+	long long liveAllocations;
+	unsigned long long totalAllocations;
+	unsigned long long totalBytes;
+};
+
+class AllocSiteTable
+{
+private:
+	AllocSiteStats *sites;
+	unsigned int siteCount;
+	unsigned int siteCapacity;
+	//Hash table of indexes in to sites, empty slots are ~0
+	unsigned int *siteTable;
+	unsigned int siteTableSize;
+
+	//Returns the site an allocation was made from, adding it if it's new
+	AllocSiteStats &findSite(const AllocData& allocData);
+	void growTable();
+
+	AllocSiteTable(const AllocSiteTable& allocSiteTable) = delete;
+	AllocSiteTable& operator =(const AllocSiteTable& allocSiteTable) = delete;
+
+public:
+	AllocSiteTable();
+	~AllocSiteTable();
+
+	//Records an allocation. Allocations whose free was merged first are counted in the totals without being live.
+	void recordAlloc(const AllocData& allocData, bool live);
+	void recordFree(const AllocData& allocData);
+
+	unsigned int size() const;
+	//Copies the statistics of up to count sites in to stats, returning the number copied
+	unsigned int copy(AllocSiteStats *stats, unsigned int count) const;
+};
+
+#endif
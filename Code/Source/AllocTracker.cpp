@@ -0,0 +1,421 @@
+// Name:
+// AllocTracker.cpp
+// Description:
+// Implementation file for AllocTracker class
+// Notes:
+// OS-Unaware
+
+#include "AllocTracker.h"
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <sstream>
+using namespace std;
+
+#include "HeapDump.h"
+
+//Events a thread can record before it has to merge them
+const unsigned int allocLogSize = 256;
+//Changes to the site statistics a merge collects before applying them
+const unsigned int siteEventBatch = 64;
+
+//A change to the site statistics made by merging an event
+struct SiteEvent
+{
+	AllocData data;
+	//Allocations whose free was merged first are added to the totals without being live
+	enum Kind { LiveAlloc, FreedAlloc, Free } kind;
+};
+
+//Allocations and frees recorded by one thread that haven't been merged in to the maps.
+//Only the owning thread moves tail, and only a thread holding the tracker's logsMutex moves head, so recording an event doesn't take a lock.
+struct ThreadAllocLog
+{
+	AllocData events[allocLogSize];
+	//Number of each event in the order every thread's events were recorded
+	unsigned long long sequences[allocLogSize];
+	//Next event to merge
+	atomic<unsigned int> head;
+	//Next event to record
+	atomic<unsigned int> tail;
+	ThreadAllocLog *next;
+};
+
+//The calling thread's log, created with it's first allocation
+static thread_local ThreadAllocLog *threadLog = nullptr;
+//Set once the thread's log has been retired, anything the thread allocates afterwards is merged straight away
+static thread_local bool threadLogRetired = false;
+static thread_local bool trackingPaused = false;
+
+//Retires the thread's log when the thread exits
+struct ThreadLogRetirer
+{
+	~ThreadLogRetirer()
+	{
+		if (threadLog != nullptr)
+			getAllocTracker().retireLog();
+	}
+};
+static thread_local ThreadLogRetirer threadLogRetirer;
+
+AllocTracker::AllocTracker() : nextSequence(0), logs(nullptr) {}
+
+AllocMap &AllocTracker::getShard(void* ptr)
+{
+	//Allocations are aligned, so the low bits are skipped
+	size_t bits = reinterpret_cast<size_t>(ptr);
+	return shards[((bits >> 4) ^ (bits >> 12)) % allocShards];
+}
+
+ThreadAllocLog *AllocTracker::createLog()
+{
+	ThreadAllocLog *log = new (malloc(sizeof(ThreadAllocLog))) ThreadAllocLog();
+	log->head = 0;
+	log->tail = 0;
+
+	//Make sure the log is retired when the thread exits
+	(void)&threadLogRetirer;
+
+	lock_guard<mutex> logsLock(logsMutex);
+	log->next = logs;
+	logs = log;
+	return log;
+}
+
+void AllocTracker::retireLog()
+{
+	ThreadAllocLog *log = threadLog;
+	threadLog = nullptr;
+	threadLogRetired = true;
+
+	{
+		//Every event the thread recorded was numbered before the merge starts, so the log is left empty
+		lock_guard<mutex> logsLock(logsMutex);
+		mergeLogs();
+		for (ThreadAllocLog **it = &logs; *it != nullptr; it = &(*it)->next)
+		{
+			if (*it == log)
+			{
+				*it = log->next;
+				break;
+			}
+		}
+	}
+
+	log->~ThreadAllocLog();
+	free(log);
+}
+
+void AllocTracker::apply(const AllocData& event, SiteEvent *siteEvents, unsigned int &siteEventCount)
+{
+	AllocData previous;
+	if (event.sourceFile != nullptr)
+	{
+		int count = getShard(event.ptr).map(event, &previous);
+		//An allocation merged over one that's still live replaces it in the map, so it replaces it in the statistics as well
+		if (count > 0)
+			siteEvents[siteEventCount++] = SiteEvent{ previous, SiteEvent::Free };
+		siteEvents[siteEventCount++] = SiteEvent{ event, count < 0 ? SiteEvent::FreedAlloc : SiteEvent::LiveAlloc };
+	}
+	else
+	{
+		//Only the free that leaves the pointer unallocated removes it's allocation from the statistics
+		if (getShard(event.ptr).erase(event.ptr, &previous) == 1)
+			siteEvents[siteEventCount++] = SiteEvent{ previous, SiteEvent::Free };
+	}
+}
+
+void AllocTracker::applySiteEvents(const SiteEvent *siteEvents, unsigned int siteEventCount)
+{
+	for (unsigned int I = 0; I < siteEventCount; I++)
+	{
+		if (siteEvents[I].kind == SiteEvent::Free)
+			sites.recordFree(siteEvents[I].data);
+		else
+			sites.recordAlloc(siteEvents[I].data, siteEvents[I].kind == SiteEvent::LiveAlloc);
+	}
+}
+
+void AllocTracker::mergeLogs()
+{
+	//Only events numbered before the limit are merged. An event recorded before one of them on the same pointer, such as the free before a block is allocated again on another thread, was already in it's log when the limit was read.
+	//Events numbered before the limit that weren't in their logs yet are merged later, after some newer events, but none of those can be on the same pointer.
+	unsigned long long limit = nextSequence.load(memory_order_acquire);
+
+	//The site statistics are shared by every thread, so their changes are collected and applied a batch at a time
+	SiteEvent siteEvents[siteEventBatch];
+	unsigned int siteEventCount = 0;
+
+	while (true)
+	{
+		//Find the log with the oldest event, and the oldest event of any other log, which it's merged up to
+		ThreadAllocLog *oldest = nullptr;
+		unsigned long long oldestSequence = limit;
+		unsigned long long mergeEnd = limit;
+		for (ThreadAllocLog *log = logs; log != nullptr; log = log->next)
+		{
+			unsigned int head = log->head.load(memory_order_relaxed);
+			if (head == log->tail.load(memory_order_acquire))
+				continue;
+			unsigned long long sequence = log->sequences[head % allocLogSize];
+			if (sequence < oldestSequence)
+			{
+				mergeEnd = oldestSequence;
+				oldest = log;
+				oldestSequence = sequence;
+			}
+			else if (sequence < mergeEnd)
+				mergeEnd = sequence;
+		}
+		if (oldest == nullptr)
+			break;
+
+		unsigned int head = oldest->head.load(memory_order_relaxed);
+		unsigned int tail = oldest->tail.load(memory_order_acquire);
+		for (; head != tail && oldest->sequences[head % allocLogSize] < mergeEnd; head++)
+		{
+			apply(oldest->events[head % allocLogSize], siteEvents, siteEventCount);
+			//Each event makes at most two changes
+			if (siteEventCount > siteEventBatch - 2)
+			{
+				lock_guard<mutex> sitesLock(sitesMutex);
+				applySiteEvents(siteEvents, siteEventCount);
+				siteEventCount = 0;
+			}
+		}
+		oldest->head.store(head, memory_order_release);
+	}
+	if (siteEventCount > 0)
+	{
+		lock_guard<mutex> sitesLock(sitesMutex);
+		applySiteEvents(siteEvents, siteEventCount);
+	}
+}
+
+void AllocTracker::record(const AllocData& event)
+{
+	if (trackingPaused)
+		return;
+	if (threadLog == nullptr)
+	{
+		if (threadLogRetired)
+		{
+			//Merge everything recorded before the event, so it's still applied in order
+			lock_guard<mutex> logsLock(logsMutex);
+			mergeLogs();
+			SiteEvent siteEvents[2];
+			unsigned int siteEventCount = 0;
+			apply(event, siteEvents, siteEventCount);
+			lock_guard<mutex> sitesLock(sitesMutex);
+			applySiteEvents(siteEvents, siteEventCount);
+			return;
+		}
+		threadLog = createLog();
+	}
+
+	//Merge the logs if this one's full, which empties it, otherwise nothing else touches the end of the log
+	ThreadAllocLog &log = *threadLog;
+	unsigned int tail = log.tail.load(memory_order_relaxed);
+	if (tail - log.head.load(memory_order_acquire) == allocLogSize)
+		mergeAll();
+	log.events[tail % allocLogSize] = event;
+	//A block is only allocated again after it's free is recorded, so it's allocation is numbered after the free
+	log.sequences[tail % allocLogSize] = nextSequence.fetch_add(1, memory_order_acq_rel);
+	log.tail.store(tail + 1, memory_order_release);
+}
+
+void AllocTracker::recordAlloc(const AllocData& allocData)
+{
+	//Failed allocations have nothing to track
+	if (allocData.ptr != nullptr)
+		record(allocData);
+}
+
+void AllocTracker::recordFree(void* ptr)
+{
+	//Deleting nullptr does nothing
+	if (ptr != nullptr)
+		record(AllocData{ ptr, nullptr, nullptr, 0, 0 });
+}
+
+void AllocTracker::mergeAll()
+{
+	lock_guard<mutex> logsLock(logsMutex);
+	mergeLogs();
+}
+
+string AllocTracker::getAllocData()
+{
+	mergeAll();
+	string result;
+	for (unsigned int I = 0; I < allocShards; I++)
+		result += shards[I].getAllocData();
+	return result;
+}
+
+vector<AllocSiteStats> AllocTracker::getSiteStats()
+{
+	mergeAll();
+	//Copy the statistics with malloc, allocating through new while sitesMutex is locked could merge this thread's log and lock it again
+	AllocSiteStats *copy;
+	unsigned int count;
+	{
+		lock_guard<mutex> sitesLock(sitesMutex);
+		count = sites.size();
+		copy = reinterpret_cast<AllocSiteStats*>(malloc(sizeof(AllocSiteStats) * (count + 1)));
+		count = sites.copy(copy, count);
+	}
+	vector<AllocSiteStats> result(copy, copy + count);
+	free(copy);
+	return result;
+}
+
+bool AllocTracker::dumpHeap(const string &fileName)
+{
+	mergeAll();
+
+	HeapDumpWriter writer;
+	if (!writer.open(fileName))
+		return false;
+
+	//Each map is copied whole while it's locked, so it can't change part way through, and the file is written with no locks held
+	for (unsigned int I = 0; I < allocShards; I++)
+	{
+		AllocData *allocations;
+		unsigned long count;
+		if (!shards[I].copyAllocations(allocations, count))
+		{
+			//Leave the End record off, so the dump reads as cut short
+			writer.abandon();
+			return false;
+		}
+		for (unsigned long J = 0; J < count; J++)
+			writer.writeAllocation(allocations[J]);
+		free(allocations);
+	}
+
+	return writer.close();
+}
+
+void AllocTracker::takeSnapshot(const string &name)
+{
+	vector<AllocSiteStats> stats = getSiteStats();
+
+	lock_guard<mutex> snapshotsLock(snapshotsMutex);
+	//Snapshots outlive the call that stores them, so they're allocated and freed without being tracked and never show up in the statistics
+	bool wasPaused = trackingPaused;
+	trackingPaused = true;
+	{
+		vector<AllocSnapshot>::iterator snapshot = snapshots.begin();
+		while (snapshot != snapshots.end() && snapshot->name != name)
+			snapshot++;
+		if (snapshot == snapshots.end())
+		{
+			snapshots.push_back(AllocSnapshot());
+			snapshot = snapshots.end() - 1;
+			snapshot->name = name;
+		}
+		snapshot->stats = stats;
+	}
+	trackingPaused = wasPaused;
+}
+
+//Orders sites by where they are, so two snapshots can be walked side by side
+static bool siteBefore(const AllocSiteStats &first, const AllocSiteStats &second)
+{
+	if (first.sourceFile != second.sourceFile)
+		return less<const char*>()(first.sourceFile, second.sourceFile);
+	if (first.funcName != second.funcName)
+		return less<const char*>()(first.funcName, second.funcName);
+	return first.lineNum < second.lineNum;
+}
+
+vector<AllocSiteDelta> AllocTracker::diffSnapshots(const string &from, const string &to)
+{
+	vector<AllocSiteStats> fromStats;
+	vector<AllocSiteStats> toStats;
+	{
+		lock_guard<mutex> snapshotsLock(snapshotsMutex);
+		for (vector<AllocSnapshot>::iterator snapshot = snapshots.begin(); snapshot != snapshots.end(); snapshot++)
+		{
+			if (snapshot->name == from)
+				fromStats = snapshot->stats;
+			if (snapshot->name == to)
+				toStats = snapshot->stats;
+		}
+	}
+	sort(fromStats.begin(), fromStats.end(), siteBefore);
+	sort(toStats.begin(), toStats.end(), siteBefore);
+
+	//Walk both snapshots together, a site missing from one of them had nothing allocated when it was taken
+	AllocSiteStats none = {};
+	vector<AllocSiteDelta> result;
+	vector<AllocSiteStats>::iterator fromSite = fromStats.begin();
+	vector<AllocSiteStats>::iterator toSite = toStats.begin();
+	while (fromSite != fromStats.end() || toSite != toStats.end())
+	{
+		const AllocSiteStats *before = &none;
+		const AllocSiteStats *after = &none;
+		if (toSite == toStats.end() || (fromSite != fromStats.end() && siteBefore(*fromSite, *toSite)))
+			before = &*fromSite++;
+		else if (fromSite == fromStats.end() || siteBefore(*toSite, *fromSite))
+			after = &*toSite++;
+		else
+		{
+			before = &*fromSite++;
+			after = &*toSite++;
+		}
+		const AllocSiteStats &site = after != &none ? *after : *before;
+
+		AllocSiteDelta delta;
+		delta.sourceFile = site.sourceFile;
+		delta.funcName = site.funcName;
+		delta.lineNum = site.lineNum;
+		delta.liveBytes = static_cast<long long>(after->liveBytes - before->liveBytes);
+		delta.liveAllocations = static_cast<long long>(after->liveAllocations - before->liveAllocations);
+		delta.totalAllocations = after->totalAllocations - before->totalAllocations;
+		delta.totalBytes = after->totalBytes - before->totalBytes;
+		if (delta.liveBytes != 0 || delta.liveAllocations != 0 || delta.totalAllocations != 0)
+			result.push_back(delta);
+	}
+
+	sort(result.begin(), result.end(), [](const AllocSiteDelta &first, const AllocSiteDelta &second) { return first.liveBytes > second.liveBytes; });
+	return result;
+}
+
+string AllocTracker::getSnapshotDiff(const string &from, const string &to)
+{
+	vector<AllocSiteDelta> deltas = diffSnapshots(from, to);
+	stringstream result;
+	for (vector<AllocSiteDelta>::iterator delta = deltas.begin(); delta != deltas.end(); delta++)
+	{
+		result << "{sourceFile: " << delta->sourceFile << ", funcName: " << delta->funcName << ", lineNum: " << delta->lineNum;
+		result << ", liveBytes: " << showpos << delta->liveBytes << ", liveAllocations: " << delta->liveAllocations << noshowpos;
+		result << ", allocations: " << delta->totalAllocations << ", bytes: " << delta->totalBytes << "}" << endl;
+	}
+	return result.str();
+}
+
+void AllocTracker::setPaused(bool paused)
+{
+	trackingPaused = paused;
+}
+
+bool AllocTracker::isPaused() const
+{
+	return trackingPaused;
+}
+
+AllocTracker &getAllocTracker()
+{
+	static aligned_storage<sizeof(AllocTracker), alignof(AllocTracker)>::type trackerStorage;
+	static AllocTracker *tracker = new (&trackerStorage) AllocTracker();
+	return *tracker;
+}
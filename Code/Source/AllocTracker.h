@@ -0,0 +1,105 @@
+// Name:
+// AllocTracker.h
+// Description:
+// Header file for AllocTracker class
+// AllocTracker keeps track of every allocation made through the tracked new and delete operators (see CustomMemory.h) without a lock shared by every thread.
+// Each thread records it's allocations and frees in a log of it's own, which only the thread writes to. When the log fills, the thread merges every thread's log in to the tracker's maps.
+// Events are numbered as they're recorded and merged in that order, so a block freed on one thread and allocated again on another is charged to it's newest allocation whichever thread merges first.
+// Merges are made one at a time. The pointers are spread across several AllocMaps, each with it's own lock, so reports and dumps only hold part of them at once.
+// Reports merge every thread's log first, and the logs are merged when a thread exits.
+// As events are merged the tracker also keeps statistics for each location allocations are made from (see AllocSiteTable.h). Peaks are the highest seen by merges, so short lived peaks between merges can be missed.
+// Every live allocation can be streamed to a binary heap dump, however many there are.
+// Snapshots of the statistics can be taken by name and diffed, to see what a stretch of the game, such as loading and unloading a level, left behind.
+// Like AllocMap, the tracker doesn't use the c++ new/delete functions itself.
+// Notes:
+// OS-Unaware
+
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <vector>
+using namespace std;
+
+#include "AllocMap.h"
+#include "AllocSiteTable.h"
+
+//Number of AllocMaps the pointers are spread across
+const unsigned int allocShards = 16;
+
+struct ThreadAllocLog;
+struct SiteEvent;
+
+class AllocTracker
+{
+private:
+	AllocMap shards[allocShards];
+	//Number given to the next event recorded
+	atomic<unsigned long long> nextSequence;
+	//Logs of every thread that has recorded an allocation and not yet exited, locked while they're merged
+	mutex logsMutex;
+	ThreadAllocLog *logs;
+	mutex sitesMutex;
+	AllocSiteTable sites;
+
+	//Statistics of every site when a snapshot was taken. Snapshots are only allocated and freed with tracking paused.
+	struct AllocSnapshot
+	{
+		string name;
+		vector<AllocSiteStats> stats;
+	};
+	mutex snapshotsMutex;
+	vector<AllocSnapshot> snapshots;
+
+	AllocMap &getShard(void* ptr);
+	//Records an event in the calling thread's log. Frees have no sourceFile.
+	void record(const AllocData& event);
+	//Applies an event to the maps, adding the changes it makes to the site statistics to siteEvents
+	void apply(const AllocData& event, SiteEvent *siteEvents, unsigned int &siteEventCount);
+	//Applies changes to the site statistics. Call with sitesMutex locked.
+	void applySiteEvents(const SiteEvent *siteEvents, unsigned int siteEventCount);
+	//Merges every log's events in to the maps in the order they were recorded. Call with logsMutex locked.
+	void mergeLogs();
+	//Creates a log for the calling thread
+	ThreadAllocLog *createLog();
+	//Merges the calling thread's log and destroys it, called when the thread exits
+	void retireLog();
+
+	AllocTracker(const AllocTracker& allocTracker) = delete;
+	AllocTracker& operator =(const AllocTracker& allocTracker) = delete;
+
+	friend struct ThreadLogRetirer;
+
+public:
+	AllocTracker();
+
+	void recordAlloc(const AllocData& allocData);
+	void recordFree(void* ptr);
+	//Merges every thread's log, so the maps hold every allocation made so far
+	void mergeAll();
+	//Returns a line for every allocation that hasn't been freed
+	string getAllocData();
+	//Returns the statistics of every location allocations have been made from
+	vector<AllocSiteStats> getSiteStats();
+	//Writes every allocation that hasn't been freed to a heap dump file (see HeapDump.h), copying one map at a time so only that map is locked, and only while it's copied.
+	//Allocations made and freed while the dump is written may or may not be in it, but each one in a map when it's copied is written once. Returns false if the file couldn't be written.
+	bool dumpHeap(const string &fileName);
+
+	//Stores the statistics of every site under name, replacing any snapshot already stored under it
+	void takeSnapshot(const string &name);
+	//Returns the change in every site that changed between two snapshots, the sites that grew the most first. A name without a snapshot diffs as if nothing had been allocated.
+	vector<AllocSiteDelta> diffSnapshots(const string &from, const string &to);
+	//Returns a line for every site that changed between two snapshots
+	string getSnapshotDiff(const string &from, const string &to);
+
+	//Stops tracking allocations made and freed on the calling thread, used while the tracker allocates memory for it's reports
+	void setPaused(bool paused);
+	bool isPaused() const;
+};
+
+//Returns the tracker, which is created on first use and never destroyed so allocations made while globals are constructed and destroyed are still tracked
+AllocTracker &getAllocTracker();
+
+#endif
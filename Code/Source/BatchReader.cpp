@@ -0,0 +1,303 @@
+// Name:
+// BatchReader.cpp
+// Description:
+// Implementation file for BatchReader class, and the pread and io_uring backends
+// Notes:
+// OS-Aware
+// POSIX only, compiles to nothing on Windows.
+
+#ifndef _WIN32
+
+#include "BatchReader.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef NF_USE_IO_URING
+#include <liburing.h>
+#endif
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <functional>
+using namespace std;
+
+//Included after the standard headers, libstdc++ can't be compiled with it's new macro defined
+#include "CustomMemory.h"
+
+const unsigned int BatchReader::stagingBufferSize;
+
+//Reads the whole range, retrying short reads. Returns the number of bytes read or -errno.
+static long long preadFully(int fd, char *buffer, unsigned long long length, unsigned long long offset)
+{
+	unsigned long long bytesRead = 0;
+	while (bytesRead < length)
+	{
+		ssize_t result = pread(fd, buffer + bytesRead, min(length - bytesRead, 1ULL << 30), offset + bytesRead);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result < 0)
+			return -errno;
+		//End of file
+		if (result == 0)
+			break;
+		bytesRead += result;
+	}
+	return bytesRead;
+}
+
+//Reads one range at a time with pread
+class PreadBatchReader : public BatchReader
+{
+private:
+	//Reads the kernel is asked to start ahead of the one being read, including it
+	unsigned int queueDepth;
+	vector<char> stagingBuffer;
+	vector<char> largeBuffer;
+public:
+	PreadBatchReader(unsigned int queueDepth) : queueDepth(queueDepth), stagingBuffer(stagingBufferSize) {}
+
+	virtual void read(BatchRead *reads, unsigned int count, const function<void(BatchRead&)> &onComplete)
+	{
+		lock_guard<recursive_mutex> objectLock(objectMutex);
+
+		//pread only reads one range at a time, so keep the rest of the queue in flight with read ahead hints
+		unsigned int hinted = queueDepth > 1 ? 0 : count;
+		for (unsigned int I = 0; I < count; I++)
+		{
+			for (; hinted < count && hinted < I + queueDepth; hinted++)
+				posix_fadvise(reads[hinted].fd, static_cast<off_t>(reads[hinted].offset), static_cast<off_t>(reads[hinted].length), POSIX_FADV_WILLNEED);
+
+			BatchRead &read = reads[I];
+			//Staged reads go in to our own buffer, or a temporary one if they're too big for it
+			bool staged = read.buffer == nullptr;
+			if (staged)
+			{
+				if (read.length > stagingBufferSize)
+				{
+					largeBuffer.resize(read.length);
+					read.buffer = &largeBuffer[0];
+				}
+				else
+					read.buffer = &stagingBuffer[0];
+			}
+			read.result = preadFully(read.fd, read.buffer, read.length, read.offset);
+			onComplete(read);
+			if (staged)
+				read.buffer = nullptr;
+		}
+		//Don't hang on to big temporary buffers
+		vector<char>().swap(largeBuffer);
+	}
+
+	virtual const char* getName() const
+	{
+		return queueDepth > 1 ? "pread (read ahead hints)" : "pread";
+	}
+};
+
+#ifdef NF_USE_IO_URING
+//Keeps up to queueDepth reads in flight through io_uring
+class IoUringBatchReader : public BatchReader
+{
+private:
+	io_uring ring;
+	unsigned int queueDepth;
+	//One staging buffer per queue entry, registered with the kernel so staged reads don't need to map pages on every read
+	vector<char> stagingBuffers;
+	vector<unsigned int> freeStagingBuffers;
+	bool buffersRegistered;
+
+	IoUringBatchReader(unsigned int queueDepth) : queueDepth(queueDepth), stagingBuffers(static_cast<size_t>(queueDepth) * stagingBufferSize), buffersRegistered(false)
+	{
+		for (unsigned int I = 0; I < queueDepth; I++)
+			freeStagingBuffers.push_back(I);
+	}
+
+	//State of a read that's in flight
+	struct PendingRead
+	{
+		char *buffer;
+		unsigned long long bytesRead;
+		int stagingBuffer;
+		vector<char> largeBuffer;
+	};
+
+	//Queues the remainder of a read. Returns false if the submission queue is full.
+	bool queueRead(BatchRead &read, PendingRead &pending, unsigned int index)
+	{
+		io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+		if (sqe == nullptr)
+			return false;
+		unsigned int length = static_cast<unsigned int>(min(read.length - pending.bytesRead, 1ULL << 30));
+		if (pending.stagingBuffer >= 0 && buffersRegistered)
+			io_uring_prep_read_fixed(sqe, read.fd, pending.buffer + pending.bytesRead, length, read.offset + pending.bytesRead, pending.stagingBuffer);
+		else
+			io_uring_prep_read(sqe, read.fd, pending.buffer + pending.bytesRead, length, read.offset + pending.bytesRead);
+		io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<uintptr_t>(index)));
+		return true;
+	}
+
+public:
+	//Returns nullptr if io_uring can't be used, ie the kernel is too old or io_uring is disabled
+	static IoUringBatchReader* create(unsigned int queueDepth)
+	{
+		IoUringBatchReader *reader = new IoUringBatchReader(queueDepth);
+		if (io_uring_queue_init(queueDepth, &reader->ring, 0) < 0)
+		{
+			delete reader;
+			return nullptr;
+		}
+		//Registered buffers are an optimization, plain reads in to the staging buffers still work without them
+		vector<iovec> buffers(queueDepth);
+		for (unsigned int I = 0; I < queueDepth; I++)
+		{
+			buffers[I].iov_base = &reader->stagingBuffers[static_cast<size_t>(I) * stagingBufferSize];
+			buffers[I].iov_len = stagingBufferSize;
+		}
+		reader->buffersRegistered = io_uring_register_buffers(&reader->ring, &buffers[0], queueDepth) == 0;
+		return reader;
+	}
+
+	virtual ~IoUringBatchReader()
+	{
+		io_uring_queue_exit(&ring);
+	}
+
+	virtual void read(BatchRead *reads, unsigned int count, const function<void(BatchRead&)> &onComplete)
+	{
+		lock_guard<recursive_mutex> objectLock(objectMutex);
+
+		vector<PendingRead> pending(count);
+		unsigned int nextRead = 0;
+		unsigned int inFlight = 0;
+		unsigned int completed = 0;
+
+		//Finishes a read, handing it to the caller and releasing it's staging buffer
+		auto complete = [&](unsigned int index, long long result)
+		{
+			BatchRead &read = reads[index];
+			bool staged = read.buffer == nullptr;
+			read.result = result;
+			if (staged)
+				read.buffer = pending[index].buffer;
+			onComplete(read);
+			if (staged)
+				read.buffer = nullptr;
+			if (pending[index].stagingBuffer >= 0)
+				freeStagingBuffers.push_back(pending[index].stagingBuffer);
+			vector<char>().swap(pending[index].largeBuffer);
+			completed++;
+		};
+
+		while (completed < count)
+		{
+			//Fill the queue with new reads
+			while (nextRead < count && inFlight < queueDepth)
+			{
+				BatchRead &read = reads[nextRead];
+				PendingRead &state = pending[nextRead];
+				state.bytesRead = 0;
+				state.stagingBuffer = -1;
+				state.buffer = read.buffer;
+				//Pick a buffer for staged reads
+				if (state.buffer == nullptr)
+				{
+					if (read.length <= stagingBufferSize && freeStagingBuffers.size() > 0)
+					{
+						state.stagingBuffer = freeStagingBuffers.back();
+						freeStagingBuffers.pop_back();
+						state.buffer = &stagingBuffers[static_cast<size_t>(state.stagingBuffer) * stagingBufferSize];
+					}
+					else
+					{
+						state.largeBuffer.resize(read.length > 0 ? read.length : 1);
+						state.buffer = &state.largeBuffer[0];
+					}
+				}
+				//Nothing to read
+				if (read.length == 0)
+				{
+					complete(nextRead++, 0);
+					continue;
+				}
+				if (!queueRead(read, state, nextRead))
+				{
+					//Submission queue is full, put the staging buffer back and try again once something's finished
+					if (state.stagingBuffer >= 0)
+						freeStagingBuffers.push_back(state.stagingBuffer);
+					vector<char>().swap(state.largeBuffer);
+					break;
+				}
+				inFlight++;
+				nextRead++;
+			}
+			if (inFlight == 0)
+				continue;
+
+			//Submit everything that's been queued and wait for at least one read to finish
+			io_uring_submit_and_wait(&ring, 1);
+
+			//Handle every read that's finished
+			io_uring_cqe *cqe;
+			while (io_uring_peek_cqe(&ring, &cqe) == 0)
+			{
+				unsigned int index = static_cast<unsigned int>(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+				int result = cqe->res;
+				io_uring_cqe_seen(&ring, cqe);
+
+				BatchRead &read = reads[index];
+				PendingRead &state = pending[index];
+				//Interrupted, try again
+				if (result == -EINTR || result == -EAGAIN)
+				{
+					queueRead(read, state, index);
+				}
+				//Failed
+				else if (result < 0)
+				{
+					inFlight--;
+					complete(index, result);
+				}
+				else
+				{
+					state.bytesRead += result;
+					//Short read, queue the rest. A read of 0 bytes is the end of the file.
+					if (result > 0 && state.bytesRead < read.length)
+						queueRead(read, state, index);
+					else
+					{
+						inFlight--;
+						complete(index, state.bytesRead);
+					}
+				}
+			}
+		}
+	}
+
+	virtual const char* getName() const
+	{
+		return buffersRegistered ? "io_uring (registered buffers)" : "io_uring";
+	}
+};
+#endif
+
+BatchReader* BatchReader::create(unsigned int queueDepth)
+{
+#ifdef NF_USE_IO_URING
+	//Fall back to pread if io_uring isn't available
+	BatchReader *reader = IoUringBatchReader::create(queueDepth);
+	if (reader != nullptr)
+		return reader;
+#endif
+	return new PreadBatchReader(queueDepth);
+}
+
+BatchReader* BatchReader::createPread()
+{
+	return new PreadBatchReader(1);
+}
+
+#endif
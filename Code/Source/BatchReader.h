@@ -0,0 +1,63 @@
+// Name:
+// BatchReader.h
+// Description:
+// Header file for BatchReader class
+// A BatchReader reads many ranges of files at once and reports each read as it completes.
+// With NF_USE_IO_URING defined, reads are submitted to the kernel in batches through io_uring, otherwise (or if io_uring isn't available) they're read one at a time with pread.
+// Staged reads are read in to buffers owned by the BatchReader, registered with the kernel when using io_uring. During the completion callback buffer points at the staged data, which is only valid until the callback returns.
+// Notes:
+// OS-Aware
+// POSIX only, file does not pollute with OS-Headers.
+
+#ifndef BATCH_READER_H
+#define BATCH_READER_H
+
+#include <functional>
+using namespace std;
+
+#include "Lockable.h"
+
+//A single read within a batch
+struct BatchRead
+{
+	//File and range to read
+	int fd;
+	unsigned long long offset;
+	unsigned long long length;
+	//Buffer to read in to. Leave null to stage the read in one of the BatchReader's buffers.
+	char *buffer;
+	//Identifies the read to the caller, not used by the BatchReader.
+	unsigned int tag;
+	//Filled in on completion, the number of bytes read or -errno on failure.
+	long long result;
+};
+
+class BatchReader : public Lockable
+{
+private:
+	BatchReader(const BatchReader& batchReader) = delete;
+	BatchReader& operator =(const BatchReader& batchReader) = delete;
+
+protected:
+	BatchReader() {}
+
+public:
+	//Largest read that can be staged in one of the BatchReader's buffers. Bigger staged reads use a temporary buffer.
+	static const unsigned int stagingBufferSize = 256 * 1024;
+
+	//Creates the best BatchReader available, keeping up to queueDepth reads in flight.
+	//Without io_uring the reads are made with pread, and the kernel is asked to read ahead up to queueDepth of them.
+	static BatchReader* create(unsigned int queueDepth);
+	//Creates a BatchReader that always uses pread, one read at a time without read ahead hints.
+	static BatchReader* createPread();
+
+	virtual ~BatchReader() {}
+
+	//Reads every read in reads, calling onComplete for each one as it finishes. Reads may complete in any order.
+	//Returns once all of the reads have completed.
+	virtual void read(BatchRead *reads, unsigned int count, const function<void(BatchRead&)> &onComplete) = 0;
+	//Name of the I/O backend, used for logging
+	virtual const char* getName() const = 0;
+};
+
+#endif
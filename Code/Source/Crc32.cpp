@@ -0,0 +1,221 @@
+// Name:
+// Crc32.cpp
+// Description:
+// Implementation file for the CRC32 functions
+// Notes:
+// OS-Unaware
+// Uses compiler intrinsics for the processor check and the carry-less multiplies.
+
+#include "CustomMemory.h"
+
+#include "Crc32.h"
+
+#include <cstring>
+#include <cstddef>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CRC32_PCLMUL
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+//MSVC allows intrinsics in any function
+#define CRC32_TARGET_PCLMUL
+#else
+#include <cpuid.h>
+//GCC and clang need to be told the function uses PCLMULQDQ
+#define CRC32_TARGET_PCLMUL __attribute__((target("pclmul,sse2")))
+#endif
+#endif
+
+//Reflected polynomial used by zip and zlib
+const unsigned int crc32Polynomial = 0xEDB88320;
+
+//Tables for slicing-by-8. table[0] is the usual byte at a time table, table[k] advances a byte through k more zero bytes.
+struct Crc32Tables
+{
+	unsigned int table[8][256];
+
+	Crc32Tables()
+	{
+		for (unsigned int I = 0; I < 256; I++)
+		{
+			unsigned int crc = I;
+			for (unsigned int J = 0; J < 8; J++)
+				crc = (crc >> 1) ^ (crc & 1 ? crc32Polynomial : 0);
+			table[0][I] = crc;
+		}
+		for (unsigned int I = 0; I < 256; I++)
+			for (unsigned int J = 1; J < 8; J++)
+				table[J][I] = (table[J - 1][I] >> 8) ^ table[0][table[J - 1][I] & 0xFF];
+	}
+};
+
+static const Crc32Tables& getTables()
+{
+	static const Crc32Tables tables;
+	return tables;
+}
+
+//Works on the inverted crc, eight bytes at a time. Assumes a little endian processor, which is all the engine runs on.
+static unsigned int scalarCrc32(unsigned int crc, const unsigned char *data, size_t length)
+{
+	const Crc32Tables &tables = getTables();
+	while (length >= 8)
+	{
+		unsigned int low, high;
+		memcpy(&low, data, 4);
+		memcpy(&high, data + 4, 4);
+		low ^= crc;
+		crc = tables.table[7][low & 0xFF] ^ tables.table[6][(low >> 8) & 0xFF] ^ tables.table[5][(low >> 16) & 0xFF] ^ tables.table[4][low >> 24] ^
+			tables.table[3][high & 0xFF] ^ tables.table[2][(high >> 8) & 0xFF] ^ tables.table[1][(high >> 16) & 0xFF] ^ tables.table[0][high >> 24];
+		data += 8;
+		length -= 8;
+	}
+	while (length > 0)
+	{
+		crc = (crc >> 8) ^ tables.table[0][(crc ^ *data) & 0xFF];
+		data++;
+		length--;
+	}
+	return crc;
+}
+
+#ifdef CRC32_PCLMUL
+//Smallest amount of data worth folding
+const size_t pclmulMinimumLength = 64;
+
+static bool hasPclmul()
+{
+	//PCLMULQDQ is bit 1 of ecx from cpuid leaf 1
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 1)) != 0;
+#else
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (ecx & (1 << 1)) != 0;
+#endif
+}
+
+//Folds the data in to the inverted crc with carry-less multiplies, from Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+//length must be at least 64 and a multiple of 16.
+CRC32_TARGET_PCLMUL static unsigned int pclmulCrc32(unsigned int crc, const unsigned char *data, size_t length)
+{
+	//Folding constants for the reflected polynomial, x^(4*128+32) mod P and friends, followed by P and the Barrett reduction constant.
+	static const long long foldBy4[2] = { 0x0154442bd4LL, 0x01c6e41596LL };
+	static const long long foldBy1[2] = { 0x01751997d0LL, 0x00ccaa009eLL };
+	static const long long fold64[2] = { 0x0163cd6124LL, 0 };
+	static const long long barrett[2] = { 0x01db710641LL, 0x01f7011641LL };
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	//Load the first 64 bytes and mix in the crc so far
+	x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+	x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+	x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32));
+	x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+	x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(foldBy4));
+	data += 64;
+	length -= 64;
+
+	//Fold 64 bytes at a time in to the four accumulators
+	while (length >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)));
+		data += 64;
+		length -= 64;
+	}
+
+	//Fold the four accumulators in to one
+	x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(foldBy1));
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	//Fold any remaining 16 byte blocks
+	while (length >= 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data))), x5);
+		data += 16;
+		length -= 16;
+	}
+
+	//Fold 128 bits down to 64
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(fold64));
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	//Barrett reduce to 32 bits
+	x0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(barrett));
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return static_cast<unsigned int>(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+}
+#endif
+
+//Picks the fastest implementation the processor supports, once
+static bool usePclmul()
+{
+#ifdef CRC32_PCLMUL
+	static const bool supported = hasPclmul();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+unsigned int updateCrc32(unsigned int crc, const void *data, size_t length)
+{
+	const unsigned char *bytes = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+#ifdef CRC32_PCLMUL
+	if (length >= pclmulMinimumLength && usePclmul())
+	{
+		size_t folded = length & ~static_cast<size_t>(15);
+		crc = pclmulCrc32(crc, bytes, folded);
+		bytes += folded;
+		length -= folded;
+	}
+#endif
+	crc = scalarCrc32(crc, bytes, length);
+	return ~crc;
+}
+
+const char* getCrc32Implementation()
+{
+	if (usePclmul())
+		return "PCLMULQDQ";
+	return "slicing-by-8";
+}
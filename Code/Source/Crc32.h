@@ -0,0 +1,22 @@
+// Name:
+// Crc32.h
+// Description:
+// Header file for the CRC32 functions
+// Calculates the CRC32 used by zip files (the same one as zlib's crc32), a piece at a time so it can be run over data as it's read.
+// On x86 processors with PCLMULQDQ the data is folded 64 bytes at a time with carry-less multiplies, everywhere else a slicing-by-8 table is used.
+// Notes:
+// OS-Unaware
+// The implementation is picked the first time a CRC is calculated.
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <cstddef>
+
+//Adds length bytes of data to crc and returns the new crc. Start with a crc of 0.
+unsigned int updateCrc32(unsigned int crc, const void *data, size_t length);
+
+//Returns the name of the implementation updateCrc32 uses, for logging
+const char* getCrc32Implementation();
+
+#endif
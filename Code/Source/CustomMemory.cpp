@@ -3,113 +3,378 @@
 #include <exception>
 #include <string>
 #include <functional>
-#include <mutex>
+#include <cstring>
+#include <vector>
+#include <new>
+#include <cstdlib>
 using namespace std;
 
-#include "AllocMap.h"
+#include "AllocTracker.h"
+#include "AllocSampler.h"
+#include "MemoryTags.h"
+#include "SpanAllocator.h"
 
-recursive_mutex memoryMutex;
+#ifdef NO_ALLOC_TRACKING
+//Without tracking the operators go straight to malloc and free, the same as the library's own operators
+static inline void* NF_allocate(size_t size)
+{
+	//new has to return a unique pointer for 0 bytes, which malloc doesn't promise
+	return malloc(size > 0 ? size : 1);
+}
+
+static inline void NF_release(void* ptr)
+{
+	free(ptr);
+}
 
-//Allocation map to keep track of where everything is allocated to/from
-AllocMap allocMap;
+static inline void NF_recordAlloc(void*, size_t, const char*, const char*, unsigned int)
+{
+}
+
+static inline void NF_recordFree(void*)
+{
+}
+#else
+//Allocates size bytes from the span allocator, charging them to the calling thread's memory tag
+static inline void* NF_allocate(size_t size)
+{
+	return getSpanAllocator().allocate(size, getCurrentMemoryTag());
+}
+
+//Frees memory from NF_allocate, taking it off the tag it was charged to
+static inline void NF_release(void* ptr)
+{
+	getSpanAllocator().release(ptr);
+}
+
+//Records an allocation made at a location
+static inline void NF_recordAlloc(void* ptr, size_t size, const char* sourceFile, const char *funcName, unsigned int lineNum)
+{
+#ifdef ALLOC_SAMPLING
+	//Most allocations only count down to the next sample
+	if (AllocSampler::countDown(size))
+		getAllocSampler().sample(ptr, size, sourceFile, funcName, lineNum);
+#else
+	//Record the allocation in this thread's log, unless tracking is paused
+	getAllocTracker().recordAlloc(AllocData{ ptr, sourceFile, funcName, lineNum, size });
+#endif
+}
+
+static inline void NF_recordFree(void* ptr)
+{
+#ifdef ALLOC_SAMPLING
+	//Only frees of pointers that might have been sampled look them up
+	if (AllocSampler::mightBeSampled(ptr))
+		getAllocSampler().recordFree(ptr);
+#else
+	//Record the free in this thread's log, unless tracking is paused
+	getAllocTracker().recordFree(ptr);
+#endif
+}
+#endif
+
+//Allocates and records size bytes, returning nullptr if there's no memory left
+static inline void* NF_new(size_t size, const char* sourceFile, const char *funcName, unsigned int lineNum)
+{
+	void* temp = NF_allocate(size);
+	if (temp != nullptr)
+		NF_recordAlloc(temp, size, sourceFile, funcName, lineNum);
+	return temp;
+}
+
+//Allocates and records size bytes, throwing bad_alloc if there's no memory left as the throwing forms of new must
+static inline void* NF_newOrThrow(size_t size, const char* sourceFile, const char *funcName, unsigned int lineNum)
+{
+	void* temp = NF_new(size, sourceFile, funcName, lineNum);
+	if (temp == nullptr)
+		throw bad_alloc();
+	return temp;
+}
+
+//Records and frees memory from new
+static inline void NF_delete(void* ptr)
+{
+	if (ptr == nullptr)
+		return;
+	NF_recordFree(ptr);
+	//Free the pointer, taking it off it's memory tag
+	NF_release(ptr);
+}
+
+#ifdef __cpp_aligned_new
+//Allocates size bytes aligned to more than malloc aligns to. The block is over allocated and the pointer to it's start is kept just before the aligned memory.
+static inline void* NF_newAligned(size_t size, size_t alignment, const char* sourceFile, const char *funcName, unsigned int lineNum)
+{
+	if (alignment <= alignof(max_align_t))
+		return NF_new(size, sourceFile, funcName, lineNum);
+
+	if (size > static_cast<size_t>(-1) - alignment - sizeof(void*))
+		return nullptr;
+	char* block = static_cast<char*>(NF_allocate(size + alignment + sizeof(void*)));
+	if (block == nullptr)
+		return nullptr;
+	char* temp = reinterpret_cast<char*>((reinterpret_cast<size_t>(block) + sizeof(void*) + alignment - 1) & ~(alignment - 1));
+	reinterpret_cast<void**>(temp)[-1] = block;
+	NF_recordAlloc(temp, size, sourceFile, funcName, lineNum);
+	return temp;
+}
 
-//Variable used to temporarily disable allocation tracking while running getAllocs();
-bool allocDisabled = false;
+static inline void NF_deleteAligned(void* ptr, size_t alignment)
+{
+	if (alignment <= alignof(max_align_t) || ptr == nullptr)
+	{
+		NF_delete(ptr);
+		return;
+	}
 
-//Forward declarations
-void NF_delete(void* ptr);
-void* operator new(unsigned int size, const char* sourceFile, const char *funcName, unsigned int lineNum);
-void* operator new[](unsigned int size, const char* sourceFile, const char *funcName, unsigned int lineNum);
+	NF_recordFree(ptr);
+	NF_release(reinterpret_cast<void**>(ptr)[-1]);
+}
+#endif
 
 string getAllocs()
 {
-	lock_guard<recursive_mutex> memoryLock(memoryMutex);
+#if defined(NO_ALLOC_TRACKING)
+	//Nothing is tracked to report
+	return string();
+#elif defined(ALLOC_SAMPLING)
+	//Sampled allocations are reported as estimates for each site, the sampler doesn't need tracking paused to build them
+	return getAllocSampler().getAllocData().substr(0, 4999);
+#else
+	AllocTracker &allocTracker = getAllocTracker();
 	//If we're running without allocation tracking, don't return anything.
-	if (allocDisabled == true)
+	if (allocTracker.isPaused())
 		return string();
 	//Allocate memory to hold results
 	char temp[5000];
-	//Disable memory allocation tracking within the block
-	allocDisabled = true;
+	//Disable memory allocation tracking on this thread within the block
+	allocTracker.setPaused(true);
 	{
-		strcpy(temp, allocMap.getAllocData().substr(0, 4999).c_str());
+		strcpy(temp, allocTracker.getAllocData().substr(0, 4999).c_str());
 	}
 	//Re-enable allocation tracking
-	allocDisabled = false;
+	allocTracker.setPaused(false);
 	//Allocate a string and return the results.
 	return string(temp);
+#endif
 }
 
-void* operator new(unsigned int size)
+bool dumpAllocs(const string &fileName)
 {
-	return operator new(size, "Unknown", "Unknown", 0);
+#if defined(NO_ALLOC_TRACKING) || defined(ALLOC_SAMPLING)
+	//Only full tracking knows every allocation
+	(void)fileName;
+	return false;
+#else
+	return getAllocTracker().dumpHeap(fileName);
+#endif
 }
 
-void* operator new[](unsigned int size)
+#ifdef ALLOC_SAMPLING
+vector<AllocSiteEstimate> getAllocSiteEstimates()
 {
-	return operator new[](size, "Unknown", "Unknown", 0);
+	return getAllocSampler().getSiteEstimates();
 }
 
-void* operator new(unsigned int size, const char* sourceFile, const char *funcName, unsigned int lineNum)
+void setAllocSampleInterval(unsigned long long bytes)
 {
-	//Allocate memory for pointer
-	void* temp = malloc(size);
-	//Unless allocation tracking is disabled, track allocated memory.
-	{
-		lock_guard<recursive_mutex> memoryLock(memoryMutex);
-		if (!allocDisabled)
-			allocMap.map(AllocData{ temp, sourceFile, funcName, lineNum });
-	}
-	//Return pointer
-	return temp;
+	getAllocSampler().setSampleInterval(bytes);
+}
+#elif defined(NO_ALLOC_TRACKING)
+//Nothing is tracked, so there are no sites or snapshots
+vector<AllocSiteStats> getAllocSiteStats()
+{
+	return vector<AllocSiteStats>();
 }
 
-void* operator new[](unsigned int size, const char* sourceFile, const char *funcName, unsigned int lineNum)
+void takeAllocSnapshot(const string &)
 {
-	//Allocate memory for pointer
-	void* temp = malloc(size);
-	//Unless allocation tracking is disabled, track allocated memory.
-	{
-		lock_guard<recursive_mutex> memoryLock(memoryMutex);
-		if (!allocDisabled)
-			allocMap.map(AllocData{ temp, sourceFile, funcName, lineNum });
-	}
-	//Return pointer
-	return temp;
 }
 
-void operator delete(void* ptr)
+vector<AllocSiteDelta> diffAllocSnapshots(const string &, const string &)
+{
+	return vector<AllocSiteDelta>();
+}
+
+string getAllocSnapshotDiff(const string &, const string &)
+{
+	return string();
+}
+#else
+vector<AllocSiteStats> getAllocSiteStats()
+{
+	return getAllocTracker().getSiteStats();
+}
+
+void takeAllocSnapshot(const string &name)
+{
+	getAllocTracker().takeSnapshot(name);
+}
+
+vector<AllocSiteDelta> diffAllocSnapshots(const string &from, const string &to)
+{
+	return getAllocTracker().diffSnapshots(from, to);
+}
+
+string getAllocSnapshotDiff(const string &from, const string &to)
+{
+	return getAllocTracker().getSnapshotDiff(from, to);
+}
+#endif
+
+//The replaceable forms, used by the library and by code that doesn't include CustomMemory.h
+void* operator new(size_t size)
+{
+	return NF_newOrThrow(size, "Unknown", "Unknown", 0);
+}
+
+void* operator new[](size_t size)
+{
+	return NF_newOrThrow(size, "Unknown", "Unknown", 0);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+	return NF_new(size, "Unknown", "Unknown", 0);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+	return NF_new(size, "Unknown", "Unknown", 0);
+}
+
+void* operator new(size_t size, const char* sourceFile, const char *funcName, unsigned int lineNum)
+{
+	return NF_newOrThrow(size, sourceFile, funcName, lineNum);
+}
+
+void* operator new[](size_t size, const char* sourceFile, const char *funcName, unsigned int lineNum)
+{
+	return NF_newOrThrow(size, sourceFile, funcName, lineNum);
+}
+
+void operator delete(void* ptr) noexcept
 {
-	//Forward to universal delete function
 	NF_delete(ptr);
 }
 
-void operator delete[](void* ptr)
+void operator delete[](void* ptr) noexcept
 {
-	//Forward to universal delete function
 	NF_delete(ptr);
 }
 
-void operator delete(void* ptr, const char* sourceFile, const char *funcName, unsigned int lineNum)
+//Sized frees don't need the size, every allocation can find it's own
+void operator delete(void* ptr, size_t) noexcept
 {
-	//Forward to universal delete function
 	NF_delete(ptr);
 }
 
-void operator delete[](void* ptr, const char* sourceFile, const char *funcName, unsigned int lineNum)
+void operator delete[](void* ptr, size_t) noexcept
 {
-	//Forward to universal delete function
 	NF_delete(ptr);
 }
 
-void NF_delete(void* ptr)
+void operator delete(void* ptr, const nothrow_t&) noexcept
 {
-	//Unless allocation tracking is disabled, remove tracked pointer
-	{
-		lock_guard<recursive_mutex> memoryLock(memoryMutex);
-		if (!allocDisabled)
-			allocMap.erase(ptr);
-	}
-	//Free the pointer
-	free(ptr);
+	NF_delete(ptr);
+}
+
+void operator delete[](void* ptr, const nothrow_t&) noexcept
+{
+	NF_delete(ptr);
+}
+
+//Only called if a constructor throws during a tracked new
+void operator delete(void* ptr, const char*, const char*, unsigned int)
+{
+	NF_delete(ptr);
+}
+
+void operator delete[](void* ptr, const char*, const char*, unsigned int)
+{
+	NF_delete(ptr);
+}
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, align_val_t alignment)
+{
+	void* temp = NF_newAligned(size, static_cast<size_t>(alignment), "Unknown", "Unknown", 0);
+	if (temp == nullptr)
+		throw bad_alloc();
+	return temp;
+}
+
+void* operator new[](size_t size, align_val_t alignment)
+{
+	void* temp = NF_newAligned(size, static_cast<size_t>(alignment), "Unknown", "Unknown", 0);
+	if (temp == nullptr)
+		throw bad_alloc();
+	return temp;
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+	return NF_newAligned(size, static_cast<size_t>(alignment), "Unknown", "Unknown", 0);
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+	return NF_newAligned(size, static_cast<size_t>(alignment), "Unknown", "Unknown", 0);
+}
+
+void operator delete(void* ptr, align_val_t alignment) noexcept
+{
+	NF_deleteAligned(ptr, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* ptr, align_val_t alignment) noexcept
+{
+	NF_deleteAligned(ptr, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr, size_t, align_val_t alignment) noexcept
+{
+	NF_deleteAligned(ptr, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* ptr, size_t, align_val_t alignment) noexcept
+{
+	NF_deleteAligned(ptr, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr, align_val_t alignment, const nothrow_t&) noexcept
+{
+	NF_deleteAligned(ptr, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* ptr, align_val_t alignment, const nothrow_t&) noexcept
+{
+	NF_deleteAligned(ptr, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, align_val_t alignment, const char* sourceFile, const char *funcName, unsigned int lineNum)
+{
+	void* temp = NF_newAligned(size, static_cast<size_t>(alignment), sourceFile, funcName, lineNum);
+	if (temp == nullptr)
+		throw bad_alloc();
+	return temp;
+}
+
+void* operator new[](size_t size, align_val_t alignment, const char* sourceFile, const char *funcName, unsigned int lineNum)
+{
+	void* temp = NF_newAligned(size, static_cast<size_t>(alignment), sourceFile, funcName, lineNum);
+	if (temp == nullptr)
+		throw bad_alloc();
+	return temp;
+}
+
+void operator delete(void* ptr, align_val_t alignment, const char*, const char*, unsigned int)
+{
+	NF_deleteAligned(ptr, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* ptr, align_val_t alignment, const char*, const char*, unsigned int)
+{
+	NF_deleteAligned(ptr, static_cast<size_t>(alignment));
 }
+#endif
@@ -2,18 +2,65 @@
 #define CUSTOM_MEMORY_H
 
 #include <string>
+#include <cstddef>
+#include <new>
+#include <vector>
 using namespace std;
 
+#include "AllocSampler.h"
+#include "AllocSiteTable.h"
+#include "MemoryTags.h"
+
+//Every allocation is tracked, unless the engine is built with ALLOC_SAMPLING or NO_ALLOC_TRACKING defined.
+//With ALLOC_SAMPLING roughly one allocation per sample interval bytes is recorded instead (see AllocSampler.h), and getAllocs reports estimates for each site.
+//Either way every allocation is also charged to the memory tag of the thread that made it (see MemoryTags.h).
+//Memory comes from the SpanAllocator (see SpanAllocator.h), which serves small allocations from per thread caches.
+//With NO_ALLOC_TRACKING nothing is recorded or charged to a tag, new isn't redirected, and the operators call malloc and free directly, so allocating costs what it would without this file.
+//getAllocs and the site and snapshot functions still exist, but report nothing.
+//Every replaceable form of new and delete is replaced, sized, nothrow, and with compilers that support it, aligned.
+
+#if defined(NO_ALLOC_TRACKING) && defined(ALLOC_SAMPLING)
+#error "NO_ALLOC_TRACKING and ALLOC_SAMPLING cannot both be defined"
+#endif
+
 //New/Delete operators that track locations of memory allocation.
-void* operator new(unsigned int size, const char* sourceFile, const char *funcName, unsigned int lineNum);
-void* operator new[](unsigned int size, const char* sourceFile, const char *funcName, unsigned int lineNum);
+void* operator new(size_t size, const char* sourceFile, const char *funcName, unsigned int lineNum);
+void* operator new[](size_t size, const char* sourceFile, const char *funcName, unsigned int lineNum);
 void operator delete(void* ptr, const char* sourceFile, const char *funcName, unsigned int lineNum);
 void operator delete[](void* ptr, const char* sourceFile, const char *funcName, unsigned int lineNum);
+#ifdef __cpp_aligned_new
+//Used by new for types aligned to more than malloc aligns to
+void* operator new(size_t size, align_val_t alignment, const char* sourceFile, const char *funcName, unsigned int lineNum);
+void* operator new[](size_t size, align_val_t alignment, const char* sourceFile, const char *funcName, unsigned int lineNum);
+void operator delete(void* ptr, align_val_t alignment, const char* sourceFile, const char *funcName, unsigned int lineNum);
+void operator delete[](void* ptr, align_val_t alignment, const char* sourceFile, const char *funcName, unsigned int lineNum);
+#endif
 
 //Function that returns a string of all memory that wasn't unallocated for logging purposes.
 string getAllocs();
+//Writes every allocation that hasn't been freed to a binary heap dump (see HeapDump.h), which HeapDumpReport turns in to reports of the sites holding the most memory.
+//Unlike getAllocs nothing is cut off, and tracking is only held up while each of the tracker's maps is copied. Returns false if the file can't be written, or the build doesn't track every allocation.
+bool dumpAllocs(const string &fileName);
+
+#ifdef ALLOC_SAMPLING
+//Returns the estimated live memory of each location and call stack allocations are made from, largest first
+vector<AllocSiteEstimate> getAllocSiteEstimates();
+//Sets the average bytes between sampled allocations
+void setAllocSampleInterval(unsigned long long bytes);
+#else
+//Returns the bytes and allocations held by each location allocations are made from, and what they've held and made over the whole run
+vector<AllocSiteStats> getAllocSiteStats();
+//Stores the statistics of every site under name, replacing any snapshot already stored under it
+void takeAllocSnapshot(const string &name);
+//Returns how every site changed between two snapshots, such as "level loaded" and "level unloaded", the sites that grew the most first
+vector<AllocSiteDelta> diffAllocSnapshots(const string &from, const string &to);
+//Returns a line for every site that changed between two snapshots for logging purposes
+string getAllocSnapshotDiff(const string &from, const string &to);
+#endif
 
+#ifndef NO_ALLOC_TRACKING
 //Redirects all usage of standard new operator to the tracking version.
 #define new new(__FILE__, __FUNCTION__, __LINE__)
+#endif
 
 #endif
@@ -0,0 +1,545 @@
+// Name:
+// DeflateDecoder.cpp
+// Description:
+// Implementation file for the deflate decoder
+// Notes:
+// OS-Unaware
+// Uses SSE2 intrinsics for match copies on x86, plain 8 byte copies elsewhere.
+
+#include "CustomMemory.h"
+
+#include "DeflateDecoder.h"
+#include "Crc32.h"
+
+#include <cstring>
+#include <cstddef>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DEFLATE_SSE2
+#include <emmintrin.h>
+#endif
+
+//Bits of lookahead used to index the primary tables. Longer codes continue in to a subtable.
+const unsigned int litLenTableBits = 11;
+const unsigned int distanceTableBits = 8;
+const unsigned int preCodeTableBits = 7;
+const unsigned int maxCodeLength = 15;
+//Worst case table sizes: every code longer than the primary table gets it's own subtable of 2^(15 - tableBits) entries
+const unsigned int litLenTableSize = (1 << litLenTableBits) + 288 * (1 << (maxCodeLength - litLenTableBits));
+const unsigned int distanceTableSize = (1 << distanceTableBits) + 32 * (1 << (maxCodeLength - distanceTableBits));
+//Most bits one length/distance pair can take: 15 bit length code, 5 extra bits, 15 bit distance code, 13 extra bits
+const unsigned int maxPairBits = 48;
+//Output that must be left after a match for it to be copied in whole 16 byte chunks, which may write past the end of the match
+const size_t copySlack = 16;
+
+//Table entries are packed as value << 16 | type << 12 | extra bits << 8 | code bits
+//For subtable entries the value is the subtable's offset and extra bits is the number of bits that index it.
+//Two literal entries hold the second literal in the top byte, and code bits is the length of both codes.
+enum EntryType
+{
+	Invalid = 0,
+	Literal = 1,
+	TwoLiterals = 2,
+	Length = 3,
+	EndOfBlock = 4,
+	Subtable = 5,
+	Distance = 6
+};
+
+static inline unsigned int makeEntry(unsigned int value, unsigned int type, unsigned int extraBits, unsigned int codeBits)
+{
+	return (value << 16) | (type << 12) | (extraBits << 8) | codeBits;
+}
+
+static inline unsigned int entryValue(unsigned int entry) { return entry >> 16; }
+static inline unsigned int entryType(unsigned int entry) { return (entry >> 12) & 0xF; }
+static inline unsigned int entryExtraBits(unsigned int entry) { return (entry >> 8) & 0xF; }
+static inline unsigned int entryCodeBits(unsigned int entry) { return entry & 0xFF; }
+
+//Base lengths and extra bits of length symbols 257 to 285
+static const unsigned short lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char lengthExtraBits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+//Base distances and extra bits of distance symbols 0 to 29
+static const unsigned short distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char distanceExtraBits[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+//Order the code length code lengths are stored in
+static const unsigned char preCodeOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+//Returns the entry a symbol decodes to in the literal/length table, not counting it's code bits
+static unsigned int litLenSymbolEntry(unsigned int symbol)
+{
+	if (symbol < 256)
+		return makeEntry(symbol, Literal, 0, 0);
+	if (symbol == 256)
+		return makeEntry(0, EndOfBlock, 0, 0);
+	if (symbol < 286)
+		return makeEntry(lengthBase[symbol - 257], Length, lengthExtraBits[symbol - 257], 0);
+	return makeEntry(0, Invalid, 0, 0);
+}
+
+static unsigned int distanceSymbolEntry(unsigned int symbol)
+{
+	if (symbol < 30)
+		return makeEntry(distanceBase[symbol], Distance, distanceExtraBits[symbol], 0);
+	return makeEntry(0, Invalid, 0, 0);
+}
+
+//Fills a decode table from code lengths. Deflate stores codes most significant bit first but reads bits from the bottom, so entries are indexed by the reversed code.
+//Returns false for codes zlib rejects: over-subscribed codes, and incomplete codes other than a lone one bit code, which isn't allowed for the code length code.
+static bool buildTable(const unsigned char *lengths, unsigned int symbolCount, unsigned int tableBits, unsigned int (*symbolEntry)(unsigned int), bool allowSingleCode, unsigned int *table)
+{
+	unsigned int lengthCounts[maxCodeLength + 1] = {};
+	for (unsigned int I = 0; I < symbolCount; I++)
+		lengthCounts[lengths[I]]++;
+	lengthCounts[0] = 0;
+
+	//Check the code isn't over-subscribed and find the first code of each length
+	unsigned int nextCode[maxCodeLength + 2] = {};
+	int available = 1;
+	unsigned int longest = 0;
+	for (unsigned int I = 1; I <= maxCodeLength; I++)
+	{
+		available = available * 2 - lengthCounts[I];
+		if (available < 0)
+			return false;
+		if (lengthCounts[I] > 0)
+			longest = I;
+		nextCode[I + 1] = (nextCode[I] + lengthCounts[I]) << 1;
+	}
+	//An empty code is fine, it just can't be used
+	if (longest > 0 && available > 0 && (!allowSingleCode || longest != 1))
+		return false;
+
+	unsigned int primarySize = 1 << tableBits;
+	for (unsigned int I = 0; I < primarySize; I++)
+		table[I] = makeEntry(0, Invalid, 0, 0);
+
+	//Subtables are sized by the longest code sharing their primary index, which needs the reversed codes first
+	unsigned int codes[288];
+	unsigned char subtableBits[1 << litLenTableBits] = {};
+	for (unsigned int I = 0; I < symbolCount; I++)
+	{
+		unsigned int length = lengths[I];
+		if (length == 0)
+			continue;
+		unsigned int code = nextCode[length]++;
+		unsigned int reversed = 0;
+		for (unsigned int J = 0; J < length; J++)
+			reversed |= ((code >> J) & 1) << (length - 1 - J);
+		codes[I] = reversed;
+		if (length > tableBits)
+		{
+			unsigned int primaryIndex = reversed & (primarySize - 1);
+			if (length - tableBits > subtableBits[primaryIndex])
+				subtableBits[primaryIndex] = length - tableBits;
+		}
+	}
+
+	unsigned int nextSubtable = primarySize;
+	for (unsigned int I = 0; I < primarySize; I++)
+	{
+		if (subtableBits[I] == 0)
+			continue;
+		unsigned int subtableSize = 1 << subtableBits[I];
+		for (unsigned int J = 0; J < subtableSize; J++)
+			table[nextSubtable + J] = makeEntry(0, Invalid, 0, 0);
+		table[I] = makeEntry(nextSubtable, Subtable, subtableBits[I], tableBits);
+		nextSubtable += subtableSize;
+	}
+
+	for (unsigned int I = 0; I < symbolCount; I++)
+	{
+		unsigned int length = lengths[I];
+		if (length == 0)
+			continue;
+		unsigned int entry = symbolEntry(I);
+		if (length <= tableBits)
+		{
+			//Every index whose low bits are this code decodes to it
+			for (unsigned int J = codes[I]; J < primarySize; J += 1 << length)
+				table[J] = entry | length;
+		}
+		else
+		{
+			unsigned int primary = table[codes[I] & (primarySize - 1)];
+			unsigned int subLength = length - tableBits;
+			unsigned int *subtable = table + entryValue(primary);
+			for (unsigned int J = codes[I] >> tableBits; J < (1u << entryExtraBits(primary)); J += 1 << subLength)
+				subtable[J] = entry | subLength;
+		}
+	}
+	return true;
+}
+
+//Merges pairs of short literal codes that fit in the primary table, so both are decoded by one lookup
+static void pairLiterals(unsigned int *table)
+{
+	const unsigned int primarySize = 1 << litLenTableBits;
+	//Entries are read from a copy, so literals already paired aren't paired again
+	unsigned int single[primarySize];
+	memcpy(single, table, sizeof(single));
+	for (unsigned int I = 0; I < primarySize; I++)
+	{
+		unsigned int first = single[I];
+		if (entryType(first) != Literal)
+			continue;
+		unsigned int firstBits = entryCodeBits(first);
+		//The bits after the first code are only known up to the end of the index
+		unsigned int second = single[I >> firstBits];
+		if (entryType(second) != Literal || entryCodeBits(second) > litLenTableBits - firstBits)
+			continue;
+		table[I] = makeEntry(entryValue(first) | entryValue(second) << 8, TwoLiterals, 0, firstBits + entryCodeBits(second));
+	}
+}
+
+struct DecodeTables
+{
+	unsigned int litLen[litLenTableSize];
+	unsigned int distance[distanceTableSize];
+};
+
+//Tables for fixed Huffman blocks, which are always the same
+static const DecodeTables* getFixedTables()
+{
+	struct FixedTables : public DecodeTables
+	{
+		FixedTables()
+		{
+			unsigned char lengths[288 + 32];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			memset(lengths + 288, 5, 32);
+			buildTable(lengths, 288, litLenTableBits, litLenSymbolEntry, true, litLen);
+			pairLiterals(litLen);
+			buildTable(lengths + 288, 32, distanceTableBits, distanceSymbolEntry, true, distance);
+		}
+	};
+	static const FixedTables tables;
+	return &tables;
+}
+
+//Reads bits from the bottom of a 64 bit buffer, refilling it eight bytes at a time
+//Past the end of the input the buffer is filled with zeros, which are counted so reading them can be caught.
+struct BitReader
+{
+	const unsigned char *in;
+	const unsigned char *inEnd;
+	unsigned long long bits;
+	unsigned int count;
+	unsigned int overrun;
+
+	//Makes sure at least 56 bits are buffered
+	inline void refill()
+	{
+		if (inEnd - in >= 8)
+		{
+			//Loading a whole word then keeping what fits avoids a loop, the bytes above count will be loaded again next time
+			unsigned long long word;
+			memcpy(&word, in, 8);
+			bits |= word << count;
+			in += (63 - count) >> 3;
+			count |= 56;
+		}
+		else
+		{
+			while (count <= 56)
+			{
+				unsigned long long byte = 0;
+				if (in < inEnd)
+					byte = *in++;
+				else
+					overrun++;
+				bits |= byte << count;
+				count += 8;
+			}
+		}
+	}
+
+	inline unsigned int peek(unsigned int bitCount) const
+	{
+		return static_cast<unsigned int>(bits & ((1ull << bitCount) - 1));
+	}
+
+	inline void consume(unsigned int bitCount)
+	{
+		bits >>= bitCount;
+		count -= bitCount;
+	}
+
+	inline unsigned int read(unsigned int bitCount)
+	{
+		if (count < bitCount)
+			refill();
+		unsigned int value = peek(bitCount);
+		consume(bitCount);
+		return value;
+	}
+
+	//True if bits were consumed from past the end of the input
+	inline bool overran() const
+	{
+		return overrun * 8 > count;
+	}
+
+	//Drops to a byte boundary and gives back the whole bytes still buffered, for stored blocks which are copied directly
+	inline bool alignToByte()
+	{
+		consume(count & 7);
+		if (overran())
+			return false;
+		in -= count / 8 - overrun;
+		bits = 0;
+		count = 0;
+		overrun = 0;
+		return true;
+	}
+};
+
+//Copies a match of length bytes from distance bytes back, where the match may overlap what it's copying
+static inline void copyMatch(unsigned char *out, unsigned int distance, unsigned int length, const unsigned char *outEnd)
+{
+	const unsigned char *source = out - distance;
+	if (static_cast<size_t>(outEnd - out) >= length + copySlack)
+	{
+		//With enough room past the match, copy whole chunks and let the last one run over. Chunks never read bytes they haven't written yet as long as the distance is at least the chunk size.
+		unsigned char *matchEnd = out + length;
+		if (distance >= 16)
+		{
+			do
+			{
+#ifdef DEFLATE_SSE2
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_loadu_si128(reinterpret_cast<const __m128i*>(source)));
+#else
+				memcpy(out, source, 8);
+				memcpy(out + 8, source + 8, 8);
+#endif
+				out += 16;
+				source += 16;
+			} while (out < matchEnd);
+			return;
+		}
+		if (distance >= 8)
+		{
+			do
+			{
+				memcpy(out, source, 8);
+				out += 8;
+				source += 8;
+			} while (out < matchEnd);
+			return;
+		}
+		if (distance == 1)
+		{
+			memset(out, *source, length);
+			return;
+		}
+	}
+	for (unsigned int I = 0; I < length; I++)
+		out[I] = source[I];
+}
+
+//Reads the code lengths of a dynamic block's header and builds it's tables
+static bool readDynamicTables(BitReader &reader, DecodeTables &tables)
+{
+	reader.refill();
+	unsigned int litLenCount = reader.read(5) + 257;
+	unsigned int distanceCount = reader.read(5) + 1;
+	unsigned int preCodeCount = reader.read(4) + 4;
+	if (litLenCount > 286 || distanceCount > 30)
+		return false;
+
+	unsigned char preCodeLengths[19] = {};
+	for (unsigned int I = 0; I < preCodeCount; I++)
+		preCodeLengths[preCodeOrder[I]] = static_cast<unsigned char>(reader.read(3));
+
+	//The code length code is short enough to never need a subtable, and it's symbols are used as they are
+	unsigned int preCodeTable[1 << preCodeTableBits];
+	if (!buildTable(preCodeLengths, 19, preCodeTableBits, [](unsigned int symbol) { return makeEntry(symbol, Literal, 0, 0); }, false, preCodeTable))
+		return false;
+
+	unsigned char lengths[288 + 32];
+	unsigned int lengthCount = litLenCount + distanceCount;
+	for (unsigned int I = 0; I < lengthCount;)
+	{
+		//A symbol and it's repeat count take at most 14 bits
+		if (reader.count < 14)
+			reader.refill();
+		unsigned int entry = preCodeTable[reader.peek(preCodeTableBits)];
+		if (entryType(entry) != Literal)
+			return false;
+		reader.consume(entryCodeBits(entry));
+		unsigned int symbol = entryValue(entry);
+		if (symbol < 16)
+		{
+			lengths[I++] = static_cast<unsigned char>(symbol);
+			continue;
+		}
+
+		unsigned char repeated = 0;
+		unsigned int repeatCount;
+		if (symbol == 16)
+		{
+			if (I == 0)
+				return false;
+			repeated = lengths[I - 1];
+			repeatCount = 3 + reader.read(2);
+		}
+		else if (symbol == 17)
+			repeatCount = 3 + reader.read(3);
+		else
+			repeatCount = 11 + reader.read(7);
+		if (repeatCount > lengthCount - I)
+			return false;
+		memset(lengths + I, repeated, repeatCount);
+		I += repeatCount;
+	}
+	if (reader.overran())
+		return false;
+
+	//Without an end of block code the block could never end
+	if (lengths[256] == 0)
+		return false;
+	if (!buildTable(lengths, litLenCount, litLenTableBits, litLenSymbolEntry, true, tables.litLen))
+		return false;
+	pairLiterals(tables.litLen);
+	return buildTable(lengths + litLenCount, distanceCount, distanceTableBits, distanceSymbolEntry, true, tables.distance);
+}
+
+static inline bool decodeHuffmanSymbols(BitReader &reader, const DecodeTables &tables, unsigned char *outStart, unsigned char *&out, unsigned char *outEnd)
+{
+	const unsigned int litLenMask = (1 << litLenTableBits) - 1;
+	const unsigned int distanceMask = (1 << distanceTableBits) - 1;
+	for (;;)
+	{
+		//One refill covers a whole length/distance pair, or up to two literal lookups
+		if (reader.count < maxPairBits)
+			reader.refill();
+
+		unsigned int entry = tables.litLen[reader.bits & litLenMask];
+		if (entryType(entry) == Subtable)
+		{
+			reader.consume(litLenTableBits);
+			entry = tables.litLen[entryValue(entry) + reader.peek(entryExtraBits(entry))];
+		}
+		reader.consume(entryCodeBits(entry));
+
+		switch (entryType(entry))
+		{
+		case TwoLiterals:
+			if (outEnd - out < 2)
+				return false;
+			out[0] = static_cast<unsigned char>(entryValue(entry));
+			out[1] = static_cast<unsigned char>(entryValue(entry) >> 8);
+			out += 2;
+			break;
+		case Literal:
+			if (out == outEnd)
+				return false;
+			*out++ = static_cast<unsigned char>(entryValue(entry));
+			break;
+		case Length:
+		{
+			unsigned int length = entryValue(entry) + reader.peek(entryExtraBits(entry));
+			reader.consume(entryExtraBits(entry));
+
+			entry = tables.distance[reader.bits & distanceMask];
+			if (entryType(entry) == Subtable)
+			{
+				reader.consume(distanceTableBits);
+				entry = tables.distance[entryValue(entry) + reader.peek(entryExtraBits(entry))];
+			}
+			if (entryType(entry) != Distance)
+				return false;
+			reader.consume(entryCodeBits(entry));
+			unsigned int distance = entryValue(entry) + reader.peek(entryExtraBits(entry));
+			reader.consume(entryExtraBits(entry));
+
+			if (distance > static_cast<size_t>(out - outStart) || length > static_cast<size_t>(outEnd - out))
+				return false;
+			copyMatch(out, distance, length, outEnd);
+			out += length;
+			break;
+		}
+		case EndOfBlock:
+			return !reader.overran();
+		default:
+			return false;
+		}
+	}
+}
+
+//Decodes the symbols of one Huffman block in to out
+static bool decodeHuffmanBlock(BitReader &blockReader, const DecodeTables &tables, unsigned char *outStart, unsigned char *&blockOut, unsigned char *outEnd)
+{
+	//Working on copies lets the compiler keep them in registers, writes through out could otherwise change them as far as it knows
+	BitReader reader = blockReader;
+	unsigned char *out = blockOut;
+	bool result = decodeHuffmanSymbols(reader, tables, outStart, out, outEnd);
+	blockReader = reader;
+	blockOut = out;
+	return result;
+}
+
+size_t decodeDeflate(const char *source, size_t sourceSize, char *destination, size_t destinationSize, unsigned int *crc)
+{
+	BitReader reader = { reinterpret_cast<const unsigned char*>(source), reinterpret_cast<const unsigned char*>(source) + sourceSize, 0, 0, 0 };
+	unsigned char *outStart = reinterpret_cast<unsigned char*>(destination);
+	unsigned char *out = outStart;
+	unsigned char *outEnd = outStart + destinationSize;
+	//Output not yet added to the CRC
+	unsigned char *crcStart = outStart;
+	//Dynamic tables are rebuilt for every block, but only allocated once per call
+	DecodeTables *dynamicTables = nullptr;
+	bool finalBlock = false;
+	bool result = true;
+
+	while (!finalBlock && result)
+	{
+		reader.refill();
+		finalBlock = reader.read(1) == 1;
+		unsigned int blockType = reader.read(2);
+
+		if (blockType == 0)
+		{
+			//Stored blocks are a length, it's complement and the bytes as they are
+			result = reader.alignToByte() && reader.inEnd - reader.in >= 4;
+			if (result)
+			{
+				unsigned int length = reader.in[0] | reader.in[1] << 8;
+				unsigned int complement = reader.in[2] | reader.in[3] << 8;
+				reader.in += 4;
+				result = length == (~complement & 0xFFFF) && static_cast<size_t>(reader.inEnd - reader.in) >= length && static_cast<size_t>(outEnd - out) >= length;
+				if (result)
+				{
+					memcpy(out, reader.in, length);
+					reader.in += length;
+					out += length;
+				}
+			}
+		}
+		else if (blockType == 1)
+			result = decodeHuffmanBlock(reader, *getFixedTables(), outStart, out, outEnd);
+		else if (blockType == 2)
+		{
+			if (dynamicTables == nullptr)
+				dynamicTables = new DecodeTables;
+			result = readDynamicTables(reader, *dynamicTables) && decodeHuffmanBlock(reader, *dynamicTables, outStart, out, outEnd);
+		}
+		else
+			result = false;
+
+		//The block was just written, so it's still in cache
+		if (result && crc != nullptr)
+		{
+			*crc = updateCrc32(*crc, crcStart, out - crcStart);
+			crcStart = out;
+		}
+	}
+
+	delete dynamicTables;
+	if (!result || reader.overran())
+		return 0;
+	return out - outStart;
+}
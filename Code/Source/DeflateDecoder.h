@@ -0,0 +1,20 @@
+// Name:
+// DeflateDecoder.h
+// Description:
+// Header file for the deflate decoder
+// Decodes raw deflate data (as stored in zip files) straight in to a buffer of known size, which is faster than going through zlib's inflate.
+// Bits are read 64 at a time, literal/length codes are decoded with a table that can return two literals from one lookup, and matches are copied 16 bytes at a time.
+// Output is identical to zlib's, the decoder fails on anything it can't handle so the caller can fall back to zlib.
+// Notes:
+// OS-Unaware
+
+#ifndef DEFLATE_DECODER_H
+#define DEFLATE_DECODER_H
+
+#include <cstddef>
+
+//Decodes sourceSize bytes of raw deflate data in to destination. Returns the number of bytes produced, or 0 if the data is invalid or doesn't fit in destinationSize.
+//Unless crc is null, the output is added to it one deflate block at a time, while the block is still in cache.
+size_t decodeDeflate(const char *source, size_t sourceSize, char *destination, size_t destinationSize, unsigned int *crc);
+
+#endif
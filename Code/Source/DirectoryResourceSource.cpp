@@ -5,30 +5,81 @@
 // Notes:
 // OS-Aware
 
-#include "CustomMemory.h"
-
 #include "DirectoryResourceSource.h"
 
 #include <tinyxml/tinyxml.h>
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <errno.h>
+#endif
 
-#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <sstream>
+#include <fstream>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdlib>
+#include <chrono>
+#include <iomanip>
 using namespace std;
 
 #include "Logger.h"
+#include "ResourceNameTable.h"
+#include "Crc32.h"
+#ifndef _WIN32
+#include "FileDescriptorCache.h"
+#include "BatchReader.h"
+#include "DirectoryScanner.h"
+#endif
+
+//Included after the standard headers, libstdc++ can't be compiled with it's new macro defined
+#include "CustomMemory.h"
 
 extern Logger* appLogger;
 
 const unsigned int fileNameLength = 1024;
+//Amount read at a time when a CRC is being checked, small enough that the data is still in cache when it's added to the CRC
+const unsigned int crcChunkSize = 256 * 1024;
 
+#ifndef _WIN32
+//Number of files kept open for repeated reads
+const unsigned int openFileCacheSize = 64;
+//Files at least this big are dropped from the OS page cache once they've been read, the ResourceCache keeps it's own copy of them.
+const unsigned long long dropFromPageCacheSize = 4 * 1024 * 1024;
+//Number of reads a batch keeps in flight at once
+const unsigned int batchQueueDepth = 64;
+//Most files a batch holds open at once, larger batches are split up so we don't run out of file descriptors
+const unsigned int maxBatchFiles = 256;
+#endif
+
+#ifdef _WIN32
 //Just store directory internally
-DirectoryResourceSource::DirectoryResourceSource(string directory) : directory(directory) {}
+DirectoryResourceSource::DirectoryResourceSource(string directory) : directory(directory), nameTable(new ResourceNameTable()) {}
 
 DirectoryResourceSource::~DirectoryResourceSource() {}
+#else
+//Store directory internally, the directory itself is opened by open()
+DirectoryResourceSource::DirectoryResourceSource(string directory) : directory(directory), nameTable(new ResourceNameTable()), directoryFd(-1), fileCache(nullptr), batchReader(nullptr) {}
 
-void DirectoryResourceSource::traverseFolder(unordered_set<string>& blackList, string folder)
+DirectoryResourceSource::~DirectoryResourceSource()
+{
+	//Close any open files, then the directory they were opened relative to
+	delete batchReader;
+	delete fileCache;
+	if (directoryFd >= 0)
+		close(directoryFd);
+}
+#endif
+
+#ifdef _WIN32
+void DirectoryResourceSource::traverseFolder(unordered_set<string>& blackList, string folder, vector<pair<string, unsigned long long> >& files)
 {
 	//Used to recursively traverse a directory structure
 	stringstream findPath;
@@ -56,22 +107,22 @@ void DirectoryResourceSource::traverseFolder(unordered_set<string>& blackList, s
 			if (findData.cFileName[0] != '.')
 			{
 				//Build path to file
-				stringstream filePath;
+				string filePath;
 				if (folder.length() > 0)
-					filePath << "\\" << folder;
-				filePath << findData.cFileName;
+					filePath = folder + "/";
+				filePath += findData.cFileName;
 
 				//If we've found a directory, recursively traverse it
 				if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
 				{
-					traverseFolder(blackList, filePath.str());
+					traverseFolder(blackList, filePath, files);
 				}
 				//Otherwise, check if the file is blacklisted and add it to the list if it isn't
 				else
 				{
-					if (blackList.count(filePath.str()) == 0)
+					if (blackList.count(filePath) == 0)
 					{
-						fileList.emplace(filePath.str(), findData.nFileSizeLow);
+						files.push_back(pair<string, unsigned long long>(filePath, (static_cast<unsigned long long>(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow));
 					}
 				}
 			}
@@ -88,13 +139,21 @@ void DirectoryResourceSource::traverseFolder(unordered_set<string>& blackList, s
 	}
 }
 
+#endif
+
 bool DirectoryResourceSource::open()
 {
 	//Blacklist used to exclude files from Resource
 	unordered_set<string> blackList;
+	//CRCs listed in the manifest
+	unordered_map<string, unsigned int> checksums;
 
 	//Path to manifest file
+#ifdef _WIN32
 	string manifestFile = directory + "\\manifest.xml";
+#else
+	string manifestFile = directory + "/manifest.xml";
+#endif
 
 	//Create and load document
 	TiXmlDocument manifestDoc(manifestFile.c_str());
@@ -126,58 +185,291 @@ bool DirectoryResourceSource::open()
 		}
 	}
 
+	//Retrieve Checksums element from XML
+	currentTag = manifestDoc.RootElement()->FirstChildElement("Checksums");
+	//If there are Checksums...
+	if (currentTag)
+	{
+		//Retrieve File element from Checksums
+		currentTag = currentTag->FirstChildElement("File");
+		//While we have a valid file element
+		while (currentTag)
+		{
+			//Get the name and CRC of the file, and move to the next File element
+			string fileName;
+			string crc;
+			currentTag->QueryStringAttribute("name", &fileName);
+			currentTag->QueryStringAttribute("crc", &crc);
+			checksums[fileName] = static_cast<unsigned int>(strtoul(crc.c_str(), nullptr, 16));
+			currentTag = currentTag->NextSiblingElement("File");
+		}
+	}
+
+#ifndef _WIN32
+	//Hold the directory open, everything is opened relative to it
+	directoryFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (directoryFd < 0)
+	{
+		appLogger->eWriteLog("Failed to open directory " + directory, LogLevel::Warning, { "Resource" });
+		return false;
+	}
+	fileCache = new FileDescriptorCache(directoryFd, openFileCacheSize);
+	batchReader = BatchReader::create(batchQueueDepth);
+	appLogger->eWriteLog(string("Reading batches from ") + directory + " with " + batchReader->getName(), LogLevel::Info, { "Resource" });
+#endif
+
 	//Begin traversing directory structure with the blackList
-	traverseFolder(blackList, "");
+	vector<pair<string, unsigned long long> > files;
+	chrono::steady_clock::time_point scanStart = chrono::steady_clock::now();
+#ifdef _WIN32
+	traverseFolder(blackList, "", files);
+	unsigned int scanThreads = 1;
+#else
+	//Scan everything, then drop the blacklisted files
+	DirectoryScanner scanner(directoryFd);
+	scanner.scan(files);
+	unsigned int scanThreads = scanner.getThreadCount();
+	for (vector<string>::const_iterator it = scanner.getFailedDirectories().begin(); it != scanner.getFailedDirectories().end(); it++)
+		appLogger->eWriteLog("Invalid directory path " + *it, LogLevel::Warning, { "Resource" });
+	if (blackList.size() > 0)
+		files.erase(remove_if(files.begin(), files.end(), [&](const pair<string, unsigned long long> &file) { return blackList.count(file.first) > 0; }), files.end());
+#endif
+	{
+		stringstream scanTime;
+		scanTime << fixed << setprecision(2);
+		scanTime << "Scanned " << files.size() << " files in " << directory << " using " << scanThreads << " threads in ";
+		scanTime << chrono::duration<double, milli>(chrono::steady_clock::now() - scanStart).count() << "ms";
+		appLogger->eWriteLog(scanTime.str(), LogLevel::Info, { "Resource" });
+	}
+
+	//Build the name table from the files found, and store each file's size at it's name's index
+	vector<string> names;
+	names.reserve(files.size());
+	for (vector<pair<string, unsigned long long> >::const_iterator it = files.begin(); it != files.end(); it++)
+		names.push_back(it->first);
+	nameTable.reset(new ResourceNameTable(names));
+	fileSizes.resize(nameTable->size());
+	for (vector<pair<string, unsigned long long> >::const_iterator it = files.begin(); it != files.end(); it++)
+		fileSizes[nameTable->find(it->first)] = it->second;
+
+	//Files missing from the checksums get their CRC the first time they're read
+	integrity.reset(nameTable->size());
+	for (unordered_map<string, unsigned int>::const_iterator it = checksums.begin(); it != checksums.end(); it++)
+	{
+		unsigned int index = nameTable->find(it->first);
+		if (index != ResourceNameTable::npos)
+			integrity.setExpectedCrc(index, it->second);
+	}
 
 	//All done
 	return true;
 }
 
-int DirectoryResourceSource::getRawResourceSize(const string &resource) const
+unsigned long long DirectoryResourceSource::getRawResourceSize(const string &resource) const
 {
 	//Return the size of the resource if it exists
-	if (fileList.count(resource) == 1)
-		return fileList.at(resource);
+	unsigned int index = nameTable->find(resource);
+	if (index != ResourceNameTable::npos)
+		return fileSizes[index];
 	//Return 0 if it doesn't
 	return 0;
 }
 
-int DirectoryResourceSource::getRawResource(const string &resource, char * buffer) const
+unsigned long long DirectoryResourceSource::getRawResource(const string &resource, char * buffer) const
 {
 	//Get resource and return size of resource if it exists
-	if (fileList.count(resource) == 1)
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
+		//Return 0 if file doesn't exist.
+		return 0;
+
+#ifdef _WIN32
+	//Use ifstream's read method to read all of the contents of the file into the buffer
+	ifstream file(directory + "\\" + resource, ios_base::in | ios_base::binary);
+	if (integrity.needsCheck(index))
+	{
+		//Read a chunk at a time, adding each to the CRC while it's in cache
+		unsigned int crc = 0;
+		unsigned long long bytesRead = 0;
+		while (bytesRead < fileSizes[index] && file)
+		{
+			file.read(buffer + bytesRead, min<unsigned long long>(fileSizes[index] - bytesRead, crcChunkSize));
+			crc = updateCrc32(crc, buffer + bytesRead, static_cast<size_t>(file.gcount()));
+			bytesRead += file.gcount();
+		}
+		//A short read would be taken as the resource's expected CRC, fail it before checking
+		if (bytesRead != fileSizes[index])
+		{
+			appLogger->eWriteLog("Failed to read " + resource + " in " + directory, LogLevel::Warning, { "Resource" });
+			return 0;
+		}
+		if (!integrity.check(index, crc, bytesRead, directory, resource))
+			return 0;
+	}
+	else if (!file.read(buffer, fileSizes[index]))
 	{
-		//Use fstream's read method to read all of the contents of the file into the buffer
-		fstream file(directory + "//" + resource);
-		file.read(buffer, fileList.at(resource));
-		//Return size of file
-		return fileList.at(resource);
+		appLogger->eWriteLog("Failed to read " + resource + " in " + directory, LogLevel::Warning, { "Resource" });
+		return 0;
+	}
+	//Return size of file
+	return fileSizes[index];
+#else
+	//Get the file from the cache of open files, opening it if needed
+	shared_ptr<FileDescriptor> file = fileCache->acquire(index, nameTable->getName(index));
+	if (!file)
+	{
+		appLogger->eWriteLog("Failed to open " + resource + " in " + directory, LogLevel::Warning, { "Resource" });
+		return 0;
+	}
+
+	//Read straight in to the buffer. pread doesn't use the file position, so files can be shared between threads.
+	//When checking the CRC, read a chunk at a time and add each to the CRC while it's in cache.
+	bool checkCrc = integrity.needsCheck(index);
+	unsigned long long chunkSize = checkCrc ? crcChunkSize : 1ULL << 30;
+	unsigned int crc = 0;
+	unsigned long long size = fileSizes[index];
+	unsigned long long bytesRead = 0;
+	while (bytesRead < size)
+	{
+		ssize_t result = pread(file->fd, buffer + bytesRead, min(size - bytesRead, chunkSize), bytesRead);
+		if (result < 0 && errno == EINTR)
+			continue;
+		if (result <= 0)
+		{
+			appLogger->eWriteLog("Failed to read " + resource + " in " + directory, LogLevel::Warning, { "Resource" });
+			return 0;
+		}
+		if (checkCrc)
+			crc = updateCrc32(crc, buffer + bytesRead, result);
+		bytesRead += result;
+	}
+
+	//Big files don't need to stay in the OS page cache, we've got our own copy now.
+	if (size >= dropFromPageCacheSize)
+		posix_fadvise(file->fd, 0, 0, POSIX_FADV_DONTNEED);
+
+	if (checkCrc && !integrity.check(index, crc, bytesRead, directory, resource))
+		return 0;
+
+	//Return size of file
+	return bytesRead;
+#endif
+}
+
+#ifndef _WIN32
+void DirectoryResourceSource::getRawResources(vector<RawResourceRequest> &requests, const function<void(RawResourceRequest&)> &onComplete) const
+{
+	//Read the requests in chunks, holding each chunk's files open until it's been read
+	for (unsigned int chunkStart = 0; chunkStart < requests.size(); chunkStart += maxBatchFiles)
+	{
+		unsigned int chunkEnd = min<unsigned int>(chunkStart + maxBatchFiles, requests.size());
+		vector<BatchRead> reads;
+		vector<shared_ptr<FileDescriptor> > files;
+		vector<unsigned int> indices;
+		reads.reserve(chunkEnd - chunkStart);
+		files.reserve(chunkEnd - chunkStart);
+		indices.reserve(chunkEnd - chunkStart);
+
+		//Find and open each file
+		for (unsigned int I = chunkStart; I < chunkEnd; I++)
+		{
+			unsigned int index = nameTable->find(requests[I].resource);
+			shared_ptr<FileDescriptor> file;
+			if (index != ResourceNameTable::npos)
+				file = fileCache->acquire(index, nameTable->getName(index));
+			//Missing files complete straight away
+			if (!file)
+			{
+				if (index != ResourceNameTable::npos)
+					appLogger->eWriteLog("Failed to open " + requests[I].resource + " in " + directory, LogLevel::Warning, { "Resource" });
+				requests[I].result = 0;
+				onComplete(requests[I]);
+				continue;
+			}
+			BatchRead read = { file->fd, 0, fileSizes[index], requests[I].buffer, I, 0 };
+			reads.push_back(read);
+			files.push_back(file);
+			indices.push_back(index);
+		}
+
+		if (reads.size() == 0)
+			continue;
+
+		//Read everything straight in to the requests' buffers
+		batchReader->read(&reads[0], reads.size(), [&](BatchRead &read)
+		{
+			RawResourceRequest &request = requests[read.tag];
+			unsigned int index = indices[&read - &reads[0]];
+			//Files that have shrunk since they were listed are failed before checking, a short read would be taken as the expected CRC
+			if (read.result < 0 || static_cast<unsigned long long>(read.result) != fileSizes[index])
+			{
+				appLogger->eWriteLog("Failed to read " + request.resource + " in " + directory, LogLevel::Warning, { "Resource" });
+				request.result = 0;
+			}
+			else
+			{
+				request.result = static_cast<unsigned long long>(read.result);
+				//The file has only just been read, check it before it leaves the cache
+				if (integrity.needsCheck(index) && !integrity.check(index, updateCrc32(0, request.buffer, request.result), request.result, directory, request.resource))
+					request.result = 0;
+			}
+			//Big files don't need to stay in the OS page cache, we've got our own copy now.
+			if (read.length >= dropFromPageCacheSize)
+				posix_fadvise(read.fd, 0, 0, POSIX_FADV_DONTNEED);
+			onComplete(request);
+		});
 	}
-	//Return 0 if file doesn't exist.
-	return 0;
 }
+#endif
 
 int DirectoryResourceSource::getNumResources() const
 {
-	//Return number of files in the file list
-	return fileList.size();
+	//Return number of files in the name table
+	return nameTable->size();
 }
 
 string DirectoryResourceSource::getResourceName(int num) const
 {
-	//Iterate over resource list to the specified resource and return it's name
-	unordered_map<string, unsigned long>::const_iterator resource = fileList.begin();
-	for (int I = 0; I < num; I++)
-		++resource;
-	return resource->first;
+	//Look up the name in the name table
+	return nameTable->getName(num);
 }
 
 unordered_set<string> DirectoryResourceSource::getResourceList() const
 {
-	//Copy resource from fileList to an unordered_set and return it
+	//Copy resources from the name table to an unordered_set and return it
 	unordered_set<string> result;
-	result.reserve(fileList.size());
-	for (unordered_map<string, unsigned long>::const_iterator it = fileList.begin(); it != fileList.end(); it++)
-		result.insert(it->first);
+	result.reserve(nameTable->size());
+	for (ResourceNameTable::const_iterator it = nameTable->begin(); it != nameTable->end(); it++)
+		result.insert(*it);
 	return result;
 }
+
+shared_ptr<const ResourceNameTable> DirectoryResourceSource::getNameTable() const
+{
+	return nameTable;
+}
+
+bool DirectoryResourceSource::hasResource(const string &resource) const
+{
+	return nameTable->find(resource) != ResourceNameTable::npos;
+}
+
+void DirectoryResourceSource::setIntegrityMode(IntegrityMode mode)
+{
+	integrity.setMode(mode);
+}
+
+IntegrityStats DirectoryResourceSource::getIntegrityStats() const
+{
+	return integrity.getStats();
+}
+
+bool DirectoryResourceSource::getContentKey(const string &resource, ResourceContentKey &key) const
+{
+	//Only files with a CRC in the manifest, or that have already been read, have a key
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos || !integrity.getExpectedCrc(index, key.crc))
+		return false;
+	key.size = fileSizes[index];
+	return true;
+}
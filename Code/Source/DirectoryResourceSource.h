@@ -3,6 +3,10 @@
 // Description:
 // Header file for DirectoryResourceSource class
 // DirectoryResourceSource provides the files located within a directory.
+// Resource names are relative to the directory and use '/' as a separator on every OS, the same as names in zip files.
+// On Linux, the directory is scanned with several threads, files are read with pread relative to a held directory descriptor, and recently read files are kept open.
+// Batches of reads go through a BatchReader, which uses io_uring when it's available.
+// Files can be given a CRC in manifest.xml, in a Checksums element containing File elements like the Blacklist, with a crc attribute in hex.
 // See IResourceSource.h for usage details.
 // Notes:
 // OS-Unaware
@@ -11,26 +15,52 @@
 #define DIRECTORY_RESOURCE_SOURCE_H
 
 #include <string>
-#include <unordered_map>
+#include <memory>
 #include <unordered_set>
+#include <vector>
 using namespace std;
 #include "IResourceSource.h"
 
+class FileDescriptorCache;
+class BatchReader;
+
 class DirectoryResourceSource : public IResourceSource
 {
 private:
 	string directory;
-	unordered_map<string, unsigned long> fileList;
-	void traverseFolder(unordered_set<string>& blackList, string folder);
+	//Size of each file, stored in the same order as the name table
+	vector<unsigned long long> fileSizes;
+	//Decides which reads are checked against the files' CRCs
+	mutable ResourceIntegrity integrity;
+	shared_ptr<const ResourceNameTable> nameTable;
+#ifndef _WIN32
+	//Descriptor for the directory, files are opened relative to it
+	int directoryFd;
+	//Recently read files, kept open for the next read
+	FileDescriptorCache *fileCache;
+	//Used to read batches of files
+	BatchReader *batchReader;
+#endif
+#ifdef _WIN32
+	void traverseFolder(unordered_set<string>& blackList, string folder, vector<pair<string, unsigned long long> >& files);
+#endif
 public:
 	DirectoryResourceSource(string directory);
 	virtual ~DirectoryResourceSource();
 	virtual bool open();
-	virtual int getRawResourceSize(const string &resource) const;
-	virtual int getRawResource(const string &resource, char * buffer) const;
+	virtual unsigned long long getRawResourceSize(const string &resource) const;
+	virtual unsigned long long getRawResource(const string &resource, char * buffer) const;
+#ifndef _WIN32
+	virtual void getRawResources(vector<RawResourceRequest> &requests, const function<void(RawResourceRequest&)> &onComplete) const;
+#endif
 	virtual int getNumResources() const;
 	virtual string getResourceName(int num) const;
 	virtual unordered_set<string> getResourceList() const;
+	virtual shared_ptr<const ResourceNameTable> getNameTable() const;
+	virtual bool hasResource(const string &resource) const;
+	virtual void setIntegrityMode(IntegrityMode mode);
+	virtual IntegrityStats getIntegrityStats() const;
+	virtual bool getContentKey(const string &resource, ResourceContentKey &key) const;
 };
 
 #endif
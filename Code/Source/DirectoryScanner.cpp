@@ -0,0 +1,232 @@
+// Name:
+// DirectoryScanner.cpp
+// Description:
+// Implementation file for DirectoryScanner class
+// Notes:
+// OS-Aware
+// POSIX only, compiles to nothing on Windows.
+
+#ifndef _WIN32
+
+#include "DirectoryScanner.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+using namespace std;
+
+//Included after the standard headers, libstdc++ can't be compiled with it's new macro defined
+#include "CustomMemory.h"
+
+//Threads available to help with scans, shared by every scan in the process
+static atomic<int> availableHelpers(static_cast<int>(thread::hardware_concurrency()) - 1);
+
+//Takes up to count helpers from the pool, returning how many were taken
+static unsigned int takeHelpers(unsigned int count)
+{
+	int available = availableHelpers;
+	int taken;
+	do
+	{
+		taken = min(available, static_cast<int>(count));
+		if (taken <= 0)
+			return 0;
+	} while (!availableHelpers.compare_exchange_weak(available, available - taken));
+	return taken;
+}
+
+DirectoryScanner::DirectoryScanner(int rootFd, unsigned int maxThreads) : rootFd(rootFd), maxThreads(maxThreads), threadCount(0), pendingDirectories(0), queuedDirectories(0), directoryCount(0)
+{
+	if (this->maxThreads == 0)
+		this->maxThreads = max(thread::hardware_concurrency(), 1u);
+}
+
+void DirectoryScanner::scan(vector<pair<string, unsigned long long> > &files)
+{
+	//This thread always scans, borrow helpers for the rest
+	unsigned int helpers = takeHelpers(maxThreads - 1);
+	threadCount = helpers + 1;
+
+	workQueues.clear();
+	for (unsigned int I = 0; I < threadCount; I++)
+		workQueues.push_back(unique_ptr<WorkQueue>(new WorkQueue()));
+	threadFiles.assign(threadCount, vector<pair<string, unsigned long long> >());
+	failedDirectories.clear();
+	visitedDirectories.clear();
+	directoryCount = 0;
+
+	//Start with the root
+	pendingDirectories = 1;
+	queuedDirectories = 1;
+	workQueues[0]->directories.push_back(string());
+
+	vector<thread> threads;
+	for (unsigned int I = 1; I < threadCount; I++)
+		threads.push_back(thread(&DirectoryScanner::work, this, I));
+	work(0);
+	for (vector<thread>::iterator it = threads.begin(); it != threads.end(); it++)
+		it->join();
+	availableHelpers += helpers;
+
+	//Gather up the files each thread found
+	for (unsigned int I = 0; I < threadCount; I++)
+	{
+		files.insert(files.end(), threadFiles[I].begin(), threadFiles[I].end());
+		vector<pair<string, unsigned long long> >().swap(threadFiles[I]);
+	}
+	set<pair<unsigned long long, unsigned long long> >().swap(visitedDirectories);
+}
+
+void DirectoryScanner::work(unsigned int thread)
+{
+	//Paths are built in to the same buffer for every file this thread finds
+	string pathBuffer;
+	string directory;
+	//Keep working until every directory found has been scanned
+	while (pendingDirectories > 0)
+	{
+		if (takeDirectory(thread, directory))
+		{
+			scanDirectory(thread, directory, pathBuffer);
+			//Last directory finished, wake the idle threads so they can return
+			if (--pendingDirectories == 0)
+			{
+				lock_guard<mutex> idleLock(idleMutex);
+				workAvailable.notify_all();
+			}
+		}
+		else
+		{
+			//Nothing to take, sleep until another thread queues a directory or the scan finishes
+			unique_lock<mutex> idleLock(idleMutex);
+			while (pendingDirectories > 0 && queuedDirectories == 0)
+				workAvailable.wait(idleLock);
+		}
+	}
+}
+
+bool DirectoryScanner::takeDirectory(unsigned int thread, string &directory)
+{
+	//Take the most recently found directory from our own queue, it's the most likely to still be in cache
+	{
+		WorkQueue &queue = *workQueues[thread];
+		lock_guard<mutex> queueLock(queue.queueMutex);
+		if (queue.directories.size() > 0)
+		{
+			directory.swap(queue.directories.back());
+			queue.directories.pop_back();
+			queuedDirectories--;
+			return true;
+		}
+	}
+	//Otherwise steal the oldest directory from another thread, it's likely to have the most work below it
+	for (unsigned int I = 1; I < workQueues.size(); I++)
+	{
+		WorkQueue &queue = *workQueues[(thread + I) % workQueues.size()];
+		lock_guard<mutex> queueLock(queue.queueMutex);
+		if (queue.directories.size() > 0)
+		{
+			directory.swap(queue.directories.front());
+			queue.directories.pop_front();
+			queuedDirectories--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void DirectoryScanner::scanDirectory(unsigned int thread, const string &directory, string &pathBuffer)
+{
+	int directoryFd;
+	DIR *directoryDir;
+	dirent *entry;
+
+	//Open the directory relative to the root. The root is opened again rather than duplicated, a duplicate would share it's read position.
+	directoryFd = openat(rootFd, directory.length() > 0 ? directory.c_str() : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	directoryDir = directoryFd >= 0 ? fdopendir(directoryFd) : nullptr;
+	if (directoryDir == nullptr)
+	{
+		if (directoryFd >= 0)
+			close(directoryFd);
+		lock_guard<mutex> failedLock(failedMutex);
+		failedDirectories.push_back(directory);
+		return;
+	}
+
+	//Symbolic links can lead back to a directory already scanned, possibly one above this one, skip it rather than looping forever
+	struct stat directoryStat;
+	if (fstat(directoryFd, &directoryStat) == 0)
+	{
+		lock_guard<mutex> visitedLock(visitedMutex);
+		if (!visitedDirectories.insert(pair<unsigned long long, unsigned long long>(directoryStat.st_dev, directoryStat.st_ino)).second)
+		{
+			closedir(directoryDir);
+			return;
+		}
+	}
+	directoryCount++;
+
+	vector<string> subdirectories;
+	while ((entry = readdir(directoryDir)) != nullptr)
+	{
+		//Ignore files that start with a period, these are hidden and/or system files
+		if (entry->d_name[0] == '.')
+			continue;
+
+		//Build path to file
+		pathBuffer.assign(directory);
+		if (directory.length() > 0)
+			pathBuffer += '/';
+		pathBuffer += entry->d_name;
+
+		//Directories can be identified without a stat, files need one for their size
+		if (entry->d_type == DT_DIR)
+		{
+			subdirectories.push_back(pathBuffer);
+			continue;
+		}
+		struct stat fileStat;
+		if ((entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) || fstatat(dirfd(directoryDir), entry->d_name, &fileStat, 0) != 0)
+			continue;
+		if (S_ISDIR(fileStat.st_mode))
+			subdirectories.push_back(pathBuffer);
+		else if (S_ISREG(fileStat.st_mode))
+			threadFiles[thread].push_back(pair<string, unsigned long long>(pathBuffer, fileStat.st_size));
+	}
+	//Finished iterating over files, this also closes directoryFd
+	closedir(directoryDir);
+
+	//Queue up the subdirectories where other threads can find them
+	if (subdirectories.size() > 0)
+	{
+		pendingDirectories += subdirectories.size();
+		{
+			WorkQueue &queue = *workQueues[thread];
+			lock_guard<mutex> queueLock(queue.queueMutex);
+			for (vector<string>::iterator it = subdirectories.begin(); it != subdirectories.end(); it++)
+			{
+				queue.directories.push_back(string());
+				queue.directories.back().swap(*it);
+			}
+			queuedDirectories += subdirectories.size();
+		}
+		//Wake idle threads to take them
+		lock_guard<mutex> idleLock(idleMutex);
+		if (subdirectories.size() > 1)
+			workAvailable.notify_all();
+		else
+			workAvailable.notify_one();
+	}
+}
+
+#endif
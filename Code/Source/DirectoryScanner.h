@@ -0,0 +1,75 @@
+// Name:
+// DirectoryScanner.h
+// Description:
+// Header file for DirectoryScanner class
+// DirectoryScanner lists every file below a directory, along with it's size, using several threads.
+// Each thread keeps a queue of directories it has found and takes work from the other threads' queues once it's own is empty.
+// Helper threads come from a process wide pool, so several scans running at once don't start more threads than there are cores.
+// Notes:
+// OS-Aware
+// POSIX only, file does not pollute with OS-Headers.
+
+#ifndef DIRECTORY_SCANNER_H
+#define DIRECTORY_SCANNER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+using namespace std;
+
+class DirectoryScanner
+{
+private:
+	//Directories waiting to be scanned by one thread, other threads steal from the front.
+	struct WorkQueue
+	{
+		mutex queueMutex;
+		deque<string> directories;
+	};
+
+	int rootFd;
+	unsigned int maxThreads;
+	unsigned int threadCount;
+	vector<unique_ptr<WorkQueue> > workQueues;
+	//Files found by each thread
+	vector<vector<pair<string, unsigned long long> > > threadFiles;
+	//Directories that have been found but not finished
+	atomic<unsigned int> pendingDirectories;
+	//Directories sitting in a queue, idle threads wait on workAvailable until there are some
+	atomic<unsigned int> queuedDirectories;
+	mutex idleMutex;
+	condition_variable workAvailable;
+	//Device and inode of every directory scanned, so symbolic links that loop back are only scanned once
+	mutex visitedMutex;
+	set<pair<unsigned long long, unsigned long long> > visitedDirectories;
+	atomic<unsigned int> directoryCount;
+	mutex failedMutex;
+	vector<string> failedDirectories;
+
+	void work(unsigned int thread);
+	bool takeDirectory(unsigned int thread, string &directory);
+	void scanDirectory(unsigned int thread, const string &directory, string &pathBuffer);
+
+	DirectoryScanner(const DirectoryScanner& directoryScanner) = delete;
+	DirectoryScanner& operator =(const DirectoryScanner& directoryScanner) = delete;
+
+public:
+	//rootFd must stay open while scanning. maxThreads of 0 uses as many threads as there are cores.
+	DirectoryScanner(int rootFd, unsigned int maxThreads = 0);
+
+	//Adds every regular file below the root to files. Paths are relative to the root and separated with '/'.
+	//Files and directories whose names start with a period are skipped. Symbolic links are followed, but each directory is only scanned once.
+	void scan(vector<pair<string, unsigned long long> > &files);
+
+	//Information about the last scan
+	unsigned int getDirectoryCount() const { return directoryCount; }
+	unsigned int getThreadCount() const { return threadCount; }
+	const vector<string> &getFailedDirectories() const { return failedDirectories; }
+};
+
+#endif
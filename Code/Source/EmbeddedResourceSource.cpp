@@ -0,0 +1,121 @@
+// Name:
+// EmbeddedResourceSource.cpp
+// Description:
+// Implementation file for EmbeddedResourceSource class
+// Notes:
+// OS-Unaware
+
+#include "CustomMemory.h"
+
+#include "EmbeddedResourceSource.h"
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <cstring>
+using namespace std;
+
+#include "Logger.h"
+#include "ResourceNameTable.h"
+
+extern Logger* appLogger;
+
+EmbeddedResourceSource::EmbeddedResourceSource(const EmbeddedResourcePack &pack) : pack(pack), nameTable(new ResourceNameTable()) {}
+
+EmbeddedResourceSource::~EmbeddedResourceSource() {}
+
+bool EmbeddedResourceSource::open()
+{
+	//The pack is already sorted, but the name table is what gives constant time lookups
+	vector<string> names;
+	names.reserve(pack.count);
+	for (unsigned int I = 0; I < pack.count; I++)
+		names.push_back(pack.resources[I].name);
+	shared_ptr<const ResourceNameTable> table(new ResourceNameTable(names));
+
+	resources.resize(table->size());
+	for (unsigned int I = 0; I < pack.count; I++)
+		resources[table->find(pack.resources[I].name, strlen(pack.resources[I].name))] = &pack.resources[I];
+	nameTable = table;
+
+	return true;
+}
+
+const EmbeddedResource *EmbeddedResourceSource::findResource(const string &resource) const
+{
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
+	{
+		appLogger->eWriteLog(string("File ") + resource + " not found in embedded resources", LogLevel::Warning, { "Resource" });
+		return nullptr;
+	}
+	return resources[index];
+}
+
+unsigned long long EmbeddedResourceSource::getRawResourceSize(const string &resource) const
+{
+	const EmbeddedResource *entry = findResource(resource);
+	if (entry == nullptr)
+		return 0;
+	return entry->size;
+}
+
+unsigned long long EmbeddedResourceSource::getRawResource(const string &resource, char * buffer) const
+{
+	const EmbeddedResource *entry = findResource(resource);
+	if (entry == nullptr)
+		return 0;
+	memcpy(buffer, entry->data, entry->size);
+	return entry->size;
+}
+
+int EmbeddedResourceSource::getNumResources() const
+{
+	//Return number of files in the name table
+	return nameTable->size();
+}
+
+string EmbeddedResourceSource::getResourceName(int num) const
+{
+	//Look up the name in the name table
+	return nameTable->getName(num);
+}
+
+unordered_set<string> EmbeddedResourceSource::getResourceList() const
+{
+	//Copy resources from the name table to an unordered_set and return it
+	unordered_set<string> result;
+	result.reserve(nameTable->size());
+	for (ResourceNameTable::const_iterator it = nameTable->begin(); it != nameTable->end(); it++)
+		result.insert(*it);
+	return result;
+}
+
+shared_ptr<const ResourceNameTable> EmbeddedResourceSource::getNameTable() const
+{
+	return nameTable;
+}
+
+bool EmbeddedResourceSource::hasResource(const string &resource) const
+{
+	return nameTable->find(resource) != ResourceNameTable::npos;
+}
+
+bool EmbeddedResourceSource::getContentKey(const string &resource, ResourceContentKey &key) const
+{
+	//ResourcePacker stores the CRC of every resource
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
+		return false;
+	key.size = resources[index]->size;
+	key.crc = resources[index]->crc;
+	return true;
+}
+
+const char *EmbeddedResourceSource::getResourceData(const string &resource) const
+{
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
+		return nullptr;
+	return reinterpret_cast<const char*>(resources[index]->data);
+}
@@ -0,0 +1,93 @@
+// Name:
+// EmbeddedResourceSource.h
+// Description:
+// Header file for EmbeddedResourceSource class
+// EmbeddedResourceSource serves resources compiled in to the executable, so boot critical resources are available before anything is read from disk.
+// ResourcePacker packs a directory in to a source file that defines an EmbeddedResourcePack, which the build compiles in with everything else.
+// The engine's build packs Game\Boot as bootResources, which GameEngine mounts beneath the Resources directory. Declare a pack with the name given to ResourcePacker, ie extern const EmbeddedResourcePack bootResources; and pass it to the constructor.
+// Lookups and reads never touch the disk, and getResourceData lets the ResourceCache use the resources without copying them.
+// Mount the source in a MasterDirectoryResourceSource (see mount) to let files on disk override it.
+// See IResourceSource.h for usage details.
+// Notes:
+// OS-Unaware
+
+#ifndef EMBEDDED_RESOURCE_SOURCE_H
+#define EMBEDDED_RESOURCE_SOURCE_H
+
+#include <string>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+#include "IResourceSource.h"
+
+//One resource in a pack
+struct EmbeddedResource
+{
+	const char *name;
+	const unsigned char *data;
+	unsigned int size;
+	//CRC32 of the data
+	unsigned int crc;
+};
+
+//Resources compiled in to the executable, sorted by name
+struct EmbeddedResourcePack
+{
+	const EmbeddedResource *resources;
+	unsigned int count;
+};
+
+//Returned by findEmbeddedResource when a name isn't in the pack
+const unsigned int embeddedResourceNotFound = 0xFFFFFFFF;
+
+//Compares names the way std::string does, so packs sort the same way as the name table. Usable at compile time.
+constexpr int compareEmbeddedNames(const char *first, const char *second)
+{
+	return *first != *second || *first == '\0' ? static_cast<unsigned char>(*first) - static_cast<unsigned char>(*second) : compareEmbeddedNames(first + 1, second + 1);
+}
+
+//Binary search of a sorted index for name. Usable at compile time, so packs can check for the resources they must contain with a static_assert.
+constexpr unsigned int findEmbeddedResource(const EmbeddedResource *resources, unsigned int first, unsigned int last, const char *name)
+{
+	return first >= last ? embeddedResourceNotFound :
+		compareEmbeddedNames(resources[first + (last - first) / 2].name, name) == 0 ? first + (last - first) / 2 :
+		compareEmbeddedNames(resources[first + (last - first) / 2].name, name) < 0 ? findEmbeddedResource(resources, first + (last - first) / 2 + 1, last, name) :
+		findEmbeddedResource(resources, first, first + (last - first) / 2, name);
+}
+
+//Checks an index is sorted with no duplicate names. Splits the range in half each step, so big packs don't hit the compiler's recursion limit.
+constexpr bool isEmbeddedIndexSorted(const EmbeddedResource *resources, unsigned int first, unsigned int last)
+{
+	return last - first < 2 ||
+		(isEmbeddedIndexSorted(resources, first, first + (last - first) / 2) &&
+		compareEmbeddedNames(resources[first + (last - first) / 2 - 1].name, resources[first + (last - first) / 2].name) < 0 &&
+		isEmbeddedIndexSorted(resources, first + (last - first) / 2, last));
+}
+
+class EmbeddedResourceSource : public IResourceSource
+{
+private:
+	const EmbeddedResourcePack &pack;
+	shared_ptr<const ResourceNameTable> nameTable;
+	//Pack entry of each resource, stored in the same order as the name table
+	vector<const EmbeddedResource*> resources;
+
+	//Returns the pack's entry for a resource, or nullptr if the pack doesn't contain it
+	const EmbeddedResource *findResource(const string &resource) const;
+public:
+	EmbeddedResourceSource(const EmbeddedResourcePack &pack);
+	virtual ~EmbeddedResourceSource();
+	virtual bool open();
+	virtual unsigned long long getRawResourceSize(const string &resource) const;
+	virtual unsigned long long getRawResource(const string &resource, char * buffer) const;
+	virtual int getNumResources() const;
+	virtual string getResourceName(int num) const;
+	virtual unordered_set<string> getResourceList() const;
+	virtual shared_ptr<const ResourceNameTable> getNameTable() const;
+	virtual bool hasResource(const string &resource) const;
+	virtual bool getContentKey(const string &resource, ResourceContentKey &key) const;
+	virtual const char *getResourceData(const string &resource) const;
+};
+
+#endif
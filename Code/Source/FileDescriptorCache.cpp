@@ -0,0 +1,80 @@
+// Name:
+// FileDescriptorCache.cpp
+// Description:
+// Implementation file for FileDescriptorCache class
+// Notes:
+// OS-Aware
+// POSIX only, compiles to nothing on Windows.
+
+#ifndef _WIN32
+
+#include "FileDescriptorCache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+using namespace std;
+
+//Included after the standard headers, libstdc++ can't be compiled with it's new macro defined
+#include "CustomMemory.h"
+
+FileDescriptor::FileDescriptor(int fd) : fd(fd) {}
+
+FileDescriptor::~FileDescriptor()
+{
+	close(fd);
+}
+
+FileDescriptorCache::FileDescriptorCache(int directoryFd, unsigned int capacity) : directoryFd(directoryFd), capacity(capacity) {}
+
+FileDescriptorCache::~FileDescriptorCache() {}
+
+shared_ptr<FileDescriptor> FileDescriptorCache::acquire(unsigned int key, const char *path)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	//If the file is already open, move it to the front of the list and return it
+	unordered_map<unsigned int, list<pair<unsigned int, shared_ptr<FileDescriptor> > >::iterator>::iterator found = fileMap.find(key);
+	if (found != fileMap.end())
+	{
+		recentFiles.splice(recentFiles.begin(), recentFiles, found->second);
+		return found->second->second;
+	}
+
+	//Open the file
+	int fd = openat(directoryFd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return shared_ptr<FileDescriptor>();
+	//Files are read from front to back, let the kernel know it can read ahead aggressively
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	shared_ptr<FileDescriptor> file(new FileDescriptor(fd));
+	if (capacity == 0)
+		return file;
+
+	//Make room for the file by forgetting the least recently used one
+	if (recentFiles.size() >= capacity)
+	{
+		fileMap.erase(recentFiles.back().first);
+		recentFiles.pop_back();
+	}
+
+	//Remember the file
+	recentFiles.push_front(pair<unsigned int, shared_ptr<FileDescriptor> >(key, file));
+	fileMap[key] = recentFiles.begin();
+
+	return file;
+}
+
+void FileDescriptorCache::clear()
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	fileMap.clear();
+	recentFiles.clear();
+}
+
+#endif
@@ -0,0 +1,57 @@
+// Name:
+// FileDescriptorCache.h
+// Description:
+// Header file for FileDescriptorCache class
+// FileDescriptorCache keeps the most recently used files within a directory open, so reading a hot file doesn't pay for an open and close every time.
+// Files are opened relative to a directory descriptor owned by the caller, and are closed once they've been evicted and nobody is reading from them.
+// Notes:
+// OS-Aware
+// POSIX only, file does not pollute with OS-Headers.
+
+#ifndef FILE_DESCRIPTOR_CACHE_H
+#define FILE_DESCRIPTOR_CACHE_H
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+using namespace std;
+
+#include "Lockable.h"
+
+//An open file descriptor, closed when destroyed.
+class FileDescriptor
+{
+private:
+	FileDescriptor(const FileDescriptor& fileDescriptor) = delete;
+	FileDescriptor& operator =(const FileDescriptor& fileDescriptor) = delete;
+public:
+	const int fd;
+	FileDescriptor(int fd);
+	~FileDescriptor();
+};
+
+class FileDescriptorCache : public Lockable
+{
+private:
+	int directoryFd;
+	unsigned int capacity;
+	//Open files, most recently used at the front. Files are identified by a key chosen by the caller.
+	list<pair<unsigned int, shared_ptr<FileDescriptor> > > recentFiles;
+	unordered_map<unsigned int, list<pair<unsigned int, shared_ptr<FileDescriptor> > >::iterator> fileMap;
+
+	FileDescriptorCache(const FileDescriptorCache& fileDescriptorCache) = delete;
+	FileDescriptorCache& operator =(const FileDescriptorCache& fileDescriptorCache) = delete;
+
+public:
+	//directoryFd must stay open for as long as the cache exists
+	FileDescriptorCache(int directoryFd, unsigned int capacity);
+	~FileDescriptorCache();
+
+	//Gets an open descriptor for the file identified by key, opening path relative to the directory if it isn't already open.
+	//Returns an empty pointer if the file can't be opened. Keep the pointer for as long as the descriptor is being used.
+	shared_ptr<FileDescriptor> acquire(unsigned int key, const char *path);
+	//Forgets all of the open files, they're closed once nobody is using them.
+	void clear();
+};
+
+#endif
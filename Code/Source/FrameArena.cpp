@@ -0,0 +1,119 @@
+// Name:
+// FrameArena.cpp
+// Description:
+// Implementation file for FrameArena class
+// Notes:
+// OS-Unaware
+
+#include "CustomMemory.h"
+
+#include <cstring>
+using namespace std;
+
+#include "FrameArena.h"
+
+//Room left for the block header, rounded so the memory after it starts aligned
+static const size_t blockHeaderSize = 16 * ((sizeof(void*) * 3 + 15) / 16);
+
+//Returns the offset in to a block's memory of the next allocation aligned to alignment
+static inline size_t alignedOffset(char *memory, size_t used, size_t alignment)
+{
+	size_t address = reinterpret_cast<size_t>(memory + used);
+	return used + ((alignment - address % alignment) % alignment);
+}
+
+FrameArena::FrameArena(size_t blockSize) : blockSize(blockSize), tickBytes(0), tickAllocations(0)
+{
+	firstBlock = reinterpret_cast<ArenaBlock*>(new char[blockHeaderSize + blockSize]);
+	firstBlock->next = nullptr;
+	firstBlock->size = blockSize;
+	firstBlock->used = 0;
+	currentBlock = firstBlock;
+
+	stats.lastTickBytes = 0;
+	stats.highWaterBytes = 0;
+	stats.lastTickAllocations = 0;
+	stats.reservedBytes = blockSize;
+	stats.blocks = 1;
+	stats.ticks = 0;
+}
+
+FrameArena::~FrameArena()
+{
+	ArenaBlock *block = firstBlock;
+	while (block != nullptr)
+	{
+		ArenaBlock *next = block->next;
+		delete[] reinterpret_cast<char*>(block);
+		block = next;
+	}
+}
+
+void FrameArena::nextBlock(size_t size, size_t alignment)
+{
+	ArenaBlock *block = currentBlock->next;
+	if (block != nullptr && alignedOffset(reinterpret_cast<char*>(block) + blockHeaderSize, 0, alignment) + size <= block->size)
+	{
+		block->used = 0;
+		currentBlock = block;
+		return;
+	}
+
+	//None of the kept blocks are next, or it's too small, so add one big enough after the current block
+	size_t newSize = size + alignment > blockSize ? size + alignment : blockSize;
+	block = reinterpret_cast<ArenaBlock*>(new char[blockHeaderSize + newSize]);
+	block->next = currentBlock->next;
+	block->size = newSize;
+	block->used = 0;
+	currentBlock->next = block;
+	currentBlock = block;
+
+	stats.reservedBytes += newSize;
+	stats.blocks++;
+}
+
+void *FrameArena::allocate(size_t size, size_t alignment)
+{
+	char *memory = reinterpret_cast<char*>(currentBlock) + blockHeaderSize;
+	size_t offset = alignedOffset(memory, currentBlock->used, alignment);
+	if (offset + size > currentBlock->size)
+	{
+		nextBlock(size, alignment);
+		memory = reinterpret_cast<char*>(currentBlock) + blockHeaderSize;
+		offset = alignedOffset(memory, 0, alignment);
+	}
+
+	tickBytes += offset + size - currentBlock->used;
+	tickAllocations++;
+	currentBlock->used = offset + size;
+	return memory + offset;
+}
+
+void FrameArena::reset()
+{
+#ifdef _DEBUG
+	//Poison everything handed out this tick, so memory used after the tick ends is easy to spot
+	for (ArenaBlock *block = firstBlock; block != currentBlock->next; block = block->next)
+	{
+		memset(reinterpret_cast<char*>(block) + blockHeaderSize, 0xDD, block->used);
+		block->used = 0;
+	}
+#endif
+
+	stats.lastTickBytes = tickBytes;
+	stats.lastTickAllocations = tickAllocations;
+	if (tickBytes > stats.highWaterBytes)
+		stats.highWaterBytes = tickBytes;
+	stats.ticks++;
+
+	//Later blocks have their offsets cleared as they're moved in to
+	tickBytes = 0;
+	tickAllocations = 0;
+	firstBlock->used = 0;
+	currentBlock = firstBlock;
+}
+
+FrameArenaStats FrameArena::getStats() const
+{
+	return stats;
+}
@@ -0,0 +1,122 @@
+// Name:
+// FrameArena.h
+// Description:
+// Header file for FrameArena class and FrameAllocator template
+// A FrameArena hands out scratch memory that only has to last until the end of the current tick, such as temporary strings and lists built by processes and views.
+// Allocations are taken from the front of a block by moving an offset, and nothing is freed on it's own. GameEngine resets it's arena at the end of every tick, which rewinds to the first block without freeing anything.
+// When a tick needs more than the first block, further blocks are chained on and kept for later ticks, so a busy tick only costs allocations the first time.
+// In debug builds reset fills everything that was handed out with 0xDD, so pointers kept past the end of the tick show up as garbage instead of quietly working.
+// FrameAllocator lets STL containers allocate from an arena, see FrameString and FrameVector. Deallocating through it does nothing.
+// A FrameArena isn't thread safe. Use the GameEngine's arena only from the thread running the tick.
+// Notes:
+// OS-Unaware
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct FrameArenaStats
+{
+	//Bytes handed out in the last tick, including alignment padding
+	size_t lastTickBytes;
+	//Most bytes handed out in any one tick
+	size_t highWaterBytes;
+	//Allocations made in the last tick
+	unsigned int lastTickAllocations;
+	//Bytes held in blocks, used or not
+	size_t reservedBytes;
+	unsigned int blocks;
+	unsigned int ticks;
+};
+
+class FrameArena
+{
+private:
+	//Header at the start of each block, the memory handed out follows it
+	struct ArenaBlock
+	{
+		ArenaBlock *next;
+		size_t size;
+		size_t used;
+	};
+
+	ArenaBlock *firstBlock;
+	ArenaBlock *currentBlock;
+	size_t blockSize;
+	size_t tickBytes;
+	unsigned int tickAllocations;
+	FrameArenaStats stats;
+
+	//Moves to the next block with room for size bytes aligned to alignment, adding one after the current block if none of the kept ones are big enough
+	void nextBlock(size_t size, size_t alignment);
+
+	FrameArena(const FrameArena& frameArena) = delete;
+	FrameArena& operator =(const FrameArena& frameArena) = delete;
+
+public:
+	//blockSize is the size of the first block, and the smallest any later block is
+	FrameArena(size_t blockSize = 64 * 1024);
+	~FrameArena();
+
+	//Returns size bytes aligned to alignment, which must be a power of 2. The memory is only valid until the next reset.
+	void *allocate(size_t size, size_t alignment = alignof(max_align_t));
+	//Makes everything allocated since the last reset invalid and records the tick's stats
+	void reset();
+
+	FrameArenaStats getStats() const;
+};
+
+//STL allocator that takes memory from a FrameArena. Containers using it must be gone by the time the arena is reset.
+template<class T>
+class FrameAllocator
+{
+private:
+	FrameArena *arena;
+
+	template<class U>
+	friend class FrameAllocator;
+
+public:
+	typedef T value_type;
+
+	FrameAllocator(FrameArena &arena) : arena(&arena)
+	{
+	}
+
+	template<class U>
+	FrameAllocator(const FrameAllocator<U> &frameAllocator) : arena(frameAllocator.arena)
+	{
+	}
+
+	T *allocate(size_t count)
+	{
+		return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+	}
+
+	//Memory is only released when the arena is reset
+	void deallocate(T *, size_t)
+	{
+	}
+
+	template<class U>
+	bool operator ==(const FrameAllocator<U> &frameAllocator) const
+	{
+		return arena == frameAllocator.arena;
+	}
+
+	template<class U>
+	bool operator !=(const FrameAllocator<U> &frameAllocator) const
+	{
+		return arena != frameAllocator.arena;
+	}
+};
+
+typedef basic_string<char, char_traits<char>, FrameAllocator<char> > FrameString;
+template<class T>
+using FrameVector = vector<T, FrameAllocator<T> >;
+
+#endif
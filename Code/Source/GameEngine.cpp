@@ -15,14 +15,28 @@ using namespace std;
 #include "GameView.h"
 #include "Process.h"
 #include "EngineMsg.h"
+#include "EmbeddedResourceSource.h"
 
-GameEngine::GameEngine()
+//Directory the engine's resources are read from, files in it override the boot resources
+const char *const resourceDirectory = "Resources";
+//Most bytes of resources the engine's cache holds at once
+const unsigned long long resourceCacheSize = 64 * 1024 * 1024;
+
+//Generated from Game\Boot by ResourcePacker when the engine is built
+extern const EmbeddedResourcePack bootResources;
+
+GameEngine::GameEngine() : resourceSource(resourceDirectory), resourceCache(resourceCacheSize, &resourceSource)
 {
 	//Set our state
 	gameState = GameState::INITIALIZING;
 	height = 0;
 	width = 0;
 	currentTick = 0;
+
+	//Mount the boot resources beneath the resource directory, so they're available even if nothing is on disk
+	MemoryTagScope memoryTagScope(MemoryTag::Resource);
+	resourceSource.mount(new EmbeddedResourceSource(bootResources), "Boot");
+	resourceSource.open();
 }
 
 GameEngine::~GameEngine()
@@ -33,6 +47,7 @@ GameEngine::~GameEngine()
 void GameEngine::tick()
 {
 	lock_guard<recursive_mutex> objectLock(objectMutex);
+	MemoryTagScope memoryTagScope(MemoryTag::Engine);
 
 	if (gameState == GameState::SHUT_DOWN)
 		return;
@@ -42,10 +57,16 @@ void GameEngine::tick()
 	{
 		shared_ptr<Process> process = it->second;
 		it = processList.erase(it);
-		process = process->trigger();
+		{
+			MemoryTagScope memoryTagScope(MemoryTag::Process);
+			process = process->trigger();
+		}
 		if (process)
 			processList.insert(multimap<unsigned int, shared_ptr<Process>>::value_type(process->triggerTick, process));
 	}
+
+	//Everything allocated from the arena this tick is done with
+	frameArena.reset();
 }
 
 void GameEngine::sendMsg(const shared_ptr<EngineMsg>& msg)
@@ -56,8 +77,12 @@ void GameEngine::sendMsg(const shared_ptr<EngineMsg>& msg)
 		gameState = GameState::SHUT_DOWN;
 	}
 	//Push msgs in to queue.
-	msgQueue.push_back(msg);
+	{
+		MemoryTagScope memoryTagScope(MemoryTag::Message);
+		msgQueue.push_back(msg);
+	}
 	//Push msgs to views. Later on, get the messages to filter based upon view.
+	MemoryTagScope memoryTagScope(MemoryTag::View);
 	for (list<shared_ptr<GameView>>::iterator it = viewList.begin(); it != viewList.end(); it++)
 	{
 		(**it).sendMsg(msg);
@@ -82,3 +107,19 @@ GameState GameEngine::getGameState()
 {
 	return gameState;
 }
+
+FrameArena &GameEngine::getFrameArena()
+{
+	return frameArena;
+}
+
+FrameArenaStats GameEngine::getFrameArenaStats()
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	return frameArena.getStats();
+}
+
+ResourceCache &GameEngine::getResourceCache()
+{
+	return resourceCache;
+}
@@ -3,6 +3,8 @@
 // Description:
 // Header file for GameEngine class
 // GameEngine is the central class in Natural Fury. It is used to pass messages back and forth between components.
+// Processes and views can take scratch memory that only lasts until the end of the tick from the engine's FrameArena (see FrameArena.h), which is reset at the end of every tick.
+// Resources are loaded through the engine's ResourceCache, from the zips and directories in the Resources directory over the boot resources compiled in to the executable (see EmbeddedResourceSource.h).
 // Notes:
 // OS-Unaware
 
@@ -17,6 +19,9 @@ using namespace std;
 
 #include "EngineMsg.h"
 #include "Lockable.h"
+#include "FrameArena.h"
+#include "MasterDirectoryResourceSource.h"
+#include "ResourceCache.h"
 
 class GameView;
 class Process;
@@ -38,6 +43,9 @@ private:
 	list<shared_ptr<GameView>> viewList;
 	multimap<unsigned int, shared_ptr<Process>> processList;
 	unsigned int currentTick;
+	FrameArena frameArena;
+	MasterDirectoryResourceSource resourceSource;
+	ResourceCache resourceCache;
 
 	GameEngine(const GameEngine& gameEngine) = delete;
 	GameEngine& operator =(const GameEngine& gameEngine) = delete;
@@ -51,6 +59,12 @@ public:
 	void addView(shared_ptr<GameView> view);
 	void addProcess(shared_ptr<Process> process);
 	GameState getGameState();
+	//Returns the arena for memory that's only needed until the end of the current tick. Only use it from the thread running the tick.
+	FrameArena &getFrameArena();
+	//Returns how much of the arena the last tick used, and the most any tick has
+	FrameArenaStats getFrameArenaStats();
+	//Returns the cache resources are loaded through
+	ResourceCache &getResourceCache();
 };
 
 #endif
@@ -0,0 +1,319 @@
+// Name:
+// HeapDump.cpp
+// Description:
+// Implementation file for HeapDumpWriter and HeapDumpReader classes
+// Notes:
+// OS-Unaware
+
+#include "HeapDump.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+static const char heapDumpMagic[8] = { 'N', 'F', 'H', 'E', 'A', 'P', 0, 0 };
+//Bytes of records gathered before they're written to the file
+const size_t heapDumpBufferSize = 64 * 1024;
+//Names the writer's table starts with room for
+const unsigned int initialStringSlots = 256;
+
+static inline unsigned int hashString(const char *str, unsigned int slots)
+{
+	return static_cast<unsigned int>((reinterpret_cast<size_t>(str) >> 3) * 2654435761u) & (slots - 1);
+}
+
+HeapDumpWriter::HeapDumpWriter() : file(nullptr), buffer(nullptr), bufferUsed(0), stringKeys(nullptr), stringIds(nullptr), stringSlots(0), stringCount(0), allocationCount(0), allocationBytes(0), failed(false)
+{
+}
+
+HeapDumpWriter::~HeapDumpWriter()
+{
+	if (file != nullptr)
+		close();
+	free(buffer);
+	free(stringKeys);
+	free(stringIds);
+}
+
+bool HeapDumpWriter::open(const string &fileName)
+{
+	buffer = reinterpret_cast<unsigned char*>(malloc(heapDumpBufferSize));
+	stringKeys = reinterpret_cast<const char**>(calloc(initialStringSlots, sizeof(const char*)));
+	stringIds = reinterpret_cast<unsigned int*>(malloc(initialStringSlots * sizeof(unsigned int)));
+	if (buffer == nullptr || stringKeys == nullptr || stringIds == nullptr)
+		return false;
+	stringSlots = initialStringSlots;
+
+	file = fopen(fileName.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+
+	put(heapDumpMagic, sizeof(heapDumpMagic));
+	putU32(heapDumpVersion);
+	putU32(sizeof(void*));
+	return true;
+}
+
+void HeapDumpWriter::put(const void *data, size_t size)
+{
+	if (bufferUsed + size > heapDumpBufferSize)
+		flush();
+	memcpy(buffer + bufferUsed, data, size);
+	bufferUsed += size;
+}
+
+void HeapDumpWriter::putU8(unsigned char value)
+{
+	put(&value, 1);
+}
+
+void HeapDumpWriter::putU32(unsigned int value)
+{
+	unsigned char bytes[4];
+	for (unsigned int I = 0; I < 4; I++)
+		bytes[I] = static_cast<unsigned char>(value >> (I * 8));
+	put(bytes, 4);
+}
+
+void HeapDumpWriter::putU64(unsigned long long value)
+{
+	unsigned char bytes[8];
+	for (unsigned int I = 0; I < 8; I++)
+		bytes[I] = static_cast<unsigned char>(value >> (I * 8));
+	put(bytes, 8);
+}
+
+void HeapDumpWriter::flush()
+{
+	if (bufferUsed > 0 && fwrite(buffer, 1, bufferUsed, file) != bufferUsed)
+		failed = true;
+	bufferUsed = 0;
+}
+
+void HeapDumpWriter::growStrings()
+{
+	unsigned int newSlots = stringSlots * 2;
+	const char **newKeys = reinterpret_cast<const char**>(calloc(newSlots, sizeof(const char*)));
+	unsigned int *newIds = reinterpret_cast<unsigned int*>(malloc(newSlots * sizeof(unsigned int)));
+	if (newKeys == nullptr || newIds == nullptr)
+	{
+		//Keep using the full table, names it can't hold are just written again
+		free(newKeys);
+		free(newIds);
+		return;
+	}
+
+	for (unsigned int I = 0; I < stringSlots; I++)
+	{
+		if (stringKeys[I] == nullptr)
+			continue;
+		unsigned int slot = hashString(stringKeys[I], newSlots);
+		while (newKeys[slot] != nullptr)
+			slot = (slot + 1) & (newSlots - 1);
+		newKeys[slot] = stringKeys[I];
+		newIds[slot] = stringIds[I];
+	}
+	free(stringKeys);
+	free(stringIds);
+	stringKeys = newKeys;
+	stringIds = newIds;
+	stringSlots = newSlots;
+}
+
+unsigned int HeapDumpWriter::getStringId(const char *str)
+{
+	if (str == nullptr)
+		str = "Unknown";
+
+	unsigned int slot = hashString(str, stringSlots);
+	while (stringKeys[slot] != nullptr)
+	{
+		if (stringKeys[slot] == str)
+			return stringIds[slot];
+		slot = (slot + 1) & (stringSlots - 1);
+	}
+
+	unsigned int id = stringCount++;
+	size_t length = strlen(str);
+	putU8(static_cast<unsigned char>(HeapDumpRecord::String));
+	putU32(id);
+	putU32(static_cast<unsigned int>(length));
+	//Names longer than the buffer go straight to the file
+	if (length > heapDumpBufferSize)
+	{
+		flush();
+		if (fwrite(str, 1, length, file) != length)
+			failed = true;
+	}
+	else
+		put(str, length);
+
+	//Keep the table under half full, if it can't grow it stops remembering new names
+	if ((stringCount + 1) * 2 > stringSlots)
+		growStrings();
+	if ((stringCount + 1) * 2 <= stringSlots)
+	{
+		slot = hashString(str, stringSlots);
+		while (stringKeys[slot] != nullptr)
+			slot = (slot + 1) & (stringSlots - 1);
+		stringKeys[slot] = str;
+		stringIds[slot] = id;
+	}
+	return id;
+}
+
+void HeapDumpWriter::writeAllocation(const AllocData &allocData)
+{
+	unsigned int fileId = getStringId(allocData.sourceFile);
+	unsigned int funcId = getStringId(allocData.funcName);
+	putU8(static_cast<unsigned char>(HeapDumpRecord::Allocation));
+	putU64(reinterpret_cast<size_t>(allocData.ptr));
+	putU64(allocData.size);
+	putU32(fileId);
+	putU32(funcId);
+	putU32(allocData.lineNum);
+	allocationCount++;
+	allocationBytes += allocData.size;
+}
+
+bool HeapDumpWriter::close()
+{
+	if (file == nullptr)
+		return false;
+
+	putU8(static_cast<unsigned char>(HeapDumpRecord::End));
+	putU64(allocationCount);
+	putU64(allocationBytes);
+	flush();
+	if (fclose(file) != 0)
+		failed = true;
+	file = nullptr;
+	return !failed;
+}
+
+void HeapDumpWriter::abandon()
+{
+	if (file == nullptr)
+		return;
+
+	flush();
+	fclose(file);
+	file = nullptr;
+}
+
+HeapDumpReader::HeapDumpReader() : file(nullptr), complete(false), endAllocations(0), endBytes(0)
+{
+}
+
+HeapDumpReader::~HeapDumpReader()
+{
+	if (file != nullptr)
+		fclose(file);
+}
+
+bool HeapDumpReader::get(void *data, size_t size)
+{
+	return fread(data, 1, size, file) == size;
+}
+
+bool HeapDumpReader::getU32(unsigned int &value)
+{
+	unsigned char bytes[4];
+	if (!get(bytes, 4))
+		return false;
+	value = 0;
+	for (unsigned int I = 0; I < 4; I++)
+		value |= static_cast<unsigned int>(bytes[I]) << (I * 8);
+	return true;
+}
+
+bool HeapDumpReader::getU64(unsigned long long &value)
+{
+	unsigned char bytes[8];
+	if (!get(bytes, 8))
+		return false;
+	value = 0;
+	for (unsigned int I = 0; I < 8; I++)
+		value |= static_cast<unsigned long long>(bytes[I]) << (I * 8);
+	return true;
+}
+
+bool HeapDumpReader::open(const string &fileName)
+{
+	file = fopen(fileName.c_str(), "rb");
+	if (file == nullptr)
+		return false;
+
+	char magic[sizeof(heapDumpMagic)];
+	unsigned int version;
+	unsigned int pointerSize;
+	return get(magic, sizeof(magic)) && memcmp(magic, heapDumpMagic, sizeof(magic)) == 0 && getU32(version) && version == heapDumpVersion && getU32(pointerSize);
+}
+
+bool HeapDumpReader::next(HeapDumpAllocation &allocation)
+{
+	if (file == nullptr || complete)
+		return false;
+
+	unsigned char type;
+	while (get(&type, 1))
+	{
+		if (type == static_cast<unsigned char>(HeapDumpRecord::String))
+		{
+			unsigned int id;
+			unsigned int length;
+			if (!getU32(id) || !getU32(length) || id != strings.size())
+				return false;
+			//Read the name a piece at a time, so a damaged length can't make the reader allocate more than is left in the file
+			string str;
+			char piece[4096];
+			while (str.length() < length)
+			{
+				size_t size = min(static_cast<size_t>(length) - str.length(), sizeof(piece));
+				if (!get(piece, size))
+					return false;
+				str.append(piece, size);
+			}
+			strings.push_back(str);
+		}
+		else if (type == static_cast<unsigned char>(HeapDumpRecord::Allocation))
+		{
+			if (!getU64(allocation.address) || !getU64(allocation.size) || !getU32(allocation.sourceFileId) || !getU32(allocation.funcNameId) || !getU32(allocation.lineNum))
+				return false;
+			//Names are always written before the first allocation using them
+			return allocation.sourceFileId < strings.size() && allocation.funcNameId < strings.size();
+		}
+		else if (type == static_cast<unsigned char>(HeapDumpRecord::End))
+		{
+			complete = getU64(endAllocations) && getU64(endBytes);
+			return false;
+		}
+		else
+			return false;
+	}
+	return false;
+}
+
+const string &HeapDumpReader::getString(unsigned int id) const
+{
+	return strings[id];
+}
+
+bool HeapDumpReader::isComplete() const
+{
+	return complete;
+}
+
+unsigned long long HeapDumpReader::getEndAllocations() const
+{
+	return endAllocations;
+}
+
+unsigned long long HeapDumpReader::getEndBytes() const
+{
+	return endBytes;
+}
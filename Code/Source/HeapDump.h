@@ -0,0 +1,121 @@
+// Name:
+// HeapDump.h
+// Description:
+// Header file for HeapDumpWriter and HeapDumpReader classes
+// A heap dump is a binary file listing every tracked allocation that hadn't been freed when it was written (see dumpAllocs in CustomMemory.h). HeapDumpReport turns one in to reports of the sites holding the most memory.
+// The file starts with the 8 bytes "NFHEAP" and two zeros, followed by the version and the size of a pointer in the program that wrote it, both 4 bytes.
+// After that comes a list of records, each starting with a byte giving it's type (see HeapDumpRecord):
+//   String: 4 byte id, 4 byte length, then the characters. Ids count up from 0, and each file and function name is written once before the first allocation using it.
+//   Allocation: 8 byte address, 8 byte size, 4 byte ids of the source file and function, 4 byte line number.
+//   End: 8 byte count of the allocations and 8 byte total of their sizes. A dump without one was cut short.
+// Numbers are little-endian.
+// Like AllocMap, the writer doesn't use the c++ new/delete functions itself, so the tracker can use it while walking it's maps.
+// Notes:
+// OS-Unaware
+
+#ifndef HEAP_DUMP_H
+#define HEAP_DUMP_H
+
+#include <cstdio>
+#include <cstddef>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "AllocMap.h"
+
+const unsigned int heapDumpVersion = 1;
+
+enum class HeapDumpRecord : unsigned char
+{
+	String = 1,
+	Allocation = 2,
+	End = 3
+};
+
+class HeapDumpWriter
+{
+private:
+	FILE *file;
+	//Records waiting to be written to the file
+	unsigned char *buffer;
+	size_t bufferUsed;
+	//Hash table of the names already written, keyed by their pointers since the compiler pools them. Empty slots hold nullptr.
+	const char **stringKeys;
+	unsigned int *stringIds;
+	unsigned int stringSlots;
+	unsigned int stringCount;
+	unsigned long long allocationCount;
+	unsigned long long allocationBytes;
+	bool failed;
+
+	void put(const void *data, size_t size);
+	void putU8(unsigned char value);
+	void putU32(unsigned int value);
+	void putU64(unsigned long long value);
+	void flush();
+	//Returns the id of a name, writing it's String record the first time it's seen
+	unsigned int getStringId(const char *str);
+	void growStrings();
+
+	HeapDumpWriter(const HeapDumpWriter& heapDumpWriter) = delete;
+	HeapDumpWriter& operator =(const HeapDumpWriter& heapDumpWriter) = delete;
+
+public:
+	HeapDumpWriter();
+	~HeapDumpWriter();
+
+	//Creates the file and writes the header. Returns false if the file can't be created.
+	bool open(const string &fileName);
+	void writeAllocation(const AllocData &allocData);
+	//Writes the End record and closes the file. Returns false if anything couldn't be written.
+	bool close();
+	//Closes the file without the End record, for a dump that couldn't be finished
+	void abandon();
+};
+
+//An allocation read from a dump
+struct HeapDumpAllocation
+{
+	unsigned long long address;
+	unsigned long long size;
+	//Ids of the names, see getString
+	unsigned int sourceFileId;
+	unsigned int funcNameId;
+	unsigned int lineNum;
+};
+
+class HeapDumpReader
+{
+private:
+	FILE *file;
+	//Names read so far, indexed by id
+	vector<string> strings;
+	bool complete;
+	unsigned long long endAllocations;
+	unsigned long long endBytes;
+
+	bool get(void *data, size_t size);
+	bool getU32(unsigned int &value);
+	bool getU64(unsigned long long &value);
+
+	HeapDumpReader(const HeapDumpReader& heapDumpReader) = delete;
+	HeapDumpReader& operator =(const HeapDumpReader& heapDumpReader) = delete;
+
+public:
+	HeapDumpReader();
+	~HeapDumpReader();
+
+	//Opens a dump and checks it's header. Returns false if the file can't be read or isn't a dump of a version this reader knows.
+	bool open(const string &fileName);
+	//Reads the next allocation. Returns false once there are none left, or the rest of the file can't be read, and isComplete tells which.
+	bool next(HeapDumpAllocation &allocation);
+	//Returns the name with an id given by an allocation
+	const string &getString(unsigned int id) const;
+	//Whether the End record was reached, and the count and bytes it gave
+	bool isComplete() const;
+	unsigned long long getEndAllocations() const;
+	unsigned long long getEndBytes() const;
+};
+
+#endif
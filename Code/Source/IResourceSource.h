@@ -12,23 +12,81 @@
 #include <string>
 #include <vector>
 #include <unordered_set>
+#include <memory>
+#include <functional>
 using namespace std;
+#include "ResourceIntegrity.h"
+
+class ResourceNameTable;
+
+//A request to read one resource as part of a batch
+struct RawResourceRequest
+{
+	//Resource to read, and a buffer big enough to hold it (see getRawResourceSize)
+	string resource;
+	char *buffer;
+	//Filled in once the read has finished, the size of the resource or 0 on failure
+	unsigned long long result;
+};
+
+//Identifies a resource's content without reading it. Resources with different keys have different content, resources with the same key probably have the same content.
+struct ResourceContentKey
+{
+	unsigned long long size;
+	unsigned int crc;
+
+	bool operator <(const ResourceContentKey& other) const
+	{
+		return size < other.size || (size == other.size && crc < other.crc);
+	}
+};
 
 class IResourceSource
 {
 public:
 	//Call Open once a ResourceSource is constructed.
 	virtual bool open() = 0;
-	//Call getRawResourceSize to get the size of a resource to allocate space for it
-	virtual int getRawResourceSize(const string &resource) const = 0;
-	//Use this to get a resource, make sure buffer has enough space with getRawResourceSize.
-	virtual int getRawResource(const string &resource, char * buffer) const = 0;
+	//Call getRawResourceSize to get the size of a resource to allocate space for it. Sizes are 64 bit, resources and the archives holding them can be over 4GB.
+	virtual unsigned long long getRawResourceSize(const string &resource) const = 0;
+	//Use this to get a resource, make sure buffer has enough space with getRawResourceSize. Returns the size of the resource or 0 on failure.
+	virtual unsigned long long getRawResource(const string &resource, char * buffer) const = 0;
+	//Reads several resources at once, calling onComplete for each request as it finishes. Requests may complete in any order.
+	//Sources that can overlap their reads override this, by default each resource is read in turn with getRawResource.
+	virtual void getRawResources(vector<RawResourceRequest> &requests, const function<void(RawResourceRequest&)> &onComplete) const
+	{
+		for (vector<RawResourceRequest>::iterator it = requests.begin(); it != requests.end(); it++)
+		{
+			it->result = getRawResource(it->resource, it->buffer);
+			onComplete(*it);
+		}
+	}
 	//Returns the number of resources in a ResourceSource
 	virtual int getNumResources() const = 0;
-	//Returns the name of a resource based on it's number. O(n) function, don't use unless absolutely needed. Function may be deleted.
+	//Returns the name of a resource based on it's number. Resources are numbered in name order.
 	virtual string getResourceName(int num) const = 0;
-	//Returns a list of the resources in the ResourceSource.
+	//Returns a copy of the list of the resources in the ResourceSource. Prefer getNameTable, which doesn't copy anything.
 	virtual unordered_set<string> getResourceList() const = 0;
+	//Returns the table of names of the resources in the ResourceSource. The table is shared and never changes once the source is open.
+	virtual shared_ptr<const ResourceNameTable> getNameTable() const = 0;
+	//Returns whether the source has a resource. Answered from the name table built at open, without locking, allocating or logging, so it's cheap enough to probe for optional resources.
+	virtual bool hasResource(const string &resource) const = 0;
+	//Sets when resources are checked against their CRC, see ResourceIntegrity.h. A resource that fails it's check is read as size 0.
+	//Sources that have no way of checking their resources ignore this.
+	virtual void setIntegrityMode(IntegrityMode) {}
+	//Returns counts of the CRC checks made by the source
+	virtual IntegrityStats getIntegrityStats() const { return IntegrityStats(); }
+	//Gets the content key of a resource from the source's index. Returns false if the source doesn't know the resource's CRC without reading it.
+	virtual bool getContentKey(const string &, ResourceContentKey &) const { return false; }
+	//Returns the name of the resource whose content is shared by every resource with the same bytes as resource, which may be resource itself.
+	//Sources that don't look for duplicate content return resource.
+	virtual string getContentName(const string &resource) const { return resource; }
+	//Returns false if resource's content name was found without comparing their bytes. Whoever first has both in memory should compare them and call setContentVerified.
+	virtual bool isContentVerified(const string &) const { return true; }
+	//Records whether a resource matched the content it was compared with. A resource that didn't is given it's own content name.
+	virtual void setContentVerified(const string &, bool) const {}
+	//Returns the resource's bytes if the source keeps them in memory for as long as it exists, so they can be used without copying them. The size is getRawResourceSize.
+	//Sources that read their resources from somewhere return nullptr.
+	virtual const char *getResourceData(const string &) const { return nullptr; }
 	virtual ~IResourceSource(){};
 };
 
@@ -109,6 +109,7 @@ void writeLog(const string &file, const string &message, LogLevel logLevel, cons
 
 Logger::Logger(string initializationFile, string generalLog) : generalStream(generalLog.c_str(), ios_base::out), warningStream("Warning.log", ios_base::out), errorStream("Error.log", ios_base::out)
 {
+	MemoryTagScope memoryTagScope(MemoryTag::Logging);
 	//Load logger settings from XML document
 	TiXmlDocument doc(initializationFile.c_str());
 	doc.LoadFile();
@@ -151,6 +152,7 @@ Logger::~Logger()
 
 void Logger::writeLog(const string &message, LogLevel logLevel, const initializer_list<string> &tags, const char *funcName, const char* sourceFile, unsigned int lineNum)
 {
+	MemoryTagScope memoryTagScope(MemoryTag::Logging);
 	//Create the debug message
 	//Format is '[Level]YYYY-MM-DD HH:MM:SS "Message" sourceFile, functionname(line lineNumber)'
 	stringstream debugMessage;
@@ -170,6 +172,8 @@ void Logger::writeLog(const string &message, LogLevel logLevel, const initialize
 	if (tags.size() > 0)
 	{
 		set<ThreadSafeStream<fstream>*> outputStreams;
+		//Lock while looking up streams, the log may be written to from several threads at once
+		unique_lock<recursive_mutex> objectLock(objectMutex);
 		//Cycle through the tags...
 		for (initializer_list<string>::iterator it = tags.begin(); it != tags.end(); it++)
 		{
@@ -183,7 +187,6 @@ void Logger::writeLog(const string &message, LogLevel logLevel, const initialize
 					//If the stream isn't opened, open it
 					if (logStreams.count(tagDefinition.file) == 0)
 					{
-						lock_guard<recursive_mutex> objectLock(objectMutex);
 						logStreams[tagDefinition.file] = new ThreadSafeStream<fstream>(escapeFileName(tagDefinition.file).c_str(), ios_base::out);
 					}
 					//Add the stream to the list of streams we want to write to
@@ -191,6 +194,7 @@ void Logger::writeLog(const string &message, LogLevel logLevel, const initialize
 				}
 			}
 		}
+		objectLock.unlock();
 		//Write to the steams, assuming there are any.
 		if (outputStreams.size() > 0)
 		{
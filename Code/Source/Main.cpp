@@ -14,6 +14,7 @@ using namespace std;
 #include "GameEngine.h"
 #include "LocalPlayerView.h"
 #include "Logger.h"
+#include "MemoryMonitor.h"
 
 /*      Screen/display attributes*/
 int width = 800;
@@ -39,10 +40,18 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 	bool    done;                   //flag for completion of app
 
 	appLogger = new Logger("LogInit.xml", "General.log");
+	MemoryMonitor *memoryMonitor = new MemoryMonitor(appLogger);
 
 	//Create GameEngnie
-	gameEngine = new GameEngine();
-	gameEngine->addView(shared_ptr<GameView>(new LocalPlayerView()));
+	{
+		MemoryTagScope memoryTagScope(MemoryTag::Engine);
+		gameEngine = new GameEngine();
+	}
+	memoryMonitor->setGameEngine(gameEngine);
+	{
+		MemoryTagScope memoryTagScope(MemoryTag::View);
+		gameEngine->addView(shared_ptr<GameView>(new LocalPlayerView()));
+	}
 
 	done = false;   //initialize loop condition variable
 
@@ -69,6 +78,7 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 			nextTick += 16;
 			//Proceses a tick
 			gameEngine->tick();
+			memoryMonitor->checkBudgets();
 			if (gameEngine->getGameState() == GameState::SHUT_DOWN)
 				PostQuitMessage(0);
 			this_thread::yield();
@@ -98,7 +108,10 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 		}
 	}
 
+	memoryMonitor->setGameEngine(nullptr);
 	delete gameEngine;
+	appLogger->eWriteLog("Memory at shut down:\n" + memoryMonitor->getReport(), LogLevel::Info, { "Memory" });
+	delete memoryMonitor;
 	delete appLogger;
 
 	string allocLog = getAllocs();
@@ -106,6 +119,8 @@ int APIENTRY WinMain(HINSTANCE hInstance,
 	if (allocLog.length() > 0)
 	{
 		staticLog("AllocLog.log", allocLog, LogLevel::Warning);
+		//The log only holds the start of the list, the dump holds all of it
+		dumpAllocs("AllocDump.nfheap");
 	}
 
 	//return the quit message parameter
@@ -6,38 +6,65 @@
 // OS-Aware
 // Uses OS-Specific functions to iterate over directory contents
 
-#include "CustomMemory.h"
-
 #include "MasterDirectoryResourceSource.h"
 
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
 
-#include <unordered_map>
 #include <unordered_set>
+#include <map>
 #include <sstream>
 #include <algorithm>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <limits>
 using namespace std;
 
 #include "Logger.h"
+#include "ResourceNameTable.h"
 #include "DirectoryResourceSource.h"
 #include "ZipResourceSource.h"
+#include "Crc32.h"
+
+//Included after the standard headers, libstdc++ can't be compiled with it's new macro defined
+#include "CustomMemory.h"
 
 extern Logger* appLogger;
 
 //Just store directory internally
-MasterDirectoryResourceSource::MasterDirectoryResourceSource(string directory) : directory(directory) {}
+MasterDirectoryResourceSource::MasterDirectoryResourceSource(string directory) : directory(directory), nameTable(new ResourceNameTable()), integrityMode(IntegrityMode::FirstLoad) {}
 
 MasterDirectoryResourceSource::~MasterDirectoryResourceSource()
 {
 	//Delete ResourceSources that were created during open.
-	for (unordered_set<IResourceSource*>::iterator it = sourceList.begin(); it != sourceList.end(); it++)
+	for (vector<IResourceSource*>::iterator it = sourceList.begin(); it != sourceList.end(); it++)
 	{
 		delete (*it);
 	}
 }
 
+void MasterDirectoryResourceSource::mount(IResourceSource *source, const string &name)
+{
+	//Mounted sources are first in the source list, so everything found by open overrides them
+	source->setIntegrityMode(integrityMode);
+	sourceList.push_back(source);
+	sourcePaths.push_back(name);
+}
+
 bool MasterDirectoryResourceSource::open()
 {
+	//Names of the zip files and directories found, paired with whether or not they're a directory
+	vector<pair<string, bool> > children;
+
+#ifdef _WIN32
 	stringstream findPath;
 	HANDLE searchHandle;
 	WIN32_FIND_DATA findData;
@@ -58,41 +85,7 @@ bool MasterDirectoryResourceSource::open()
 			//Ignore files that start with a period, these are hidden and/or system files.
 			if (findData.cFileName[0] != '.')
 			{
-				//Build path to file
-				stringstream filePath;
-				filePath << directory << "\\" << findData.cFileName;
-				//ResourceSource to be initialized
-				IResourceSource* source = nullptr;
-				//If we've found a directory, initialize a DirectoryResourceSource for it
-				if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-				{
-					source = new DirectoryResourceSource(filePath.str().c_str());
-				}
-				//Otherwise, check for a zip file
-				else
-				{
-					//Convert filename to lower case for testing
-					string temp = filePath.str().c_str();
-					transform(temp.begin(), temp.end(), temp.begin(), ::tolower);
-					//If we've got a zip file, initialize a ZipResourceSource for it
-					if (temp.substr(temp.length() - 4, 4) == ".zip")
-						source = new ZipResourceSource(filePath.str());
-				}
-				//If a source was created...
-				if (source)
-				{
-					//Open the source
-					source->open();
-					//Add the source to the sourceList so it can be deleted during destruction
-					sourceList.insert(source);
-					//Get a list of files in the source
-					unordered_set<string> files = source->getResourceList();
-					//Add all of the files from the source into our file list
-					for (unordered_set<string>::iterator it = files.begin(); it != files.end(); it++)
-					{
-						fileList[(*it)] = source;
-					}
-				}
+				children.push_back(pair<string, bool>(findData.cFileName, (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0));
 			}
 			//Get the next file
 			nextFileResult = FindNextFile(searchHandle, &findData);
@@ -105,51 +98,366 @@ bool MasterDirectoryResourceSource::open()
 	{
 		appLogger->eWriteLog("Invalid directory path " + directory, LogLevel::Warning, { "Resource" });
 	}
+#else
+	DIR *dir = opendir(directory.c_str());
+	if (dir != nullptr)
+	{
+		int dirFd = dirfd(dir);
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != nullptr)
+		{
+			//Ignore files that start with a period, these are hidden files and the . and .. entries.
+			if (entry->d_name[0] == '.')
+				continue;
+			bool isDirectory = entry->d_type == DT_DIR;
+			//Some file systems don't fill in the type, look it up instead
+			if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+			{
+				struct stat fileStat;
+				if (fstatat(dirFd, entry->d_name, &fileStat, 0) != 0)
+					continue;
+				isDirectory = S_ISDIR(fileStat.st_mode);
+			}
+			children.push_back(pair<string, bool>(entry->d_name, isDirectory));
+		}
+		closedir(dir);
+	}
+	//Something went wrong attempting to search the files in the directory.
+	else
+	{
+		appLogger->eWriteLog("Invalid directory path " + directory, LogLevel::Warning, { "Resource" });
+	}
+#endif
+
+	//Sort the children by name so that the override order is the same on every run, regardless of the order the OS returns them in.
+	sort(children.begin(), children.end());
+
+	//Create a ResourceSource for each child
+	for (vector<pair<string, bool> >::iterator it = children.begin(); it != children.end(); it++)
+	{
+		//Build path to file
+#ifdef _WIN32
+		string filePath = directory + "\\" + it->first;
+#else
+		string filePath = directory + "/" + it->first;
+#endif
+		//ResourceSource to be initialized
+		IResourceSource* source = nullptr;
+		//If we've found a directory, initialize a DirectoryResourceSource for it
+		if (it->second)
+		{
+			source = new DirectoryResourceSource(filePath);
+		}
+		//Otherwise, check for a zip file
+		else
+		{
+			//Convert filename to lower case for testing
+			string temp = filePath;
+			transform(temp.begin(), temp.end(), temp.begin(), ::tolower);
+			//If we've got a zip file, initialize a ZipResourceSource for it
+			if (temp.length() > 4 && temp.substr(temp.length() - 4, 4) == ".zip")
+				source = new ZipResourceSource(filePath);
+		}
+		//If a source was created, add it to the sourceList so it can be opened, and deleted during destruction
+		if (source)
+		{
+			source->setIntegrityMode(integrityMode);
+			sourceList.push_back(source);
+			sourcePaths.push_back(filePath);
+		}
+	}
+
+	//Open all of the sources
+	openSources();
+	if (integrityMode != IntegrityMode::Never)
+		appLogger->eWriteLog(string("Checking resource CRCs with ") + getCrc32Implementation(), LogLevel::Info, { "Resource" });
+
+	//Build the name table from the files in all of the sources
+	vector<string> names;
+	for (vector<IResourceSource*>::iterator source = sourceList.begin(); source != sourceList.end(); source++)
+	{
+		shared_ptr<const ResourceNameTable> files = (*source)->getNameTable();
+		names.insert(names.end(), files->begin(), files->end());
+	}
+	nameTable.reset(new ResourceNameTable(names));
+
+	//Record which source provides each file in mount order, so files in later sources override those in earlier ones
+	fileSources.resize(nameTable->size());
+	for (vector<IResourceSource*>::iterator source = sourceList.begin(); source != sourceList.end(); source++)
+	{
+		shared_ptr<const ResourceNameTable> files = (*source)->getNameTable();
+		for (ResourceNameTable::const_iterator it = files->begin(); it != files->end(); it++)
+		{
+			fileSources[nameTable->find(*it, files->getNameLength(it.getIndex()))] = (*source);
+		}
+	}
+
+	//Look for files that are in more than one place, or under more than one name
+	findDuplicates();
 
 	return true;
 }
 
-int MasterDirectoryResourceSource::getRawResourceSize(const string &resource) const
+void MasterDirectoryResourceSource::openSources()
+{
+	//Time at which each source started and finished opening
+	struct OpenTiming
+	{
+		chrono::steady_clock::time_point start;
+		chrono::steady_clock::time_point finish;
+		bool opened;
+	};
+	vector<OpenTiming> timings(sourceList.size());
+	//Index of the next source to be opened by a worker
+	atomic<unsigned int> nextSource(0);
+	chrono::steady_clock::time_point openStart = chrono::steady_clock::now();
+
+	//Each worker opens sources until there are none left
+	auto worker = [&]()
+	{
+		unsigned int I;
+		while ((I = nextSource++) < sourceList.size())
+		{
+			timings[I].start = chrono::steady_clock::now();
+			timings[I].opened = sourceList[I]->open();
+			timings[I].finish = chrono::steady_clock::now();
+		}
+	};
+
+	//Use one worker per hardware thread, but there's no point in having more workers than sources
+	unsigned int workerCount = thread::hardware_concurrency();
+	if (workerCount == 0)
+		workerCount = 1;
+	if (workerCount > sourceList.size())
+		workerCount = sourceList.size();
+
+	//Start the extra workers, then have this thread work alongside them until all of the sources are open
+	vector<thread> workers;
+	for (unsigned int I = 1; I < workerCount; I++)
+		workers.push_back(thread(worker));
+	worker();
+	for (vector<thread>::iterator it = workers.begin(); it != workers.end(); it++)
+		it->join();
+
+	chrono::steady_clock::time_point openFinish = chrono::steady_clock::now();
+
+	//Write the startup timeline to the log, times are in milliseconds since the sources started opening
+	for (unsigned int I = 0; I < sourceList.size(); I++)
+	{
+		stringstream timeline;
+		timeline << fixed << setprecision(2);
+		timeline << (timings[I].opened ? "Opened " : "Failed to open ") << sourcePaths[I];
+		timeline << " [" << chrono::duration<double, milli>(timings[I].start - openStart).count();
+		timeline << "ms - " << chrono::duration<double, milli>(timings[I].finish - openStart).count() << "ms]";
+		timeline << " " << sourceList[I]->getNumResources() << " resources";
+		appLogger->eWriteLog(timeline.str(), LogLevel::Info, { "Resource" });
+	}
+	{
+		stringstream summary;
+		summary << fixed << setprecision(2);
+		summary << "Opened " << sourceList.size() << " sources in " << directory << " using " << workerCount << " workers in ";
+		summary << chrono::duration<double, milli>(openFinish - openStart).count() << "ms";
+		appLogger->eWriteLog(summary.str(), LogLevel::Info, { "Resource" });
+	}
+}
+
+void MasterDirectoryResourceSource::findDuplicates()
+{
+	chrono::steady_clock::time_point findStart = chrono::steady_clock::now();
+	contentIndices.reset(new atomic<unsigned int>[nameTable->size()]);
+	contentVerified.reset(new atomic<bool>[nameTable->size()]);
+	for (unsigned int I = 0; I < nameTable->size(); I++)
+	{
+		contentIndices[I] = I;
+		contentVerified[I] = true;
+	}
+
+	//Group the files by the size and CRC their source's index gives them, nothing is read. Only files whose source knows their CRC can be grouped.
+	//Files too big to fit in memory can't be compared, so they're left with their own content.
+	map<ResourceContentKey, vector<unsigned int> > candidates;
+	for (unsigned int I = 0; I < nameTable->size(); I++)
+	{
+		ResourceContentKey key;
+		if (fileSources[I]->getContentKey(nameTable->getName(I), key) && key.size > 0 && key.size <= numeric_limits<size_t>::max())
+			candidates[key].push_back(I);
+	}
+
+	//Files with the same size and CRC almost certainly match, so they share the first file's content until they're compared (see setContentVerified)
+	unsigned int duplicateFiles = 0;
+	unsigned long long duplicateBytes = 0;
+	for (map<ResourceContentKey, vector<unsigned int> >::iterator group = candidates.begin(); group != candidates.end(); group++)
+	{
+		vector<unsigned int> &files = group->second;
+		for (unsigned int I = 1; I < files.size(); I++)
+		{
+			contentIndices[files[I]] = files[0];
+			contentVerified[files[I]] = false;
+			duplicateFiles++;
+			duplicateBytes += group->first.size;
+		}
+	}
+
+	//Report what was found
+	stringstream report;
+	report << fixed << setprecision(2);
+	report << "Found " << duplicateFiles << " files with " << duplicateBytes << " bytes of content matching another file's size and CRC in " << directory << " in ";
+	report << chrono::duration<double, milli>(chrono::steady_clock::now() - findStart).count() << "ms";
+	appLogger->eWriteLog(report.str(), LogLevel::Info, { "Resource" });
+}
+
+unsigned long long MasterDirectoryResourceSource::getRawResourceSize(const string &resource) const
 {
 	//If the selected file exists...
-	if (fileList.count(resource) == 1)
+	unsigned int index = nameTable->find(resource);
+	if (index != ResourceNameTable::npos)
 		//Forward the size request to the correct ResourceSource
-		return fileList.at(resource)->getRawResourceSize(resource);
+		return fileSources[index]->getRawResourceSize(resource);
 	//If the resource isn't found, return 0.
 	return 0;
 }
 
-int MasterDirectoryResourceSource::getRawResource(const string &resource, char * buffer) const
+unsigned long long MasterDirectoryResourceSource::getRawResource(const string &resource, char * buffer) const
 {
 	//If the select file exists...
-	if (fileList.count(resource) == 1)
+	unsigned int index = nameTable->find(resource);
+	if (index != ResourceNameTable::npos)
 		//Forward the resource request to the correct ResourceSource
-		return fileList.at(resource)->getRawResource(resource, buffer);
+		return fileSources[index]->getRawResource(resource, buffer);
 	//If the resource isn't found, return 0.
 	return 0;
 }
 
+void MasterDirectoryResourceSource::getRawResources(vector<RawResourceRequest> &requests, const function<void(RawResourceRequest&)> &onComplete) const
+{
+	//Split the requests up by the source that provides them, remembering where each one came from
+	map<IResourceSource*, vector<unsigned int> > sourceRequests;
+	for (unsigned int I = 0; I < requests.size(); I++)
+	{
+		unsigned int index = nameTable->find(requests[I].resource);
+		//If the resource isn't found, it's done
+		if (index == ResourceNameTable::npos)
+		{
+			requests[I].result = 0;
+			onComplete(requests[I]);
+		}
+		else
+			sourceRequests[fileSources[index]].push_back(I);
+	}
+
+	//Forward each batch to it's source
+	for (map<IResourceSource*, vector<unsigned int> >::iterator it = sourceRequests.begin(); it != sourceRequests.end(); it++)
+	{
+		vector<RawResourceRequest> batch;
+		batch.reserve(it->second.size());
+		for (vector<unsigned int>::iterator request = it->second.begin(); request != it->second.end(); request++)
+			batch.push_back(requests[*request]);
+		it->first->getRawResources(batch, [&](RawResourceRequest &request)
+		{
+			RawResourceRequest &original = requests[it->second[&request - &batch[0]]];
+			original.result = request.result;
+			onComplete(original);
+		});
+	}
+}
+
 int MasterDirectoryResourceSource::getNumResources() const
 {
 	//Return resource count
-	return fileList.size();
+	return nameTable->size();
 }
 
 string MasterDirectoryResourceSource::getResourceName(int num) const
 {
-	//Iterate over resource list to the specified resource and return it's name
-	unordered_map<string, IResourceSource*>::const_iterator resource = fileList.begin();
-	for (int I = 0; I < num; I++)
-		++resource;
-	return resource->first;
+	//Look up the name in the name table
+	return nameTable->getName(num);
 }
 
 unordered_set<string> MasterDirectoryResourceSource::getResourceList() const
 {
-	//Copy resource from fileList to an unordered_set and return it
+	//Copy resources from the name table to an unordered_set and return it
 	unordered_set<string> result;
-	result.reserve(fileList.size());
-	for (unordered_map<string, IResourceSource*>::const_iterator it = fileList.begin(); it != fileList.end(); it++)
-		result.insert(it->first);
+	result.reserve(nameTable->size());
+	for (ResourceNameTable::const_iterator it = nameTable->begin(); it != nameTable->end(); it++)
+		result.insert(*it);
 	return result;
 }
+
+shared_ptr<const ResourceNameTable> MasterDirectoryResourceSource::getNameTable() const
+{
+	return nameTable;
+}
+
+bool MasterDirectoryResourceSource::hasResource(const string &resource) const
+{
+	return nameTable->find(resource) != ResourceNameTable::npos;
+}
+
+void MasterDirectoryResourceSource::setIntegrityMode(IntegrityMode mode)
+{
+	integrityMode = mode;
+	for (vector<IResourceSource*>::iterator it = sourceList.begin(); it != sourceList.end(); it++)
+		(*it)->setIntegrityMode(mode);
+}
+
+IntegrityStats MasterDirectoryResourceSource::getIntegrityStats() const
+{
+	IntegrityStats stats;
+	for (vector<IResourceSource*>::const_iterator it = sourceList.begin(); it != sourceList.end(); it++)
+		stats += (*it)->getIntegrityStats();
+	return stats;
+}
+
+bool MasterDirectoryResourceSource::getContentKey(const string &resource, ResourceContentKey &key) const
+{
+	//Get the key from the source that provides the file
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
+		return false;
+	return fileSources[index]->getContentKey(resource, key);
+}
+
+string MasterDirectoryResourceSource::getContentName(const string &resource) const
+{
+	//Files with duplicate content share the name of the first file found with that content
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
+		return resource;
+	return nameTable->getName(contentIndices[index]);
+}
+
+bool MasterDirectoryResourceSource::isContentVerified(const string &resource) const
+{
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
+		return true;
+	return contentVerified[index];
+}
+
+void MasterDirectoryResourceSource::setContentVerified(const string &resource, bool duplicate) const
+{
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos || contentVerified[index])
+		return;
+
+	//A file that doesn't match keeps it's own content. The index is changed first, so anyone who sees the file as verified also sees it's new content name.
+	string contentName = nameTable->getName(contentIndices[index]);
+	if (!duplicate)
+		contentIndices[index] = index;
+	contentVerified[index] = true;
+
+	stringstream report;
+	if (duplicate)
+		report << resource << " is a duplicate of " << contentName << " (" << fileSources[index]->getRawResourceSize(resource) << " bytes)";
+	else
+		report << resource << " has the same size and CRC as " << contentName << " but different content";
+	appLogger->eWriteLog(report.str(), LogLevel::Info, { "ResourceDuplicates" });
+}
+
+const char *MasterDirectoryResourceSource::getResourceData(const string &resource) const
+{
+	//Only the source that provides the file can say where it's data is, files overridden from disk aren't in memory
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
+		return nullptr;
+	return fileSources[index]->getResourceData(resource);
+}
@@ -4,6 +4,9 @@
 // Header file for MasterDirectoryResourceSource class
 // MasterDirectoryResourceSource examines all of the zip files and subdirectories within a folder and attempts to initialize a DirectoryResourceSource or ZipResourceSource for each,
 // it then merges the contents of each to give the game access to all of the files contained in all of the zips and directories.
+// Sources are opened concurrently and merged in name order, so a source overrides files from any source whose name sorts before it.
+// Files with the same size and CRC in their source's index share a content name (see getContentName). Their bytes are compared by the first cache to load both (see setContentVerified).
+// Other sources, such as an EmbeddedResourceSource, can be mounted beneath the directory's sources so files in the directory override them.
 // See IResourceSource.h for usage details.
 // Notes:
 // OS-Unaware
@@ -12,8 +15,10 @@
 #define MASTER_DIRECTORY_RESOURCE_SOURCE_H
 
 #include <string>
-#include <unordered_map>
+#include <memory>
 #include <unordered_set>
+#include <vector>
+#include <atomic>
 using namespace std;
 #include "IResourceSource.h"
 
@@ -21,17 +26,47 @@ class MasterDirectoryResourceSource : public IResourceSource
 {
 private:
 	string directory;
-	unordered_map<string, IResourceSource*> fileList;
-	unordered_set<IResourceSource*> sourceList;
+	//Source that provides each file, stored in the same order as the name table
+	vector<IResourceSource*> fileSources;
+	shared_ptr<const ResourceNameTable> nameTable;
+	//Sources in mount order, sources later in the list override files from earlier ones.
+	vector<IResourceSource*> sourceList;
+	vector<string> sourcePaths;
+	//Integrity mode given to each source
+	IntegrityMode integrityMode;
+	//Index of the file whose content each file shares, stored in the same order as the name table. Files with unique content share their own.
+	//Duplicates found by size and CRC are only compared byte for byte once a cache has loaded both, so both change after open.
+	//They're read on every load, so they're atomic instead of locked.
+	unique_ptr<atomic<unsigned int>[]> contentIndices;
+	//Whether each file's content index has been checked, stored in the same order as the name table
+	unique_ptr<atomic<bool>[]> contentVerified;
+
+	void openSources();
+	//Finds files with the same size and CRC, filling in contentIndices and contentVerified and logging how many were found. Nothing is read.
+	void findDuplicates();
 public:
 	MasterDirectoryResourceSource(string directory);
 	virtual ~MasterDirectoryResourceSource();
+	//Mounts a source beneath the directory's zips and directories, and any source mounted before it. Call before open, name is used in the log.
+	//The master takes ownership of the source and opens it with the others.
+	void mount(IResourceSource *source, const string &name);
 	virtual bool open();
-	virtual int getRawResourceSize(const string &resource) const;
-	virtual int getRawResource(const string &resource, char * buffer) const;
+	virtual unsigned long long getRawResourceSize(const string &resource) const;
+	virtual unsigned long long getRawResource(const string &resource, char * buffer) const;
+	virtual void getRawResources(vector<RawResourceRequest> &requests, const function<void(RawResourceRequest&)> &onComplete) const;
 	virtual int getNumResources() const;
 	virtual string getResourceName(int num) const;
 	virtual unordered_set<string> getResourceList() const;
+	virtual shared_ptr<const ResourceNameTable> getNameTable() const;
+	virtual bool hasResource(const string &resource) const;
+	//Sets the integrity mode of every source, including those opened later. Stats are totalled over all of the sources.
+	virtual void setIntegrityMode(IntegrityMode mode);
+	virtual IntegrityStats getIntegrityStats() const;
+	virtual bool getContentKey(const string &resource, ResourceContentKey &key) const;
+	virtual string getContentName(const string &resource) const;
+	virtual bool isContentVerified(const string &resource) const;
+	virtual void setContentVerified(const string &resource, bool duplicate) const;
+	virtual const char *getResourceData(const string &resource) const;
 };
 
 #endif
@@ -0,0 +1,210 @@
+// Name:
+// MemoryBudgetBroker.cpp
+// Description:
+// Implementation file for MemoryBudgetBroker class
+// Notes:
+// OS-Unaware
+
+#include "CustomMemory.h"
+
+#include "MemoryBudgetBroker.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <cmath>
+#include <sstream>
+using namespace std;
+
+#include "Logger.h"
+#include "ResourceCache.h"
+
+extern Logger* appLogger;
+
+//Time for a cache's pressure to fall by half once it stops loading resources
+const double pressureHalfLifeSeconds = 5.0;
+
+MemoryBudgetBroker::MemoryBudgetBroker(unsigned long long ceiling) : ceiling(ceiling), totalBudget(0), overCeiling(false) {}
+
+MemoryBudgetBroker::~MemoryBudgetBroker() {}
+
+MemoryBudgetBroker::CacheRecord *MemoryBudgetBroker::findCache(const ResourceCache *cache)
+{
+	for (vector<CacheRecord>::iterator it = caches.begin(); it != caches.end(); it++)
+	{
+		if (it->cache == cache)
+			return &*it;
+	}
+	return nullptr;
+}
+
+void MemoryBudgetBroker::decayPressure(CacheRecord &record, Clock::time_point now)
+{
+	double elapsed = chrono::duration<double>(now - record.updated).count();
+	record.stats.pressure *= pow(0.5, elapsed / pressureHalfLifeSeconds);
+	record.updated = now;
+}
+
+unsigned long long MemoryBudgetBroker::moveBudget(CacheRecord &from, CacheRecord &to, unsigned long long amount)
+{
+	amount = min(amount, from.stats.budget - from.stats.minimum);
+	if (amount == 0)
+		return 0;
+	from.stats.budget -= amount;
+	from.stats.lent += amount;
+	to.stats.budget += amount;
+	to.stats.borrowed += amount;
+	return amount;
+}
+
+void MemoryBudgetBroker::checkCeiling()
+{
+	unsigned long long used = 0;
+	for (vector<CacheRecord>::iterator it = caches.begin(); it != caches.end(); it++)
+		used += it->stats.used;
+
+	//Only going over is logged, not every load made while over
+	if (used > ceiling && !overCeiling)
+	{
+		stringstream message;
+		message << "Resource caches are using " << used << " bytes, over their ceiling of " << ceiling;
+		appLogger->eWriteLog(message.str(), LogLevel::Warning, { "Resource" });
+	}
+	overCeiling = used > ceiling;
+}
+
+unsigned long long MemoryBudgetBroker::registerCache(ResourceCache *cache, const string &name, unsigned long long minimum, unsigned long long maximum, double missWeight)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	if (minimum > ceiling - totalBudget)
+	{
+		appLogger->eWriteLog(string("Minimum size of cache ") + name + " doesn't fit under the memory ceiling", LogLevel::Warning, { "Resource" });
+		minimum = ceiling - totalBudget;
+	}
+
+	CacheRecord record;
+	record.cache = cache;
+	record.stats.name = name;
+	record.stats.minimum = minimum;
+	record.stats.maximum = max(minimum, maximum);
+	record.stats.budget = minimum;
+	record.stats.used = 0;
+	record.stats.pressure = 0;
+	record.stats.borrowed = 0;
+	record.stats.lent = 0;
+	record.missWeight = missWeight;
+	record.updated = Clock::now();
+	caches.push_back(record);
+	totalBudget += minimum;
+	return minimum;
+}
+
+void MemoryBudgetBroker::unregisterCache(ResourceCache *cache)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	for (vector<CacheRecord>::iterator it = caches.begin(); it != caches.end(); it++)
+	{
+		if (it->cache == cache)
+		{
+			totalBudget -= it->stats.budget;
+			caches.erase(it);
+			return;
+		}
+	}
+}
+
+unsigned long long MemoryBudgetBroker::reserve(ResourceCache *cache, unsigned long long allocated, unsigned long long size)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	CacheRecord *record = findCache(cache);
+	if (record == nullptr)
+		return 0;
+	Clock::time_point now = Clock::now();
+	decayPressure(*record, now);
+	record->stats.pressure += size * record->missWeight;
+	record->stats.used = allocated;
+
+	//Only borrow what's needed to fit the resource, up to the cache's maximum
+	if (allocated + size <= record->stats.budget)
+		return record->stats.budget;
+	unsigned long long needed = min(allocated + size - record->stats.budget, record->stats.maximum - record->stats.budget);
+
+	//Memory no cache has
+	unsigned long long unassigned = min(needed, ceiling - totalBudget);
+	record->stats.budget += unassigned;
+	totalBudget += unassigned;
+	needed -= unassigned;
+	if (needed == 0)
+		return record->stats.budget;
+
+	//Other caches, least pressured first
+	vector<CacheRecord*> lenders;
+	for (vector<CacheRecord>::iterator it = caches.begin(); it != caches.end(); it++)
+	{
+		if (&*it == record)
+			continue;
+		decayPressure(*it, now);
+		lenders.push_back(&*it);
+	}
+	sort(lenders.begin(), lenders.end(), [](const CacheRecord *first, const CacheRecord *second) { return first->stats.pressure < second->stats.pressure; });
+
+	//Memory other caches have but aren't using costs them nothing to lend
+	for (vector<CacheRecord*>::iterator it = lenders.begin(); it != lenders.end() && needed > 0; it++)
+	{
+		unsigned long long floor = max((*it)->stats.minimum, (*it)->stats.used);
+		if ((*it)->stats.budget > floor)
+			needed -= moveBudget(**it, *record, min(needed, (*it)->stats.budget - floor));
+	}
+	//Caches under less pressure evict resources to make room, then lend what they freed. Memory that's still in use is never lent.
+	for (vector<CacheRecord*>::iterator it = lenders.begin(); it != lenders.end() && needed > 0; it++)
+	{
+		CacheRecord &lender = **it;
+		if (lender.stats.pressure >= record->stats.pressure || lender.stats.budget <= lender.stats.minimum)
+			continue;
+		//Evicting reports the lender's new use through release. A lender that's busy loading is skipped rather than waited for.
+		unsigned long long target = lender.stats.budget > needed ? max(lender.stats.minimum, lender.stats.budget - needed) : lender.stats.minimum;
+		if (!lender.cache->shrink(target))
+			continue;
+		unsigned long long floor = max(lender.stats.minimum, lender.stats.used);
+		if (lender.stats.budget > floor)
+			needed -= moveBudget(lender, *record, min(needed, lender.stats.budget - floor));
+	}
+
+	return record->stats.budget;
+}
+
+void MemoryBudgetBroker::release(ResourceCache *cache, unsigned long long allocated)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	CacheRecord *record = findCache(cache);
+	if (record != nullptr)
+	{
+		record->stats.used = allocated;
+		checkCeiling();
+	}
+}
+
+unsigned long long MemoryBudgetBroker::getCeiling() const
+{
+	return ceiling;
+}
+
+vector<CacheBudgetStats> MemoryBudgetBroker::getStats() const
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	//Report pressure as it is now, without changing the records
+	Clock::time_point now = Clock::now();
+	vector<CacheBudgetStats> stats;
+	for (vector<CacheRecord>::const_iterator it = caches.begin(); it != caches.end(); it++)
+	{
+		stats.push_back(it->stats);
+		stats.back().pressure *= pow(0.5, chrono::duration<double>(now - it->updated).count() / pressureHalfLifeSeconds);
+	}
+	return stats;
+}
@@ -0,0 +1,96 @@
+// Name:
+// MemoryBudgetBroker.h
+// Description:
+// Header file for MemoryBudgetBroker class
+// A MemoryBudgetBroker shares one memory ceiling between several ResourceCaches, so a cache that's thrashing can use memory another cache isn't.
+// Caches register with a minimum and maximum size and a weight for how costly their misses are (see ResourceCache::setBudgetBroker), and start with their minimum.
+// When a cache needs more room it borrows capacity, first from memory no cache has, then from memory other caches have but aren't using,
+// and finally from caches under less pressure than itself, which evict resources to free it, down to their minimum. Pressure is the weighted bytes a cache has had to load recently.
+// Only memory a cache isn't using is lent. A cache that is loading when another wants to borrow from it is skipped, and resources held outside a cache can't be evicted, so a borrower may not get all it wants.
+// Moves between caches aren't logged, as they happen on most loads under churn. A warning is logged under the Resource tag each time the caches go over the ceiling, and getStats reports how much each cache has borrowed and lent.
+// Notes:
+// OS-Unaware
+
+#ifndef MEMORY_BUDGET_BROKER_H
+#define MEMORY_BUDGET_BROKER_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+using namespace std;
+#include "Lockable.h"
+
+class ResourceCache;
+
+//A cache's share of a MemoryBudgetBroker's ceiling
+struct CacheBudgetStats
+{
+	string name;
+	unsigned long long minimum;
+	unsigned long long maximum;
+	//Memory the cache may use, and memory it is using
+	unsigned long long budget;
+	unsigned long long used;
+	//Weighted bytes the cache has loaded recently
+	double pressure;
+	//Memory moved to the cache from other caches, and from the cache to other caches
+	unsigned long long borrowed;
+	unsigned long long lent;
+};
+
+class MemoryBudgetBroker : public Lockable
+{
+private:
+	typedef chrono::steady_clock Clock;
+
+	struct CacheRecord
+	{
+		ResourceCache *cache;
+		CacheBudgetStats stats;
+		double missWeight;
+		//Time pressure was last decayed
+		Clock::time_point updated;
+	};
+
+	unsigned long long ceiling;
+	//Sum of the budgets of every cache
+	unsigned long long totalBudget;
+	vector<CacheRecord> caches;
+	//Whether the caches were over the ceiling when last checked, so going over is only logged once
+	bool overCeiling;
+
+	//Returns the record for a cache, or nullptr if it isn't registered. Call with the object locked.
+	CacheRecord *findCache(const ResourceCache *cache);
+	//Decays a cache's pressure to now. Call with the object locked.
+	void decayPressure(CacheRecord &record, Clock::time_point now);
+	//Moves up to amount of budget from one cache to another, returning the amount moved. Call with the object locked.
+	unsigned long long moveBudget(CacheRecord &from, CacheRecord &to, unsigned long long amount);
+	//Logs a warning if the memory the caches use has just gone over the ceiling. Call with the object locked.
+	void checkCeiling();
+
+	MemoryBudgetBroker(const MemoryBudgetBroker& memoryBudgetBroker) = delete;
+	MemoryBudgetBroker& operator =(const MemoryBudgetBroker& memoryBudgetBroker) = delete;
+
+	//Caches register and report their use through ResourceCache::setBudgetBroker
+	friend class ResourceCache;
+
+	//Adds a cache, returning it's starting budget. Minimums that don't fit under the ceiling are cut down to what's left.
+	unsigned long long registerCache(ResourceCache *cache, const string &name, unsigned long long minimum, unsigned long long maximum, double missWeight);
+	//Removes a cache, giving it's budget back
+	void unregisterCache(ResourceCache *cache);
+	//Records a cache loading size bytes while using allocated, borrowing capacity if it needs room. Returns the cache's budget.
+	unsigned long long reserve(ResourceCache *cache, unsigned long long allocated, unsigned long long size);
+	//Records the memory a cache uses once it has released memory or made room for a load, so it's unused budget can be lent
+	void release(ResourceCache *cache, unsigned long long allocated);
+
+public:
+	//Takes the most memory every registered cache can use between them. The broker must outlive the caches registered with it.
+	MemoryBudgetBroker(unsigned long long ceiling);
+	~MemoryBudgetBroker();
+
+	unsigned long long getCeiling() const;
+	//Returns the budget, use and movements of every registered cache
+	vector<CacheBudgetStats> getStats() const;
+};
+
+#endif
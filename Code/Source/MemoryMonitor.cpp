@@ -0,0 +1,86 @@
+// Name:
+// MemoryMonitor.cpp
+// Description:
+// Implementation file for MemoryMonitor class
+// Notes:
+// OS-Unaware
+
+#include "CustomMemory.h"
+
+#include <string>
+#include <vector>
+#include <sstream>
+using namespace std;
+
+#include "MemoryMonitor.h"
+#include "ResourceCache.h"
+#include "GameEngine.h"
+#include "Logger.h"
+
+MemoryMonitor::MemoryMonitor(Logger *logger) : logger(logger), gameEngine(nullptr), frameArenaChecked(false)
+{
+	for (unsigned int I = 0; I < memoryTagCount; I++)
+		overBudget[I] = false;
+}
+
+void MemoryMonitor::addResourceCache(const string &name, ResourceCache *resourceCache)
+{
+	resourceCaches.push_back(pair<string, ResourceCache*>(name, resourceCache));
+}
+
+void MemoryMonitor::removeResourceCache(ResourceCache *resourceCache)
+{
+	for (vector<pair<string, ResourceCache*> >::iterator it = resourceCaches.begin(); it != resourceCaches.end(); it++)
+	{
+		if (it->second == resourceCache)
+		{
+			resourceCaches.erase(it);
+			return;
+		}
+	}
+}
+
+void MemoryMonitor::setGameEngine(GameEngine *gameEngine)
+{
+	this->gameEngine = gameEngine;
+}
+
+void MemoryMonitor::checkBudgets()
+{
+	if (gameEngine != nullptr)
+	{
+		frameArenaStats = gameEngine->getFrameArenaStats();
+		frameArenaChecked = true;
+	}
+
+	for (unsigned int I = 0; I < memoryTagCount; I++)
+	{
+		MemoryTagStats stats = getMemoryTagStats(static_cast<MemoryTag>(I));
+		bool over = stats.budget > 0 && stats.liveBytes > static_cast<long long>(stats.budget);
+		if (over && !overBudget[I])
+		{
+			stringstream message;
+			message << stats.name << " memory is over budget, " << stats.liveBytes << " bytes of " << stats.budget;
+			logger->eWriteLog(message.str(), LogLevel::Warning, { "Memory" });
+		}
+		overBudget[I] = over;
+	}
+}
+
+string MemoryMonitor::getReport()
+{
+	stringstream result;
+	vector<MemoryTagStats> tags = getMemoryTagStats();
+	for (vector<MemoryTagStats>::iterator it = tags.begin(); it != tags.end(); it++)
+	{
+		result << "{tag: " << it->name << ", liveBytes: " << it->liveBytes << ", liveAllocations: " << it->liveAllocations << ", peakBytes: " << it->peakBytes << ", allocations: " << it->totalAllocations;
+		if (it->budget > 0)
+			result << ", budget: " << it->budget;
+		result << "}" << endl;
+	}
+	for (vector<pair<string, ResourceCache*> >::iterator it = resourceCaches.begin(); it != resourceCaches.end(); it++)
+		result << "{resourceCache: " << it->first << ", usedBytes: " << it->second->getAllocatedMemory() << ", budget: " << it->second->getAvailableMemory() << "}" << endl;
+	if (frameArenaChecked)
+		result << "{frameArena: lastTickBytes: " << frameArenaStats.lastTickBytes << ", highWaterBytes: " << frameArenaStats.highWaterBytes << ", lastTickAllocations: " << frameArenaStats.lastTickAllocations << ", reservedBytes: " << frameArenaStats.reservedBytes << ", blocks: " << frameArenaStats.blocks << ", ticks: " << frameArenaStats.ticks << "}" << endl;
+	return result.str();
+}
@@ -0,0 +1,56 @@
+// Name:
+// MemoryMonitor.h
+// Description:
+// Header file for MemoryMonitor class
+// A MemoryMonitor watches the memory tags (see MemoryTags.h) and warns under the Memory log tag each time one goes over it's budget.
+// It also reports the memory every tag holds alongside the use and budget of the ResourceCaches added to it and the per tick use of the GameEngine's FrameArena, so all of the engine's memory can be seen in one place.
+// Notes:
+// OS-Unaware
+
+#ifndef MEMORY_MONITOR_H
+#define MEMORY_MONITOR_H
+
+#include <string>
+#include <vector>
+#include <utility>
+using namespace std;
+
+#include "MemoryTags.h"
+#include "FrameArena.h"
+
+class Logger;
+class ResourceCache;
+class GameEngine;
+
+class MemoryMonitor
+{
+private:
+	Logger *logger;
+	//Caches reported with the tags, and their names
+	vector<pair<string, ResourceCache*> > resourceCaches;
+	//Engine whose frame arena is reported, and it's arena's stats when budgets were last checked
+	GameEngine *gameEngine;
+	FrameArenaStats frameArenaStats;
+	bool frameArenaChecked;
+	//Whether each tag was over it's budget when last checked, so a tag is warned about once each time it goes over
+	bool overBudget[memoryTagCount];
+
+	MemoryMonitor(const MemoryMonitor& memoryMonitor) = delete;
+	MemoryMonitor& operator =(const MemoryMonitor& memoryMonitor) = delete;
+
+public:
+	MemoryMonitor(Logger *logger);
+
+	//Reports a cache's use and budget with the tags. The cache must be removed before it's destroyed.
+	void addResourceCache(const string &name, ResourceCache *resourceCache);
+	void removeResourceCache(ResourceCache *resourceCache);
+	//Reports the engine's frame arena with the tags. Set it to nullptr before the engine is destroyed, the last stats checked are still reported.
+	void setGameEngine(GameEngine *gameEngine);
+
+	//Warns about every tag that's gone over it's budget since the last check, and records the frame arena's stats. Cheap enough to call every tick.
+	void checkBudgets();
+	//Returns a line for every tag and every cache
+	string getReport();
+};
+
+#endif
@@ -0,0 +1,143 @@
+// Name:
+// MemoryTags.cpp
+// Description:
+// Implementation file for memory tags
+// Notes:
+// OS-Unaware
+
+#include "MemoryTags.h"
+
+#include <atomic>
+#include <vector>
+using namespace std;
+
+//Changes a thread gathers before adding them to the shared counters
+const long long bytesPerFlush = 64 * 1024;
+const unsigned int chargesPerFlush = 256;
+
+static const char *tagNames[memoryTagCount] = { "Untagged", "Engine", "Resource", "Logging", "Message", "View", "Process" };
+
+//Shared counters of each tag. Statics are zeroed before anything runs, so allocations made while globals are constructed are counted.
+static atomic<long long> liveBytes[memoryTagCount];
+static atomic<long long> liveAllocations[memoryTagCount];
+static atomic<long long> peakBytes[memoryTagCount];
+static atomic<unsigned long long> totalAllocations[memoryTagCount];
+static atomic<unsigned long long> budgets[memoryTagCount];
+
+//Changes the calling thread hasn't added to the shared counters yet
+struct PendingCharges
+{
+	long long bytes[memoryTagCount];
+	long long allocations[memoryTagCount];
+	unsigned long long totalAllocations[memoryTagCount];
+	unsigned int charges;
+};
+
+static thread_local MemoryTag currentTag = MemoryTag::Untagged;
+static thread_local PendingCharges pendingCharges;
+static thread_local bool pendingRegistered = false;
+
+//Adds the calling thread's changes to the shared counters
+static void flushCharges()
+{
+	for (unsigned int I = 0; I < memoryTagCount; I++)
+	{
+		if (pendingCharges.bytes[I] == 0 && pendingCharges.allocations[I] == 0 && pendingCharges.totalAllocations[I] == 0)
+			continue;
+
+		long long live = liveBytes[I].fetch_add(pendingCharges.bytes[I], memory_order_relaxed) + pendingCharges.bytes[I];
+		liveAllocations[I].fetch_add(pendingCharges.allocations[I], memory_order_relaxed);
+		totalAllocations[I].fetch_add(pendingCharges.totalAllocations[I], memory_order_relaxed);
+		long long peak = peakBytes[I].load(memory_order_relaxed);
+		while (live > peak && !peakBytes[I].compare_exchange_weak(peak, live, memory_order_relaxed));
+
+		pendingCharges.bytes[I] = 0;
+		pendingCharges.allocations[I] = 0;
+		pendingCharges.totalAllocations[I] = 0;
+	}
+	pendingCharges.charges = 0;
+}
+
+//Adds the thread's last changes to the shared counters when the thread exits
+struct PendingChargesFlusher
+{
+	~PendingChargesFlusher()
+	{
+		flushCharges();
+	}
+};
+static thread_local PendingChargesFlusher pendingChargesFlusher;
+
+MemoryTagScope::MemoryTagScope(MemoryTag tag) : previous(currentTag)
+{
+	currentTag = tag;
+}
+
+MemoryTagScope::~MemoryTagScope()
+{
+	currentTag = previous;
+}
+
+const char *getMemoryTagName(MemoryTag tag)
+{
+	return tagNames[static_cast<unsigned int>(tag)];
+}
+
+MemoryTag getCurrentMemoryTag()
+{
+	return currentTag;
+}
+
+void chargeMemoryTag(MemoryTag tag, long long bytes)
+{
+	//Make sure the thread's changes are flushed when it exits
+	if (!pendingRegistered)
+	{
+		pendingRegistered = true;
+		(void)&pendingChargesFlusher;
+	}
+
+	unsigned int index = static_cast<unsigned int>(tag);
+	pendingCharges.bytes[index] += bytes;
+	if (bytes >= 0)
+	{
+		pendingCharges.allocations[index]++;
+		pendingCharges.totalAllocations[index]++;
+	}
+	else
+		pendingCharges.allocations[index]--;
+
+	if (++pendingCharges.charges >= chargesPerFlush || pendingCharges.bytes[index] >= bytesPerFlush || pendingCharges.bytes[index] <= -bytesPerFlush)
+		flushCharges();
+}
+
+void setMemoryTagBudget(MemoryTag tag, unsigned long long budget)
+{
+	budgets[static_cast<unsigned int>(tag)] = budget;
+}
+
+MemoryTagStats getMemoryTagStats(MemoryTag tag)
+{
+	//Include the calling thread's own changes
+	flushCharges();
+
+	unsigned int index = static_cast<unsigned int>(tag);
+	MemoryTagStats stats;
+	stats.tag = tag;
+	stats.name = tagNames[index];
+	stats.liveBytes = liveBytes[index].load(memory_order_relaxed);
+	stats.liveAllocations = liveAllocations[index].load(memory_order_relaxed);
+	stats.peakBytes = peakBytes[index].load(memory_order_relaxed);
+	stats.totalAllocations = totalAllocations[index].load(memory_order_relaxed);
+	stats.budget = budgets[index].load(memory_order_relaxed);
+	return stats;
+}
+
+vector<MemoryTagStats> getMemoryTagStats()
+{
+	vector<MemoryTagStats> result;
+	result.reserve(memoryTagCount);
+	for (unsigned int I = 0; I < memoryTagCount; I++)
+		result.push_back(getMemoryTagStats(static_cast<MemoryTag>(I)));
+	return result;
+}
@@ -0,0 +1,75 @@
+// Name:
+// MemoryTags.h
+// Description:
+// Header file for memory tags
+// Memory tags charge allocations to the part of the engine that made them, such as resources, logging, engine messages or views, so what each part uses can be seen and kept to a budget.
+// A MemoryTagScope charges everything allocated on it's thread to a tag until the scope ends. Scopes nest, the innermost one wins, and allocations made outside every scope are Untagged.
+// Each allocation remembers it's tag (see SpanAllocator.h), so it's taken off the right tag whichever thread frees it.
+// Allocations of up to 1KB are charged the size of their size class rather than the size asked for, since that's the memory they take up.
+// Threads gather their changes and add them to the shared counters every 64KB or 256 allocations, so the counters and peaks can be behind by that much for each thread.
+// Budgets are soft, nothing stops a tag going over it's budget. MemoryMonitor warns through the Logger when one does.
+// Like AllocMap, the tags don't use the c++ new/delete functions themselves.
+// Notes:
+// OS-Unaware
+
+#ifndef MEMORY_TAGS_H
+#define MEMORY_TAGS_H
+
+#include <vector>
+using namespace std;
+
+enum class MemoryTag : unsigned char
+{
+	Untagged,
+	Engine,
+	Resource,
+	Logging,
+	Message,
+	View,
+	Process
+};
+
+const unsigned int memoryTagCount = 7;
+
+struct MemoryTagStats
+{
+	MemoryTag tag;
+	const char *name;
+	//Bytes and allocations charged to the tag that haven't been freed
+	long long liveBytes;
+	long long liveAllocations;
+	//Most bytes the tag has held at once
+	long long peakBytes;
+	//Every allocation charged to the tag
+	unsigned long long totalAllocations;
+	//0 if the tag has no budget
+	unsigned long long budget;
+};
+
+//Charges allocations made on the calling thread to a tag until it's destroyed
+class MemoryTagScope
+{
+private:
+	MemoryTag previous;
+
+	MemoryTagScope(const MemoryTagScope& memoryTagScope) = delete;
+	MemoryTagScope& operator =(const MemoryTagScope& memoryTagScope) = delete;
+
+public:
+	MemoryTagScope(MemoryTag tag);
+	~MemoryTagScope();
+};
+
+const char *getMemoryTagName(MemoryTag tag);
+//Returns the tag allocations made on the calling thread are charged to
+MemoryTag getCurrentMemoryTag();
+//Charges an allocation of bytes to a tag, or takes a free off it when bytes is negative
+void chargeMemoryTag(MemoryTag tag, long long bytes);
+
+//Sets the bytes a tag should stay under, 0 for no budget
+void setMemoryTagBudget(MemoryTag tag, unsigned long long budget);
+MemoryTagStats getMemoryTagStats(MemoryTag tag);
+//Returns the counters of every tag
+vector<MemoryTagStats> getMemoryTagStats();
+
+#endif
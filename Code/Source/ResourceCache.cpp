@@ -1,82 +1,195 @@
 #include "CustomMemory.h"
 
 #include <mutex>
+#include <vector>
+#include <unordered_set>
+#include <string>
+#include <cstring>
+#include <limits>
 
 #include "ResourceCache.h"
 #include "ResourceHandle.h"
 #include "IResourceSource.h"
 #include "IResourceProcessor.h"
+#include "MemoryBudgetBroker.h"
 #include "Logger.h"
 
 extern Logger* appLogger;
 
-ResourceCache::ResourceCache(unsigned int size, IResourceSource *resourceSource) : availableMemory(size), resourceSource(resourceSource), allocatedMemory(0)
+ResourceCache::ResourceCache(unsigned long long size, IResourceSource *resourceSource) : resourceSource(resourceSource), budgetBroker(nullptr), allocatedMemory(0), availableMemory(size)
 {
 }
 
 ResourceCache::~ResourceCache()
 {
+	//Give the cache's budget back to the other caches
+	if (budgetBroker)
+		budgetBroker->unregisterCache(this);
 }
 
 shared_ptr<ResourceHandle> ResourceCache::load(const string &resourceName)
 {
-	int resourceSize;		//Size of the resource to be loaded
+	unsigned long long resourceSize;	//Size of the resource to be loaded
 	char* resource;			//Buffer to hold the resource
-	
+
+	//If another resource has the same content, share it. Content that hasn't been compared with the resource yet is compared once the resource is loaded.
+	//Ask whether it's verified first, a resource that has been verified won't have it's content name change afterwards.
+	bool contentVerified = resourceSource->isContentVerified(resourceName);
+	string contentName = resourceSource->getContentName(resourceName);
+	if (contentName != resourceName && contentVerified)
+	{
+		shared_ptr<ResourceHandle> resourceHandle = loadDuplicate(resourceName, contentName);
+		if (resourceHandle)
+			return resourceHandle;
+	}
+
+	//Resources the source keeps in memory are used where they are, unless a processor would need to change them
+	const char *data = resourceSource->getResourceData(resourceName);
+	if (data != nullptr)
+	{
+		shared_ptr<ResourceHandle> resourceHandle = ResourceHandle::wrapStatic(resourceName, data, resourceSource->getRawResourceSize(resourceName), this);
+		if (findProcessor(resourceHandle) == nullptr)
+		{
+			//The data doesn't count against the cache's size, it's in memory either way
+			freeQueue.push_front(resourceHandle);
+			resourceHandleMap[resourceName] = resourceHandle;
+			return resourceHandle;
+		}
+	}
+
 	//Get size of resource
 	resourceSize = resourceSource->getRawResourceSize(resourceName);
 	//Allocate room for the resource
 	resource = allocate(resourceSize);
-	//Get the resource
-	resourceSource->getRawResource(resourceName, resource);
+	if (resource == nullptr)
+		return shared_ptr<ResourceHandle>();
+	//Get the resource. Reads that failed don't get a handle, so the next gethandle tries again
+	if (resourceSource->getRawResource(resourceName, resource) != resourceSize)
+	{
+		appLogger->eWriteLog(string("Failed to load resource ") + resourceName, LogLevel::Warning, { "Resource" });
+		delete[] resource;
+		memoryReleased(resourceSize);
+		return shared_ptr<ResourceHandle>();
+	}
 
 	//Create handle to resource
 	shared_ptr<ResourceHandle> resourceHandle(new ResourceHandle(resourceName, resource, resourceSize, this));
 
-	//Perform resource processing if there is a resource processor to match the file.
+	//Process the resource and add it to the cache
+	finishLoad(resourceHandle);
+
+	//Compare the resource with the content it might share, if they match the resource's own copy is swapped for the shared one
+	if (contentName != resourceName && !contentVerified)
 	{
-		bool resourceProcessed = false;
-		list<shared_ptr<IResourceProcessor> >::iterator it = resourceProcessors.begin();
-		//Iterate over the resource processors until they've all been checked or the resource was processed
-		while (it != resourceProcessors.end() && resourceProcessed == false)
-		{
-			//If the resource processor is for this file, process the file.
-			if ((*it)->checkRawFile(resourceHandle))
-			{
-				(*it)->processResource(resourceHandle);
-				resourceProcessed = true;
-			}
-			//Move to the next resource processor
-			it++;
-		}
+		shared_ptr<ResourceHandle> duplicateHandle = verifyDuplicate(resourceHandle, contentName);
+		if (duplicateHandle)
+			return duplicateHandle;
+	}
+
+	//Return handle
+	return resourceHandle;
+}
+
+shared_ptr<ResourceHandle> ResourceCache::loadDuplicate(const string &resourceName, const string &contentName)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	//Get the handle that owns the content
+	shared_ptr<ResourceHandle> content = gethandle(contentName);
+	if (!content)
+		return shared_ptr<ResourceHandle>();
+	shared_ptr<ResourceHandle> resourceHandle(new ResourceHandle(resourceName, content, this));
+
+	//Processors work on the data in place, so the content can only be shared if it would have been processed the same way
+	resourceHandle->processor = findProcessor(resourceHandle);
+	if (resourceHandle->processor != content->processor)
+		return shared_ptr<ResourceHandle>();
+
+	//Add the handle to the cache, it's memory is already accounted for by the content's handle
+	freeQueue.push_front(resourceHandle);
+	resourceHandleMap[resourceName] = resourceHandle;
+	return resourceHandle;
+}
+
+shared_ptr<ResourceHandle> ResourceCache::verifyDuplicate(const shared_ptr<ResourceHandle> &resourceHandle, const string &contentName)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	//Processors work on the data in place, so the two can only be compared if they were processed the same way. Otherwise it's left for another load to decide.
+	shared_ptr<ResourceHandle> content = gethandle(contentName);
+	if (!content || content->processor != resourceHandle->processor)
+		return shared_ptr<ResourceHandle>();
+
+	//Both are already in memory, so the comparison doesn't read or allocate anything. The source remembers the result for every cache.
+	bool duplicate = content->resourceSize == resourceHandle->resourceSize && memcmp(content->resource, resourceHandle->resource, static_cast<size_t>(resourceHandle->resourceSize)) == 0;
+	resourceSource->setContentVerified(resourceHandle->getName(), duplicate);
+	if (!duplicate)
+		return shared_ptr<ResourceHandle>();
+
+	//Replace the resource's own copy with a handle sharing the content, the copy is released once the caller lets go of it
+	shared_ptr<ResourceHandle> duplicateHandle(new ResourceHandle(resourceHandle->getName(), content, this));
+	duplicateHandle->processor = content->processor;
+	freeQueue.remove(resourceHandle);
+	freeQueue.push_front(duplicateHandle);
+	resourceHandleMap[duplicateHandle->getName()] = duplicateHandle;
+	return duplicateHandle;
+}
+
+IResourceProcessor *ResourceCache::findProcessor(const shared_ptr<ResourceHandle> &resourceHandle)
+{
+	//Iterate over the resource processors until one matches the file
+	for (list<shared_ptr<IResourceProcessor> >::iterator it = resourceProcessors.begin(); it != resourceProcessors.end(); it++)
+	{
+		if ((*it)->checkRawFile(resourceHandle))
+			return it->get();
 	}
+	return nullptr;
+}
+
+void ResourceCache::finishLoad(const shared_ptr<ResourceHandle> &resourceHandle)
+{
+	//Perform resource processing if there is a resource processor to match the file.
+	resourceHandle->processor = findProcessor(resourceHandle);
+	if (resourceHandle->processor)
+		resourceHandle->processor->processResource(resourceHandle);
 
 	//Put the resource on the front of the freeQueue
 	freeQueue.push_front(resourceHandle);
 
 	//Store handle for future retrieval
-	resourceHandleMap[resourceName] = resourceHandle;
-
-	//Return handle
-	return resourceHandle;
+	resourceHandleMap[resourceHandle->getName()] = resourceHandle;
 }
 
-char *ResourceCache::allocate(unsigned int size)
+char *ResourceCache::allocate(unsigned long long size)
 {
 	lock_guard<recursive_mutex> objectLock(objectMutex);
+	MemoryTagScope memoryTagScope(MemoryTag::Resource);
+
+	//Resources too big to hold in memory can't be loaded, on 32 bit builds their size would be truncated
+	if (size > numeric_limits<size_t>::max())
+	{
+		appLogger->eWriteLog("ResourceCache can't allocate a resource that doesn't fit in memory", LogLevel::Error, { "ResourceCache" });
+		return nullptr;
+	}
+
+	//A cache that shares it's memory borrows room if it can, and it's budget may have shrunk if it lent memory it was using
+	if (budgetBroker)
+		availableMemory = budgetBroker->reserve(this, allocatedMemory, size);
 
 	//Free resources until we have enough memory
-	while ((availableMemory - allocatedMemory) < size && freeOneResource());
+	while (allocatedMemory + size > availableMemory && freeOneResource());
 
-	//Add size to the allocated memory
+	//Add size to the allocated memory, and let the broker check the caches' use against it's ceiling now room has been made
 	allocatedMemory += size;
+	if (budgetBroker)
+		budgetBroker->release(this, allocatedMemory);
 
 	//Check if we're over our allocation limits, write a warning entry if we are
 	if (allocatedMemory > availableMemory)
 		appLogger->eWriteLog("ResourceCache over memory limit!", LogLevel::Warning, { "ResourceCache" });
 
 	//Allocate memory and return pointer.
-	return new char[size];
+	return new char[static_cast<size_t>(size)];
 }
 
 bool ResourceCache::freeOneResource()
@@ -93,9 +206,34 @@ bool ResourceCache::freeOneResource()
 	return false;
 }
 
+bool ResourceCache::shrink(unsigned long long size)
+{
+	//The broker calls this while another cache is loading and holds that cache's lock, so waiting here could deadlock two caches lending to each other
+	unique_lock<recursive_mutex> objectLock(objectMutex, try_to_lock);
+	if (!objectLock.owns_lock())
+		return false;
+
+	//Resources still held outside the cache aren't released, so the cache may not get all the way down to size
+	while (allocatedMemory > size && freeOneResource());
+	return true;
+}
+
 shared_ptr<ResourceHandle> ResourceCache::gethandle(const string &resourceName)
 {
+	shared_ptr<ResourceHandle> result = tryGetHandle(resourceName);
+	if (!result)
+		appLogger->eWriteLog(string("Resource ") + resourceName + " not found", LogLevel::Warning, { "Resource" });
+	return result;
+}
+
+shared_ptr<ResourceHandle> ResourceCache::tryGetHandle(const string &resourceName)
+{
+	//The source's name table never changes once it's open, so misses can be turned away before locking anything
+	if (!resourceSource->hasResource(resourceName))
+		return shared_ptr<ResourceHandle>();
+
 	lock_guard<recursive_mutex> objectLock(objectMutex);
+	MemoryTagScope memoryTagScope(MemoryTag::Resource);
 
 	shared_ptr<ResourceHandle> result;
 
@@ -136,12 +274,14 @@ shared_ptr<ResourceHandle> ResourceCache::gethandle(const string &resourceName)
 	return result;
 }
 
-void ResourceCache::memoryReleased(unsigned int size)
+void ResourceCache::memoryReleased(unsigned long long size)
 {
 	lock_guard<recursive_mutex> objectLock(objectMutex);
 
 	//Note the memory as having been released
 	allocatedMemory -= size;
+	if (budgetBroker)
+		budgetBroker->release(this, allocatedMemory);
 }
 
 void ResourceCache::preLoad(const string &resourceName)
@@ -153,6 +293,80 @@ void ResourceCache::preLoad(const string &resourceName)
 	gethandle(resourceName);
 }
 
+void ResourceCache::preLoad(const vector<string> &resourceNames)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	MemoryTagScope memoryTagScope(MemoryTag::Resource);
+
+	vector<RawResourceRequest> requests;
+	vector<unsigned long long> resourceSizes;
+	unordered_set<string> batchNames;
+	//Resources that share another's content, loaded once their content has been read
+	vector<string> duplicates;
+	requests.reserve(resourceNames.size());
+	resourceSizes.reserve(resourceNames.size());
+
+	for (vector<string>::const_iterator it = resourceNames.begin(); it != resourceNames.end(); it++)
+	{
+		//Resources that are already loaded just get moved to the front of the freeQueue
+		//Missing resources would only be read as size 0
+		if (!resourceSource->hasResource(*it))
+			continue;
+		map<string, weak_ptr<ResourceHandle> >::iterator loaded = resourceHandleMap.find(*it);
+		if (loaded != resourceHandleMap.end() && !loaded->second.expired())
+		{
+			gethandle(*it);
+			continue;
+		}
+		//Resources the source keeps in memory don't need to be read
+		if (resourceSource->getResourceData(*it) != nullptr)
+		{
+			gethandle(*it);
+			continue;
+		}
+		//Read the content of duplicates in the batch instead of the duplicates themselves
+		string contentName = resourceSource->getContentName(*it);
+		if (contentName != *it)
+		{
+			duplicates.push_back(*it);
+			loaded = resourceHandleMap.find(contentName);
+			if (loaded != resourceHandleMap.end() && !loaded->second.expired())
+				continue;
+		}
+
+		//Skip resources that are in the batch more than once
+		if (!batchNames.insert(contentName).second)
+			continue;
+
+		//Allocate room for the resource
+		unsigned long long resourceSize = resourceSource->getRawResourceSize(contentName);
+		RawResourceRequest request = { contentName, allocate(resourceSize), 0 };
+		if (request.buffer == nullptr)
+			continue;
+		requests.push_back(request);
+		resourceSizes.push_back(resourceSize);
+	}
+
+	//Read the batch, adding each resource to the cache as it arrives
+	resourceSource->getRawResources(requests, [&](RawResourceRequest &request)
+	{
+		unsigned long long resourceSize = resourceSizes[&request - &requests[0]];
+		//Reads that failed don't get a handle, so the next gethandle tries again
+		if (request.result != resourceSize)
+		{
+			appLogger->eWriteLog(string("Failed to preload resource ") + request.resource, LogLevel::Warning, { "Resource" });
+			delete[] request.buffer;
+			memoryReleased(resourceSize);
+			return;
+		}
+		finishLoad(shared_ptr<ResourceHandle>(new ResourceHandle(request.resource, request.buffer, resourceSize, this)));
+	});
+
+	//Now that their content is loaded, add handles for the duplicates
+	for (vector<string>::const_iterator it = duplicates.begin(); it != duplicates.end(); it++)
+		gethandle(*it);
+}
+
 void ResourceCache::flush()
 {
 	lock_guard<recursive_mutex> objectLock(objectMutex);
@@ -161,6 +375,18 @@ void ResourceCache::flush()
 	freeQueue.clear();
 }
 
+unsigned long long ResourceCache::getAllocatedMemory()
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	return allocatedMemory;
+}
+
+unsigned long long ResourceCache::getAvailableMemory()
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	return availableMemory;
+}
+
 void ResourceCache::registerProcessor(shared_ptr<IResourceProcessor> resourceLoader)
 {
 	lock_guard<recursive_mutex> objectLock(objectMutex);
@@ -168,3 +394,17 @@ void ResourceCache::registerProcessor(shared_ptr<IResourceProcessor> resourceLoa
 	//Register processor.
 	resourceProcessors.push_back(resourceLoader);
 }
+
+void ResourceCache::setBudgetBroker(MemoryBudgetBroker *broker, const string &name, unsigned long long minimum, unsigned long long maximum, double missWeight)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	if (budgetBroker)
+		budgetBroker->unregisterCache(this);
+	budgetBroker = broker;
+	if (budgetBroker)
+	{
+		availableMemory = budgetBroker->registerCache(this, name, minimum, maximum, missWeight);
+		budgetBroker->release(this, allocatedMemory);
+	}
+}
@@ -3,6 +3,11 @@
 // Description:
 // Header file for ResourceCache class
 // A ResourceCache holds data read from the hard drive for a period of time so that it can be retrieved more quickly later
+// Resources the source reports as having the same content (see IResourceSource::getContentName) share one copy of it, which only counts against the cache's size once.
+// Resources the source keeps in memory (see IResourceSource::getResourceData) aren't copied or counted at all, unless a processor has to change them.
+// Several caches can share one memory ceiling through a MemoryBudgetBroker (see setBudgetBroker), in which case the broker decides the cache's size.
+// Names the source doesn't have are turned away before the cache is locked, so probing for optional resources (localized overrides, mod variants) with tryGetHandle is cheap.
+// Everything the cache allocates is charged to the Resource memory tag (see MemoryTags.h).
 // Notes:
 // OS-Unaware
 
@@ -11,6 +16,8 @@
 
 #include <map>
 #include <list>
+#include <vector>
+#include <string>
 #include <memory>
 #include <mutex>
 using namespace std;
@@ -18,6 +25,7 @@ using namespace std;
 class ResourceHandle;
 class IResourceSource;
 class IResourceProcessor;
+class MemoryBudgetBroker;
 
 class ResourceCache
 {
@@ -27,34 +35,62 @@ private:
 	map<string, weak_ptr<ResourceHandle> > resourceHandleMap;
 	list<shared_ptr<IResourceProcessor> > resourceProcessors;
 	IResourceSource *resourceSource;
+	//Broker that sets availableMemory, if the cache shares a ceiling with other caches
+	MemoryBudgetBroker *budgetBroker;
 
-	unsigned int allocatedMemory;
-	unsigned int availableMemory;
+	//Sizes in bytes, 64 bit so budgets over 4GB are accounted correctly
+	unsigned long long allocatedMemory;
+	unsigned long long availableMemory;
 
 	shared_ptr<ResourceHandle> load(const string &resource);
-	bool makeRoom(unsigned int size);
+	//Creates a handle that shares the content of contentName's handle, loading it if needed.
+	//Returns nothing if the two would be processed differently, in which case resource needs it's own copy.
+	shared_ptr<ResourceHandle> loadDuplicate(const string &resource, const string &contentName);
+	//Compares a newly loaded resource with the content the source thinks it shares, once both are processed, and tells the source whether they match.
+	//Returns a handle sharing the content if they do, which replaces resourceHandle in the cache.
+	shared_ptr<ResourceHandle> verifyDuplicate(const shared_ptr<ResourceHandle> &resourceHandle, const string &contentName);
+	//Returns the processor that handles a resource, or nullptr if there isn't one
+	IResourceProcessor *findProcessor(const shared_ptr<ResourceHandle> &resourceHandle);
+	//Processes a newly read resource and adds it to the cache
+	void finishLoad(const shared_ptr<ResourceHandle> &resourceHandle);
+	bool makeRoom(unsigned long long size);
 	bool freeOneResource();
-	char *allocate(unsigned int size);
+	//Frees resources until the cache uses no more than size, so the broker can lend the memory to another cache. Returns false without freeing anything if the cache is busy.
+	bool shrink(unsigned long long size);
+	//Makes room for and allocates a resource's buffer. Returns nullptr if the size doesn't fit in memory.
+	char *allocate(unsigned long long size);
 	//Tells the ResourceCache that memory was released. Used by ResourceHandle to inform the ResourceCache when it is destroyed.
-	void memoryReleased(unsigned int size);
+	void memoryReleased(unsigned long long size);
 
 	friend class ResourceHandle;
+	friend class MemoryBudgetBroker;
 
 public:
 	//Consturctor
 	//Takes size of cache and a IResourceSource which is used to obtain resources.
-	ResourceCache(unsigned int size, IResourceSource *resourceSource);
+	ResourceCache(unsigned long long size, IResourceSource *resourceSource);
 	virtual ~ResourceCache();
 
 	//Add a processor to pre-process resources before handles are returned.
 	void registerProcessor(shared_ptr<IResourceProcessor> resourceProcessor);
+	//Shares a memory ceiling with the other caches registered with broker, replacing the size given to the constructor. The cache starts at minimum and borrows up to maximum.
+	//missWeight is how costly the cache's misses are compared to other caches', caches with costly misses keep memory over caches with cheap ones.
+	void setBudgetBroker(MemoryBudgetBroker *broker, const string &name, unsigned long long minimum, unsigned long long maximum, double missWeight = 1.0);
 
-	//Get a ResourceHandle to the requested resource, loading it if needed
+	//Get a ResourceHandle to the requested resource, loading it if needed. Logs a warning and returns nothing if the source doesn't have the resource.
 	shared_ptr<ResourceHandle> gethandle(const string &resourceName);
+	//Same as gethandle, but for resources that may not exist. Returns nothing for missing resources without locking, allocating or logging.
+	shared_ptr<ResourceHandle> tryGetHandle(const string &resourceName);
 	//Makes sure a particular resource is in the cache, but doesn't actually get the handle.
 	void preLoad(const string &resourceName);
+	//Makes sure several resources are in the cache. Resources that aren't loaded are read as one batch, so the source can overlap the reads. Missing resources are skipped.
+	void preLoad(const vector<string> &resourceNames);
 	//Gets rid of all of the shared_ptrs to handles
 	void flush();
+
+	//Returns the bytes the cache's resources use, and the most they may use
+	unsigned long long getAllocatedMemory();
+	unsigned long long getAvailableMemory();
 };
 
 #endif
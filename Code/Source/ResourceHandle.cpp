@@ -7,13 +7,29 @@ using namespace std;
 
 #include "ResourceCache.h"
 
-ResourceHandle::ResourceHandle(string name, char* resource, unsigned int resourceSize, ResourceCache *resourceCache) : name(name), resource(resource), resourceSize(resourceSize), resourceCache(resourceCache)
+ResourceHandle::ResourceHandle(string name, char* resource, unsigned long long resourceSize, ResourceCache *resourceCache) : name(name), resource(resource), resourceSize(resourceSize), resourceCache(resourceCache), processor(nullptr), ownsResource(true)
 {
 
 }
 
+ResourceHandle::ResourceHandle(string name, shared_ptr<ResourceHandle> content, ResourceCache *resourceCache) : name(name), resource(content->resource), resourceSize(content->resourceSize), resourceCache(resourceCache), content(content), processor(nullptr), ownsResource(false)
+{
+
+}
+
+//Handles never write to their data, only processors do, and the cache doesn't give data that isn't the handle's own to a processor
+shared_ptr<ResourceHandle> ResourceHandle::wrapStatic(string name, const char* resource, unsigned long long resourceSize, ResourceCache *resourceCache)
+{
+	shared_ptr<ResourceHandle> resourceHandle(new ResourceHandle(name, const_cast<char*>(resource), resourceSize, resourceCache));
+	resourceHandle->ownsResource = false;
+	return resourceHandle;
+}
+
 ResourceHandle::~ResourceHandle()
 {
+	//Shared data belongs to the content's handle, which releases it once nothing else needs it. Data in the source's memory is never released.
+	if (!ownsResource)
+		return;
 	//Unallocate memory
 	delete[] resource;
 	//Tell the cache that the memory was released.
@@ -3,6 +3,8 @@
 // Description:
 // Header file for ResourceHandle class
 // A ResourceHandle holds data loaded by a ResourceCache
+// Resources with identical content share one handle's data, the handles for the duplicates keep the handle that owns the data alive.
+// Resources a source keeps in memory, such as embedded resources, are used where they are and don't belong to the handle.
 // Notes:
 // OS-Unaware
 
@@ -10,26 +12,45 @@
 #define RESOURCE_HANDLE_H
 
 #include <string>
+#include <memory>
 using namespace std;
 
 #include "Lockable.h"
 
 class ResourceCache;
+class IResourceProcessor;
 
 class ResourceHandle : Lockable
 {
 private:
 	string name;
 	char* resource;
-	unsigned int resourceSize;
+	unsigned long long resourceSize;
 	ResourceCache *resourceCache;
+	//Handle that owns the data, if this handle shares another's content
+	shared_ptr<ResourceHandle> content;
+	//Processor that processed the data, if any
+	IResourceProcessor *processor;
+	//False if the data belongs to another handle or to the source, in which case it isn't released with the handle
+	bool ownsResource;
+
+	friend class ResourceCache;
 public:
-	ResourceHandle(string name, char* resource, unsigned int resourceSize, ResourceCache *resourceCache);
+	//Creates a handle that owns resource, which was allocated by resourceCache and is released with the handle
+	ResourceHandle(string name, char* resource, unsigned long long resourceSize, ResourceCache *resourceCache);
+	//Creates a handle that shares the data of content
+	ResourceHandle(string name, shared_ptr<ResourceHandle> content, ResourceCache *resourceCache);
+	//Creates a handle for data the source keeps in memory, which must outlive the handle. The handle doesn't own or release the data.
+	static shared_ptr<ResourceHandle> wrapStatic(string name, const char* resource, unsigned long long resourceSize, ResourceCache *resourceCache);
 	virtual ~ResourceHandle();
 	const char * const getResource() const
 	{
 		return resource;
 	};
+	const string &getName() const
+	{
+		return name;
+	};
 };
 
 #endif
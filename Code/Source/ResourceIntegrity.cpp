@@ -0,0 +1,129 @@
+// Name:
+// ResourceIntegrity.cpp
+// Description:
+// Implementation file for ResourceIntegrity class
+// Notes:
+// OS-Unaware
+
+#include "CustomMemory.h"
+
+#include "ResourceIntegrity.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <sstream>
+#include <iomanip>
+using namespace std;
+
+#include "Logger.h"
+
+extern Logger* appLogger;
+
+//Bits in a resource's state
+const unsigned char hasExpectedCrc = 1;
+const unsigned char checkPassed = 2;
+
+IntegrityStats& IntegrityStats::operator +=(const IntegrityStats& other)
+{
+	passed += other.passed;
+	failed += other.failed;
+	skipped += other.skipped;
+	bytesChecked += other.bytesChecked;
+	return *this;
+}
+
+ResourceIntegrity::ResourceIntegrity(IntegrityMode mode) : mode(mode), passed(0), failed(0), skipped(0), bytesChecked(0) {}
+
+void ResourceIntegrity::reset(unsigned int resourceCount)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	expectedCrcs.assign(resourceCount, 0);
+	states.assign(resourceCount, 0);
+}
+
+void ResourceIntegrity::setExpectedCrc(unsigned int index, unsigned int crc)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	expectedCrcs[index] = crc;
+	states[index] = hasExpectedCrc;
+}
+
+bool ResourceIntegrity::getExpectedCrc(unsigned int index, unsigned int &crc) const
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	if ((states[index] & hasExpectedCrc) == 0)
+		return false;
+	crc = expectedCrcs[index];
+	return true;
+}
+
+void ResourceIntegrity::setMode(IntegrityMode mode)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	this->mode = mode;
+}
+
+IntegrityMode ResourceIntegrity::getMode() const
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	return mode;
+}
+
+bool ResourceIntegrity::needsCheck(unsigned int index)
+{
+	bool result;
+	{
+		lock_guard<recursive_mutex> objectLock(objectMutex);
+		if (mode == IntegrityMode::Always)
+			result = true;
+		else if (mode == IntegrityMode::FirstLoad)
+			result = (states[index] & checkPassed) == 0;
+		else
+			result = false;
+	}
+	if (!result)
+		skipped++;
+	return result;
+}
+
+bool ResourceIntegrity::check(unsigned int index, unsigned int crc, unsigned long long size, const string &source, const string &resource)
+{
+	bytesChecked += size;
+	unsigned int expectedCrc;
+	{
+		lock_guard<recursive_mutex> objectLock(objectMutex);
+		//Nothing to check against, the first read decides what the resource should contain
+		if ((states[index] & hasExpectedCrc) == 0)
+		{
+			expectedCrcs[index] = crc;
+			states[index] |= hasExpectedCrc;
+		}
+		expectedCrc = expectedCrcs[index];
+		if (crc == expectedCrc)
+			states[index] |= checkPassed;
+	}
+
+	if (crc == expectedCrc)
+	{
+		passed++;
+		return true;
+	}
+
+	failed++;
+	stringstream message;
+	message << hex << setfill('0');
+	message << "CRC mismatch for " << resource << " in " << source << ": expected " << setw(8) << expectedCrc << ", got " << setw(8) << crc;
+	appLogger->eWriteLog(message.str(), LogLevel::Warning, { "Resource" });
+	return false;
+}
+
+IntegrityStats ResourceIntegrity::getStats() const
+{
+	IntegrityStats stats;
+	stats.passed = passed;
+	stats.failed = failed;
+	stats.skipped = skipped;
+	stats.bytesChecked = bytesChecked;
+	return stats;
+}
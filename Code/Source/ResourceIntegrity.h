@@ -0,0 +1,86 @@
+// Name:
+// ResourceIntegrity.h
+// Description:
+// Header file for ResourceIntegrity class
+// ResourceIntegrity tracks the expected CRC32 of each resource in a source and decides which reads need to be checked against it.
+// Zip files get their CRCs from the central directory. Loose files can list them in manifest.xml, files that aren't listed use the CRC from the first time they're read.
+// Sources calculate the CRC with updateCrc32 (see Crc32.h) as the data is read or inflated, while it's still in cache, and pass it to check.
+// Notes:
+// OS-Unaware
+
+#ifndef RESOURCE_INTEGRITY_H
+#define RESOURCE_INTEGRITY_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+using namespace std;
+#include "Lockable.h"
+
+//When resources are checked against their CRC
+enum class IntegrityMode
+{
+	//Never check resources
+	Never,
+	//Check each resource the first time it's read from a source
+	FirstLoad,
+	//Check every read
+	Always
+};
+
+//Counts of the checks made by one or more sources
+struct IntegrityStats
+{
+	//Reads that matched their CRC
+	unsigned long long passed;
+	//Reads that didn't match their CRC
+	unsigned long long failed;
+	//Reads that weren't checked
+	unsigned long long skipped;
+	//Bytes checked
+	unsigned long long bytesChecked;
+
+	IntegrityStats() : passed(0), failed(0), skipped(0), bytesChecked(0) {}
+	IntegrityStats& operator +=(const IntegrityStats& other);
+};
+
+class ResourceIntegrity : public Lockable
+{
+private:
+	IntegrityMode mode;
+	//Expected CRC of each resource, stored in the same order as the source's name table
+	vector<unsigned int> expectedCrcs;
+	//Whether each resource has an expected CRC, and whether it has passed a check
+	vector<unsigned char> states;
+
+	atomic<unsigned long long> passed;
+	atomic<unsigned long long> failed;
+	atomic<unsigned long long> skipped;
+	atomic<unsigned long long> bytesChecked;
+
+	ResourceIntegrity(const ResourceIntegrity& resourceIntegrity) = delete;
+	ResourceIntegrity& operator =(const ResourceIntegrity& resourceIntegrity) = delete;
+public:
+	ResourceIntegrity(IntegrityMode mode = IntegrityMode::FirstLoad);
+
+	//Sizes the table for a source's resources, forgetting any expected CRCs and checks
+	void reset(unsigned int resourceCount);
+	//Sets the CRC a resource is expected to have
+	void setExpectedCrc(unsigned int index, unsigned int crc);
+	//Gets the CRC a resource is expected to have. Returns false if it isn't known yet.
+	bool getExpectedCrc(unsigned int index, unsigned int &crc) const;
+
+	void setMode(IntegrityMode mode);
+	IntegrityMode getMode() const;
+
+	//Returns true if the next read of a resource needs to be checked. Reads that won't be checked are counted as skipped.
+	bool needsCheck(unsigned int index);
+	//Checks a resource's CRC after it has been read. Failures are logged, with source and resource naming what failed.
+	//Only complete reads should be checked, size is just counted. A short read would set the expected CRC of a resource with none.
+	//Returns false if the resource is corrupt, and should not be used.
+	bool check(unsigned int index, unsigned int crc, unsigned long long size, const string &source, const string &resource);
+
+	IntegrityStats getStats() const;
+};
+
+#endif
@@ -0,0 +1,283 @@
+// Name:
+// ResourceNameTable.cpp
+// Description:
+// Implementation file for ResourceNameTable class
+// Notes:
+// OS-Unaware
+
+#include "CustomMemory.h"
+
+#include "ResourceNameTable.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+//Compares a name in the table against value in the same order that std::string sorts in
+static int compareName(const char *name, unsigned int nameLength, const char *value, unsigned int valueLength)
+{
+	int result = memcmp(name, value, min(nameLength, valueLength));
+	if (result != 0)
+		return result;
+	if (nameLength < valueLength)
+		return -1;
+	if (nameLength > valueLength)
+		return 1;
+	return 0;
+}
+
+//Finalizer from splitmix64, spreads every bit of the input over the whole result
+static unsigned long long mixHash(unsigned long long hash)
+{
+	hash ^= hash >> 30;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94D049BB133111EBULL;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+//Seeded 64 bit FNV-1a hash of a name
+static unsigned long long hashName(const char *name, unsigned int length, unsigned long long seed)
+{
+	unsigned long long hash = 0xCBF29CE484222325ULL ^ seed;
+	for (unsigned int I = 0; I < length; I++)
+	{
+		hash ^= static_cast<unsigned char>(name[I]);
+		hash *= 0x100000001B3ULL;
+	}
+	return mixHash(hash);
+}
+
+const unsigned int ResourceNameTable::npos;
+
+//Average number of names per bucket in the perfect hash. Larger buckets use less memory but take longer to build.
+const unsigned int namesPerBucket = 4;
+
+ResourceNameTable::ResourceNameTable() : hashSeed(0)
+{
+	//The end of the (non-existent) last name
+	nameOffsets.push_back(0);
+}
+
+ResourceNameTable::ResourceNameTable(vector<string> names) : hashSeed(0)
+{
+	//Sort the names and get rid of duplicates
+	sort(names.begin(), names.end());
+	names.erase(unique(names.begin(), names.end()), names.end());
+
+	//Work out how much space we need so the table is allocated exactly once
+	size_t dataSize = 0;
+	for (vector<string>::const_iterator it = names.begin(); it != names.end(); it++)
+		dataSize += it->length() + 1;
+	nameData.reserve(dataSize);
+	nameOffsets.reserve(names.size() + 1);
+
+	//Pack the names end to end, each with a null terminator
+	for (vector<string>::const_iterator it = names.begin(); it != names.end(); it++)
+	{
+		nameOffsets.push_back(nameData.size());
+		nameData.insert(nameData.end(), it->begin(), it->end());
+		nameData.push_back(0);
+	}
+	nameOffsets.push_back(nameData.size());
+
+	buildHash();
+}
+
+unsigned int ResourceNameTable::getSlot(unsigned long long hash, unsigned int displacement) const
+{
+	return static_cast<unsigned int>(mixHash(hash ^ (displacement * 0x9E3779B97F4A7C15ULL)) % slotIndices.size());
+}
+
+void ResourceNameTable::buildHash()
+{
+	unsigned int nameCount = size();
+	if (nameCount == 0)
+		return;
+
+	unsigned int bucketCount = nameCount / namesPerBucket + 1;
+	//Give up on a seed if a bucket can't be placed after this many tries. Only happens if two names have the same hash.
+	unsigned int maxDisplacement = max(nameCount, 1024u) * 16;
+
+	vector<unsigned long long> hashes(nameCount);
+	vector<unsigned int> bucketStarts(bucketCount + 1);
+	vector<unsigned int> bucketNames(nameCount);
+	vector<unsigned int> bucketOrder(bucketCount);
+	vector<char> slotTaken(nameCount);
+	vector<unsigned int> bucketSlots;
+
+	bool built = false;
+	while (!built)
+	{
+		displacements.assign(bucketCount, 0);
+		slotIndices.assign(nameCount, npos);
+		slotTaken.assign(nameCount, 0);
+		bucketStarts.assign(bucketCount + 1, 0);
+
+		//Hash the names and group them by bucket
+		for (unsigned int I = 0; I < nameCount; I++)
+		{
+			hashes[I] = hashName(getName(I), getNameLength(I), hashSeed);
+			bucketStarts[hashes[I] % bucketCount + 1]++;
+		}
+		for (unsigned int I = 0; I < bucketCount; I++)
+			bucketStarts[I + 1] += bucketStarts[I];
+		{
+			vector<unsigned int> bucketFill(bucketStarts.begin(), bucketStarts.end() - 1);
+			for (unsigned int I = 0; I < nameCount; I++)
+				bucketNames[bucketFill[hashes[I] % bucketCount]++] = I;
+		}
+
+		//Place the largest buckets first, while the slots are mostly empty
+		for (unsigned int I = 0; I < bucketCount; I++)
+			bucketOrder[I] = I;
+		stable_sort(bucketOrder.begin(), bucketOrder.end(), [&](unsigned int a, unsigned int b)
+		{
+			return bucketStarts[a + 1] - bucketStarts[a] > bucketStarts[b + 1] - bucketStarts[b];
+		});
+
+		built = true;
+		for (unsigned int I = 0; I < bucketCount && built; I++)
+		{
+			unsigned int bucket = bucketOrder[I];
+			unsigned int first = bucketStarts[bucket];
+			unsigned int last = bucketStarts[bucket + 1];
+			//Buckets are sorted by size, so the rest are empty
+			if (first == last)
+				break;
+
+			//Try displacements until every name in the bucket lands in a free slot, and no two land in the same one
+			bool placed = false;
+			for (unsigned int displacement = 0; displacement < maxDisplacement && !placed; displacement++)
+			{
+				bucketSlots.clear();
+				placed = true;
+				for (unsigned int J = first; J < last && placed; J++)
+				{
+					unsigned int slot = getSlot(hashes[bucketNames[J]], displacement);
+					if (slotTaken[slot] || std::find(bucketSlots.begin(), bucketSlots.end(), slot) != bucketSlots.end())
+						placed = false;
+					else
+						bucketSlots.push_back(slot);
+				}
+				if (placed)
+				{
+					displacements[bucket] = displacement;
+					for (unsigned int J = first; J < last; J++)
+					{
+						slotTaken[bucketSlots[J - first]] = 1;
+						slotIndices[bucketSlots[J - first]] = bucketNames[J];
+					}
+				}
+			}
+
+			//Couldn't place the bucket, start over with a new seed.
+			if (!placed)
+			{
+				built = false;
+				hashSeed++;
+			}
+		}
+	}
+}
+
+unsigned int ResourceNameTable::lowerBound(const char *value, unsigned int length) const
+{
+	//Binary search for the first name that isn't less than value
+	unsigned int first = 0;
+	unsigned int count = size();
+	while (count > 0)
+	{
+		unsigned int step = count / 2;
+		unsigned int middle = first + step;
+		if (compareName(getName(middle), getNameLength(middle), value, length) < 0)
+		{
+			first = middle + 1;
+			count -= step + 1;
+		}
+		else
+			count = step;
+	}
+	return first;
+}
+
+unsigned int ResourceNameTable::prefixEnd(const char *prefix, unsigned int length) const
+{
+	//Binary search for the first name whose leading characters sort after prefix. Names shorter than the prefix are compared in full.
+	unsigned int first = 0;
+	unsigned int count = size();
+	while (count > 0)
+	{
+		unsigned int step = count / 2;
+		unsigned int middle = first + step;
+		if (compareName(getName(middle), min(getNameLength(middle), length), prefix, length) <= 0)
+		{
+			first = middle + 1;
+			count -= step + 1;
+		}
+		else
+			count = step;
+	}
+	return first;
+}
+
+unsigned int ResourceNameTable::find(const string &name) const
+{
+	return find(name.c_str(), name.length());
+}
+
+unsigned int ResourceNameTable::find(const char *name, unsigned int length) const
+{
+	if (slotIndices.size() == 0)
+		return npos;
+
+	//Find the only name that could match using the perfect hash, then check that it actually does
+	unsigned long long hash = hashName(name, length, hashSeed);
+	unsigned int index = slotIndices[getSlot(hash, displacements[hash % displacements.size()])];
+	if (getNameLength(index) == length && memcmp(getName(index), name, length) == 0)
+		return index;
+	return npos;
+}
+
+void ResourceNameTable::getPrefixRange(const string &prefix, unsigned int &first, unsigned int &last) const
+{
+	//All of the names starting with prefix sort together, beginning at the prefix itself
+	first = lowerBound(prefix.c_str(), prefix.length());
+	last = prefixEnd(prefix.c_str(), prefix.length());
+}
+
+void ResourceNameTable::visitPrefix(const string &prefix, const function<void(unsigned int, const char*)> &visitor) const
+{
+	unsigned int first, last;
+	getPrefixRange(prefix, first, last);
+	for (unsigned int I = first; I < last; I++)
+		visitor(I, getName(I));
+}
+
+void ResourceNameTable::visitDirectory(const string &directory, const function<void(unsigned int, const char*)> &visitor) const
+{
+	unsigned int first, last;
+	getPrefixRange(directory, first, last);
+
+	unsigned int I = first;
+	while (I < last)
+	{
+		//Look for a separator after the directory part of the name
+		const char *name = getName(I);
+		const char *separator = strpbrk(name + directory.length(), "/\\");
+		//No separator, the name is directly within the directory
+		if (separator == nullptr)
+		{
+			visitor(I, name);
+			I++;
+		}
+		//Otherwise the name is in a subdirectory, skip everything else in that subdirectory
+		else
+		{
+			I = prefixEnd(name, separator - name + 1);
+		}
+	}
+}
@@ -0,0 +1,109 @@
+// Name:
+// ResourceNameTable.h
+// Description:
+// Header file for ResourceNameTable class
+// A ResourceNameTable is an immutable, sorted list of resource names packed into a single block of memory.
+// ResourceSources build one when they're opened and share it with anyone that needs to enumerate their contents, so listing resources never copies names.
+// A minimal perfect hash over the names is built with the table, so find maps a name to its index with a couple of array reads.
+// Sources keep their per-resource data in flat arrays in the same order as the table, using the index find returns.
+// Notes:
+// OS-Unaware
+
+#ifndef RESOURCE_NAME_TABLE_H
+#define RESOURCE_NAME_TABLE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <iterator>
+#include <cstddef>
+using namespace std;
+
+class ResourceNameTable
+{
+private:
+	//All of the names in sorted order, each followed by a null terminator
+	vector<char> nameData;
+	//Offset of each name within nameData, with one extra entry marking the end of the last name
+	vector<unsigned int> nameOffsets;
+
+	//Minimal perfect hash. Names are hashed in to buckets, each bucket stores the displacement that places all of its names in unique slots.
+	unsigned long long hashSeed;
+	vector<unsigned int> displacements;
+	//Index of the name that hashes to each slot
+	vector<unsigned int> slotIndices;
+
+	//Builds the perfect hash once the names are in place
+	void buildHash();
+	//Gets the slot for a name's hash using its bucket's displacement
+	unsigned int getSlot(unsigned long long hash, unsigned int displacement) const;
+
+	//Returns the index of the first name that doesn't sort before value
+	unsigned int lowerBound(const char *value, unsigned int length) const;
+	//Returns the index of the first name that sorts after every name starting with prefix
+	unsigned int prefixEnd(const char *prefix, unsigned int length) const;
+
+	ResourceNameTable(const ResourceNameTable& resourceNameTable) = delete;
+	ResourceNameTable& operator =(const ResourceNameTable& resourceNameTable) = delete;
+
+public:
+	//Returned by find when a name isn't in the table
+	static const unsigned int npos = 0xFFFFFFFF;
+
+	//Iterates over the names in the table in sorted order
+	class const_iterator
+	{
+	public:
+		typedef random_access_iterator_tag iterator_category;
+		typedef const char* value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const char* const* pointer;
+		//Names are returned by value, there's nothing in the table to refer to
+		typedef const char* reference;
+	private:
+		const ResourceNameTable *table;
+		unsigned int index;
+	public:
+		const_iterator(const ResourceNameTable *table, unsigned int index) : table(table), index(index) {}
+		const char* operator*() const { return table->getName(index); }
+		unsigned int getIndex() const { return index; }
+		const_iterator& operator++() { index++; return *this; }
+		const_iterator operator++(int) { const_iterator temp(*this); index++; return temp; }
+		const_iterator& operator--() { index--; return *this; }
+		const_iterator operator--(int) { const_iterator temp(*this); index--; return temp; }
+		const_iterator& operator+=(int distance) { index += distance; return *this; }
+		const_iterator operator+(int distance) const { return const_iterator(table, index + distance); }
+		int operator-(const const_iterator& other) const { return index - other.index; }
+		bool operator==(const const_iterator& other) const { return index == other.index; }
+		bool operator!=(const const_iterator& other) const { return index != other.index; }
+		bool operator<(const const_iterator& other) const { return index < other.index; }
+	};
+
+	//Creates an empty table
+	ResourceNameTable();
+	//Creates a table from a list of names. Duplicate names are only stored once.
+	ResourceNameTable(vector<string> names);
+
+	//Returns the number of names in the table
+	unsigned int size() const { return nameOffsets.size() - 1; }
+	//Returns the null terminated name at index. O(1)
+	const char* getName(unsigned int index) const { return &nameData[nameOffsets[index]]; }
+	//Returns the length of the name at index, not including the null terminator. O(1)
+	unsigned int getNameLength(unsigned int index) const { return nameOffsets[index + 1] - nameOffsets[index] - 1; }
+	//Returns the index of name, or npos if the table doesn't contain it. O(1)
+	unsigned int find(const string &name) const;
+	unsigned int find(const char *name, unsigned int length) const;
+
+	//Gets the range of indices [first, last) of names starting with prefix, ie "textures/ui/". O(log n)
+	void getPrefixRange(const string &prefix, unsigned int &first, unsigned int &last) const;
+	//Calls visitor with the index and name of every name starting with prefix, in sorted order.
+	void visitPrefix(const string &prefix, const function<void(unsigned int, const char*)> &visitor) const;
+	//Calls visitor with the index and name of every name directly within directory, not including names in its subdirectories.
+	//directory should end with a separator, ie "textures/ui/". Both '/' and '\' are treated as separators. An empty directory visits the names at the root.
+	void visitDirectory(const string &directory, const function<void(unsigned int, const char*)> &visitor) const;
+
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, size()); }
+};
+
+#endif
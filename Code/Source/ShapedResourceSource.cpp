@@ -0,0 +1,215 @@
+// Name:
+// ShapedResourceSource.cpp
+// Description:
+// Implementation file for ShapedResourceSource class
+// Notes:
+// OS-Unaware
+
+#include "CustomMemory.h"
+
+#include "ShapedResourceSource.h"
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <chrono>
+using namespace std;
+
+#include "Logger.h"
+
+extern Logger* appLogger;
+
+ShapingConfig::ShapingConfig() : latencyMicroseconds(0), jitterMicroseconds(0), bytesPerSecond(0), failureRate(0), queueDepth(32), seed(1) {}
+
+//Mixes bits for the random numbers, see splitmix64
+static unsigned long long mixBits(unsigned long long value)
+{
+	value += 0x9E3779B97F4A7C15ULL;
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+	return value ^ (value >> 31);
+}
+
+//Turns random bits in to a number from 0 to 1
+static double toUnit(unsigned long long bits)
+{
+	return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+ShapedResourceSource::ShapedResourceSource(IResourceSource *source, const ShapingConfig &config) : source(source), config(config), bandwidthFree(Clock::now()) {}
+
+ShapedResourceSource::~ShapedResourceSource()
+{
+	delete source;
+}
+
+ShapedResourceSource::Clock::duration ShapedResourceSource::shapeRead(const string &resource, bool &fail) const
+{
+	//FNV-1a of the name, which unlike hash<string> is the same everywhere
+	unsigned long long nameHash = 0xCBF29CE484222325ULL;
+	for (string::const_iterator it = resource.begin(); it != resource.end(); it++)
+		nameHash = (nameHash ^ static_cast<unsigned char>(*it)) * 0x100000001B3ULL;
+
+	unsigned long long bits = mixBits(nameHash ^ mixBits(config.seed) ^ (static_cast<unsigned long long>(readCounts[resource]++) << 32));
+	fail = toUnit(mixBits(bits)) < config.failureRate;
+	double jitter = toUnit(bits) * config.jitterMicroseconds;
+	return chrono::duration_cast<Clock::duration>(chrono::duration<double, micro>(config.latencyMicroseconds + jitter));
+}
+
+ShapedResourceSource::Clock::time_point ShapedResourceSource::reserveTransfer(Clock::time_point ready, unsigned long long bytes) const
+{
+	if (config.bytesPerSecond == 0)
+		return ready;
+	//Transfers take turns with the bandwidth, a transfer can't start until the one before it has finished
+	Clock::time_point start = max(ready, bandwidthFree);
+	bandwidthFree = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(static_cast<double>(bytes) / config.bytesPerSecond));
+	return bandwidthFree;
+}
+
+bool ShapedResourceSource::open()
+{
+	return source->open();
+}
+
+unsigned long long ShapedResourceSource::getRawResourceSize(const string &resource) const
+{
+	return source->getRawResourceSize(resource);
+}
+
+unsigned long long ShapedResourceSource::getRawResource(const string &resource, char * buffer) const
+{
+	Clock::time_point start = Clock::now();
+	unsigned long long result = source->getRawResource(resource, buffer);
+
+	bool fail;
+	Clock::time_point finish;
+	{
+		lock_guard<recursive_mutex> objectLock(objectMutex);
+		Clock::duration latency = shapeRead(resource, fail);
+		finish = reserveTransfer(start + latency, result);
+		stats.reads++;
+		stats.bytes += fail ? 0 : result;
+		stats.failures += fail ? 1 : 0;
+		stats.waitSeconds += chrono::duration<double>(finish - start).count();
+	}
+
+	this_thread::sleep_until(finish);
+	if (fail)
+	{
+		appLogger->eWriteLog(string("Injected failure reading ") + resource, LogLevel::Warning, { "Resource" });
+		return 0;
+	}
+	return result;
+}
+
+void ShapedResourceSource::getRawResources(vector<RawResourceRequest> &requests, const function<void(RawResourceRequest&)> &onComplete) const
+{
+	if (requests.size() == 0)
+		return;
+	Clock::time_point start = Clock::now();
+
+	//Read everything from the wrapped source first, then hand each request back when it would have finished
+	source->getRawResources(requests, [](RawResourceRequest &) {});
+
+	vector<Clock::time_point> finishes(requests.size());
+	vector<bool> failures(requests.size());
+	{
+		lock_guard<recursive_mutex> objectLock(objectMutex);
+		//Each slot is a read in flight, requests take the first slot to come free
+		vector<Clock::time_point> slots(max(min<size_t>(config.queueDepth, requests.size()), static_cast<size_t>(1)), start);
+		for (unsigned int I = 0; I < requests.size(); I++)
+		{
+			vector<Clock::time_point>::iterator slot = min_element(slots.begin(), slots.end());
+			bool fail;
+			Clock::duration latency = shapeRead(requests[I].resource, fail);
+			unsigned long long bytes = requests[I].result;
+			finishes[I] = reserveTransfer(*slot + latency, bytes);
+			failures[I] = fail;
+			*slot = finishes[I];
+			stats.reads++;
+			stats.bytes += fail ? 0 : bytes;
+			stats.failures += fail ? 1 : 0;
+			stats.waitSeconds += chrono::duration<double>(finishes[I] - start).count();
+		}
+	}
+
+	//Complete the requests in the order they finish
+	vector<unsigned int> order(requests.size());
+	for (unsigned int I = 0; I < order.size(); I++)
+		order[I] = I;
+	stable_sort(order.begin(), order.end(), [&](unsigned int first, unsigned int second) { return finishes[first] < finishes[second]; });
+	for (vector<unsigned int>::const_iterator it = order.begin(); it != order.end(); it++)
+	{
+		this_thread::sleep_until(finishes[*it]);
+		if (failures[*it])
+		{
+			appLogger->eWriteLog(string("Injected failure reading ") + requests[*it].resource, LogLevel::Warning, { "Resource" });
+			requests[*it].result = 0;
+		}
+		onComplete(requests[*it]);
+	}
+}
+
+int ShapedResourceSource::getNumResources() const
+{
+	return source->getNumResources();
+}
+
+string ShapedResourceSource::getResourceName(int num) const
+{
+	return source->getResourceName(num);
+}
+
+unordered_set<string> ShapedResourceSource::getResourceList() const
+{
+	return source->getResourceList();
+}
+
+shared_ptr<const ResourceNameTable> ShapedResourceSource::getNameTable() const
+{
+	return source->getNameTable();
+}
+
+bool ShapedResourceSource::hasResource(const string &resource) const
+{
+	return source->hasResource(resource);
+}
+
+void ShapedResourceSource::setIntegrityMode(IntegrityMode mode)
+{
+	source->setIntegrityMode(mode);
+}
+
+IntegrityStats ShapedResourceSource::getIntegrityStats() const
+{
+	return source->getIntegrityStats();
+}
+
+bool ShapedResourceSource::getContentKey(const string &resource, ResourceContentKey &key) const
+{
+	return source->getContentKey(resource, key);
+}
+
+string ShapedResourceSource::getContentName(const string &resource) const
+{
+	return source->getContentName(resource);
+}
+
+bool ShapedResourceSource::isContentVerified(const string &resource) const
+{
+	return source->isContentVerified(resource);
+}
+
+void ShapedResourceSource::setContentVerified(const string &resource, bool duplicate) const
+{
+	source->setContentVerified(resource, duplicate);
+}
+
+ShapingStats ShapedResourceSource::getStats() const
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	return stats;
+}
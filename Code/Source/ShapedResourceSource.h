@@ -0,0 +1,96 @@
+// Name:
+// ShapedResourceSource.h
+// Description:
+// Header file for ShapedResourceSource class
+// ShapedResourceSource wraps another source and makes it's reads behave like a slow disk or network file system, for testing preloading and eviction.
+// Each read waits for a latency plus random jitter, then for it's share of a bandwidth limit shared by all reads, and can be made to fail at random.
+// Reads in a batch overlap up to a queue depth, so batches hide latency the way they would on a real device.
+// The random numbers for a read come from the seed, the resource's name and how many times it's been read, so runs with the same reads behave the same whatever threads make them.
+// Lookups, names and sizes are passed straight through, only reads are shaped.
+// See IResourceSource.h for usage details.
+// Notes:
+// OS-Unaware
+
+#ifndef SHAPED_RESOURCE_SOURCE_H
+#define SHAPED_RESOURCE_SOURCE_H
+
+#include <string>
+#include <memory>
+#include <unordered_set>
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+using namespace std;
+#include "IResourceSource.h"
+#include "Lockable.h"
+
+struct ShapingConfig
+{
+	//Time every read waits before any data arrives, plus a random amount up to jitter
+	unsigned int latencyMicroseconds;
+	unsigned int jitterMicroseconds;
+	//Bytes per second shared by every read, 0 for no limit
+	unsigned long long bytesPerSecond;
+	//Chance of a read failing, from 0 to 1. Failed reads still take their time, then return 0.
+	double failureRate;
+	//Reads from a batch that can be waiting at once
+	unsigned int queueDepth;
+	unsigned int seed;
+
+	ShapingConfig();
+};
+
+//Counts of the reads made through a ShapedResourceSource
+struct ShapingStats
+{
+	unsigned long long reads;
+	unsigned long long failures;
+	unsigned long long bytes;
+	//Total time reads spent waiting on the shaping, in seconds
+	double waitSeconds;
+
+	ShapingStats() : reads(0), failures(0), bytes(0), waitSeconds(0) {}
+};
+
+class ShapedResourceSource : public IResourceSource, public Lockable
+{
+private:
+	typedef chrono::steady_clock Clock;
+
+	IResourceSource *source;
+	ShapingConfig config;
+	//Time the bandwidth is free for the next read's data
+	mutable Clock::time_point bandwidthFree;
+	//Number of times each resource has been read, which picks the random numbers for the next read
+	mutable unordered_map<string, unsigned int> readCounts;
+	mutable ShapingStats stats;
+
+	//Picks the latency and whether the read fails for the next read of a resource. Call with the object locked.
+	Clock::duration shapeRead(const string &resource, bool &fail) const;
+	//Reserves the bandwidth for bytes of data that's ready to transfer at ready, returning when the transfer finishes. Call with the object locked.
+	Clock::time_point reserveTransfer(Clock::time_point ready, unsigned long long bytes) const;
+public:
+	//Takes ownership of source, which is deleted with the ShapedResourceSource
+	ShapedResourceSource(IResourceSource *source, const ShapingConfig &config);
+	virtual ~ShapedResourceSource();
+	virtual bool open();
+	virtual unsigned long long getRawResourceSize(const string &resource) const;
+	virtual unsigned long long getRawResource(const string &resource, char * buffer) const;
+	virtual void getRawResources(vector<RawResourceRequest> &requests, const function<void(RawResourceRequest&)> &onComplete) const;
+	virtual int getNumResources() const;
+	virtual string getResourceName(int num) const;
+	virtual unordered_set<string> getResourceList() const;
+	virtual shared_ptr<const ResourceNameTable> getNameTable() const;
+	virtual bool hasResource(const string &resource) const;
+	virtual void setIntegrityMode(IntegrityMode mode);
+	virtual IntegrityStats getIntegrityStats() const;
+	virtual bool getContentKey(const string &resource, ResourceContentKey &key) const;
+	virtual string getContentName(const string &resource) const;
+	virtual bool isContentVerified(const string &resource) const;
+	virtual void setContentVerified(const string &resource, bool duplicate) const;
+	//getResourceData isn't passed through, so resources in memory are read and shaped like any other
+
+	ShapingStats getStats() const;
+};
+
+#endif
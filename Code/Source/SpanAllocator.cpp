@@ -0,0 +1,523 @@
+// Name:
+// SpanAllocator.cpp
+// Description:
+// Implementation file for SpanAllocator class
+// Notes:
+// OS-Aware
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "SpanAllocator.h"
+
+#include <mutex>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <cstdlib>
+using namespace std;
+
+//Size and alignment of a span
+const size_t spanSize = 64 * 1024;
+const unsigned int spanShift = 16;
+//Most empty spans kept for reuse before they're given back to the OS
+const unsigned int maxSpareSpans = 16;
+
+//Bytes in each size class, every one a multiple of 16 so blocks are aligned like malloc's
+static const unsigned int blockSizes[spanSizeClasses] = { 16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 640, 768, 896, 1024 };
+
+//Header at the start of each span, followed by the memory tag of each block and then the blocks
+struct Span
+{
+	//Links in the class's list of spans with free blocks, or in the list of spares
+	Span *next;
+	Span *prev;
+	//Blocks that have been freed back to the span, linked through their first bytes
+	void *freeBlocks;
+	//Blocks that have never been handed out, from nextUnused up to end
+	char *nextUnused;
+	char *end;
+	char *firstBlock;
+	unsigned int sizeClass;
+	unsigned int blockSize;
+	//Turns an offset from firstBlock in to a block number with a multiply instead of a divide
+	unsigned int reciprocal;
+	//Blocks handed out to threads that haven't come back
+	unsigned int usedBlocks;
+	//Whether the span is in it's class's list of spans with free blocks
+	bool partial;
+};
+
+//Blocks each thread has been given but isn't using, linked through their first bytes
+struct ThreadBlockCache
+{
+	void *blocks[spanSizeClasses];
+	unsigned int counts[spanSizeClasses];
+};
+
+static thread_local ThreadBlockCache threadBlockCache;
+//Set once the thread's cache needs giving back when the thread exits
+static thread_local bool threadCacheUsed = false;
+//Set once the thread's cache has been given back, anything the thread allocates or frees afterwards goes straight to the central lists
+static thread_local bool threadCacheRetired = false;
+
+//Gives the thread's cached blocks back when the thread exits
+struct ThreadBlockCacheRetirer
+{
+	~ThreadBlockCacheRetirer()
+	{
+		if (threadCacheUsed)
+			getSpanAllocator().retireCache();
+	}
+};
+static thread_local ThreadBlockCacheRetirer threadBlockCacheRetirer;
+
+//Placed in front of allocations too large for a size class
+struct LargeHeader
+{
+	size_t size;
+	MemoryTag tag;
+};
+const size_t largeHeaderSize = (sizeof(LargeHeader) + 15) / 16 * 16;
+
+//A bit for each 64KB region of the address space, set while the region is a span, so frees can tell spans from malloc's memory.
+//32 bit builds cover the whole address space with one leaf, 64 bit builds cover the 48 bits processors use with leaves created as they're needed.
+const size_t regionsPerLeaf = static_cast<size_t>(1) << 16;
+const size_t regionLeaves = sizeof(void*) == 4 ? 1 : regionsPerLeaf;
+static atomic<atomic<unsigned int>*> regionLeafTable[regionLeaves];
+
+//Sets or clears a span's region bit. Returns false if there wasn't memory for the leaf, or the span is past the addresses the table covers.
+static bool markRegion(void *span, bool isSpan)
+{
+	size_t region = reinterpret_cast<size_t>(span) >> spanShift;
+	if (region / regionsPerLeaf >= regionLeaves)
+		return false;
+	atomic<unsigned int> *leaf = regionLeafTable[region / regionsPerLeaf].load(memory_order_acquire);
+	if (leaf == nullptr)
+	{
+		atomic<unsigned int> *newLeaf = reinterpret_cast<atomic<unsigned int>*>(calloc(regionsPerLeaf / 32, sizeof(atomic<unsigned int>)));
+		if (newLeaf == nullptr)
+			return false;
+		if (regionLeafTable[region / regionsPerLeaf].compare_exchange_strong(leaf, newLeaf, memory_order_acq_rel))
+			leaf = newLeaf;
+		else
+			free(newLeaf);
+	}
+
+	unsigned int bit = 1u << (region % 32);
+	if (isSpan)
+		leaf[(region % regionsPerLeaf) / 32].fetch_or(bit, memory_order_release);
+	else
+		leaf[(region % regionsPerLeaf) / 32].fetch_and(~bit, memory_order_release);
+	return true;
+}
+
+static inline bool isSpanRegion(void *ptr)
+{
+	size_t region = reinterpret_cast<size_t>(ptr) >> spanShift;
+	if (region / regionsPerLeaf >= regionLeaves)
+		return false;
+	atomic<unsigned int> *leaf = regionLeafTable[region / regionsPerLeaf].load(memory_order_acquire);
+	if (leaf == nullptr)
+		return false;
+	return ((leaf[(region % regionsPerLeaf) / 32].load(memory_order_acquire) >> (region % 32)) & 1) != 0;
+}
+
+static void *mapSpan()
+{
+#ifdef _WIN32
+	//VirtualAlloc hands out memory on 64KB boundaries, so the span is aligned already
+	return VirtualAlloc(nullptr, spanSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	//Map twice the size and trim it down to an aligned span
+	char *mapping = static_cast<char*>(mmap(nullptr, spanSize * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	if (mapping == MAP_FAILED)
+		return nullptr;
+	char *span = reinterpret_cast<char*>((reinterpret_cast<size_t>(mapping) + spanSize - 1) & ~(spanSize - 1));
+	if (span != mapping)
+		munmap(mapping, span - mapping);
+	munmap(span + spanSize, mapping + spanSize * 2 - (span + spanSize));
+	return span;
+#endif
+}
+
+static void unmapSpan(void *span)
+{
+#ifdef _WIN32
+	VirtualFree(span, 0, MEM_RELEASE);
+#else
+	munmap(span, spanSize);
+#endif
+}
+
+static inline Span *findSpan(void *block)
+{
+	return reinterpret_cast<Span*>(reinterpret_cast<size_t>(block) & ~(spanSize - 1));
+}
+
+static inline MemoryTag *spanTags(Span *span)
+{
+	return reinterpret_cast<MemoryTag*>(span + 1);
+}
+
+//Returns a block's number in it's span. Offsets are under 64KB and blocks at most 1KB, so the multiply is exact.
+static inline unsigned int blockIndex(Span *span, void *block)
+{
+	return static_cast<unsigned int>((static_cast<unsigned long long>(static_cast<char*>(block) - span->firstBlock) * span->reciprocal) >> 32);
+}
+
+//Blocks moved between a thread and the central list at once, smaller for larger blocks so threads don't sit on much memory
+static inline unsigned int batchSize(unsigned int sizeClass)
+{
+	unsigned int batch = 4096 / blockSizes[sizeClass];
+	if (batch > 32)
+		return 32;
+	if (batch < 4)
+		return 4;
+	return batch;
+}
+
+static void linkSpan(Span *&head, Span *span)
+{
+	span->prev = nullptr;
+	span->next = head;
+	if (head != nullptr)
+		head->prev = span;
+	head = span;
+	span->partial = true;
+}
+
+static void unlinkSpan(Span *&head, Span *span)
+{
+	if (span->prev != nullptr)
+		span->prev->next = span->next;
+	else
+		head = span->next;
+	if (span->next != nullptr)
+		span->next->prev = span->prev;
+	span->partial = false;
+}
+
+SpanAllocator::SpanAllocator() : spareSpans(nullptr), spareCount(0), mappedBytes(0)
+{
+	for (unsigned int I = 0; I < spanSizeClasses; I++)
+		centralLists[I].partialSpans = nullptr;
+
+	//Each step of 16 bytes goes to the smallest class it fits in
+	unsigned int sizeClass = 0;
+	for (unsigned int I = 0; I <= maxSpanBlockSize / 16; I++)
+	{
+		while (blockSizes[sizeClass] < I * 16)
+			sizeClass++;
+		sizeClasses[I] = static_cast<unsigned char>(sizeClass);
+	}
+}
+
+Span *SpanAllocator::createSpan(unsigned int sizeClass)
+{
+	Span *span = nullptr;
+	{
+		lock_guard<mutex> spareLock(spareMutex);
+		if (spareSpans != nullptr)
+		{
+			span = spareSpans;
+			spareSpans = span->next;
+			spareCount--;
+		}
+	}
+
+	if (span == nullptr)
+	{
+		void *memory = mapSpan();
+		if (memory == nullptr)
+			return nullptr;
+		if (!markRegion(memory, true))
+		{
+			unmapSpan(memory);
+			return nullptr;
+		}
+		mappedBytes += spanSize;
+		span = static_cast<Span*>(memory);
+	}
+
+	//Fit as many blocks as there's room for after the header and their tags
+	unsigned int blockSize = blockSizes[sizeClass];
+	size_t blockCount = (spanSize - sizeof(Span)) / (blockSize + 1);
+	size_t firstOffset = (sizeof(Span) + blockCount + 15) / 16 * 16;
+	while (firstOffset + blockCount * blockSize > spanSize)
+		blockCount--;
+
+	span->next = nullptr;
+	span->prev = nullptr;
+	span->freeBlocks = nullptr;
+	span->firstBlock = reinterpret_cast<char*>(span) + firstOffset;
+	span->nextUnused = span->firstBlock;
+	span->end = span->firstBlock + blockCount * blockSize;
+	span->sizeClass = sizeClass;
+	span->blockSize = blockSize;
+	span->reciprocal = 0xFFFFFFFFu / blockSize + 1;
+	span->usedBlocks = 0;
+	span->partial = false;
+	return span;
+}
+
+void SpanAllocator::destroySpan(Span *span)
+{
+	{
+		lock_guard<mutex> spareLock(spareMutex);
+		if (spareCount < maxSpareSpans)
+		{
+			span->next = spareSpans;
+			spareSpans = span;
+			spareCount++;
+			return;
+		}
+	}
+
+	markRegion(span, false);
+	mappedBytes -= spanSize;
+	unmapSpan(span);
+}
+
+unsigned int SpanAllocator::takeBlocks(unsigned int sizeClass, unsigned int count, void *&blocks)
+{
+	CentralList &list = centralLists[sizeClass];
+	lock_guard<mutex> listLock(list.listMutex);
+
+	blocks = nullptr;
+	unsigned int taken = 0;
+	while (taken < count)
+	{
+		Span *span = list.partialSpans;
+		if (span == nullptr)
+		{
+			span = createSpan(sizeClass);
+			if (span == nullptr)
+				break;
+			linkSpan(list.partialSpans, span);
+		}
+
+		//Take blocks that have been freed first, then ones that have never been used
+		while (taken < count && span->freeBlocks != nullptr)
+		{
+			void *block = span->freeBlocks;
+			span->freeBlocks = *static_cast<void**>(block);
+			*static_cast<void**>(block) = blocks;
+			blocks = block;
+			span->usedBlocks++;
+			taken++;
+		}
+		while (taken < count && span->nextUnused < span->end)
+		{
+			void *block = span->nextUnused;
+			span->nextUnused += span->blockSize;
+			*static_cast<void**>(block) = blocks;
+			blocks = block;
+			span->usedBlocks++;
+			taken++;
+		}
+
+		//Full spans leave the list until a block is freed back to them
+		if (span->freeBlocks == nullptr && span->nextUnused >= span->end)
+			unlinkSpan(list.partialSpans, span);
+	}
+	return taken;
+}
+
+void SpanAllocator::giveBlocks(unsigned int sizeClass, void *blocks, unsigned int count)
+{
+	CentralList &list = centralLists[sizeClass];
+	lock_guard<mutex> listLock(list.listMutex);
+
+	for (unsigned int I = 0; I < count; I++)
+	{
+		void *block = blocks;
+		blocks = *static_cast<void**>(block);
+
+		Span *span = findSpan(block);
+		*static_cast<void**>(block) = span->freeBlocks;
+		span->freeBlocks = block;
+		span->usedBlocks--;
+
+		if (span->usedBlocks == 0)
+		{
+			//Every block is back, the span can go
+			if (span->partial)
+				unlinkSpan(list.partialSpans, span);
+			destroySpan(span);
+		}
+		else if (!span->partial)
+			linkSpan(list.partialSpans, span);
+	}
+}
+
+void *SpanAllocator::refill(ThreadBlockCache &cache, unsigned int sizeClass)
+{
+	void *blocks;
+	//Threads that have exited take blocks one at a time
+	if (threadCacheRetired)
+		return takeBlocks(sizeClass, 1, blocks) > 0 ? blocks : nullptr;
+
+	//Make sure the cache is given back when the thread exits
+	if (!threadCacheUsed)
+	{
+		threadCacheUsed = true;
+		(void)&threadBlockCacheRetirer;
+	}
+
+	unsigned int taken = takeBlocks(sizeClass, batchSize(sizeClass), blocks);
+	if (taken == 0)
+		return nullptr;
+	cache.blocks[sizeClass] = *static_cast<void**>(blocks);
+	cache.counts[sizeClass] = taken - 1;
+	return blocks;
+}
+
+void SpanAllocator::flushCache()
+{
+	ThreadBlockCache &cache = threadBlockCache;
+	for (unsigned int I = 0; I < spanSizeClasses; I++)
+	{
+		if (cache.counts[I] > 0)
+			giveBlocks(I, cache.blocks[I], cache.counts[I]);
+		cache.blocks[I] = nullptr;
+		cache.counts[I] = 0;
+	}
+}
+
+void SpanAllocator::retireCache()
+{
+	threadCacheRetired = true;
+	flushCache();
+}
+
+void SpanAllocator::trim()
+{
+	//The thread takes new batches as it allocates again
+	flushCache();
+
+	Span *spans;
+	{
+		lock_guard<mutex> spareLock(spareMutex);
+		spans = spareSpans;
+		spareSpans = nullptr;
+		spareCount = 0;
+	}
+	while (spans != nullptr)
+	{
+		Span *next = spans->next;
+		markRegion(spans, false);
+		mappedBytes -= spanSize;
+		unmapSpan(spans);
+		spans = next;
+	}
+}
+
+void *SpanAllocator::allocateLarge(size_t size, MemoryTag tag)
+{
+	//Sizes so large the header would wrap them around can't be allocated
+	if (size > static_cast<size_t>(-1) - largeHeaderSize)
+		return nullptr;
+	char *memory = static_cast<char*>(malloc(size + largeHeaderSize));
+	if (memory == nullptr)
+		return nullptr;
+
+	LargeHeader *header = reinterpret_cast<LargeHeader*>(memory);
+	header->size = size;
+	header->tag = tag;
+	chargeMemoryTag(tag, static_cast<long long>(size));
+	return memory + largeHeaderSize;
+}
+
+void SpanAllocator::releaseLarge(void *ptr)
+{
+	LargeHeader *header = reinterpret_cast<LargeHeader*>(static_cast<char*>(ptr) - largeHeaderSize);
+	chargeMemoryTag(header->tag, -static_cast<long long>(header->size));
+	free(header);
+}
+
+void *SpanAllocator::allocate(size_t size, MemoryTag tag)
+{
+	if (size > maxSpanBlockSize)
+		return allocateLarge(size, tag);
+
+	unsigned int sizeClass = sizeClasses[(size + 15) / 16];
+	ThreadBlockCache &cache = threadBlockCache;
+	void *block = cache.blocks[sizeClass];
+	if (block != nullptr)
+	{
+		cache.blocks[sizeClass] = *static_cast<void**>(block);
+		cache.counts[sizeClass]--;
+	}
+	else
+	{
+		block = refill(cache, sizeClass);
+		if (block == nullptr)
+			return nullptr;
+	}
+
+	//Blocks are charged to their tag at the size of their class, which is what they really take up
+	Span *span = findSpan(block);
+	spanTags(span)[blockIndex(span, block)] = tag;
+	chargeMemoryTag(tag, blockSizes[sizeClass]);
+	return block;
+}
+
+void SpanAllocator::release(void *ptr)
+{
+	if (ptr == nullptr)
+		return;
+	if (!isSpanRegion(ptr))
+	{
+		releaseLarge(ptr);
+		return;
+	}
+
+	Span *span = findSpan(ptr);
+	unsigned int sizeClass = span->sizeClass;
+	chargeMemoryTag(spanTags(span)[blockIndex(span, ptr)], -static_cast<long long>(span->blockSize));
+
+	if (threadCacheRetired)
+	{
+		giveBlocks(sizeClass, ptr, 1);
+		return;
+	}
+	//Blocks allocated on other threads can be freed on one that's never allocated, it's cache still has to be given back
+	if (!threadCacheUsed)
+	{
+		threadCacheUsed = true;
+		(void)&threadBlockCacheRetirer;
+	}
+
+	ThreadBlockCache &cache = threadBlockCache;
+	*static_cast<void**>(ptr) = cache.blocks[sizeClass];
+	cache.blocks[sizeClass] = ptr;
+
+	//Once the thread holds two batches, give one back and keep the other for it's next allocations
+	unsigned int batch = batchSize(sizeClass);
+	if (++cache.counts[sizeClass] >= batch * 2)
+	{
+		void *blocks = cache.blocks[sizeClass];
+		void *last = blocks;
+		for (unsigned int I = 1; I < batch; I++)
+			last = *static_cast<void**>(last);
+		cache.blocks[sizeClass] = *static_cast<void**>(last);
+		cache.counts[sizeClass] -= batch;
+		giveBlocks(sizeClass, blocks, batch);
+	}
+}
+
+unsigned long long SpanAllocator::getMappedBytes() const
+{
+	return mappedBytes.load(memory_order_relaxed);
+}
+
+SpanAllocator &getSpanAllocator()
+{
+	static aligned_storage<sizeof(SpanAllocator), alignof(SpanAllocator)>::type allocatorStorage;
+	static SpanAllocator *allocator = new (&allocatorStorage) SpanAllocator();
+	return *allocator;
+}
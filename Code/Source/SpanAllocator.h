@@ -0,0 +1,94 @@
+// Name:
+// SpanAllocator.h
+// Description:
+// Header file for SpanAllocator class
+// SpanAllocator is the allocator behind the tracked new operators (see CustomMemory.h). It's built for the small, short lived allocations most of the engine makes, such as messages, log strings and list nodes.
+// Sizes up to 1KB are rounded up to one of a few size classes. Each thread keeps a list of free blocks of each class, so most allocations and frees don't take a lock.
+// A thread whose list runs dry takes a batch of blocks from the class's central list, and a thread whose list grows too long gives a batch back.
+// Blocks are cut from 64KB spans taken straight from the OS. Each span holds blocks of one class, and starts with a header that holds the memory tag (see MemoryTags.h) of each block.
+// Spans are aligned to 64KB, so a block's span is found by masking it's address. Once every block of a span is free, the span is kept as a spare or given back to the OS.
+// A thread's blocks are given back when it exits, and trim gives back the calling thread's blocks and the spares without waiting for that.
+// Larger allocations go to malloc with a small header in front holding their size and tag.
+// Like AllocMap, the allocator doesn't use the c++ new/delete functions itself.
+// Notes:
+// OS-Aware
+// Spans are mapped with VirtualAlloc on Windows and mmap elsewhere.
+
+#ifndef SPAN_ALLOCATOR_H
+#define SPAN_ALLOCATOR_H
+
+#include <cstddef>
+#include <mutex>
+#include <atomic>
+using namespace std;
+
+#include "MemoryTags.h"
+
+//Number of size classes, and the largest size given a class
+const unsigned int spanSizeClasses = 20;
+const size_t maxSpanBlockSize = 1024;
+
+struct Span;
+struct ThreadBlockCache;
+
+class SpanAllocator
+{
+private:
+	//Spans of one size class that have free blocks
+	struct CentralList
+	{
+		mutex listMutex;
+		Span *partialSpans;
+	};
+
+	CentralList centralLists[spanSizeClasses];
+	//Size class of each size, in steps of 16 bytes
+	unsigned char sizeClasses[maxSpanBlockSize / 16 + 1];
+	//Empty spans kept for reuse instead of being given back to the OS
+	mutex spareMutex;
+	Span *spareSpans;
+	unsigned int spareCount;
+	atomic<unsigned long long> mappedBytes;
+
+	//Returns a span for a size class, reusing a spare if there is one. Call with the class's list locked.
+	Span *createSpan(unsigned int sizeClass);
+	//Keeps an empty span as a spare, or gives it back to the OS
+	void destroySpan(Span *span);
+	//Takes up to count blocks from a class's central list, linked through their first bytes. Returns the number taken.
+	unsigned int takeBlocks(unsigned int sizeClass, unsigned int count, void *&blocks);
+	//Gives count linked blocks back to their spans
+	void giveBlocks(unsigned int sizeClass, void *blocks, unsigned int count);
+	//Fills the calling thread's list for a size class, returning a block from it
+	void *refill(ThreadBlockCache &cache, unsigned int sizeClass);
+	//Gives back every block in the calling thread's lists
+	void flushCache();
+	//Gives back the calling thread's blocks for good, called when the thread exits
+	void retireCache();
+
+	void *allocateLarge(size_t size, MemoryTag tag);
+	void releaseLarge(void *ptr);
+
+	SpanAllocator(const SpanAllocator& spanAllocator) = delete;
+	SpanAllocator& operator =(const SpanAllocator& spanAllocator) = delete;
+
+	friend struct ThreadBlockCacheRetirer;
+
+public:
+	SpanAllocator();
+
+	//Allocates size bytes charged to tag, returns nullptr if there's no memory left
+	void *allocate(size_t size, MemoryTag tag);
+	//Frees memory from allocate, taking it off the tag it was charged to
+	void release(void *ptr);
+
+	//Gives back the blocks the calling thread has cached and unmaps every spare span. Threads that exit give their blocks back themselves, this is for ones that live as long as the game, after they free memory in bulk such as when a level is unloaded.
+	void trim();
+
+	//Returns the bytes of spans mapped from the OS, including spares
+	unsigned long long getMappedBytes() const;
+};
+
+//Returns the allocator, which is created on first use and never destroyed so memory allocated while globals are constructed and destroyed is still handled
+SpanAllocator &getSpanAllocator();
+
+#endif
@@ -3,46 +3,187 @@
 // Description:
 // Implementation file for ZipResourceSource class
 // Notes:
-// OS-Unaware
-
-#include "CustomMemory.h"
+// OS-Aware
+// Uses POSIX functions for batched reads on Linux
 
 #include "ZipResourceSource.h"
 
 #include <zlib/unzip.h>
 #include <tinyxml/tinyxml.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include <unordered_set>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <limits>
 using namespace std;
 
 #include "Logger.h"
+#include "ResourceNameTable.h"
+#include "Crc32.h"
+#include "DeflateDecoder.h"
+#ifndef _WIN32
+#include "BatchReader.h"
+#endif
+
+//Included after the standard headers, libstdc++ can't be compiled with it's new macro defined
+#include "CustomMemory.h"
 
 extern Logger* appLogger;
 
 const unsigned int fileNameLength = 1024;
+//Amount read or inflated at a time when a CRC is being checked, small enough that the data is still in cache when it's added to the CRC
+const unsigned int crcChunkSize = 256 * 1024;
+//Most read or inflated at a time otherwise. unzip and zlib count in 32 bits, so files over 4GB are read in pieces.
+const unsigned int streamChunkSize = 1 << 30;
+//Compression methods the zip source decodes itself, anything else is read through unzip
+const unsigned short methodStored = 0;
+const unsigned short methodDeflated = 8;
+//Most entries read ahead at a time, the most compressed data kept waiting to be used, and the number read ahead once reads start moving forward
+const unsigned int defaultReadAheadWindow = 16;
+const unsigned long long defaultReadAheadBudget = 4 * 1024 * 1024;
+const unsigned int initialReadAheadWindow = 2;
+//Forward reads in a row before reading ahead starts, and before it's tried again once it's backed off completely
+const unsigned int readAheadTriggerReads = 2;
+const unsigned int readAheadRetryReads = 8;
+//Furthest forward a read can move and still count as sequential, so skipping the odd entry doesn't stop the read ahead
+const unsigned int sequentialReadGap = 2;
+const unsigned int noRank = 0xFFFFFFFF;
+
+#ifdef _WIN32
+ZipResourceSource::ZipResourceSource(string fileName) : zipFile(nullptr), zipFileName(fileName), zipOpen(false), nameTable(new ResourceNameTable()),
+	readAheadBytes(0), lastRank(noRank), sequentialReads(0), readAheadWindow(initialReadAheadWindow), maxReadAheadWindow(defaultReadAheadWindow), readAheadBudget(defaultReadAheadBudget),
+	readAheadPendingBytes(0), stopReadAhead(false) {}
+
+ZipResourceSource::~ZipResourceSource()
+{
+	//The read ahead thread uses the zip file, so it has to finish first
+	stopReadAheadThread();
+	//If the zip file is open, close it.
+	if (zipOpen)
+	{
+		unzClose(zipFile);
+	}
+}
+#else
+//Number of reads a batch keeps in flight at once
+const unsigned int batchQueueDepth = 64;
 
-ZipResourceSource::ZipResourceSource(string fileName) : zipOpen(false), zipFileName(fileName), zipFile(nullptr) {}
+ZipResourceSource::ZipResourceSource(string fileName) : zipFile(nullptr), zipFileName(fileName), zipOpen(false), zipFd(-1), batchReader(nullptr), nameTable(new ResourceNameTable()),
+	readAheadBytes(0), lastRank(noRank), sequentialReads(0), readAheadWindow(initialReadAheadWindow), maxReadAheadWindow(defaultReadAheadWindow), readAheadBudget(defaultReadAheadBudget),
+	readAheadPendingBytes(0), stopReadAhead(false) {}
 
 ZipResourceSource::~ZipResourceSource()
 {
+	//The read ahead thread uses the zip file, so it has to finish first
+	stopReadAheadThread();
 	//If the zip file is open, close it.
 	if (zipOpen)
 	{
 		unzClose(zipFile);
 	}
+	delete batchReader;
+	if (zipFd >= 0)
+		close(zipFd);
+}
+#endif
+
+//Inflates raw deflate data in to destination with zlib, returning the number of bytes produced
+//Unless crc is null, the output is added to it a chunk at a time as it's produced.
+static unsigned long long zlibInflateRaw(const char *source, unsigned long long sourceSize, char *destination, unsigned long long destinationSize, unsigned int *crc)
+{
+	z_stream stream = z_stream();
+	if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+		return 0;
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(source));
+	//zlib's counts are 32 bit, so the input and output are handed over a chunk at a time
+	unsigned long long consumed = 0;
+	unsigned long long produced = 0;
+	unsigned long long outputChunkSize = crc != nullptr ? crcChunkSize : streamChunkSize;
+	int result = Z_OK;
+	while (result == Z_OK)
+	{
+		if (stream.avail_in == 0)
+		{
+			stream.avail_in = static_cast<uInt>(min<unsigned long long>(sourceSize - consumed, streamChunkSize));
+			consumed += stream.avail_in;
+		}
+		stream.next_out = reinterpret_cast<Bytef*>(destination + produced);
+		stream.avail_out = static_cast<uInt>(min<unsigned long long>(destinationSize - produced, outputChunkSize));
+		uInt outputSpace = stream.avail_out;
+		//Once the output is full, inflate returns Z_BUF_ERROR unless it's also reached the end of the stream
+		result = inflate(&stream, Z_NO_FLUSH);
+		if (crc != nullptr)
+			*crc = updateCrc32(*crc, destination + produced, outputSpace - stream.avail_out);
+		produced += outputSpace - stream.avail_out;
+	}
+	inflateEnd(&stream);
+	if (result != Z_STREAM_END)
+		return 0;
+	return produced;
+}
+
+//Returns whether an entry's data can be held in memory. On 32 bit builds entries over 4GB can't be, and their sizes would be truncated when allocating for them.
+static bool fitsInMemory(const ZipEntry &entry)
+{
+	return entry.compressedSize <= numeric_limits<size_t>::max() && entry.uncompressedSize <= numeric_limits<size_t>::max();
+}
+
+//Inflates raw deflate data in to destination, returning the number of bytes produced
+//The deflate decoder is tried first as it's faster. Anything it fails on goes through zlib, which is also what reports the error for data that's actually broken.
+static unsigned long long inflateRaw(const char *source, unsigned long long sourceSize, char *destination, unsigned long long destinationSize, unsigned int *crc)
+{
+	unsigned int decoderCrc = crc != nullptr ? *crc : 0;
+	unsigned long long produced = decodeDeflate(source, static_cast<size_t>(sourceSize), destination, static_cast<size_t>(destinationSize), crc != nullptr ? &decoderCrc : nullptr);
+	if (produced == destinationSize)
+	{
+		if (crc != nullptr)
+			*crc = decoderCrc;
+		return produced;
+	}
+	return zlibInflateRaw(source, sourceSize, destination, destinationSize, crc);
+}
+
+//Reads size bytes of the current file in to buffer, a chunk at a time as unzip can't read more than 2GB at once. Returns the number of bytes read.
+//Unless crc is null, each chunk is added to it while it's still in cache.
+static unsigned long long readCurrentFile(unzFile zipFile, char *buffer, unsigned long long size, unsigned int *crc)
+{
+	unsigned long long chunkSize = crc != nullptr ? crcChunkSize : streamChunkSize;
+	unsigned long long bytesRead = 0;
+	while (bytesRead < size)
+	{
+		int result = unzReadCurrentFile(zipFile, buffer + bytesRead, static_cast<unsigned int>(min(size - bytesRead, chunkSize)));
+		if (result <= 0)
+			break;
+		if (crc != nullptr)
+			*crc = updateCrc32(*crc, buffer + bytesRead, result);
+		bytesRead += result;
+	}
+	return bytesRead;
 }
 
 bool ZipResourceSource::open()
 {
 	int result;
-	unz_file_info fileInfo;
+	unz_file_info64 fileInfo;
 	char fileName[fileNameLength];
-	unsigned long filePos;
+	ZipEntry entry;
+	//Names and entries of the files found, added to the name table and entries once they've all been read
+	vector<string> foundNames;
+	vector<ZipEntry> foundEntries;
 	char* docTemp;
 	TiXmlDocument manifestDoc;
 	unordered_set<string> blackList;
 
 	//Open the zip file
-	zipFile = unzOpen(zipFileName.c_str());
+	//The 64 bit functions read Zip64 archives, which can hold more than 65535 files and files or archives over 4GB
+	zipFile = unzOpen64(zipFileName.c_str());
 	//Write a log and return false on error
 	if (zipFile == nullptr)
 	{
@@ -63,7 +204,7 @@ bool ZipResourceSource::open()
 	}
 
 	//Get the file info
-	result = unzGetCurrentFileInfo(zipFile, &fileInfo, fileName, fileNameLength, nullptr, 0, nullptr, 0);
+	result = unzGetCurrentFileInfo64(zipFile, &fileInfo, fileName, fileNameLength, nullptr, 0, nullptr, 0);
 	//If the failed to the the file info, write the log, close the zip, and return false.
 	if (result != UNZ_OK)
 	{
@@ -72,22 +213,30 @@ bool ZipResourceSource::open()
 		return false;
 	}
 
+	//A manifest too big to hold in memory, with room for it's terminator, is treated as corrupt
+	if (fileInfo.uncompressed_size >= numeric_limits<size_t>::max())
+	{
+		appLogger->eWriteLog(string("manifest.xml in ") + zipFileName + " is too big to read", LogLevel::Warning, { "Resource" });
+		unzClose(zipFile);
+		return false;
+	}
+
 	//Allocate space for the manifest.
-	docTemp = new char[fileInfo.uncompressed_size+1];
+	docTemp = new char[static_cast<size_t>(fileInfo.uncompressed_size) + 1];
 
 	//Read the manifest from the zip file
 	unzOpenCurrentFile(zipFile);
-	unzReadCurrentFile(zipFile, docTemp, fileInfo.uncompressed_size);
+	unsigned long long manifestSize = readCurrentFile(zipFile, docTemp, fileInfo.uncompressed_size, nullptr);
 	unzCloseCurrentFile(zipFile);
 
-	//Null terminate the manifest file.
-	docTemp[fileInfo.uncompressed_size] = 0;
+	//Null terminate the manifest file, after whatever was read of it
+	docTemp[manifestSize] = 0;
 	
 	//Parse the manifest file
 	manifestDoc.Parse(docTemp);
 
 	//Release the space allocated for the manifest file
-	delete docTemp;
+	delete[] docTemp;
 
 	//Get the Blacklist element from the manifest
 	currentTag = manifestDoc.RootElement()->FirstChildElement("Blacklist");
@@ -121,8 +270,13 @@ bool ZipResourceSource::open()
 	while (result == UNZ_OK)
 	{
 		//Get the file info and offset to the file
-		result = unzGetCurrentFileInfo(zipFile, &fileInfo, fileName, fileNameLength, nullptr, 0, nullptr, 0);
-		filePos = unzGetOffset(zipFile);
+		result = unzGetCurrentFileInfo64(zipFile, &fileInfo, fileName, fileNameLength, nullptr, 0, nullptr, 0);
+		entry.position = unzGetOffset64(zipFile);
+		entry.uncompressedSize = fileInfo.uncompressed_size;
+		entry.compressedSize = fileInfo.compressed_size;
+		entry.crc = fileInfo.crc;
+		entry.method = static_cast<unsigned short>(fileInfo.compression_method);
+		entry.flags = static_cast<unsigned short>(fileInfo.flag);
 
 		//If we have an error... write the log, close the zip, and return false
 		if (result != UNZ_OK)
@@ -132,10 +286,11 @@ bool ZipResourceSource::open()
 			return false;
 		}
 
-		//Unless the file is blacklisted, add it to the positionMap
+		//Unless the file is blacklisted, add it to the found files
 		if (!(blackList.count(fileName) == 1))
 		{
-			positionMap[fileName] = filePos;
+			foundNames.push_back(fileName);
+			foundEntries.push_back(entry);
 		}
 
 		//Go to the next file
@@ -150,6 +305,34 @@ bool ZipResourceSource::open()
 		return false;
 	}
 
+	//Build the name table from the files found, and store each entry at it's name's index
+	nameTable.reset(new ResourceNameTable(foundNames));
+	entries.resize(nameTable->size());
+	for (unsigned int I = 0; I < foundNames.size(); I++)
+		entries[nameTable->find(foundNames[I])] = foundEntries[I];
+	integrity.reset(entries.size());
+	for (unsigned int I = 0; I < entries.size(); I++)
+		integrity.setExpectedCrc(I, entries[I].crc);
+	//The central directory lists entries in the order they're stored
+	archiveOrder.resize(entries.size());
+	archiveRanks.resize(entries.size());
+	for (unsigned int I = 0; I < entries.size(); I++)
+		archiveOrder[I] = I;
+	sort(archiveOrder.begin(), archiveOrder.end(), [&](unsigned int first, unsigned int second) { return entries[first].position < entries[second].position; });
+	for (unsigned int I = 0; I < archiveOrder.size(); I++)
+		archiveRanks[archiveOrder[I]] = I;
+
+#ifndef _WIN32
+	//Open the zip a second time for batched reads, these read the compressed data directly. Without it batches go through unzip.
+	zipFd = ::open(zipFileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (zipFd >= 0)
+	{
+		batchReader = BatchReader::create(batchQueueDepth);
+		dataOffsets.assign(entries.size(), 0);
+		appLogger->eWriteLog(string("Reading batches from ") + zipFileName + " with " + batchReader->getName(), LogLevel::Info, { "Resource" });
+	}
+#endif
+
 	//Zip file is open
 	zipOpen = true;
 
@@ -157,11 +340,9 @@ bool ZipResourceSource::open()
 	return true;
 }
 
-int ZipResourceSource::getRawResourceSize(const string &resource) const
+unsigned long long ZipResourceSource::getRawResourceSize(const string &resource) const
 {
-	int result;
-	unz_file_info fileInfo;
-	char fileName[fileNameLength];
+	unsigned int index;
 
 	//Can't get resources with closed zip file
 	if (!zipOpen)
@@ -171,34 +352,20 @@ int ZipResourceSource::getRawResourceSize(const string &resource) const
 	}
 
 	//File not found
-	if (positionMap.count(resource) == 0)
+	index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
 	{
 		appLogger->eWriteLog(string("File ") + resource + " not found in " + zipFileName, LogLevel::Warning, { "Resource" });
 		return 0;
 	}
 
-	//Set ourselves to the selected file
-	unzSetOffset(zipFile, positionMap.at(resource));
-
-	//Get file info
-	result = unzGetCurrentFileInfo(zipFile, &fileInfo, fileName, fileNameLength, nullptr, 0, nullptr, 0);
-
-	//Error getting file info
-	if (result != UNZ_OK)
-	{
-		appLogger->eWriteLog(string("Failed to retieve file info for ") + resource + " from " + zipFileName, LogLevel::Warning, { "Resource" });
-		return 0;
-	}
-
 	//Return size of file
-	return fileInfo.uncompressed_size;
+	return entries[index].uncompressedSize;
 }
 
-int ZipResourceSource::getRawResource(const string &resource, char * buffer) const
+unsigned long long ZipResourceSource::getRawResource(const string &resource, char * buffer) const
 {
-	int result;
-	unz_file_info fileInfo;
-	char fileName[fileNameLength];
+	unsigned int index;
 
 	//Zip file not open
 	if (!zipOpen)
@@ -208,17 +375,40 @@ int ZipResourceSource::getRawResource(const string &resource, char * buffer) con
 	}
 
 	//File not in zip file
-	if (positionMap.count(resource) == 0)
+	index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
 	{
 		appLogger->eWriteLog(string("File ") + resource + " not found in " + zipFileName, LogLevel::Warning, { "Resource" });
 		return 0;
 	}
 
-	//Set position
-	unzSetOffset(zipFile, positionMap.at(resource));
+	//The zip file's position is shared, so only one read at a time
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	//Read the entry, then read ahead of it if reads are moving forward through the archive
+	unsigned long long size = readEntry(index, resource, buffer);
+	trackRead(index);
+	return size;
+}
 
-	//Get file info
-	result = unzGetCurrentFileInfo(zipFile, &fileInfo, fileName, fileNameLength, nullptr, 0, nullptr, 0);
+unsigned long long ZipResourceSource::readEntry(unsigned int index, const string &resource, char *buffer) const
+{
+	int result;
+
+	//Entries too big to hold in memory can't be read, and are never read ahead
+	if (!fitsInMemory(entries[index]))
+	{
+		appLogger->eWriteLog(string("Failed to read ") + resource + " from " + zipFileName + ", it's too big to fit in memory", LogLevel::Warning, { "Resource" });
+		return 0;
+	}
+
+	//Entries that were read ahead only need decoding
+	vector<char> compressed;
+	if (takeReadAhead(index, compressed))
+		return decodeRawEntry(index, resource, &compressed[0], buffer);
+
+	//Set position, this also reads the file's info
+	result = unzSetOffset64(zipFile, entries[index].position);
 
 	//Error: We failed to retrieve the info
 	if (result != UNZ_OK)
@@ -227,36 +417,429 @@ int ZipResourceSource::getRawResource(const string &resource, char * buffer) con
 		return 0;
 	}
 
-	//Open and read the data from the file
+	const ZipEntry &entry = entries[index];
+	bool checkCrc = integrity.needsCheck(index);
+
+	//Deflated files are read raw and decoded straight in to the buffer, instead of through unzip's inflate
+	if (entry.method == methodDeflated && (entry.flags & 1) == 0)
+	{
+		int method, level;
+		vector<char> compressed(static_cast<size_t>(max(entry.compressedSize, 1ULL)));
+		unsigned long long bytesRead = 0;
+		if (unzOpenCurrentFile2(zipFile, &method, &level, 1) == UNZ_OK)
+		{
+			bytesRead = readCurrentFile(zipFile, &compressed[0], entry.compressedSize, nullptr);
+			unzCloseCurrentFile(zipFile);
+		}
+		if (bytesRead != entry.compressedSize)
+		{
+			appLogger->eWriteLog(string("Failed to read ") + resource + " from " + zipFileName, LogLevel::Warning, { "Resource" });
+			return 0;
+		}
+		return decodeRawEntry(index, resource, &compressed[0], buffer);
+	}
+
+	//Open and read the data from the file. When checking the CRC, each chunk is added to it while it's in cache.
 	unzOpenCurrentFile(zipFile);
-	unzReadCurrentFile(zipFile, buffer, fileInfo.uncompressed_size);
+	unsigned int crc = 0;
+	unsigned long long bytesRead = readCurrentFile(zipFile, buffer, entry.uncompressedSize, checkCrc ? &crc : nullptr);
 	unzCloseCurrentFile(zipFile);
+	if (bytesRead != entry.uncompressedSize)
+	{
+		appLogger->eWriteLog(string("Failed to read ") + resource + " from " + zipFileName, LogLevel::Warning, { "Resource" });
+		return 0;
+	}
+	if (checkCrc && !integrity.check(index, crc, bytesRead, zipFileName, resource))
+		return 0;
 
 	//retrun size of file
-	return fileInfo.uncompressed_size;
+	return entries[index].uncompressedSize;
 }
 
+unsigned long long ZipResourceSource::decodeRawEntry(unsigned int index, const string &resource, const char *data, char *buffer) const
+{
+	const ZipEntry &entry = entries[index];
+	bool checkCrc = integrity.needsCheck(index);
+	unsigned int crc = 0;
+	unsigned long long produced = entry.uncompressedSize;
+	if (entry.method == methodStored)
+	{
+		memcpy(buffer, data, static_cast<size_t>(entry.uncompressedSize));
+		if (checkCrc)
+			crc = updateCrc32(crc, buffer, static_cast<size_t>(entry.uncompressedSize));
+	}
+	else
+		produced = inflateRaw(data, entry.compressedSize, buffer, entry.uncompressedSize, checkCrc ? &crc : nullptr);
+
+	if (produced != entry.uncompressedSize)
+	{
+		appLogger->eWriteLog(string("Failed to read ") + resource + " from " + zipFileName, LogLevel::Warning, { "Resource" });
+		return 0;
+	}
+	if (checkCrc && !integrity.check(index, crc, produced, zipFileName, resource))
+		return 0;
+	return entry.uncompressedSize;
+}
+
+void ZipResourceSource::trackRead(unsigned int index) const
+{
+	unsigned int rank = archiveRanks[index];
+	if (lastRank != noRank && rank > lastRank && rank - lastRank <= sequentialReadGap)
+		sequentialReads++;
+	else
+	{
+		//The run of forward reads is over, so whatever was read ahead for it was a wrong guess
+		sequentialReads = 0;
+		cancelReadAhead();
+		while (readAheadQueue.size() > 0)
+			dropReadAhead(readAheadQueue.front(), false);
+	}
+	lastRank = rank;
+
+	if (maxReadAheadWindow == 0)
+		return;
+	//Once the read ahead has backed off completely, only a long run of forward reads starts it again
+	if (readAheadWindow == 0 && sequentialReads >= readAheadRetryReads)
+		readAheadWindow = 1;
+	if (readAheadWindow > 0 && sequentialReads >= readAheadTriggerReads)
+		readAhead(rank);
+}
+
+void ZipResourceSource::readAhead(unsigned int rank) const
+{
+	//Pick the entries after rank that haven't been read ahead or asked for already, stopping at anything that can't be decoded from it's raw data
+	vector<unsigned int> indices;
+	unsigned long long bytes = 0;
+	for (unsigned int I = rank + 1; I < archiveOrder.size() && indices.size() < readAheadWindow; I++)
+	{
+		unsigned int index = archiveOrder[I];
+		const ZipEntry &entry = entries[index];
+		if (readAheadData.count(index) || readAheadPending.count(index))
+			continue;
+		if ((entry.method != methodStored && entry.method != methodDeflated) || (entry.flags & 1) != 0 || readAheadPendingBytes + bytes + entry.compressedSize > readAheadBudget)
+			break;
+		indices.push_back(index);
+		bytes += entry.compressedSize;
+	}
+	if (indices.size() == 0)
+		return;
+
+	//Make room, throwing away the oldest entries that were never used
+	while (readAheadBytes + readAheadPendingBytes + bytes > readAheadBudget && readAheadQueue.size() > 0)
+		dropReadAhead(readAheadQueue.front(), false);
+
+	//Hand the entries to the read ahead thread, starting it if this is the first time
+	for (unsigned int I = 0; I < indices.size(); I++)
+	{
+		readAheadRequests.push_back(indices[I]);
+		readAheadPending.insert(indices[I]);
+	}
+	readAheadPendingBytes += bytes;
+	if (!readAheadThread.joinable())
+		readAheadThread = thread(&ZipResourceSource::readAheadWorker, this);
+	readAheadSignal.notify_one();
+}
+
+void ZipResourceSource::readAheadWorker() const
+{
+	unique_lock<recursive_mutex> objectLock(objectMutex);
+	while (true)
+	{
+		readAheadSignal.wait(objectLock, [&]() { return stopReadAhead || readAheadRequests.size() > 0; });
+		if (stopReadAhead)
+			return;
+		vector<unsigned int> indices(readAheadRequests.begin(), readAheadRequests.end());
+		readAheadRequests.clear();
+
+		//Data for each entry, only added to the read ahead once it's been read successfully
+		vector<vector<char> > data(indices.size());
+		vector<bool> succeeded(indices.size(), false);
+#ifndef _WIN32
+		//Read the whole window at once through the BatchReader. It reads our own descriptor for the zip, so other reads can go ahead while it does.
+		if (batchReader != nullptr)
+		{
+			vector<BatchRead> reads;
+			for (unsigned int I = 0; I < indices.size(); I++)
+			{
+				if (!readAheadPending.count(indices[I]) || !fitsInMemory(entries[indices[I]]))
+					continue;
+				unsigned long long dataOffset = getDataOffset(indices[I]);
+				if (dataOffset == 0)
+					continue;
+				data[I].resize(static_cast<size_t>(max(entries[indices[I]].compressedSize, 1ULL)));
+				BatchRead read = { zipFd, dataOffset, entries[indices[I]].compressedSize, &data[I][0], I, 0 };
+				reads.push_back(read);
+			}
+			if (reads.size() > 0)
+			{
+				objectLock.unlock();
+				batchReader->read(&reads[0], reads.size(), [&](BatchRead &read)
+				{
+					succeeded[read.tag] = read.result == static_cast<long long>(read.length);
+				});
+				objectLock.lock();
+			}
+		}
+		else
+#endif
+		{
+			//Read each entry's raw data through unzip, in archive order. unzip's position is shared, so the object stays locked for each entry and other reads get a turn between them.
+			for (unsigned int I = 0; I < indices.size() && !stopReadAhead; I++)
+			{
+				if (!readAheadPending.count(indices[I]) || !fitsInMemory(entries[indices[I]]))
+					continue;
+				const ZipEntry &entry = entries[indices[I]];
+				int method, level;
+				data[I].resize(static_cast<size_t>(max(entry.compressedSize, 1ULL)));
+				if (unzSetOffset64(zipFile, entry.position) != UNZ_OK || unzOpenCurrentFile2(zipFile, &method, &level, 1) != UNZ_OK)
+					break;
+				succeeded[I] = readCurrentFile(zipFile, &data[I][0], entry.compressedSize, nullptr) == entry.compressedSize;
+				unzCloseCurrentFile(zipFile);
+				objectLock.unlock();
+				objectLock.lock();
+			}
+		}
+
+		//Entries that were read, or given up on, while the thread was reading are left out
+		for (unsigned int I = 0; I < indices.size(); I++)
+		{
+			if (readAheadPending.erase(indices[I]) == 0)
+				continue;
+			readAheadPendingBytes -= entries[indices[I]].compressedSize;
+			if (!succeeded[I])
+				continue;
+			readAheadBytes += entries[indices[I]].compressedSize;
+			readAheadStats.prefetched++;
+			readAheadStats.bytes += entries[indices[I]].compressedSize;
+			readAheadQueue.push_back(indices[I]);
+			readAheadData[indices[I]].swap(data[I]);
+		}
+	}
+}
+
+bool ZipResourceSource::takeReadAhead(unsigned int index, vector<char> &compressed) const
+{
+	unordered_map<unsigned int, vector<char> >::iterator readAheadEntry = readAheadData.find(index);
+	if (readAheadEntry != readAheadData.end())
+	{
+		compressed.swap(readAheadEntry->second);
+		dropReadAhead(index, true);
+		return true;
+	}
+	//The caller reads it instead, so whatever the thread gets for it would go unused
+	if (readAheadPending.erase(index) > 0)
+		readAheadPendingBytes -= entries[index].compressedSize;
+	return false;
+}
+
+void ZipResourceSource::cancelReadAhead() const
+{
+	readAheadRequests.clear();
+	readAheadPending.clear();
+	readAheadPendingBytes = 0;
+}
+
+void ZipResourceSource::stopReadAheadThread()
+{
+	{
+		lock_guard<recursive_mutex> objectLock(objectMutex);
+		stopReadAhead = true;
+	}
+	readAheadSignal.notify_all();
+	if (readAheadThread.joinable())
+		readAheadThread.join();
+}
+
+void ZipResourceSource::dropReadAhead(unsigned int index, bool used) const
+{
+	readAheadData.erase(index);
+	readAheadQueue.erase(find(readAheadQueue.begin(), readAheadQueue.end(), index));
+	readAheadBytes -= entries[index].compressedSize;
+	//Read a little further ahead while the predictions are right, and back off quickly while they're wrong
+	if (used)
+	{
+		readAheadStats.hits++;
+		readAheadWindow = min(readAheadWindow + 1, maxReadAheadWindow);
+	}
+	else
+	{
+		readAheadStats.wasted++;
+		readAheadWindow /= 2;
+	}
+}
+
+void ZipResourceSource::setReadAhead(unsigned int maxWindow, unsigned long long budget)
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	maxReadAheadWindow = maxWindow;
+	readAheadBudget = budget;
+	readAheadWindow = min(initialReadAheadWindow, maxWindow);
+	//Whatever was read ahead may no longer fit, it isn't counted as wasted
+	cancelReadAhead();
+	readAheadData.clear();
+	readAheadQueue.clear();
+	readAheadBytes = 0;
+}
+
+ZipReadAheadStats ZipResourceSource::getReadAheadStats() const
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+	return readAheadStats;
+}
+
+#ifndef _WIN32
+unsigned long long ZipResourceSource::getDataOffset(unsigned int index) const
+{
+	lock_guard<recursive_mutex> objectLock(objectMutex);
+
+	if (dataOffsets[index] == 0)
+	{
+		int method, level;
+		//Opening the file in raw mode reads it's local header, after which unzip knows where the data starts.
+		if (unzSetOffset64(zipFile, entries[index].position) == UNZ_OK && unzOpenCurrentFile2(zipFile, &method, &level, 1) == UNZ_OK)
+		{
+			dataOffsets[index] = unzGetCurrentFileZStreamPos64(zipFile);
+			unzCloseCurrentFile(zipFile);
+		}
+	}
+	return dataOffsets[index];
+}
+
+void ZipResourceSource::getRawResources(vector<RawResourceRequest> &requests, const function<void(RawResourceRequest&)> &onComplete) const
+{
+	//Without our own descriptor for the zip, read everything through unzip
+	if (!zipOpen || batchReader == nullptr)
+	{
+		IResourceSource::getRawResources(requests, onComplete);
+		return;
+	}
+
+	vector<BatchRead> reads;
+	vector<unsigned int> indices;
+	reads.reserve(requests.size());
+	indices.reserve(requests.size());
+	for (unsigned int I = 0; I < requests.size(); I++)
+	{
+		unsigned int index = nameTable->find(requests[I].resource);
+		const ZipEntry *entry = index != ResourceNameTable::npos ? &entries[index] : nullptr;
+		//Entries that were read ahead only need decoding
+		if (entry)
+		{
+			vector<char> compressed;
+			bool wasReadAhead;
+			{
+				lock_guard<recursive_mutex> objectLock(objectMutex);
+				wasReadAhead = takeReadAhead(index, compressed);
+			}
+			if (wasReadAhead)
+			{
+				requests[I].result = decodeRawEntry(index, requests[I].resource, &compressed[0], requests[I].buffer);
+				onComplete(requests[I]);
+				continue;
+			}
+		}
+		//Only stored and deflated files that aren't encrypted can be read directly, use unzip for anything else.
+		unsigned long long dataOffset = 0;
+		if (entry && (entry->method == methodStored || entry->method == methodDeflated) && (entry->flags & 1) == 0 && fitsInMemory(*entry))
+			dataOffset = getDataOffset(index);
+		if (dataOffset == 0)
+		{
+			requests[I].result = getRawResource(requests[I].resource, requests[I].buffer);
+			onComplete(requests[I]);
+			continue;
+		}
+
+		//Stored files are read straight in to the request's buffer, compressed ones are staged and inflated in to it
+		BatchRead read = { zipFd, dataOffset, entry->compressedSize, entry->method == methodStored ? requests[I].buffer : nullptr, I, 0 };
+		reads.push_back(read);
+		indices.push_back(index);
+	}
+
+	if (reads.size() == 0)
+		return;
+
+	batchReader->read(&reads[0], reads.size(), [&](BatchRead &read)
+	{
+		RawResourceRequest &request = requests[read.tag];
+		unsigned int index = indices[&read - &reads[0]];
+		const ZipEntry &entry = entries[index];
+		bool checkCrc = integrity.needsCheck(index);
+		unsigned int crc = 0;
+		request.result = 0;
+		if (read.result == static_cast<long long>(entry.compressedSize))
+		{
+			//Stored data has only just been read, so it's still in cache. Inflated data is added to the CRC as it's produced.
+			if (entry.method == methodStored)
+			{
+				request.result = entry.uncompressedSize;
+				if (checkCrc)
+					crc = updateCrc32(crc, request.buffer, entry.uncompressedSize);
+			}
+			else
+				request.result = inflateRaw(read.buffer, entry.compressedSize, request.buffer, entry.uncompressedSize, checkCrc ? &crc : nullptr);
+		}
+		if (request.result != entry.uncompressedSize)
+		{
+			appLogger->eWriteLog(string("Failed to read ") + request.resource + " from " + zipFileName, LogLevel::Warning, { "Resource" });
+			request.result = 0;
+		}
+		else if (checkCrc && !integrity.check(index, crc, entry.uncompressedSize, zipFileName, request.resource))
+			request.result = 0;
+		onComplete(request);
+	});
+}
+#endif
+
 int ZipResourceSource::getNumResources() const
 {
-	//Return number of files in the file list
-	return positionMap.size();
+	//Return number of files in the name table
+	return nameTable->size();
 }
 
 string ZipResourceSource::getResourceName(int num) const
 {
-	//Iterate over resource list to the specified resoruce and return it's name
-	unordered_map<string, unsigned long>::const_iterator resource = positionMap.begin();
-	for (int I = 0; I < num; I++)
-		++resource;
-	return resource->first;
+	//Look up the name in the name table
+	return nameTable->getName(num);
 }
 
 unordered_set<string> ZipResourceSource::getResourceList() const
 {
-	//Copy resource from fileList to an unordered_set and return it
+	//Copy resources from the name table to an unordered_set and return it
 	unordered_set<string> result;
-	result.reserve(positionMap.size());
-	for (unordered_map<string, unsigned long>::const_iterator it = positionMap.begin(); it != positionMap.end(); it++)
-		result.insert(it->first);
+	result.reserve(nameTable->size());
+	for (ResourceNameTable::const_iterator it = nameTable->begin(); it != nameTable->end(); it++)
+		result.insert(*it);
 	return result;
 }
+
+shared_ptr<const ResourceNameTable> ZipResourceSource::getNameTable() const
+{
+	return nameTable;
+}
+
+bool ZipResourceSource::hasResource(const string &resource) const
+{
+	return nameTable->find(resource) != ResourceNameTable::npos;
+}
+
+void ZipResourceSource::setIntegrityMode(IntegrityMode mode)
+{
+	integrity.setMode(mode);
+}
+
+IntegrityStats ZipResourceSource::getIntegrityStats() const
+{
+	return integrity.getStats();
+}
+
+bool ZipResourceSource::getContentKey(const string &resource, ResourceContentKey &key) const
+{
+	//The central directory has the size and CRC of every file
+	unsigned int index = nameTable->find(resource);
+	if (index == ResourceNameTable::npos)
+		return false;
+	key.size = entries[index].uncompressedSize;
+	key.crc = entries[index].crc;
+	return true;
+}
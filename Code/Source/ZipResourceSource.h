@@ -3,36 +3,145 @@
 // Description:
 // Header file for ZipResourceSource class
 // ZipResourceSource provides the files located within a zip file.
+// On Linux, batches of reads fetch the compressed data with a BatchReader, which uses io_uring when it's available, and inflate it straight in to the destination buffers.
+// Related resources are usually packed next to each other, so when single reads walk forward through the archive the entries after them are read ahead, still compressed, in one go.
+// The read ahead runs on a thread of the source's own, so the read that sets it off doesn't wait for it. Batches of reads use whatever has been read ahead too.
+// How far ahead it reads grows slowly while the entries read ahead get used and halves when they're thrown away unused, see setReadAhead and getReadAheadStats.
+// Zip64 archives are supported, so archives and the files in them can be over 4GB.
 // See IResourceSource.h for usage details.
 // Notes:
 // OS-Unaware
+// File does not pollute with OS-Headers.
 
 #ifndef ZIP_RESOURCE_SOURCE_H
 #define ZIP_RESOURCE_SOURCE_H
 
 #include <string>
+#include <memory>
+#include <vector>
+#include <deque>
 #include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <condition_variable>
 using namespace std;
 #include "IResourceSource.h"
+#include "Lockable.h"
+
+class BatchReader;
 
 typedef void *unzFile;
 
-class ZipResourceSource : public IResourceSource
+//Information about a file in the zip file, stored in the same order as the name table
+struct ZipEntry
+{
+	//Offset of the file's entry in the zip's central directory, used with unzSetOffset64
+	unsigned long long position;
+	unsigned long long uncompressedSize;
+	unsigned long long compressedSize;
+	//CRC32 of the uncompressed data
+	unsigned long crc;
+	//Compression method and general purpose flags from the zip's central directory
+	unsigned short method;
+	unsigned short flags;
+};
+
+//Counts of the entries a zip read ahead
+struct ZipReadAheadStats
+{
+	//Entries read ahead, and how many of them were later used or thrown away unused
+	unsigned long long prefetched;
+	unsigned long long hits;
+	unsigned long long wasted;
+	//Compressed bytes read ahead
+	unsigned long long bytes;
+
+	ZipReadAheadStats() : prefetched(0), hits(0), wasted(0), bytes(0) {}
+};
+
+class ZipResourceSource : public IResourceSource, public Lockable
 {
 private:
 	unzFile zipFile;
 	string zipFileName;
 	bool zipOpen;
-	unordered_map<string, unsigned long> positionMap;
+	vector<ZipEntry> entries;
+	//Decides which reads are checked against the entries' CRCs
+	mutable ResourceIntegrity integrity;
+#ifndef _WIN32
+	//Descriptor for the zip file, used for batched reads of compressed data
+	int zipFd;
+	BatchReader *batchReader;
+	//Offset of each file's data within the zip file, found the first time the file is read in a batch. 0 until then.
+	mutable vector<unsigned long long> dataOffsets;
+	//Gets the offset of a file's data, reading the file's local header if it isn't known yet. Returns 0 on failure.
+	unsigned long long getDataOffset(unsigned int index) const;
+#endif
+	shared_ptr<const ResourceNameTable> nameTable;
+
+	//Entries in the order they're stored in the archive, and each entry's place in that order
+	vector<unsigned int> archiveOrder;
+	vector<unsigned int> archiveRanks;
+	//Compressed data of the entries read ahead and not used yet, and the order they were read in
+	mutable unordered_map<unsigned int, vector<char> > readAheadData;
+	mutable deque<unsigned int> readAheadQueue;
+	mutable unsigned long long readAheadBytes;
+	//Place in the archive of the last entry read, and the number of reads in a row that moved forward from the one before
+	mutable unsigned int lastRank;
+	mutable unsigned int sequentialReads;
+	//Number of entries read ahead at a time, 0 when reading ahead has backed off completely
+	mutable unsigned int readAheadWindow;
+	unsigned int maxReadAheadWindow;
+	unsigned long long readAheadBudget;
+	mutable ZipReadAheadStats readAheadStats;
+	//Entries waiting for the read ahead thread, and every entry it's been asked for that it hasn't finished with, along with their compressed size
+	mutable deque<unsigned int> readAheadRequests;
+	mutable unordered_set<unsigned int> readAheadPending;
+	mutable unsigned long long readAheadPendingBytes;
+	//Thread that does the reading ahead, started the first time it's needed. It waits on readAheadSignal with the object locked.
+	mutable thread readAheadThread;
+	mutable condition_variable_any readAheadSignal;
+	bool stopReadAhead;
+
+	//Reads an entry in to buffer, from the read ahead if it's there. Call with the object locked.
+	unsigned long long readEntry(unsigned int index, const string &resource, char *buffer) const;
+	//Decodes an entry's raw data, stored or deflated, in to buffer and checks it's CRC if needed. Returns the size of the resource or 0 on failure.
+	unsigned long long decodeRawEntry(unsigned int index, const string &resource, const char *data, char *buffer) const;
+	//Notes a read of an entry, and reads ahead of it if the reads have been moving forward through the archive. Call with the object locked.
+	void trackRead(unsigned int index) const;
+	//Asks the read ahead thread for the compressed data of the entries after rank. Call with the object locked.
+	void readAhead(unsigned int rank) const;
+	//Reads the entries asked for by readAhead until the source is destroyed
+	void readAheadWorker() const;
+	//Takes an entry's compressed data out of the read ahead, returning false if it isn't there. If the thread is still to read it, it's told not to bother. Call with the object locked.
+	bool takeReadAhead(unsigned int index, vector<char> &compressed) const;
+	//Removes an entry from the read ahead, counting it as used or wasted. Call with the object locked.
+	void dropReadAhead(unsigned int index, bool used) const;
+	//Forgets every entry the read ahead thread has been asked for and hasn't finished. Call with the object locked.
+	void cancelReadAhead() const;
+	//Stops the read ahead thread and waits for it to finish
+	void stopReadAheadThread();
 public:
 	ZipResourceSource(string fileName);
 	virtual ~ZipResourceSource();
 	virtual bool open();
-	virtual int getRawResourceSize(const string &resource) const;
-	virtual int getRawResource(const string &resource, char * buffer) const;
+	virtual unsigned long long getRawResourceSize(const string &resource) const;
+	virtual unsigned long long getRawResource(const string &resource, char * buffer) const;
+#ifndef _WIN32
+	virtual void getRawResources(vector<RawResourceRequest> &requests, const function<void(RawResourceRequest&)> &onComplete) const;
+#endif
 	virtual int getNumResources() const;
 	virtual string getResourceName(int num) const;
 	virtual unordered_set<string> getResourceList() const;
+	virtual shared_ptr<const ResourceNameTable> getNameTable() const;
+	virtual bool hasResource(const string &resource) const;
+	virtual void setIntegrityMode(IntegrityMode mode);
+	virtual IntegrityStats getIntegrityStats() const;
+	virtual bool getContentKey(const string &resource, ResourceContentKey &key) const;
+
+	//Sets the most entries read ahead at a time and the most compressed data kept waiting to be used. A maxWindow of 0 turns reading ahead off.
+	void setReadAhead(unsigned int maxWindow, unsigned long long budget);
+	ZipReadAheadStats getReadAheadStats() const;
 };
 
 #endif